@@ -0,0 +1,152 @@
+/*
+    * batchengine.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef BATCHENGINE_H
+#define BATCHENGINE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "bike.h"
+#include "config.h"
+#include "riderstats.h"
+#include "simstats.h"
+#include "sitemap.h"
+
+/**
+ * @brief Parameters of a batch simulation.
+ */
+struct BatchConfig
+{
+    size_t nbSites = NBSITES;
+    size_t slotsPerSite = BORNES;
+    size_t nbBikes = NB_BIKES;   /**< Capped at nbSites * (slotsPerSite - 2). */
+    size_t nbRiders = NBPEOPLE;
+    uint64_t seed = 1;
+    bool geographic = false;     /**< Sites spread by diskLayout(), travel times from a SiteMap. */
+};
+
+/**
+ * @brief Rider simulation without threads, for millions of riders.
+ *
+ * Riders follow the same cycle as @ref Person (wait for a bike of their
+ * preferred type, ride, wait for a dock, walk) with the same travel time
+ * distributions, but in simulated time. With a geographic configuration
+ * the travel times come from a @ref SiteMap as for @ref Person, at the
+ * cost of n(n-1)/2 floats for n sites (200 MB for 10000 sites). Their state is kept in parallel
+ * arrays indexed by rider: site, phase, preferred type and next event time.
+ *
+ * Rides and walks end in a timing wheel of one millisecond slots, which
+ * covers the longest travel time. Each slot is processed as one batch:
+ * first the random draws of every rider of the batch in one tight loop,
+ * then the station operations. Riders that cannot be served wait in FIFO
+ * queues per site and type, chained through the rider arrays, and are
+ * served as soon as the station changes. There are no vans.
+ *
+ * Single-threaded: nothing is locked.
+ */
+class BatchEngine
+{
+public:
+    /**
+     * @brief Distributes the bikes and schedules the first arrivals.
+     *
+     * @param _config Parameters of the simulation.
+     */
+    explicit BatchEngine(const BatchConfig& _config);
+
+    /**
+     * @brief Advances the simulation.
+     *
+     * @param untilMs Simulated time to reach, in milliseconds.
+     */
+    void run(uint64_t untilMs);
+
+    /**
+     * @brief Current simulated time, in milliseconds.
+     */
+    uint64_t nowMs() const
+    {
+        return now;
+    }
+
+    /**
+     * @brief Bikes in the stations plus bikes ridden or waiting for a dock.
+     *
+     * Equals nbBikes() unless the engine is broken.
+     */
+    size_t bikesAccountedFor() const;
+
+    /**
+     * @brief Number of bikes actually distributed.
+     */
+    size_t nbBikes() const
+    {
+        return bikeTotal;
+    }
+
+    const BatchConfig config;
+    const SiteMap siteMap;    /**< Empty unless the configuration is geographic. */
+    uint64_t events = 0;      /**< Ride and walk ends processed. */
+    uint64_t trips = 0;       /**< Bikes docked. */
+    HistogramSnapshot waitBikeUs; /**< Time waited for a bike, in simulated us. */
+    HistogramSnapshot waitDockUs; /**< Time waited for a dock, in simulated us. */
+    HistogramSnapshot cycleUs;    /**< End-to-end cycles, in simulated us. */
+
+private:
+    /**
+     * @brief Size of the timing wheel, above the longest travel time.
+     */
+    static constexpr size_t wheelSize = 8192;
+
+    /**
+     * @brief FIFO of riders, chained through @ref nextWaiter.
+     */
+    struct Queue
+    {
+        uint32_t head = noRider;
+        uint32_t tail = noRider;
+    };
+
+    static constexpr uint32_t noRider = UINT32_MAX;
+    static constexpr uint64_t noCycle = UINT64_MAX;
+
+    void processSlot();
+    void push(Queue& queue, uint32_t rider);
+    uint32_t pop(Queue& queue);
+    void schedule(uint32_t rider, uint32_t delayMs);
+    void startRide(uint32_t rider);
+    void startWalk(uint32_t rider);
+
+    /**
+     * @brief Serves the waiters of a site until none can be served.
+     */
+    void settle(uint32_t site);
+
+    uint64_t now = 0;
+    size_t bikeTotal = 0;
+
+    // Riders, one entry each
+    std::vector<uint32_t> site;          /**< Site of the next event. */
+    std::vector<uint8_t> phase;          /**< A @ref RiderPhase. */
+    std::vector<uint8_t> type;           /**< Preferred bike type. */
+    std::vector<uint64_t> eventMs;       /**< Next event time, or start of the wait. */
+    std::vector<uint64_t> cycleStartMs;  /**< Arrival that started the cycle, noCycle before the first. */
+    std::vector<uint64_t> rngState;
+    std::vector<uint32_t> drawnSite;     /**< Destination drawn for the next ride or walk. */
+    std::vector<uint32_t> drawnMs;       /**< Travel time drawn for it, without the fixed part. */
+    std::vector<uint32_t> nextWaiter;
+
+    // Sites, one entry each (per type for the stocks and bike queues)
+    std::vector<uint32_t> stock;
+    std::vector<uint32_t> total;
+    std::vector<Queue> bikeWaiters;
+    std::vector<Queue> dockWaiters;
+
+    std::vector<std::vector<uint32_t>> wheel;
+    std::vector<uint32_t> batch;
+};
+
+#endif // BATCHENGINE_H
@@ -9,49 +9,79 @@
 #include <vector>
 #include <deque>
 #include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
 #include "bike.h"
-#include "pcosynchro/pcoconditionvariable.h"
-#include "pcosynchro/pcomutex.h"
+#include "lockprofiler.h"
+#include "spinfutex.h"
+
+/**
+ * @brief Synchronisation of the original stations: PcoMutex and
+ * PcoConditionVariable, profiled with PCO_LOCK_PROFILING.
+ */
+struct PcoSync
+{
+    using Mutex = StationMutex;
+    using ConditionVariable = StationConditionVariable;
+};
+
+/**
+ * @brief Synchronisation spinning briefly before sleeping on a futex, see
+ * SpinFutexMutex.
+ */
+struct SpinFutexSync
+{
+    using Mutex = SpinFutexMutex;
+    using ConditionVariable = FutexConditionVariable;
+};
 
 /**
  * @brief Thread-safe bike station storing bikes by type with a limited capacity.
  *
  * Bikes are stored. Multiple threads can safely
  * put and get bikes using internal synchronization.
+ *
+ * Interface of the implementations a simulation can pick at startup, see
+ * makeBikeStation(): the monitor of @ref BasicBikeStation and the queues
+ * of @ref LockFreeBikeStation.
  */
 class BikeStation
 {
 public:
     /**
-     * @brief Default constructor (deleted or undefined in your code base).
+     * @brief Destructor.
      *
-     * Declared but not defined here; if used, it must be implemented elsewhere.
+     * Implementations call ending() to wake up all waiting threads.
      */
-    BikeStation();
+    virtual ~BikeStation() = default;
 
     /**
-     * @brief Constructs a bike station with the given capacity.
+     * @brief Inserts a bike into the station.
      *
-     * @param _capacity Maximum number of bikes that can be stored at this station.
-     */
-    BikeStation(int _capacity);
-
-    /**
-     * @brief Destructor.
+     * If the station is full, the calling thread blocks until a slot becomes
+     * available or the station is marked as ending.
      *
-     * Calls ending() to wake up all waiting threads and signal termination.
+     * @param _bike Pointer to the bike to put into the station. Must not be null.
+     * @return true if the bike was stored, false if the station is ending
+     *         (the caller keeps the bike).
      */
-    ~BikeStation();
+    virtual bool putBike(Bike *_bike) = 0;
 
     /**
-     * @brief Inserts a bike into the station.
+     * @brief Inserts a bike, waiting for a free slot at most until a deadline.
      *
-     * If the station is full, the calling thread blocks until a slot becomes
-     * available or the station is marked as ending.
+     * The deadline may only be checked when the waiter is woken up, so it
+     * is honoured within the period of the wakeTimedWaiters() calls.
      *
      * @param _bike Pointer to the bike to put into the station. Must not be null.
+     * @param _deadlineNs Latest time to wait until (see nowNs()), 0 to wait
+     *        for ever.
+     * @return true if the bike was stored, false on timeout or if the
+     *         station is ending (the caller keeps the bike).
      */
-    void putBike(Bike *_bike);
+    virtual bool putBike(Bike *_bike, uint64_t _deadlineNs) = 0;
 
     /**
      * @brief Retrieves one bike of the requested type from the station.
@@ -62,7 +92,42 @@ public:
      * @param _bikeType Requested bike type index (0..Bike::nbBikeTypes-1).
      * @return Pointer to the retrieved bike, or nullptr if the station is ending.
      */
-    Bike* getBike(size_t _bikeType);
+    virtual Bike* getBike(size_t _bikeType) = 0;
+
+    /**
+     * @brief Retrieves one bike, waiting for the requested type at most until
+     * a deadline.
+     *
+     * The deadline may only be checked when the waiter is woken up, so it
+     * is honoured within the period of the wakeTimedWaiters() calls.
+     *
+     * @param _bikeType Requested bike type index (0..Bike::nbBikeTypes-1).
+     * @param _deadlineNs Latest time to wait until (see nowNs()), 0 to wait
+     *        for ever.
+     * @param _anyType On timeout, take a bike of another type if there is one.
+     * @return Pointer to the retrieved bike, or nullptr on timeout or if the
+     *         station is ending.
+     */
+    virtual Bike* getBike(size_t _bikeType, uint64_t _deadlineNs, bool _anyType) = 0;
+
+    /**
+     * @brief Wakes up the threads waiting with a deadline so that they can
+     * check it.
+     *
+     * Cheap when there is no such waiter. Called periodically by
+     * SimContext while bounded waits are enabled.
+     */
+    virtual void wakeTimedWaiters() = 0;
+
+    /**
+     * @brief Publishes the availability of the station to a site index.
+     *
+     * From now on the station keeps @p _flags up to date (see
+     * siteTypeFlag(), SiteFreeDock) after each modification.
+     *
+     * @param _flags Word of the station in a SiteIndex.
+     */
+    virtual void publishAvailability(std::atomic<uint32_t> *_flags) = 0;
 
     /**
      * @brief Adds several bikes to the station at once.
@@ -73,7 +138,7 @@ public:
      * @param _bikesToAdd Vector of bike pointers to insert.
      * @return Vector containing the bikes that could not be inserted.
      */
-    std::vector<Bike*> addBikes(std::vector<Bike*> _bikesToAdd);
+    virtual std::vector<Bike*> addBikes(std::vector<Bike*> _bikesToAdd) = 0;
 
     /**
      * @brief Retrieves up to a given number of bikes from the station.
@@ -84,61 +149,275 @@ public:
      * @param _nbBikes Maximum number of bikes to retrieve.
      * @return Vector containing the bikes actually retrieved (may be fewer).
      */
-    std::vector<Bike*> getBikes(size_t _nbBikes);
+    virtual std::vector<Bike*> getBikes(size_t _nbBikes) = 0;
 
     /**
      * @brief Counts the bikes of a specific type currently stored.
      *
+     * Lock-free read of a counter published after each modification.
+     *
      * @param type Bike type index (0..Bike::nbBikeTypes-1).
      * @return Number of bikes of the given type in the station.
      */
-    size_t countBikesOfType(size_t type) const;
+    virtual size_t countBikesOfType(size_t type) const = 0;
 
     /**
      * @brief Returns the total number of bikes currently stored.
      *
+     * Lock-free read of a counter published after each modification.
+     *
      * @return Current number of bikes in the station.
      */
-    size_t nbBikes();
+    virtual size_t nbBikes() const = 0;
 
     /**
      * @brief Returns the maximum number of bikes the station can contain.
      *
      * @return Station capacity in number of bikes.
      */
-    size_t nbSlots();
+    virtual size_t nbSlots() const = 0;
+
+    /**
+     * @brief Number of threads waiting for a bike, of any type.
+     *
+     * Lock-free read, for monitoring.
+     */
+    virtual size_t nbWaitingForBike() const = 0;
+
+    /**
+     * @brief Number of threads waiting for a free dock.
+     *
+     * Lock-free read, for monitoring.
+     */
+    virtual size_t nbWaitingForDock() const = 0;
+
+    /**
+     * @brief Returns the site index given at construction.
+     */
+    virtual unsigned int siteId() const = 0;
+
+    /**
+     * @brief Total time the station has been empty since its creation.
+     *
+     * Lock-free, includes the ongoing empty period if any.
+     *
+     * @return Empty time in nanoseconds.
+     */
+    virtual uint64_t emptyTimeNs() const = 0;
+
+    /**
+     * @brief Total time the station has been full since its creation.
+     *
+     * Lock-free, includes the ongoing full period if any.
+     *
+     * @return Full time in nanoseconds.
+     */
+    virtual uint64_t fullTimeNs() const = 0;
 
     /**
      * @brief Signals that the station is ending and wakes up all waiting threads.
      *
-     * Sets the @ref shouldEnd flag to true and notifies all condition variables
-     * so that blocked threads can exit gracefully.
+     * Blocked threads return as if they had failed, so that they can exit
+     * gracefully, and so do the later putBike() and getBike() calls.
+     */
+    virtual void ending() = 0;
+
+    /**
+     * @brief Stops the station so that its content can be inspected.
+     *
+     * While frozen, no bike can enter or leave the station. Used by checkers
+     * that need a consistent view of several stations: freeze them all in
+     * index order, read them with contents(), then thaw() them.
+     */
+    virtual void freeze() = 0;
+
+    /**
+     * @brief Releases a station locked by freeze().
      */
-    void ending();
+    virtual void thaw() = 0;
+
+    /**
+     * @brief Lists the bikes currently stored, type by type.
+     *
+     * Must only be called while the station is frozen or when no other
+     * thread uses it anymore.
+     *
+     * @return Pointers to all stored bikes.
+     */
+    virtual std::vector<Bike*> contents() const = 0;
+};
+
+/**
+ * @brief Station as a monitor: one mutex and condition variables on which
+ * riders wait for a bike of their type or for a free dock.
+ *
+ * Waiters of a type, and of a dock, are served in order of arrival.
+ *
+ * @tparam Sync Policy giving the Mutex and ConditionVariable types, with
+ *         the interface of PcoMutex and PcoConditionVariable. Only
+ *         @ref PcoSync and @ref SpinFutexSync are instantiated, in
+ *         bikestation.cpp.
+ */
+template <class Sync>
+class BasicBikeStation final : public BikeStation
+{
+public:
+    /**
+     * @brief Default constructor (deleted or undefined in your code base).
+     *
+     * Declared but not defined here; if used, it must be implemented elsewhere.
+     */
+    BasicBikeStation();
+
+    /**
+     * @brief Constructs a bike station with the given capacity.
+     *
+     * @param _capacity Maximum number of bikes that can be stored at this station.
+     * @param _id Site index of the station, used by traces and statistics.
+     */
+    BasicBikeStation(int _capacity, unsigned int _id = 0);
+
+    /**
+     * @brief Destructor.
+     *
+     * Calls ending() to wake up all waiting threads and signal termination.
+     */
+    ~BasicBikeStation() override;
+
+    bool putBike(Bike *_bike) override;
+    bool putBike(Bike *_bike, uint64_t _deadlineNs) override;
+    Bike* getBike(size_t _bikeType) override;
+    Bike* getBike(size_t _bikeType, uint64_t _deadlineNs, bool _anyType) override;
+    void wakeTimedWaiters() override;
+    void publishAvailability(std::atomic<uint32_t> *_flags) override;
+    std::vector<Bike*> addBikes(std::vector<Bike*> _bikesToAdd) override;
+    std::vector<Bike*> getBikes(size_t _nbBikes) override;
+    size_t countBikesOfType(size_t type) const override;
+    size_t nbBikes() const override;
+    size_t nbSlots() const override;
+    size_t nbWaitingForBike() const override;
+    size_t nbWaitingForDock() const override;
+    unsigned int siteId() const override;
+    uint64_t emptyTimeNs() const override;
+    uint64_t fullTimeNs() const override;
+
+    /**
+     * @brief Sets the @ref shouldEnd flag to true and notifies all condition
+     * variables so that blocked threads can exit gracefully.
+     */
+    void ending() override;
+
+    /**
+     * @brief Locks the mutex of the station, see BikeStation::freeze().
+     */
+    void freeze() override;
+    void thaw() override;
+    std::vector<Bike*> contents() const override;
 
 private:
+    /**
+     * @brief Publishes the occupancy counters after a modification.
+     *
+     * Must be called with @ref mutex held, after any change to
+     * @ref bikesByType.
+     */
+    void publishOccupancy();
+
     /**
      * @brief Maximum number of bikes that can be stored in this station.
      */
     const size_t capacity;
+    /**
+     * @brief Site index of this station.
+     */
+    const unsigned int id;
     /**
      * @brief Internal storage of bikes, grouped by type.
      */
     std::array<std::deque<Bike*>, Bike::nbBikeTypes> bikesByType;
     /**
      * @brief Mutex protecting access to the station's internal data.
+     *
+     * From the @p Sync policy: for @ref PcoSync, a plain PcoMutex unless
+     * built with PCO_LOCK_PROFILING.
      */
-    PcoMutex mutex;
+    typename Sync::Mutex mutex;
     /**
      * @brief Condition variable signaled when a bike is added.
      */
-    std::vector<PcoConditionVariable> bikeAdded = std::vector<PcoConditionVariable>(Bike::nbBikeTypes);
+    std::vector<typename Sync::ConditionVariable> bikeAdded =
+        std::vector<typename Sync::ConditionVariable>(Bike::nbBikeTypes);
     /**
      * @brief Condition variable signaled when a bike is removed.
+     *
+     * A single one for every type: a dock freed by a bike of any type
+     * serves a rider bringing any type.
      */
-    std::vector<PcoConditionVariable> bikeRemoved = std::vector<PcoConditionVariable>(Bike::nbBikeTypes);
+    typename Sync::ConditionVariable dockFreed;
 
     bool shouldEnd = false; /**< Flag indicating if the station is ending. */
+    std::atomic<unsigned int> timedWaiters{0}; /**< Threads waiting with a deadline. */
+    std::atomic<unsigned int> bikeWaiters{0};  /**< Threads waiting in getBike(). */
+    std::atomic<unsigned int> dockWaiters{0};  /**< Threads waiting in putBike(). */
+
+    /**
+     * @brief Copy of the size of each deque, readable without the mutex.
+     */
+    std::array<std::atomic<size_t>, Bike::nbBikeTypes> typeCounts{};
+    std::atomic<size_t> bikeCount{0}; /**< Sum of @ref typeCounts. */
+
+    std::atomic<uint64_t> emptyNs{0};    /**< Closed empty periods, in ns. */
+    std::atomic<uint64_t> fullNs{0};     /**< Closed full periods, in ns. */
+    std::atomic<uint64_t> emptySince{0}; /**< Start of the ongoing empty period, 0 if none. */
+    std::atomic<uint64_t> fullSince{0};  /**< Start of the ongoing full period, 0 if none. */
+    std::atomic<uint32_t> *availability = nullptr; /**< Flags in a SiteIndex, null if not indexed. */
+    uint32_t availabilityPublished = 0;           /**< Last value stored in @ref availability. */
+};
+
+extern template class BasicBikeStation<PcoSync>;
+extern template class BasicBikeStation<SpinFutexSync>;
+
+/**
+ * @brief Station of the original simulation.
+ */
+using PcoBikeStation = BasicBikeStation<PcoSync>;
+
+/**
+ * @brief Station with the spin-then-futex synchronisation, for comparison.
+ */
+using SpinFutexBikeStation = BasicBikeStation<SpinFutexSync>;
+
+/**
+ * @brief Implementations of BikeStation a simulation can pick.
+ */
+enum StationKind
+{
+    StationPco,       /**< @ref PcoBikeStation, the default. */
+    StationSpinFutex, /**< @ref SpinFutexBikeStation. */
+    StationLockFree   /**< @ref LockFreeBikeStation. */
 };
 
+/**
+ * @brief Finds a station kind from its name.
+ *
+ * @param name "pco", "spin" or "lockfree".
+ * @param kind Set if the name is known.
+ * @return false if the name is unknown.
+ */
+bool parseStationKind(const std::string& name, StationKind& kind);
+
+/**
+ * @brief Names a station kind, in the format of parseStationKind().
+ */
+const char *stationKindName(StationKind kind);
+
+/**
+ * @brief Creates an empty station of a given kind.
+ *
+ * @param kind Implementation.
+ * @param capacity Maximum number of bikes that can be stored at this station.
+ * @param id Site index of the station.
+ */
+std::unique_ptr<BikeStation> makeBikeStation(StationKind kind, size_t capacity, unsigned int id);
+
 #endif // BIKESTATION_H
@@ -13,6 +13,7 @@
 #include <QObject>
 
 #include "mainwindow.h"
+#include "stopsignal.h"
 
 /**
   \brief Classe permettant aux threads d'interagir avec la partie graphique.
@@ -48,8 +49,11 @@ public:
       de type BikingInterface.
       \param nbConsoles Nombre de consoles d'affichage
       \param nbSites Nombre de sites où peuvent être trouvés les vélos
+      \param sitePositions Position des sites puis du dépôt, vide pour les
+             disposer en cercle
       */
-    static void initialize(unsigned int nbConsoles,unsigned int nbSites);
+    static void initialize(unsigned int nbConsoles,unsigned int nbSites,
+                           const std::vector<SitePoint> &sitePositions = {});
 
     /**
       \brief Fonction permettant d'afficher du texte dans une console.
@@ -138,8 +142,24 @@ public:
      */
     void vanTravel(unsigned int site1, unsigned int site2,unsigned int ms);
 
+    /**
+      \brief Rend les déplacements interruptibles.
+
+      Une fois le signal levé, travel(), walk() et vanTravel() retournent
+      immédiatement au lieu d'attendre la fin de l'animation.
+      \param signal Signal d'arrêt de la simulation, nullptr pour attendre
+             toujours la fin.
+      */
+    void setStopSignal(StopSignal *signal);
+
 private:
 
+    //! Attend la durée d'un déplacement, ou jusqu'au signal d'arrêt
+    void sleepMs(unsigned int ms);
+
+    //! Signal d'arrêt, nullptr si aucun
+    StopSignal *m_stopSignal=nullptr;
+
     //! Indique si la fonction d'initialisation a déjà été appelée
     static bool sm_didInitialize;
     //! Fenêtre principale de l'application
@@ -3,6 +3,7 @@
 
 #include <random>
 #include <cstddef>
+#include <cstdint>
 
 /**
  * @brief Number of bike-sharing sites (excluding the depot).
@@ -46,34 +47,78 @@ const size_t VAN_CAPACITY = 4;
  */
 static thread_local std::mt19937_64 c_rng(std::random_device{}());
 
+/**
+ * @brief Random stream owned by one agent, which can be saved and restored.
+ *
+ * The state is summarised by the seed and the number of values drawn so
+ * far, which is enough to rebuild the exact same stream.
+ */
+struct SimRng
+{
+    using result_type = std::mt19937_64::result_type;
+
+    explicit SimRng(uint64_t _seed = std::random_device{}(), uint64_t _draws = 0)
+        : engine(_seed), seed(_seed), draws(_draws)
+    {
+        engine.discard(_draws);
+    }
+
+    result_type operator()()
+    {
+        draws++;
+        return engine();
+    }
+
+    static constexpr result_type min() { return std::mt19937_64::min(); }
+    static constexpr result_type max() { return std::mt19937_64::max(); }
+
+    std::mt19937_64 engine;
+    uint64_t seed;  /**< Seed of @ref engine. */
+    uint64_t draws; /**< Values drawn since seeding. */
+};
+
 /**
  * @brief Returns a random site index different from a given one.
  *
  * @param maxSite Number of valid sites (exclusive upper bound).
  * @param exclude Site index that must not be chosen.
+ * @param rng Random stream to draw from.
  * @return Random site index in [0, maxSite) and != @p exclude.
  */
-inline unsigned int randomSiteExcept(unsigned int maxSite, unsigned int exclude)
+template <class Rng>
+inline unsigned int randomSiteExcept(unsigned int maxSite, unsigned int exclude, Rng& rng)
 {
     std::uniform_int_distribution<unsigned int> dist(0, maxSite - 1);
     unsigned int s;
     do {
-        s = dist(c_rng);
+        s = dist(rng);
     } while (s == exclude);
     return s;
 }
 
+inline unsigned int randomSiteExcept(unsigned int maxSite, unsigned int exclude)
+{
+    return randomSiteExcept(maxSite, exclude, c_rng);
+}
+
 /**
  * @brief Returns a random travel time in milliseconds.
  *
  * The value is uniformly drawn between 500 ms and 2000 ms.
  *
+ * @param rng Random stream to draw from.
  * @return Random travel time in milliseconds.
  */
-inline unsigned int randomTravelTimeMs()
+template <class Rng>
+inline unsigned int randomTravelTimeMs(Rng& rng)
 {
     std::uniform_int_distribution<unsigned int> dist(500, 2000);
-    return dist(c_rng);
+    return dist(rng);
+}
+
+inline unsigned int randomTravelTimeMs()
+{
+    return randomTravelTimeMs(c_rng);
 }
 
 #endif // CONFIG_H
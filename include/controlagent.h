@@ -0,0 +1,122 @@
+/*
+    * controlagent.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef CONTROLAGENT_H
+#define CONTROLAGENT_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <semaphore.h>
+
+#include "bike.h"
+#include "mpscqueue.h"
+
+class SimContext;
+
+/**
+ * @brief Kinds of @ref ControlCommand.
+ */
+enum ControlCommandType : uint8_t
+{
+    ControlAddDepotBikes,    /**< Puts new bikes in the depot. */
+    ControlRemoveDepotBikes, /**< Takes bikes out of the fleet, from the depot. */
+    ControlStop              /**< Stops the simulation, as SimContext::stop(). */
+};
+
+/**
+ * @brief Action requested by the user interface.
+ */
+struct ControlCommand
+{
+    ControlCommandType type = ControlStop;
+    unsigned int count = 0;  /**< Bikes, for the depot commands. */
+};
+
+/**
+ * @brief Agent applying the actions of the user interface to a running
+ * simulation.
+ *
+ * The interface only posts commands, which never takes a lock of the
+ * simulation nor waits for one: the command goes into a lock-free queue
+ * and the agent is woken through a POSIX semaphore, whose post is a single
+ * atomic operation unless the agent sleeps. The agent drains every command
+ * queued when it wakes up and adds up the depot changes, so that a burst
+ * of clicks becomes one addBikes() or getBikes() on the depot.
+ *
+ * Bikes never block the agent either: those that do not fit in the depot
+ * are kept aside, as are the ones taken out, and both are reused by the
+ * next additions. The bikes it creates live as long as the agent, hence as
+ * long as the context.
+ */
+class ControlAgent
+{
+public:
+    /**
+     * @param _context Simulation the commands apply to.
+     */
+    explicit ControlAgent(SimContext *_context);
+    ~ControlAgent();
+
+    ControlAgent(const ControlAgent&) = delete;
+    ControlAgent& operator=(const ControlAgent&) = delete;
+
+    /**
+     * @brief Queues a command for the agent. Never blocks.
+     *
+     * Can be called from any thread. Commands posted once the agent has
+     * stopped are dropped.
+     */
+    void post(const ControlCommand& command);
+
+    /**
+     * @brief Wakes the agent so that it notices a stop, see SimContext::stop().
+     */
+    void wake();
+
+    /**
+     * @brief Body of the agent thread: applies the commands until the
+     * simulation stops.
+     */
+    void run();
+
+    /**
+     * @brief Batches of commands applied so far.
+     */
+    uint64_t nbBatches() const
+    {
+        return batches.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Bikes kept aside: refused by a full depot or taken out of it.
+     *
+     * Only exact once nbBatches() has counted the last batch posted, for
+     * checks in tests.
+     */
+    size_t nbSpareBikes() const
+    {
+        return spare.size();
+    }
+
+private:
+    /**
+     * @brief Adds bikes to the depot, or takes some out if negative.
+     */
+    void changeDepot(long delta);
+
+    SimContext *context;
+    MpscQueue<ControlCommand> commands;
+    sem_t pending;                  /**< Posted once per command and per wake(). */
+    std::atomic<uint64_t> batches{0};
+
+    std::deque<Bike> created;       /**< Bikes added by the user, at stable addresses. */
+    std::vector<Bike*> spare;       /**< Bikes out of the fleet, reused first. */
+    size_t nextType = 0;            /**< Type of the next bike created, in turn. */
+};
+
+#endif // CONTROLAGENT_H
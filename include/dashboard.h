@@ -0,0 +1,113 @@
+/*
+    * dashboard.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef DASHBOARD_H
+#define DASHBOARD_H
+
+#include <QWidget>
+#include <QTimer>
+#include <QRectF>
+#include <array>
+
+#include "config.h"
+#include "simstats.h"
+
+class QPainter;
+
+/**
+ * @brief Fixed-size history of a metric, drawn as a small line chart.
+ */
+class Sparkline
+{
+public:
+    /**
+     * @brief Number of samples kept (one minute at the default rate).
+     */
+    static const size_t nbSamples = 120;
+
+    /**
+     * @brief Appends a sample, dropping the oldest one when full.
+     *
+     * @param value New sample.
+     */
+    void push(double value);
+
+    /**
+     * @brief Draws the history scaled to fit in a rectangle.
+     *
+     * @param painter Painter of the widget.
+     * @param rect Area to draw into.
+     */
+    void draw(QPainter& painter, const QRectF& rect) const;
+
+private:
+    std::array<double, nbSamples> values{};
+    size_t next = 0;  /**< Slot of the next sample. */
+    size_t count = 0; /**< Number of valid samples. */
+};
+
+/**
+ * @brief Live performance dashboard of the running simulation.
+ *
+ * The widget samples @ref SimStats and the station counters twice per
+ * second. Only atomic loads are performed, never a station lock, so that
+ * observing the simulation does not perturb it.
+ */
+class DashboardWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Constructs the dashboard and starts sampling.
+     *
+     * @param parent Parent widget.
+     */
+    DashboardWidget(QWidget *parent = nullptr);
+
+    QSize sizeHint() const override;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+private slots:
+    /**
+     * @brief Reads the counters and refreshes the displayed values.
+     */
+    void sample();
+
+private:
+    /**
+     * @brief Sampling period in milliseconds.
+     */
+    static const int SAMPLEPERIODMS = 500;
+
+    QTimer timer;
+
+    uint64_t lastSampleNs;
+    uint64_t lastTrips = 0;
+    uint64_t lastLegs = 0;
+    uint64_t lastCargoSum = 0;
+    HistogramSnapshot lastWaits;
+
+    double tripsPerSecond = 0;
+    int64_t bikesInTransit = 0;
+    double vanLastRoundS = 0;
+    double vanMeanRoundS = 0;
+    double cargoUtilisation = 0;
+    uint64_t waitP50Us = 0;
+    uint64_t waitP95Us = 0;
+    uint64_t waitP99Us = 0;
+    std::array<size_t, NB_SITES_TOTAL> stationBikes{};
+    std::array<double, NB_SITES_TOTAL> emptyRatio{};
+    std::array<double, NB_SITES_TOTAL> fullRatio{};
+
+    Sparkline tripsHistory;
+    Sparkline transitHistory;
+    Sparkline waitHistory;
+    Sparkline cargoHistory;
+};
+
+#endif // DASHBOARD_H
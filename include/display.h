@@ -11,6 +11,12 @@
 
 #include <QGraphicsView>
 #include <QGraphicsItem>
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include <vector>
+
+#include "siteindex.h"
 
 
 class BikeItem :  public QObject, public QGraphicsPixmapItem
@@ -32,15 +38,65 @@ public:
 
 };
 
+/**
+  \brief Déplacements en cours, stockés en colonnes (struct-of-arrays).
+
+  Chaque déplacement est décrit par sa position de départ, sa position
+  d'arrivée, son instant de départ et sa durée (en ms). Les colonnes sont
+  réutilisées d'un déplacement à l'autre : aucun objet n'est alloué par
+  trajet une fois la capacité atteinte.
+  */
+struct MotionTable
+{
+    //! Nature de l'élément déplacé, pour le traitement en fin de trajet
+    enum Kind : unsigned char { Bike, Person, Van };
+
+    std::vector<float> startX;
+    std::vector<float> startY;
+    std::vector<float> endX;
+    std::vector<float> endY;
+    //! Instant de départ en ms de l'horloge : entier, un float perd la
+    //! milliseconde après quelques heures de simulation
+    std::vector<qint64> t0;
+    std::vector<float> duration;
+    //! Avancement courant dans [0,1], calculé à chaque image
+    std::vector<float> progress;
+    std::vector<QGraphicsItem *> items;
+    std::vector<Kind> kinds;
+
+    size_t size() const { return items.size(); }
+    void add(QGraphicsItem *item,Kind kind,QPointF start,QPointF end,
+             qint64 now,float ms);
+    void remove(size_t i);
+};
+
 class BikeDisplay : public QGraphicsView
 {
     Q_OBJECT
 public:
-    BikeDisplay(unsigned int nbSite,QWidget *parent=0);
+    /**
+      \brief Dessine les sites et le dépôt.
+      \param nbSite Nombre de sites, dépôt exclu
+      \param sitePositions Position des sites puis du dépôt, mise à l'échelle
+             de la vue; vide pour les placer en cercle autour du dépôt
+      */
+    BikeDisplay(unsigned int nbSite,const std::vector<SitePoint> &sitePositions,
+                QWidget *parent=0);
     unsigned int m_nbSite;
     QList<BikeItem *> *m_sites;
     QPointF *m_sitePos;
 private:
+    //! Période du ticker d'animation (~60 images par seconde)
+    static const int FRAMEPERIODMS = 16;
+
+    MotionTable m_motions;
+    QTimer m_ticker;
+    QElapsedTimer m_clock;
+
+    void startMotion(QGraphicsItem *item,MotionTable::Kind kind,
+                     QPointF start,QPointF end,unsigned int ms);
+    void finishMotion(QGraphicsItem *item,MotionTable::Kind kind);
+
     QList<BikeItem *>m_freeBikes;
     QList<BikeItem *>m_occupiedBikes;
     QGraphicsScene *m_scene;
@@ -57,9 +113,8 @@ public slots:
     void setPerson(unsigned int site, unsigned int personID);
     void travel(unsigned int personId,unsigned int site1, unsigned int site2,unsigned int ms);
     void walk(unsigned int personId,unsigned int site1, unsigned int site2,unsigned int ms);
-    void finishedAnimation();
     void vanTravel(unsigned int site1, unsigned int site2,unsigned int ms);
-    void finishedVanAnimation();
+    void tick();
 };
 
 #endif // DISPLAY_H
@@ -0,0 +1,140 @@
+/*
+    * journal.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Station operations recorded in the journal.
+ */
+enum JournalOp : uint8_t
+{
+    JournalPutBike,
+    JournalGetBike,
+    JournalAddBikes,
+    JournalGetBikes,
+    NbJournalOps
+};
+
+/**
+ * @brief One journal record, 24 bytes, written as is in the file.
+ */
+struct JournalRecord
+{
+    uint64_t ticks;       /**< End of the operation, to the clock period, see JournalHeader::toNs(). */
+    uint32_t agent;       /**< Agent id, see Journal::setAgent(). */
+    uint16_t site;        /**< Station index. */
+    uint8_t op;           /**< A @ref JournalOp. */
+    uint8_t bikeType;     /**< Bike type, 0xff for the batch operations. */
+    uint16_t requested;   /**< Number of bikes asked for or offered. */
+    uint16_t result;      /**< Number of bikes actually moved. */
+    uint32_t bikesAfter;  /**< Bikes in the station after the operation. */
+};
+
+static_assert(sizeof(JournalRecord) == 24, "journal records are fixed-width");
+
+/**
+ * @brief Header at the beginning of a journal file.
+ */
+struct JournalHeader
+{
+    char magic[8];        /**< "PCOJRNL1". */
+    uint32_t recordSize;  /**< sizeof(JournalRecord). */
+    uint32_t reserved;
+    uint64_t originNs;    /**< nowNs() when the journal was opened. */
+    uint64_t originTicks; /**< Tick counter at the same instant. */
+    uint64_t endNs;       /**< nowNs() when the journal was closed, 0 if not closed. */
+    uint64_t endTicks;    /**< Tick counter at the same instant. */
+
+    /**
+     * @brief Converts the ticks of a record to nanoseconds since the opening.
+     *
+     * Records carry raw ticks (the TSC on x86, nowNs() elsewhere); both ends
+     * of the journal are used to calibrate them.
+     */
+    double toNs(uint64_t ticks) const
+    {
+        if (endTicks <= originTicks)
+        {
+            return double(ticks - originTicks);
+        }
+        return double(int64_t(ticks - originTicks)) * double(endNs - originNs) /
+               double(endTicks - originTicks);
+    }
+};
+
+/**
+ * @brief Optional append-only journal of every station operation.
+ *
+ * Each thread fills its own buffer of records without any lock. Full
+ * buffers are handed to a background writer that appends them to the file
+ * with one large write each. Buffers grow with the activity of their
+ * thread, from 1.5 KiB to 96 KiB by default. Records of different threads are therefore
+ * grouped by buffer in the file and not sorted by time.
+ *
+ * The records do not read the tick counter themselves: the writer
+ * refreshes a shared copy every clock period, so their times are only
+ * accurate to that period. Records of one thread keep their order in the
+ * file.
+ */
+class Journal
+{
+public:
+    /**
+     * @brief Marks a journal record's agent as a van rather than a person.
+     */
+    static const uint32_t vanAgent = 0x80000000u;
+
+    /**
+     * @brief Opens the journal file and starts the writer.
+     *
+     * @param path File to create.
+     * @param recordsPerBuffer Largest number of records buffered per thread
+     *        before handing them to the writer. The first buffer of a
+     *        thread holds 64 records and each next one twice as many.
+     * @param clockPeriodUs Resolution of the record times in microseconds.
+     * @return false if the file could not be created.
+     */
+    static bool open(const std::string& path, size_t recordsPerBuffer = 1 << 12,
+                     unsigned int clockPeriodUs = 1000);
+
+    /**
+     * @brief Tells whether operations are currently journaled.
+     */
+    static bool enabled()
+    {
+        return isEnabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Sets the agent id of the records of the calling thread.
+     *
+     * @param agent Person id, or van id ORed with @ref vanAgent.
+     */
+    static void setAgent(uint32_t agent);
+
+    /**
+     * @brief Appends a record for the calling thread.
+     */
+    static void record(JournalOp op, unsigned int site, size_t bikeType,
+                       size_t requested, size_t result, size_t bikesAfter);
+
+    /**
+     * @brief Flushes every buffer, stops the writer and closes the file.
+     *
+     * Must be called once the threads using the stations have been joined.
+     * Does nothing if the journal was not opened.
+     */
+    static void close();
+
+private:
+    static std::atomic<bool> isEnabled;
+};
+
+#endif // JOURNAL_H
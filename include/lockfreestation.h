@@ -0,0 +1,141 @@
+/*
+    * lockfreestation.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef LOCKFREESTATION_H
+#define LOCKFREESTATION_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "bike.h"
+#include "bikestation.h"
+#include "mpmcqueue.h"
+#include "spinfutex.h"
+
+/**
+ * @brief Station without a lock on the way of the bikes: one bounded
+ * lock-free queue per type, and a counter of free docks.
+ *
+ * A rider bringing a bike reserves a dock by decrementing the counter,
+ * then pushes the bike on the queue of its type; a rider taking a bike
+ * pops it, then increments the counter. Threads only sleep when the queue
+ * of their type is empty or no dock is free, on a futex (see
+ * @ref FutexEventCount) that the opposite operation signals, so that
+ * riders at a busy station almost never enter the kernel.
+ *
+ * Bikes of a type leave in order of arrival, but waiters are not served
+ * in order: a rider arriving when a bike is put may take it before the
+ * one woken for it. A deadline is a futex timeout, so wakeTimedWaiters()
+ * has nothing to do.
+ *
+ * Keeping the empty and full times and the flags of the site index is the
+ * only part under a lock, a @ref SpinFutexMutex taken when the station
+ * becomes empty or full or a type appears or runs out. freeze() makes new
+ * operations wait at the entrance and waits for the ongoing ones.
+ */
+class LockFreeBikeStation final : public BikeStation
+{
+public:
+    /**
+     * @param _capacity Maximum number of bikes that can be stored at this station.
+     * @param _id Site index of the station, used by traces and statistics.
+     */
+    LockFreeBikeStation(size_t _capacity, unsigned int _id = 0);
+
+    /**
+     * @brief Calls ending() to wake up all waiting threads.
+     */
+    ~LockFreeBikeStation() override;
+
+    bool putBike(Bike *_bike) override;
+    bool putBike(Bike *_bike, uint64_t _deadlineNs) override;
+    Bike* getBike(size_t _bikeType) override;
+    Bike* getBike(size_t _bikeType, uint64_t _deadlineNs, bool _anyType) override;
+    void wakeTimedWaiters() override;
+    void publishAvailability(std::atomic<uint32_t> *_flags) override;
+    std::vector<Bike*> addBikes(std::vector<Bike*> _bikesToAdd) override;
+    std::vector<Bike*> getBikes(size_t _nbBikes) override;
+    size_t countBikesOfType(size_t type) const override;
+    size_t nbBikes() const override;
+    size_t nbSlots() const override;
+    size_t nbWaitingForBike() const override;
+    size_t nbWaitingForDock() const override;
+    unsigned int siteId() const override;
+    uint64_t emptyTimeNs() const override;
+    uint64_t fullTimeNs() const override;
+    void ending() override;
+    void freeze() override;
+    void thaw() override;
+    std::vector<Bike*> contents() const override;
+
+private:
+    /**
+     * @brief Counts the calling thread among the ongoing operations,
+     * after waiting for a thaw() if the station is frozen.
+     */
+    void enter();
+
+    /**
+     * @brief Ends an operation started by enter().
+     */
+    void leave();
+
+    /**
+     * @brief Reserves up to @p count docks.
+     *
+     * @return Number of docks reserved.
+     */
+    size_t reserveDocks(size_t count);
+
+    /**
+     * @brief Returns docks freed by bikes taken, and wakes their waiters.
+     */
+    void releaseDocks(size_t count);
+
+    /**
+     * @brief Stores a bike on a reserved dock.
+     */
+    void store(Bike *bike);
+
+    /**
+     * @brief Takes a bike of a type if there is one.
+     */
+    Bike* take(size_t type);
+
+    /**
+     * @brief Brings the empty and full periods and the availability flags
+     * up to date with the counters, under @ref bookkeeping.
+     */
+    void publishOccupancy();
+
+    const size_t capacity;
+    const unsigned int id;
+    std::array<std::unique_ptr<MpmcQueue<Bike*>>, Bike::nbBikeTypes> queues;
+
+    alignas(64) std::atomic<size_t> freeDocks;  /**< Docks neither taken nor reserved. */
+    std::array<std::atomic<size_t>, Bike::nbBikeTypes> typeCounts{}; /**< Upper bounds of the queue sizes. */
+
+    std::array<FutexEventCount, Bike::nbBikeTypes> bikeAdded;
+    FutexEventCount dockFreed;
+    std::atomic<bool> shouldEnd{false};
+    std::atomic<unsigned int> bikeWaiters{0};
+    std::atomic<unsigned int> dockWaiters{0};
+
+    alignas(64) std::atomic<uint32_t> active{0}; /**< Operations between enter() and leave(). */
+    std::atomic<uint32_t> frozen{0};             /**< 1 between freeze() and thaw(). */
+
+    SpinFutexMutex bookkeeping;                  /**< Serialises the writers of the fields below. */
+    std::atomic<uint64_t> emptyNs{0};            /**< Closed empty periods, read without the lock. */
+    std::atomic<uint64_t> fullNs{0};             /**< Closed full periods, read without the lock. */
+    std::atomic<uint64_t> emptySince{0};         /**< Start of the ongoing empty period, 0 if none. */
+    std::atomic<uint64_t> fullSince{0};          /**< Start of the ongoing full period, 0 if none. */
+    std::atomic<uint32_t> *availability = nullptr;
+    uint32_t availabilityPublished = 0;
+};
+
+#endif // LOCKFREESTATION_H
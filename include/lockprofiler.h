@@ -0,0 +1,129 @@
+/*
+    * lockprofiler.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef LOCKPROFILER_H
+#define LOCKPROFILER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+#include "pcosynchro/pcoconditionvariable.h"
+#include "pcosynchro/pcomutex.h"
+#include "simstats.h"
+
+/**
+ * @brief Contention statistics of one profiled lock.
+ *
+ * Durations are in nanoseconds. Instances are owned by the profiler and
+ * stay valid until the end of the program.
+ */
+struct LockProfile
+{
+    int site = -1;                          /**< Site guarded by the lock, -1 if unknown. */
+    Histogram acquireNs;                    /**< Time spent in lock(). */
+    Histogram holdNs;                       /**< Time between acquisition and release. */
+    Histogram waitersAtAcquire;             /**< Threads already blocked in lock() when trying to acquire. */
+    Histogram wakeNs;                       /**< Time between a notify and the woken waiter running. */
+    std::atomic<uint64_t> futileWakeups{0}; /**< Wake-ups directly followed by another wait. */
+    std::atomic<uint64_t> blockedNow{0};    /**< Threads currently blocked in lock(). */
+};
+
+/**
+ * @brief Registry of the lock profiles and contention report.
+ */
+class LockProfiler
+{
+public:
+    /**
+     * @brief Creates a new profile, kept until the end of the program.
+     */
+    static LockProfile *createProfile();
+
+    /**
+     * @brief Prints the profiled locks ranked by lost time.
+     *
+     * The lost time of a lock is the sum of its acquisition latencies and
+     * of its notify-to-run latencies.
+     *
+     * Prints nothing when no lock is profiled, i.e. when the program was
+     * not built with PCO_LOCK_PROFILING.
+     *
+     * @param file Output stream.
+     */
+    static void printReport(FILE *file);
+};
+
+/**
+ * @brief PcoMutex recording its acquisition latency, hold time and the
+ * number of threads blocked on it.
+ *
+ * Only meant to be used through @ref StationMutex.
+ */
+class ProfiledMutex
+{
+public:
+    ProfiledMutex();
+
+    void lock();
+    void unlock();
+
+    /**
+     * @brief Statistics of this mutex.
+     */
+    LockProfile *profile() const
+    {
+        return stats;
+    }
+
+private:
+    friend class ProfiledConditionVariable;
+
+    PcoMutex mutex;
+    LockProfile *stats;
+    uint64_t lockedAt = 0;     /**< Acquisition time of the current holder. */
+    bool holderWoken = false;  /**< The holder got the mutex back from a wait. */
+};
+
+/**
+ * @brief PcoConditionVariable measuring how long a notified thread takes
+ * to run again, and counting the wake-ups that lead straight back to
+ * blocking.
+ *
+ * Only meant to be used through @ref StationConditionVariable.
+ */
+class ProfiledConditionVariable
+{
+public:
+    void wait(ProfiledMutex *mutex);
+    void notifyOne();
+    void notifyAll();
+
+private:
+    PcoConditionVariable condition;
+    std::atomic<uint64_t> notifiedAt{0};
+};
+
+#ifdef PCO_LOCK_PROFILING
+using StationMutex = ProfiledMutex;
+using StationConditionVariable = ProfiledConditionVariable;
+
+/**
+ * @brief Tags the statistics of a station lock with its site.
+ */
+inline void labelLock(ProfiledMutex& mutex, unsigned int site)
+{
+    mutex.profile()->site = static_cast<int>(site);
+}
+#else
+using StationMutex = PcoMutex;
+using StationConditionVariable = PcoConditionVariable;
+
+inline void labelLock(PcoMutex&, unsigned int)
+{
+}
+#endif
+
+#endif // LOCKPROFILER_H
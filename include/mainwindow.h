@@ -13,12 +13,14 @@
 #include <QTextEdit>
 #include <QDockWidget>
 #include "display.h"
+#include "dashboard.h"
 
 #include "config.h"
 #include "bikestation.h"
 #include "bike.h"
+#include "simcontext.h"
 
-extern std::array<BikeStation*, NB_SITES_TOTAL>* globalStations;
+extern SimContext* globalContext;
 
 class MainWindow : public QMainWindow
 {
@@ -26,12 +28,15 @@ class MainWindow : public QMainWindow
 
 public:
     MainWindow(unsigned int nbConsoles,unsigned int nbSite,
+               const std::vector<SitePoint> &sitePositions,
                QWidget *parent = 0);
     ~MainWindow();
 
     QDockWidget **m_docks;
     QTextEdit **m_consoles;
     BikeDisplay *m_display;
+    QDockWidget *m_dashboardDock;
+    DashboardWidget *m_dashboard;
 
     void setConsoleTitle(unsigned int consoleId,QString title);
 
@@ -0,0 +1,149 @@
+/*
+    * mpmcqueue.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef MPMCQUEUE_H
+#define MPMCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief Bounded FIFO queue between any number of producer and consumer
+ * threads, without any lock.
+ *
+ * A ring of a power-of-two size whose cells carry a sequence number
+ * telling whether they are ready to be written or read at a given lap, so
+ * that a push or a pop is a compare-and-swap on the tail or the head plus
+ * a store in the cell. A push may fail although the queue is not full,
+ * when the pop of the last lap on that cell is still in progress; callers
+ * that reserve room beforehand simply try again.
+ *
+ * @tparam T Trivially copyable element.
+ */
+template <class T>
+class MpmcQueue
+{
+public:
+    /**
+     * @brief Creates an empty queue.
+     *
+     * @param minCapacity Rounded up to a power of two.
+     */
+    explicit MpmcQueue(size_t minCapacity)
+    {
+        size_t capacity = 1;
+        while (capacity < minCapacity)
+        {
+            capacity *= 2;
+        }
+        mask = capacity - 1;
+        ring.reset(new Cell[capacity]);
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            ring[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    /**
+     * @brief Appends an element, from any thread.
+     *
+     * @return false if the queue is full.
+     */
+    bool push(const T& value)
+    {
+        size_t position = tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = ring[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t lag = intptr_t(sequence) - intptr_t(position);
+            if (lag == 0)
+            {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (lag < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Removes the oldest element, from any thread.
+     *
+     * @return false if the queue is empty.
+     */
+    bool pop(T& value)
+    {
+        size_t position = head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = ring[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t lag = intptr_t(sequence) - intptr_t(position + 1);
+            if (lag == 0)
+            {
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    value = cell.value;
+                    cell.sequence.store(position + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (lag < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Calls a function on every element, oldest first.
+     *
+     * Only while no push or pop is in progress.
+     */
+    template <class F>
+    void forEach(F f) const
+    {
+        size_t end = tail.load(std::memory_order_acquire);
+        for (size_t position = head.load(std::memory_order_acquire); position != end; ++position)
+        {
+            f(ring[position & mask].value);
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> ring;
+    size_t mask;
+
+    alignas(64) std::atomic<size_t> tail{0}; /**< Next position to write. */
+    alignas(64) std::atomic<size_t> head{0}; /**< Next position to read. */
+};
+
+#endif // MPMCQUEUE_H
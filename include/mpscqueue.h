@@ -0,0 +1,88 @@
+/*
+    * mpscqueue.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <atomic>
+#include <utility>
+
+/**
+ * @brief Unbounded queue from any number of producer threads to a single
+ * consumer thread, without any lock.
+ *
+ * A linked list whose first node is a dummy one. A push swaps the tail for
+ * its node then links the old tail to it, so producers never wait for each
+ * other nor for the consumer. Between the two steps the new node is not
+ * reachable yet: pop() then sees the queue as empty, and finds the node
+ * after the producer has linked it.
+ *
+ * @tparam T Default-constructible element.
+ */
+template <class T>
+class MpscQueue
+{
+public:
+    MpscQueue()
+        : head(new Node), tail(head)
+    {
+    }
+
+    ~MpscQueue()
+    {
+        while (head)
+        {
+            Node *next = head->next.load(std::memory_order_relaxed);
+            delete head;
+            head = next;
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    /**
+     * @brief Appends an element, from any thread.
+     */
+    void push(T value)
+    {
+        Node *node = new Node;
+        node->value = std::move(value);
+        Node *previous = tail.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    /**
+     * @brief Removes the oldest element, from the consumer thread only.
+     *
+     * @return false if the queue is empty, or if the oldest push is not
+     *         linked yet.
+     */
+    bool pop(T& value)
+    {
+        Node *next = head->next.load(std::memory_order_acquire);
+        if (!next)
+        {
+            return false;
+        }
+        // The popped node becomes the dummy one
+        value = std::move(next->value);
+        delete head;
+        head = next;
+        return true;
+    }
+
+private:
+    struct Node
+    {
+        std::atomic<Node*> next{nullptr};
+        T value{};
+    };
+
+    Node *head;                         /**< Dummy node, owned by the consumer. */
+    alignas(64) std::atomic<Node*> tail; /**< Last node, swapped by the producers. */
+};
+
+#endif // MPSCQUEUE_H
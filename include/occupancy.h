@@ -0,0 +1,191 @@
+/*
+    * occupancy.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef OCCUPANCY_H
+#define OCCUPANCY_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Header at the beginning of an occupancy file.
+ *
+ * Followed by one uint32_t capacity per site, then by blocks.
+ */
+struct OccupancyHeader
+{
+    char magic[8];         /**< "PCOOCC1". */
+    uint32_t nbSites;      /**< Sites recorded, the depot last when recorded by a simulation. */
+    uint32_t nbTypes;      /**< Bike types per site. */
+    uint32_t periodUs;     /**< Time between two rows. */
+    uint32_t rowsPerBlock; /**< Rows of every block but the last one. */
+    uint64_t originNs;     /**< nowNs() at row 0. */
+    uint64_t nbRows;       /**< Rows in the file, 0 if it was not closed. */
+};
+
+/**
+ * @brief Header of a block of rows.
+ *
+ * Followed by the size in bytes of each column as uint32_t, then by the
+ * columns themselves. Column c holds type c % nbTypes of site c / nbTypes.
+ *
+ * A column is a sequence of runs of equal values, each encoded as two
+ * LEB128 varints: the difference with the value of the previous run,
+ * zigzag-encoded (the first run of a block starts from 0), and the length
+ * of the run. The runs of a column cover the rows of its block exactly.
+ */
+struct OccupancyBlockHeader
+{
+    uint32_t magic;        /**< "OBLK" in little endian, see OCCUPANCY_BLOCK_MAGIC. */
+    uint32_t nbRows;
+    uint64_t firstRow;
+    uint64_t payloadBytes; /**< Column sizes and columns. */
+};
+
+/**
+ * @brief Magic number of a block.
+ */
+const uint32_t OCCUPANCY_BLOCK_MAGIC = 0x4b4c424f;
+
+/**
+ * @brief Records the number of bikes of every type at every site at a
+ * fixed period, as a compact column store.
+ *
+ * Each row is appended to one run-length encoder per column. Occupancy
+ * changes far less often than it is sampled, so a row usually costs a
+ * comparison per column and no memory. Every @c rowsPerBlock rows the
+ * encoded columns become a block, handed to a background writer so that
+ * the sampling thread never waits for the disk. Blocks are independent,
+ * a reader may skip them using their header only.
+ *
+ * append() and close() must be called by one thread at a time.
+ */
+class OccupancyRecorder
+{
+public:
+    OccupancyRecorder() = default;
+
+    /**
+     * @brief Closes the file if needed.
+     */
+    ~OccupancyRecorder();
+
+    OccupancyRecorder(const OccupancyRecorder&) = delete;
+    OccupancyRecorder& operator=(const OccupancyRecorder&) = delete;
+
+    /**
+     * @brief Creates the file and starts the writer.
+     *
+     * @param path File to create.
+     * @param capacities Capacity of each site, which also gives their number.
+     * @param nbTypes Bike types per site.
+     * @param periodUs Time between two rows.
+     * @param rowsPerBlock Rows encoded before a block is handed to the writer.
+     * @return false if the file could not be created.
+     */
+    bool open(const std::string& path, const std::vector<uint32_t>& capacities, size_t nbTypes,
+              unsigned int periodUs, size_t rowsPerBlock = 1 << 16);
+
+    /**
+     * @brief Tells whether open() succeeded and close() was not called yet.
+     */
+    bool isOpen() const
+    {
+        return fd >= 0;
+    }
+
+    /**
+     * @brief Time between two rows, in microseconds.
+     */
+    unsigned int periodUs() const
+    {
+        return header.periodUs;
+    }
+
+    /**
+     * @brief Sets the time of row 0, nowNs() at open() by default.
+     *
+     * Only before the first append().
+     */
+    void setOrigin(uint64_t originNs)
+    {
+        header.originNs = originNs;
+    }
+
+    /**
+     * @brief Rows the next sample should go to: one more than the periods
+     * elapsed since the origin.
+     */
+    uint64_t rowsDue(uint64_t now) const;
+
+    /**
+     * @brief Appends rows with the same values.
+     *
+     * @param values One value per column, site by site then type by type.
+     * @param count Number of identical rows, more than one when the
+     *        sampling thread was late.
+     */
+    void append(const uint32_t *values, uint64_t count = 1);
+
+    /**
+     * @brief Rows appended so far.
+     */
+    uint64_t nbRows() const
+    {
+        return rows;
+    }
+
+    /**
+     * @brief Writes the last block and the final header, then closes the file.
+     *
+     * Does nothing if the recorder is not open.
+     */
+    void close();
+
+private:
+    struct Column
+    {
+        std::vector<uint8_t> bytes;
+        uint32_t previous = 0;  /**< Value of the last run written. */
+        uint32_t value = 0;     /**< Value of the ongoing run. */
+        uint64_t length = 0;    /**< Length of the ongoing run, 0 if none. */
+    };
+
+    struct Block
+    {
+        OccupancyBlockHeader header;
+        std::vector<uint32_t> sizes;
+        std::vector<uint8_t> payload;
+    };
+
+    /**
+     * @brief Encodes the pending runs and queues them as one block.
+     */
+    void seal();
+
+    void writerLoop();
+
+    OccupancyHeader header{};
+    std::vector<Column> columns;
+    size_t rowsPerBlock = 0;
+    uint64_t rows = 0;
+    uint64_t blockFirstRow = 0;
+    int fd = -1;
+
+    std::mutex mutex;             /**< Protects the fields below. */
+    std::condition_variable queued;
+    std::deque<std::unique_ptr<Block>> writeQueue;
+    bool stopping = false;
+    uint64_t writeErrors = 0;
+    std::thread writer;
+};
+
+#endif // OCCUPANCY_H
@@ -7,9 +7,15 @@
 #define PERSON_H
 
 #include <array>
+#include <atomic>
 #include "config.h"
 #include "bikestation.h"
 #include "bikinginterface.h"
+#include "riderstats.h"
+#include "simcontext.h"
+#include "snapshot.h"
+#include "tripreader.h"
+#include "workload.h"
 #include "pcosynchro/pcothread.h"
 
 /**
@@ -30,9 +36,21 @@ public:
      * The constructor randomly chooses a preferred bike type and initializes
      * the home and current site (here both start at 0).
      *
+     * @param _context Simulation the person belongs to.
      * @param _id Unique identifier for this person.
      */
-    Person(unsigned int _id);
+    Person(SimContext* _context, unsigned int _id);
+
+    /**
+     * @brief Recreates a person saved in a snapshot.
+     *
+     * run() first finishes the ride or walk the person was in.
+     *
+     * @param _context Simulation the person belongs to.
+     * @param _state Saved state.
+     * @param _bike Bike the person was riding, nullptr if none.
+     */
+    Person(SimContext* _context, const RiderState& _state, Bike* _bike);
 
     /**
      * @brief Main loop of the person.
@@ -43,53 +61,139 @@ public:
     void run();
 
     /**
-     * @brief Sets the user interface used to display actions and movements.
+     * @brief Returns the bike currently ridden by the person, if any.
+     *
+     * Safe to call from any thread; used by invariant checkers.
+     *
+     * @return Pointer to the held bike, nullptr if the person has none.
+     */
+    Bike* heldBike() const;
+
+    /**
+     * @brief Returns the latency statistics of the person.
+     *
+     * Must only be read once the person thread has been joined.
      *
-     * @param _binkingInterface Pointer to the interface implementation.
+     * @return Per-phase statistics recorded by run().
      */
-    static void setInterface(BikingInterface* _binkingInterface);
+    const RiderStats& riderStats() const;
 
     /**
-     * @brief Sets the array of bike stations used by all people.
+     * @brief Returns the state of the person for a snapshot.
      *
-     * @param _stations Array of pointers to all stations (sites + depot).
+     * Must only be called once the person thread has been joined.
      */
-    static void setStations(const std::array<BikeStation*, NB_SITES_TOTAL>& _stations);
+    RiderState state() const;
 
 private:
+    /**
+     * @brief Finishes the phase a restored person was in.
+     *
+     * @return false if the simulation stopped meanwhile.
+     */
+    bool resume();
+
+    /**
+     * @brief Main loop of the person when replaying recorded trips.
+     */
+    void replay();
+
+    /**
+     * @brief Sleeps until the given time or until the simulation stops.
+     *
+     * @param _dueNs Wake-up time (see nowNs()).
+     * @return false if the simulation or the thread was asked to stop.
+     */
+    bool sleepUntil(uint64_t _dueNs) const;
+
+    /**
+     * @brief Phase of the workload profile in force, if any.
+     *
+     * @return nullptr when the simulation has no workload profile.
+     */
+    const WorkloadPhase* currentLoad() const;
+
+    /**
+     * @brief Idles while the workload profile leaves this person out.
+     *
+     * Persons are ranked by id: with a share a of active riders out of n,
+     * those with an id up to a * n cycle.
+     *
+     * @return false if the simulation or the thread was asked to stop.
+     */
+    bool waitUntilActive();
+
     /**
      * @brief Chooses a random site different from the given one.
      *
+     * Follows the destination skew of the workload profile, if any.
+     *
      * @param _from Origin site index.
      * @return Index of a different site.
      */
-    unsigned int chooseOtherSite(unsigned int _from) const;
+    unsigned int chooseOtherSite(unsigned int _from);
 
     /**
-     * @brief Computes a random travel time for a bike trip.
+     * @brief Computes the travel time of a bike trip.
      *
+     * Riding time between the sites from the site map, varied at random
+     * and scaled by the workload profile, if any, plus the time to take
+     * and dock the bike.
+     *
+     * @param _from Origin site index.
+     * @param _to Destination site index.
      * @return Travel time in milliseconds.
      */
-    unsigned int bikeTravelTime() const;
+    unsigned int bikeTravelTime(unsigned int _from, unsigned int _to);
 
     /**
-     * @brief Computes a random travel time for a walk.
+     * @brief Computes the travel time of a walk.
      *
-     * Typically longer than a bike trip.
+     * Walking time between the sites, varied and scaled as for a bike
+     * trip, plus the time of the activity.
      *
+     * @param _from Origin site index.
+     * @param _to Destination site index.
      * @return Travel time in milliseconds.
      */
-    unsigned int walkTravelTime() const;
+    unsigned int walkTravelTime(unsigned int _from, unsigned int _to);
 
     /**
-     * @brief Takes a bike of the preferred type from the given site.
+     * @brief Takes a bike of the given type from the given site.
      *
      * Updates the user interface with the new bike count at the site.
      *
      * @param _site Index of the site from which to take the bike.
-     * @return Pointer to the taken bike (never null in normal operation).
+     * @param _type Requested bike type.
+     * @param _deadlineNs Latest time to wait until, 0 to wait for ever.
+     * @param _anyType On timeout, take a bike of another type if any.
+     * @return Pointer to the taken bike, nullptr on timeout or if the
+     *         simulation is ending.
+     */
+    Bike* takeBikeFromSite(unsigned int _site, size_t _type, uint64_t _deadlineNs = 0, bool _anyType = false);
+
+    /**
+     * @brief Takes a bike at the current site, applying the rider policy.
+     *
+     * Each time a wait reaches the bound of the policy, the person takes
+     * another type if allowed, or walks to the nearest site with stock if
+     * allowed, then waits again.
+     *
+     * @return Pointer to the taken bike, nullptr if the simulation is ending.
+     */
+    Bike* takeBikeWithPolicy();
+
+    /**
+     * @brief Deposits a bike at the current site, applying the rider policy.
+     *
+     * Each time a wait reaches the bound of the policy, the person rides on
+     * to the nearest site with a free dock if allowed, then waits again.
+     *
+     * @param _bike Pointer to the bike being deposited.
+     * @return true once the bike is deposited, false if the simulation is
+     *         ending (the person keeps the bike).
      */
-    Bike* takeBikeFromSite(unsigned int _site);
+    bool depositBikeWithPolicy(Bike* _bike);
 
     /**
      * @brief Deposits a bike at the given site.
@@ -98,27 +202,46 @@ private:
      *
      * @param _site Index of the site where the bike is deposited.
      * @param _bike Pointer to the bike being deposited.
+     * @param _deadlineNs Latest time to wait until, 0 to wait for ever.
+     * @return true if the bike was deposited, false on timeout or if the
+     *         simulation is ending (the person keeps the bike).
      */
-    void depositBikeAtSite(unsigned int _site, Bike* _bike);
+    bool depositBikeAtSite(unsigned int _site, Bike* _bike, uint64_t _deadlineNs = 0);
 
     /**
      * @brief Simulates riding a bike from the current site to a destination.
      *
-     * Notifies the user interface of the trip and updates @ref currentSite.
+     * Notifies the user interface of the trip, or waits as travelHeadless()
+     * when headless, and updates @ref currentSite.
      *
      * @param _dest Destination site index.
      * @param _bike Pointer to the bike used for this trip.
+     * @param _ms Ride duration in milliseconds, 0 for a random one.
      */
-    void bikeTo(unsigned int _dest, Bike* _bike);
+    void bikeTo(unsigned int _dest, Bike* _bike, unsigned int _ms = 0);
 
     /**
      * @brief Simulates walking from the current site to a destination.
      *
-     * Notifies the user interface of the walk and updates @ref currentSite.
+     * Notifies the user interface of the walk, or waits as travelHeadless()
+     * when headless, and updates @ref currentSite.
      *
      * @param _dest Destination site index.
+     * @param _ms Walk duration in milliseconds, 0 for a random one.
      */
-    void walkTo(unsigned int _dest);
+    void walkTo(unsigned int _dest, unsigned int _ms = 0);
+
+    /**
+     * @brief Spends a travel time when no user interface animates it.
+     *
+     * Only done under a workload profile (at its speed) or a site map read
+     * from a file, and never when replaying trips; otherwise headless
+     * riders chain their trips as fast as the stations allow. Returns early
+     * if the simulation stops.
+     *
+     * @param _ms Travel duration in milliseconds of the profile.
+     */
+    void travelHeadless(unsigned int _ms) const;
 
     /**
      * @brief Writes a message to the user interface console if available.
@@ -150,14 +273,49 @@ private:
     unsigned int currentSite;
 
     /**
-     * @brief User interface shared by all people (may be null).
+     * @brief Phase of the cycle the person is in, saved by snapshots.
+     */
+    RiderPhase phase = WaitBike;
+
+    /**
+     * @brief Destination of the ongoing ride or walk.
+     */
+    unsigned int destination = 0;
+
+    /**
+     * @brief Planned end of the ongoing ride or walk, 0 if unknown.
+     */
+    uint64_t phaseEndNs = 0;
+
+    /**
+     * @brief Time at which run() returned.
+     */
+    uint64_t stoppedNs = 0;
+
+    /**
+     * @brief Time left in the restored ride or walk, in milliseconds.
+     */
+    unsigned int resumeMs = 0;
+
+    /**
+     * @brief Random stream of the person (sites and travel times).
+     */
+    SimRng rng;
+
+    /**
+     * @brief Bike taken and not yet deposited, published for checkers.
+     */
+    std::atomic<Bike*> holding{nullptr};
+
+    /**
+     * @brief Duration of each phase of the person's cycles.
      */
-    static BikingInterface* binkingInterface;
+    RiderStats stats;
 
     /**
-     * @brief Shared array of bike stations for all sites and the depot.
+     * @brief Simulation the person belongs to.
      */
-    static std::array<BikeStation*, NB_SITES_TOTAL> stations;
+    SimContext* context;
 };
 
 #endif // PERSON_H
@@ -0,0 +1,273 @@
+/*
+    * region.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef REGION_H
+#define REGION_H
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bike.h"
+#include "bikestation.h"
+#include "config.h"
+#include "regionwire.h"
+#include "simstats.h"
+#include "sitemap.h"
+
+class RegionLink;
+
+/**
+ * @brief Parameters of a simulation split over several processes.
+ *
+ * Every process is given the same configuration.
+ */
+struct RegionConfig
+{
+    size_t nbRegions = 2;
+    size_t nbSites = 256;
+    size_t slotsPerSite = BORNES;
+    size_t nbBikes = 256 * (BORNES - 2); /**< Capped at nbSites * (slotsPerSite - 2). */
+    size_t nbRiders = 1024;
+    size_t vanCapacity = VAN_CAPACITY;
+    size_t depotLoad = 2;                /**< Bikes loaded at the depot at each round. */
+    unsigned int depotWaitUs = 1000000;
+    double timeScale = 1;                /**< Travel times are divided by it. */
+    size_t batchSize = 256;              /**< Riders sent to a region in one message at most. */
+    unsigned int flushUs = 1000;         /**< Longest a rider waits to be sent. */
+    uint64_t seed = 1;
+};
+
+/**
+ * @brief What a region reports to the coordinator once stopped.
+ */
+struct RegionReport
+{
+    uint64_t trips = 0;         /**< Bikes docked. */
+    uint64_t events = 0;        /**< Arrivals of riders and of the van. */
+    uint64_t handoffsOut = 0;   /**< Riders sent to another region. */
+    uint64_t handoffsIn = 0;    /**< Riders received from another region. */
+    uint64_t messagesOut = 0;   /**< Batches of riders sent. */
+    uint64_t bytesOut = 0;      /**< Bytes sent to other regions. */
+    uint64_t vanRounds = 0;
+    uint64_t riders = 0;        /**< Riders held at the end. */
+    uint64_t bikes = 0;         /**< Bikes held at the end: stations, depot, van and riders. */
+    HistogramSnapshot waitBikeUs;
+    HistogramSnapshot waitDockUs;
+
+    /**
+     * @brief Adds the report of another region to this one.
+     */
+    void merge(const RegionReport& other);
+};
+
+/**
+ * @brief One process of a partitioned simulation: the stations of a
+ * contiguous range of sites, the riders currently there, a van and a
+ * depot.
+ *
+ * Riders follow the cycle of @ref Person (wait for a bike of their type,
+ * ride, wait for a dock, walk) with the travel times of a @ref SiteMap of
+ * defaultSiteLayout(), but as events of a single thread rather than one
+ * thread each, so that they can move between processes as plain data. The
+ * stations are @ref BikeStation, only ever reached from that thread, so
+ * they are only called when they can serve at once; riders that cannot be
+ * served wait in FIFO queues per site, as with BatchEngine.
+ *
+ * A rider leaving for a site of another region is removed at departure
+ * and sent with its remaining travel time, batched per destination region.
+ * The van balances the sites of its own region only.
+ *
+ * Connections are Unix-domain stream sockets in a directory shared with
+ * the coordinator and the other regions, see @ref RegionCoordinator.
+ */
+class RegionNode
+{
+public:
+    /**
+     * @brief Creates the stations, bikes and riders of a region.
+     *
+     * @param _config Configuration shared by every region.
+     * @param _region Index of this region, below nbRegions.
+     */
+    RegionNode(const RegionConfig& _config, size_t _region);
+    ~RegionNode();
+
+    RegionNode(const RegionNode&) = delete;
+    RegionNode& operator=(const RegionNode&) = delete;
+
+    /**
+     * @brief Connects to the others, runs until the coordinator stops the
+     * region, then sends it the report.
+     *
+     * @param dir Directory of the sockets.
+     * @return false, with a message on stderr, on any connection error.
+     */
+    bool run(const std::string& dir);
+
+    /**
+     * @brief Region owning a site.
+     */
+    static size_t ownerOf(const RegionConfig& config, size_t site)
+    {
+        return site * config.nbRegions / config.nbSites;
+    }
+
+    /**
+     * @brief First site of a region, the end of the previous one.
+     */
+    static size_t firstSiteOf(const RegionConfig& config, size_t region)
+    {
+        return (region * config.nbSites + config.nbRegions - 1) / config.nbRegions;
+    }
+
+    const RegionConfig config;
+    const size_t region;
+
+private:
+    struct Rider
+    {
+        uint32_t id;
+        uint32_t site;      /**< Site of the next arrival, or waited at. */
+        uint32_t bike;      /**< Bike ridden, WireRider::noBike when walking. */
+        uint64_t sinceNs;   /**< Start of the current wait. */
+    };
+
+    /**
+     * @brief Next arrival of a rider, or of the van for @ref vanEvent.
+     */
+    struct Event
+    {
+        uint64_t dueNs;
+        uint32_t rider;
+
+        bool operator>(const Event& other) const
+        {
+            return dueNs > other.dueNs;
+        }
+    };
+
+    /**
+     * @brief Rider on its way to another region, until the next batch.
+     */
+    struct Departure
+    {
+        WireRider rider;
+        uint64_t dueNs;     /**< Arrival time, turned into the remaining time when sent. */
+    };
+
+    static const uint32_t vanEvent = UINT32_MAX;
+    static const uint32_t freeSlot = UINT32_MAX;
+
+    bool connect(const std::string& dir);
+    bool serveLinks(uint64_t timeoutNs);
+    bool receive(RegionLink& link, const WireHeader& header, const char *body);
+    void begin(uint64_t now);
+    void stop(uint64_t now);
+
+    void arrive(uint32_t rider, uint64_t now);
+    void settle(uint32_t site, uint64_t now);
+    void takeBike(uint32_t rider, uint64_t now);
+    void dockBike(uint32_t rider, uint64_t now);
+    void travel(uint32_t rider, uint32_t site, unsigned int ms, uint64_t now);
+    void adopt(const WireRider& wire, uint64_t now);
+    void flush(size_t to, uint64_t now);
+
+    void vanArrive(uint64_t now);
+    void balanceSite(uint32_t site);
+
+    BikeStation& station(uint32_t site)
+    {
+        return *stations[site - firstSite];
+    }
+
+    uint32_t typeOf(uint32_t rider) const
+    {
+        return riders[rider].id % Bike::nbBikeTypes;
+    }
+
+    void report(RegionReport& result) const;
+
+    const SiteMap siteMap;
+    const size_t firstSite;
+    const size_t endSite;
+    size_t bikeTotal = 0;
+    std::unique_ptr<Bike[]> bikes;      /**< The whole fleet, indexed by bike id. */
+    std::vector<std::unique_ptr<BikeStation>> stations;
+    std::unique_ptr<BikeStation> depot;
+
+    std::vector<Rider> riders;          /**< Slots, reused through @ref freeRiders. */
+    std::vector<uint32_t> freeRiders;
+    size_t nbInitialRiders = 0;         /**< Riders created here, first slots, scheduled at the start. */
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+    std::vector<std::array<std::deque<uint32_t>, Bike::nbBikeTypes>> bikeWaiters; /**< Per local site and type. */
+    std::vector<std::deque<uint32_t>> dockWaiters;                               /**< Per local site. */
+
+    std::vector<Bike*> vanCargo;
+    std::vector<uint32_t> vanRoute;     /**< Sites of the region, in round order. */
+    size_t vanStop = 0;                 /**< Stop reached next: 0 and route size + 1 for the depot. */
+    uint32_t vanSite = 0;               /**< Site reached last, nbSites for the depot. */
+
+    std::unique_ptr<RegionLink> coordinator;
+    std::vector<std::unique_ptr<RegionLink>> peers;       /**< Indexed by region, null for this one. */
+    std::vector<std::vector<Departure>> outbound;         /**< Riders waiting to be sent, per region. */
+    std::vector<uint64_t> outboundSince;                  /**< When the oldest of them left, per region. */
+    size_t drainedPeers = 0;
+    bool started = false;
+    bool stopping = false;
+
+    SimRng rng;
+    RegionReport counters;
+};
+
+/**
+ * @brief Starts the regions as child processes, lets them run, stops them
+ * and merges their reports.
+ *
+ * The coordinator and region k listen on coordinator.sock and region-k.sock
+ * in the socket directory. Region k connects to the coordinator and to
+ * every region below k, and accepts the connections of those above it. The
+ * coordinator starts the clock once every region has said hello, and
+ * stops it after the duration. Each region then sends what it still holds
+ * for another region followed by a drained mark, adopts the riders sent
+ * to it until every other region is drained, and reports, so that no bike
+ * is lost in transit.
+ */
+class RegionCoordinator
+{
+public:
+    /**
+     * @param _config Configuration given to every region.
+     */
+    explicit RegionCoordinator(const RegionConfig& _config);
+
+    /**
+     * @brief Runs a whole simulation.
+     *
+     * @param durationMs Time between the start and the stop.
+     * @param dir Directory of the sockets, created if needed; a new one
+     *        under /tmp if empty.
+     * @return false, with a message on stderr, if a region failed.
+     */
+    bool run(unsigned int durationMs, std::string dir = "");
+
+    /**
+     * @brief Number of bikes the regions share.
+     */
+    size_t nbBikes() const;
+
+    const RegionConfig config;
+    std::vector<RegionReport> reports; /**< One per region, after run(). */
+    RegionReport total;                /**< Merge of @ref reports. */
+    double seconds = 0;                /**< Measured time between start and stop. */
+};
+
+#endif // REGION_H
@@ -0,0 +1,85 @@
+/*
+    * regionwire.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef REGIONWIRE_H
+#define REGIONWIRE_H
+
+#include <cstdint>
+
+/**
+ * @brief First word of a hello, "PCBR".
+ */
+const uint32_t REGION_WIRE_MAGIC = 0x52424350;
+
+/**
+ * @brief Version of the messages below, bumped on any change to them.
+ */
+const uint32_t REGION_WIRE_VERSION = 1;
+
+/**
+ * @brief Messages exchanged between regions and with the coordinator.
+ */
+enum RegionWireType : uint16_t
+{
+    WireHello,   /**< First message of a connection, a @ref WireHelloBody. */
+    WireStart,   /**< Coordinator to region: the clock starts now. */
+    WireRiders,  /**< Region to region: a batch of @ref WireRider. */
+    WireStop,    /**< Coordinator to region: stop serving riders. */
+    WireDrained, /**< Region to region: no rider will follow on this connection. */
+    WireReport,  /**< Region to coordinator: a @ref RegionReport. */
+    NbWireTypes
+};
+
+/**
+ * @brief Header of every message, followed by @ref bytes of body.
+ *
+ * Fields are in host byte order: both ends run on the same host.
+ */
+struct WireHeader
+{
+    uint16_t type;   /**< A @ref RegionWireType. */
+    uint16_t from;   /**< Region sending it, nbRegions for the coordinator. */
+    uint32_t bytes;  /**< Size of the body. */
+};
+
+static_assert(sizeof(WireHeader) == 8, "wire headers are fixed-width");
+
+/**
+ * @brief Body of a hello, checked against the receiver's own configuration.
+ */
+struct WireHelloBody
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nbRegions;
+    uint32_t nbSites;
+    uint32_t slotsPerSite;
+    uint32_t nbBikes;
+    uint32_t nbRiders;
+    uint32_t reserved;
+    uint64_t seed;
+};
+
+/**
+ * @brief A rider handed to the region owning its destination, 16 bytes.
+ *
+ * The preferred type of a rider is its id modulo Bike::nbBikeTypes and the
+ * type of a bike its id modulo the same, so neither is sent. The remaining
+ * travel time is relative, so that the clocks of the two ends need not
+ * agree.
+ */
+struct WireRider
+{
+    uint32_t id;          /**< Rider id, unique over every region. */
+    uint32_t site;        /**< Destination, owned by the receiver. */
+    uint32_t bike;        /**< Bike ridden, or noBike when walking. */
+    uint32_t remainingUs; /**< Travel time left when the batch was sent. */
+
+    static const uint32_t noBike = UINT32_MAX;
+};
+
+static_assert(sizeof(WireRider) == 16, "riders are fixed-width");
+
+#endif // REGIONWIRE_H
@@ -0,0 +1,141 @@
+/*
+    * riderstats.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef RIDERSTATS_H
+#define RIDERSTATS_H
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "config.h"
+#include "simstats.h"
+
+/**
+ * @brief Phases of a rider cycle, in the order they happen.
+ */
+enum RiderPhase
+{
+    WaitBike, /**< Waiting for a bike of the preferred type, fallbacks included. */
+    Ride,     /**< Riding to the destination. */
+    WaitDock, /**< Waiting for a free dock, diversions included. */
+    Walk,     /**< Walking to the next origin. */
+    NbRiderPhases
+};
+
+/**
+ * @brief Printable names of the @ref RiderPhase values.
+ */
+extern const char *const riderPhaseNames[NbRiderPhases];
+
+/**
+ * @brief Fallbacks a rider can take when a wait exceeds its bound.
+ */
+enum RiderFallback
+{
+    TookOtherType,  /**< Took a bike of another type at the origin. */
+    WalkedForBike,  /**< Walked to the nearest site with stock. */
+    DivertedToDock, /**< Rode on to the nearest site with a free dock. */
+    NbRiderFallbacks
+};
+
+/**
+ * @brief Printable names of the @ref RiderFallback values.
+ */
+extern const char *const riderFallbackNames[NbRiderFallbacks];
+
+/**
+ * @brief Latency of each phase of one rider, by origin site of the cycle.
+ *
+ * Owned and written by the rider thread only, without synchronisation.
+ * Instances are merged by printRiderReport() once the threads are joined.
+ */
+class RiderStats
+{
+public:
+    /**
+     * @param _preferredType Bike type preferred by the rider.
+     */
+    explicit RiderStats(size_t _preferredType);
+
+    /**
+     * @brief Marks the start of the rider activity.
+     */
+    void begin();
+
+    /**
+     * @brief Marks the end of the rider activity.
+     */
+    void end();
+
+    /**
+     * @brief Records the duration of a phase.
+     *
+     * @param phase Phase that just ended.
+     * @param origin Site where the current cycle started.
+     * @param durationNs Duration of the phase in nanoseconds.
+     */
+    void record(RiderPhase phase, unsigned int origin, uint64_t durationNs);
+
+    /**
+     * @brief Counts one complete cycle (wait, ride, dock, walk).
+     *
+     * @param durationNs End-to-end duration of the cycle in nanoseconds.
+     */
+    void completeCycle(uint64_t durationNs);
+
+    /**
+     * @brief Counts one fallback taken by the rider.
+     */
+    void recordFallback(RiderFallback fallback);
+
+    /**
+     * @brief Bike type preferred by the rider.
+     */
+    const size_t preferredType;
+
+    /**
+     * @brief Phase durations in microseconds, by origin site and phase.
+     */
+    std::array<std::array<SparseHistogram, NbRiderPhases>, NBSITES> byOrigin;
+
+    /**
+     * @brief End-to-end cycle durations in microseconds, fallbacks included.
+     */
+    SparseHistogram cycleUs;
+
+    /**
+     * @brief Number of complete cycles.
+     */
+    uint64_t cycles = 0;
+
+    /**
+     * @brief Number of times each fallback was taken.
+     */
+    std::array<uint64_t, NbRiderFallbacks> fallbacks{};
+
+    /**
+     * @brief Time between begin() and end(), in nanoseconds.
+     */
+    uint64_t activeNs = 0;
+
+private:
+    uint64_t startNs = 0;
+};
+
+/**
+ * @brief Prints the latency breakdown of a set of riders.
+ *
+ * Reports p50/p95/p99/max per phase, per preferred type and per origin
+ * site, the end-to-end cycle time, the number of completed cycles per
+ * rider-hour and the fallbacks taken.
+ *
+ * @param file Output stream.
+ * @param riders Statistics of the riders, all threads joined.
+ */
+void printRiderReport(FILE *file, const std::vector<const RiderStats*>& riders);
+
+#endif // RIDERSTATS_H
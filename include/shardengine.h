@@ -0,0 +1,172 @@
+/*
+    * shardengine.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef SHARDENGINE_H
+#define SHARDENGINE_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "bike.h"
+#include "spscqueue.h"
+#include "pcosynchro/pcomutex.h"
+
+/**
+ * @brief How the stations of a @ref ShardEngine are shared between threads.
+ */
+enum class ShardMode
+{
+    SharedLocks, /**< Any thread locks any station, as BikeStation does. */
+    Owned        /**< Each thread owns a range of stations and the riders at them. */
+};
+
+/**
+ * @brief Name of a mode, as accepted by the tools.
+ */
+const char *shardModeName(ShardMode mode);
+
+/**
+ * @brief Parameters of a @ref ShardEngine run.
+ */
+struct ShardConfig
+{
+    ShardMode mode = ShardMode::Owned;
+    size_t threads = 1;
+    size_t nbSites = 1024;
+    size_t slotsPerSite = 20;
+    size_t nbBikes = 1024 * 9;  /**< Capped at nbSites * (slotsPerSite - 2). */
+    size_t nbRiders = 8192;
+    double locality = 0;        /**< Share of trips ending in the partition they start from. */
+    bool pin = true;            /**< Pin thread k to CPU k modulo the number of CPUs. */
+    uint64_t seed = 1;
+};
+
+/**
+ * @brief Rider cycle without travel time, spread over a fixed number of
+ * threads, to compare shared stations with stations owned by one thread.
+ *
+ * Riders repeat the cycle of @ref Person: take a bike of their type, ride
+ * to another site, dock it, walk to another site. A rider that cannot be
+ * served gives up at once and goes on to another site, as a @ref Person
+ * whose wait times out, so that no rider ever blocks a thread and the
+ * modes only differ by how stations are reached:
+ *
+ * - SharedLocks: thread k runs a fixed set of riders and locks whatever
+ *   station they are at, so the lines of busy stations move between cores.
+ * - Owned: sites are split in contiguous ranges, one per thread. A thread
+ *   runs the riders currently at its sites, with no lock; a rider going to
+ *   another range is passed to its owner over a single-producer
+ *   single-consumer queue, one per pair of threads. Station state is only
+ *   ever touched by its owner, which also allocates it after being pinned.
+ *
+ * Each thread keeps its own counters, summed once the threads are joined.
+ */
+class ShardEngine
+{
+public:
+    /**
+     * @param _config Parameters of the run.
+     */
+    explicit ShardEngine(const ShardConfig& _config);
+    ~ShardEngine();
+
+    ShardEngine(const ShardEngine&) = delete;
+    ShardEngine& operator=(const ShardEngine&) = delete;
+
+    /**
+     * @brief Runs the threads for a wall-clock duration, then joins them.
+     *
+     * Can only be called once.
+     */
+    void run(unsigned int durationMs);
+
+    /**
+     * @brief Bikes in the stations plus bikes ridden, after run().
+     *
+     * Equals nbBikes() unless the engine is broken.
+     */
+    size_t bikesAccountedFor() const;
+
+    /**
+     * @brief Number of bikes actually distributed.
+     */
+    size_t nbBikes() const
+    {
+        return bikeTotal;
+    }
+
+    const ShardConfig config;
+    uint64_t trips = 0;    /**< Bikes docked. */
+    uint64_t messages = 0; /**< Riders passed to another thread. */
+    uint64_t retries = 0;  /**< Station visits given up, the station being empty or full. */
+    double seconds = 0;    /**< Measured duration of the run. */
+
+private:
+    struct Rider
+    {
+        uint32_t site;
+        uint8_t type;
+        uint8_t riding;    /**< Holds a bike and looks for a dock. */
+    };
+
+    struct Station
+    {
+        uint32_t stock[Bike::nbBikeTypes];
+        uint32_t total;
+    };
+
+    struct alignas(64) SharedStation
+    {
+        PcoMutex mutex;
+        Station state;
+    };
+
+    /**
+     * @brief State of one thread, only touched by it while running.
+     */
+    struct alignas(64) Worker
+    {
+        std::deque<Rider> riders;                 /**< Runnable riders, in turn. */
+        std::vector<Station> stations;            /**< Owned mode: sites firstSite.. of the range. */
+        std::vector<std::vector<Rider>> overflow; /**< Owned mode: riders for a full queue, per thread. */
+        size_t firstSite = 0;
+        uint64_t rng = 0;
+        uint64_t trips = 0;
+        uint64_t messages = 0;
+        uint64_t retries = 0;
+    };
+
+    size_t ownerOf(uint32_t site) const
+    {
+        return size_t(site) * config.threads / config.nbSites;
+    }
+    size_t firstSiteOf(size_t worker) const
+    {
+        return (worker * config.nbSites + config.threads - 1) / config.threads;
+    }
+    SpscQueue<Rider>& queue(size_t from, size_t to)
+    {
+        return *queues[from * config.threads + to];
+    }
+
+    void setUp(size_t k);
+    void runShared(size_t k);
+    void runOwned(size_t k);
+    bool serve(Worker& worker, Rider& rider, Station& station);
+    uint32_t destination(Worker& worker, uint32_t from);
+    void route(Worker& worker, size_t k, const Rider& rider);
+    uint32_t initialStock(size_t site, size_t type) const;
+
+    size_t bikeTotal = 0;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::unique_ptr<SharedStation[]> shared;             /**< SharedLocks mode only. */
+    std::vector<std::unique_ptr<SpscQueue<Rider>>> queues; /**< Owned mode: threads x threads. */
+    std::atomic<bool> stopping{false};
+};
+
+#endif // SHARDENGINE_H
@@ -0,0 +1,232 @@
+/*
+    * simcontext.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef SIMCONTEXT_H
+#define SIMCONTEXT_H
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bike.h"
+#include "bikestation.h"
+#include "config.h"
+#include "controlagent.h"
+#include "simstats.h"
+#include "siteindex.h"
+#include "sitemap.h"
+#include "stopsignal.h"
+#include "watchdog.h"
+#include "pcosynchro/pcothread.h"
+
+class BikingInterface;
+class OccupancyRecorder;
+class Person;
+class Snapshot;
+class Telemetry;
+class TripReader;
+class Van;
+class WorkloadProfile;
+
+/**
+ * @brief Default pause of a van at the depot between two rounds, in microseconds.
+ */
+const unsigned int VAN_DEPOT_WAITIME = 1000000;
+
+/**
+ * @brief Neighbours kept per site by the site index.
+ */
+const size_t SITE_NEIGHBOURS = 16;
+
+/**
+ * @brief What riders do when a station keeps them waiting.
+ *
+ * With the defaults riders wait for ever, as in the original simulation.
+ */
+struct RiderPolicy
+{
+    unsigned int maxWaitMs = 0;    /**< Wait at a station before falling back, 0 for ever. */
+    bool acceptOtherType = false;  /**< Take a bike of another type at the origin. */
+    bool walkToStock = false;      /**< Walk to the nearest site with a bike. */
+    bool divertToFreeDock = false; /**< Ride on to the nearest site with a free dock. */
+};
+
+/**
+ * @brief Sets the fallbacks of a policy from their names.
+ *
+ * @param names "none" or any of "type", "walk" and "dock" joined with '+'.
+ * @param policy Policy whose fallback flags are set.
+ * @return false if a name is unknown.
+ */
+bool parseRiderFallbacks(const std::string& names, RiderPolicy& policy);
+
+/**
+ * @brief Names the fallbacks of a policy, in the format of parseRiderFallbacks().
+ */
+std::string riderFallbacksName(const RiderPolicy& policy);
+
+/**
+ * @brief Parameters of one simulation.
+ *
+ * Defaults are the compile-time constants of config.h. The number of sites
+ * stays fixed at @ref NBSITES.
+ */
+struct SimConfig
+{
+    size_t slotsPerSite = BORNES;        /**< Docks per site. */
+    size_t nbBikes = NB_BIKES;           /**< Bikes in the fleet, also the depot capacity. */
+    size_t nbRiders = NBPEOPLE;
+    size_t nbVans = 1;
+    size_t vanCapacity = VAN_CAPACITY;
+    size_t depotLoad = 2;                /**< Bikes loaded at the depot at each round. */
+    unsigned int depotWaitUs = VAN_DEPOT_WAITIME;
+    RiderPolicy policy;
+    unsigned int stallMs = 0;            /**< Wait after which a blocked rider is reported, 0 for no watchdog. */
+    StationKind station = StationPco;    /**< Implementation of the stations and the depot. */
+    std::vector<SitePoint> sites;        /**< NB_SITES_TOTAL positions, empty for defaultSiteLayout(). */
+};
+
+/**
+ * @brief Owns everything a simulation needs: stations, bikes, agents,
+ * their threads and the statistics.
+ *
+ * Agents only reach the rest of the simulation through their context, so
+ * any number of contexts can run side by side in one process.
+ */
+class SimContext
+{
+public:
+    /**
+     * @brief Creates the sites and the depot, empty.
+     *
+     * @param _config Parameters of the simulation.
+     */
+    explicit SimContext(const SimConfig& _config = SimConfig());
+
+    /**
+     * @brief Stops and joins the agents if needed, then frees everything.
+     */
+    ~SimContext();
+
+    SimContext(const SimContext&) = delete;
+    SimContext& operator=(const SimContext&) = delete;
+
+    /**
+     * @brief Creates the bikes and the agents with the usual initial state.
+     *
+     * Each site gets slotsPerSite - 2 bikes, the depot the rest. Must be
+     * called after @ref interface and @ref trips have been set.
+     */
+    void populate();
+
+    /**
+     * @brief Creates the bikes and the agents from a snapshot.
+     *
+     * @return false if the bikes do not fit in the stations.
+     */
+    bool restore(const Snapshot& snapshot);
+
+    /**
+     * @brief Starts one thread per agent.
+     *
+     * The trips shown by @ref interface become interruptible by stop().
+     */
+    void start();
+
+    /**
+     * @brief Asks the agents to stop, releases the waiting ones and cuts
+     * the sleeping ones short.
+     *
+     * Can be called from any thread, several times.
+     */
+    void stop();
+
+    /**
+     * @brief Waits for the agent threads to finish.
+     */
+    void join();
+
+    /**
+     * @brief Number of bikes in the fleet: created by populate() or
+     * restore(), then changed by the depot commands of @ref control.
+     */
+    size_t nbBikes() const
+    {
+        return bikeCount.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Finds the closest other site holding a bike.
+     *
+     * Looks among the nearest sites of @ref siteIndex only, without taking
+     * any lock; the answer may be stale.
+     *
+     * @param from Site of the rider.
+     * @param type Bike type wanted.
+     * @param anyType Whether any type will do.
+     * @return Site index, or -1 if no nearby site has such a bike.
+     */
+    int nearestSiteWithBike(unsigned int from, size_t type, bool anyType) const;
+
+    /**
+     * @brief Finds the closest other site with a free dock.
+     *
+     * Same distance and staleness as nearestSiteWithBike().
+     *
+     * @param from Site of the rider.
+     * @return Site index, or -1 if every nearby site is full.
+     */
+    int nearestSiteWithFreeDock(unsigned int from) const;
+
+    const SimConfig config;
+    std::array<BikeStation*, NB_SITES_TOTAL> stations;
+    std::unique_ptr<Bike[]> bikes;    /**< Every bike of the fleet, in one allocation. */
+    std::vector<Person*> riders;
+    std::vector<Van*> vans;
+    SimStats stats;
+    const SiteMap siteMap;            /**< Positions and distances, depot included. */
+    SiteIndex siteIndex;              /**< Neighbours and availability of the sites, depot excluded. */
+    const std::vector<unsigned int> vanRoute; /**< Sites in the order of a van round. */
+    StopSignal stopSignal;            /**< Raised by stop(), ends every timed delay of the agents. */
+    ControlAgent control;             /**< Applies the commands of the user interface. */
+    StallWatchdog watchdog;           /**< Slots of the riders, scanned if config.stallMs is set. */
+
+    BikingInterface* interface = nullptr; /**< User interface, null when headless. */
+    TripReader* trips = nullptr;          /**< Recorded trips to replay, null for random trips. */
+    const WorkloadProfile* workload = nullptr; /**< Load over time, null for a constant load. */
+    Telemetry* telemetry = nullptr;       /**< Live region for pco_biking_top, null for none. */
+    OccupancyRecorder* occupancy = nullptr; /**< Occupancy time series, null for none. */
+
+private:
+    friend class ControlAgent;
+
+    /**
+     * @brief Periodically lets the bounded waits check their deadline.
+     */
+    void tick();
+
+    /**
+     * @brief Periodically copies the counters into @ref telemetry.
+     */
+    void publishTelemetry();
+
+    /**
+     * @brief Periodically looks for stalled riders, see StallWatchdog.
+     */
+    void watchStalls();
+
+    /**
+     * @brief Periodically appends the bikes of each type at each station
+     * to @ref occupancy.
+     */
+    void recordOccupancy();
+
+    std::atomic<size_t> bikeCount{0};
+    std::vector<std::unique_ptr<PcoThread>> threads;
+};
+
+#endif // SIMCONTEXT_H
@@ -0,0 +1,250 @@
+/*
+    * simstats.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef SIMSTATS_H
+#define SIMSTATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Monotonic timestamp in nanoseconds.
+ *
+ * All statistics use this clock so that durations from different modules
+ * can be compared directly.
+ *
+ * @return Nanoseconds since an arbitrary fixed origin.
+ */
+inline uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Plain histogram, used as a copy of a @ref Histogram or directly by
+ *        a single thread.
+ *
+ * Per-thread instances can be recorded without any synchronisation and
+ * merged at the end of a run.
+ */
+class HistogramSnapshot
+{
+public:
+    /**
+     * @brief Number of buckets of every histogram.
+     *
+     * Values below 16 have an exact bucket, above that each power of two is
+     * split in 8 sub-buckets (relative error below 12.5%), up to 2^40.
+     */
+    static const size_t nbBuckets = 16 + 37 * 8;
+
+    /**
+     * @brief Maps a value to its bucket index.
+     *
+     * @param value Recorded value (any unit).
+     * @return Bucket index in [0, nbBuckets).
+     */
+    static size_t bucketOf(uint64_t value);
+
+    /**
+     * @brief Returns the upper bound of the values stored in a bucket.
+     *
+     * @param bucket Bucket index.
+     * @return Largest value mapped to @p bucket.
+     */
+    static uint64_t bucketUpperBound(size_t bucket);
+
+    /**
+     * @brief Records one value. Not thread-safe.
+     *
+     * @param value Value to record.
+     */
+    void record(uint64_t value)
+    {
+        buckets[bucketOf(value)]++;
+        count++;
+        sum += value;
+        max = value > max ? value : max;
+    }
+
+    /**
+     * @brief Adds the content of another snapshot to this one.
+     *
+     * @param other Snapshot to merge.
+     */
+    void merge(const HistogramSnapshot& other);
+
+    /**
+     * @brief Removes an earlier snapshot of the same histogram.
+     *
+     * The result describes only the values recorded in between. @ref max
+     * cannot be windowed and keeps the value of this snapshot.
+     *
+     * @param earlier Older snapshot of the same histogram.
+     */
+    void subtract(const HistogramSnapshot& earlier);
+
+    /**
+     * @brief Estimates a percentile.
+     *
+     * @param p Percentile in [0, 100].
+     * @return Upper bound of the bucket holding the percentile, 0 if empty.
+     */
+    uint64_t percentile(double p) const;
+
+    /**
+     * @brief Number of recorded values.
+     */
+    uint64_t count = 0;
+
+    /**
+     * @brief Largest recorded value.
+     */
+    uint64_t max = 0;
+
+    /**
+     * @brief Sum of the recorded values.
+     */
+    uint64_t sum = 0;
+
+    /**
+     * @brief Count per bucket.
+     */
+    std::array<uint64_t, nbBuckets> buckets{};
+};
+
+/**
+ * @brief Latency histogram that can be recorded from any thread.
+ *
+ * Recording is a handful of relaxed atomic increments, reading takes a
+ * snapshot without stopping the writers. The count is derived from the
+ * buckets so that a snapshot is always self-consistent.
+ */
+class Histogram
+{
+public:
+    /**
+     * @brief Records one value.
+     *
+     * @param value Value to record (any unit, usually microseconds).
+     */
+    void record(uint64_t value);
+
+    /**
+     * @brief Copies the current content of the histogram.
+     *
+     * @return Snapshot of the counts.
+     */
+    HistogramSnapshot snapshot() const;
+
+private:
+    std::array<std::atomic<uint64_t>, HistogramSnapshot::nbBuckets> buckets{};
+    std::atomic<uint64_t> max{0};
+    std::atomic<uint64_t> sum{0};
+};
+
+/**
+ * @brief Compact single-thread histogram storing only non-empty buckets.
+ *
+ * Uses the bucket layout of @ref HistogramSnapshot. Values recorded by one
+ * agent usually fall into a few dozen buckets, which keeps many instances
+ * per thread affordable. Not thread-safe.
+ */
+class SparseHistogram
+{
+public:
+    /**
+     * @brief Records one value.
+     *
+     * @param value Value to record.
+     */
+    void record(uint64_t value);
+
+    /**
+     * @brief Adds the content of this histogram to a dense one.
+     *
+     * @param target Histogram receiving the counts.
+     */
+    void mergeInto(HistogramSnapshot& target) const;
+
+    /**
+     * @brief Number of recorded values.
+     */
+    uint64_t count() const;
+
+private:
+    /**
+     * @brief Non-empty buckets as (bucket index, count), sorted by index.
+     */
+    std::vector<std::pair<uint16_t, uint32_t>> entries;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+};
+
+/**
+ * @brief Counters describing a running simulation, owned by its SimContext.
+ *
+ * Counters are only written by the simulation threads with relaxed atomic
+ * operations and can be sampled at any time by observers (dashboard, tools)
+ * without taking any station lock. Per-station occupancy lives in the
+ * stations themselves (see BikeStation::emptyTimeNs()).
+ */
+class SimStats
+{
+public:
+    /**
+     * @brief Timestamp at which the counters were created.
+     */
+    const uint64_t startNs = nowNs();
+
+    /**
+     * @brief Number of completed bike trips (bike taken and dropped).
+     */
+    std::atomic<uint64_t> tripsCompleted{0};
+
+    /**
+     * @brief Number of bikes currently held by riders.
+     */
+    std::atomic<int64_t> bikesInTransit{0};
+
+    /**
+     * @brief Time spent by riders waiting for a bike or a free dock, in us.
+     */
+    Histogram waitTimesUs;
+
+    /**
+     * @brief Number of complete van rounds.
+     */
+    std::atomic<uint64_t> vanRounds{0};
+
+    /**
+     * @brief Duration of the last complete van round, in ns.
+     */
+    std::atomic<uint64_t> vanLastRoundNs{0};
+
+    /**
+     * @brief Sum of all van round durations, in ns.
+     */
+    std::atomic<uint64_t> vanTotalRoundNs{0};
+
+    /**
+     * @brief Number of van legs driven (one cargo sample per leg).
+     */
+    std::atomic<uint64_t> vanLegs{0};
+
+    /**
+     * @brief Sum of the cargo sizes at the start of each van leg.
+     *
+     * Divided by vanLegs * SimConfig::vanCapacity it gives the cargo utilisation.
+     */
+    std::atomic<uint64_t> vanCargoSum{0};
+};
+
+#endif // SIMSTATS_H
@@ -0,0 +1,120 @@
+/*
+    * siteindex.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef SITEINDEX_H
+#define SITEINDEX_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "bike.h"
+
+/**
+ * @brief Position of a site, in arbitrary units.
+ */
+struct SitePoint
+{
+    double x = 0;
+    double y = 0;
+};
+
+/**
+ * @brief Availability flag of a site: at least one bike of the given type.
+ */
+inline uint32_t siteTypeFlag(size_t type)
+{
+    return uint32_t(1) << type;
+}
+
+/**
+ * @brief Availability flag of a site: at least one bike, of any type.
+ */
+const uint32_t SiteAnyBike = (uint32_t(1) << Bike::nbBikeTypes) - 1;
+
+/**
+ * @brief Availability flag of a site: at least one free dock.
+ */
+const uint32_t SiteFreeDock = uint32_t(1) << 31;
+
+static_assert(Bike::nbBikeTypes < 31, "bike types must fit in the availability flags");
+
+/**
+ * @brief Places sites evenly on a unit circle, in index order, as the
+ * display does.
+ *
+ * @param nbSites Number of sites.
+ * @return Position of each site.
+ */
+std::vector<SitePoint> circleLayout(size_t nbSites);
+
+/**
+ * @brief Answers "nearest site with ..." queries without taking any lock.
+ *
+ * Each site has its k nearest other sites precomputed, closest first, in
+ * one contiguous row. Each station publishes what it can offer as a word of
+ * availability flags, written by the station under its own lock and read
+ * here with relaxed loads. A query walks one row and tests one word per
+ * neighbour, stopping at the first match, so it reads a few cache lines
+ * whatever the number of sites. Answers may be stale by one operation.
+ */
+class SiteIndex
+{
+public:
+    /**
+     * @brief Builds the neighbour lists.
+     *
+     * Every site starts with no flag set until its station publishes.
+     *
+     * @param sites Position of each site.
+     * @param _k Neighbours kept per site, capped at the number of other sites.
+     */
+    SiteIndex(const std::vector<SitePoint>& sites, size_t _k);
+
+    /**
+     * @brief Number of indexed sites.
+     */
+    size_t nbSites() const
+    {
+        return count;
+    }
+
+    /**
+     * @brief Availability flags of a site, written by its station only.
+     */
+    std::atomic<uint32_t>& flags(size_t site)
+    {
+        return siteFlags[site];
+    }
+
+    /**
+     * @brief Finds the closest neighbour of a site offering any of the flags.
+     *
+     * @param from Site of the caller.
+     * @param mask Wanted flags, e.g. siteTypeFlag(t) or SiteFreeDock.
+     * @return Site index, or -1 if none of the k nearest sites matches.
+     */
+    int nearest(unsigned int from, uint32_t mask) const
+    {
+        const uint32_t *row = &neighbourIds[size_t(from) * k];
+        for (size_t i = 0; i < k; ++i)
+        {
+            if (siteFlags[row[i]].load(std::memory_order_relaxed) & mask)
+            {
+                return int(row[i]);
+            }
+        }
+        return -1;
+    }
+
+private:
+    size_t count;
+    size_t k;
+    std::vector<uint32_t> neighbourIds;                /**< count rows of k sites, closest first. */
+    std::unique_ptr<std::atomic<uint32_t>[]> siteFlags; /**< Availability flags per site. */
+};
+
+#endif // SITEINDEX_H
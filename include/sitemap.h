@@ -0,0 +1,189 @@
+/*
+    * sitemap.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef SITEMAP_H
+#define SITEMAP_H
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "siteindex.h"
+
+/**
+ * @brief Riding time per kilometre, in milliseconds of simulation.
+ *
+ * With the default layout a ride takes 1250 ms on average, the mean of
+ * randomTravelTimeMs().
+ */
+const unsigned int BIKE_MS_PER_KM = 850;
+
+/**
+ * @brief Walking time per kilometre, in milliseconds of simulation.
+ */
+const unsigned int WALK_MS_PER_KM = 1200;
+
+/**
+ * @brief Driving time of the van per kilometre, in milliseconds of simulation.
+ */
+const unsigned int VAN_MS_PER_KM = 1250;
+
+/**
+ * @brief Default layout of the sites: the circle of the display, one
+ * kilometre wide in radius, with the depot in the middle.
+ *
+ * @param nbSites Number of sites, the depot comes after them.
+ * @return Position of each site then of the depot, in kilometres.
+ */
+std::vector<SitePoint> defaultSiteLayout(size_t nbSites);
+
+/**
+ * @brief Spreads sites at random over the disk of the default layout.
+ *
+ * Used for thousands of sites, where a circle makes no sense.
+ *
+ * @param nbSites Number of sites.
+ * @param seed Seed of the positions.
+ * @return Position of each site, in kilometres.
+ */
+std::vector<SitePoint> diskLayout(size_t nbSites, uint64_t seed);
+
+/**
+ * @brief Reads the positions of the sites and the depot from a file.
+ *
+ * One site per line, in site order, as "x y" in kilometres. A line
+ * "depot x y" places the depot, otherwise it goes to the centroid of the
+ * sites. '#' starts a comment.
+ * @code
+ * # city centre first
+ * 0.0 0.0
+ * 1.2 0.4
+ * depot 0.5 -0.3
+ * @endcode
+ *
+ * @param path File to read.
+ * @param nbSites Number of sites expected, depot excluded.
+ * @param points Receives the sites then the depot.
+ * @return false, with a message on stderr, if the file cannot be used.
+ */
+bool loadSiteLayout(const std::string& path, size_t nbSites, std::vector<SitePoint>& points);
+
+/**
+ * @brief Geography of the simulation: where the sites are and how long it
+ * takes to go from one to another.
+ *
+ * The distances between every pair of sites are computed once and kept in
+ * a symmetric-packed matrix: row i holds the distances to sites 0..i-1,
+ * rows one after the other, so n sites take n(n-1)/2 floats and a row is
+ * contiguous. Travel times are distances times a speed, one multiply away
+ * from the matrix, so they are not stored a second time.
+ *
+ * Read-only once built: agents query it without any lock.
+ */
+class SiteMap
+{
+public:
+    /**
+     * @brief Computes the distance matrix.
+     *
+     * @param _points Position of each site, in kilometres.
+     */
+    explicit SiteMap(const std::vector<SitePoint>& _points);
+
+    /**
+     * @brief Number of sites, depot included if it was given.
+     */
+    size_t nbSites() const
+    {
+        return points.size();
+    }
+
+    /**
+     * @brief Position of a site, in kilometres.
+     */
+    const SitePoint& position(size_t site) const
+    {
+        return points[site];
+    }
+
+    /**
+     * @brief Positions of all the sites.
+     */
+    const std::vector<SitePoint>& positions() const
+    {
+        return points;
+    }
+
+    /**
+     * @brief Distance between two sites, in kilometres.
+     */
+    float distance(size_t from, size_t to) const
+    {
+        if (from == to)
+        {
+            return 0;
+        }
+        size_t row = from > to ? from : to;
+        size_t col = from > to ? to : from;
+        return packed[row * (row - 1) / 2 + col];
+    }
+
+    /**
+     * @brief Riding time between two sites, in milliseconds.
+     */
+    unsigned int bikeMs(size_t from, size_t to) const
+    {
+        return unsigned(distance(from, to) * BIKE_MS_PER_KM);
+    }
+
+    /**
+     * @brief Walking time between two sites, in milliseconds.
+     */
+    unsigned int walkMs(size_t from, size_t to) const
+    {
+        return unsigned(distance(from, to) * WALK_MS_PER_KM);
+    }
+
+    /**
+     * @brief Driving time of the van between two sites, in milliseconds.
+     */
+    unsigned int driveMs(size_t from, size_t to) const
+    {
+        return unsigned(distance(from, to) * VAN_MS_PER_KM);
+    }
+
+    /**
+     * @brief Visiting order of sites 0..nbSites-1 by nearest neighbour.
+     *
+     * Greedy, good enough for a van round of a few dozen sites.
+     *
+     * @param start Site the tour leaves from, e.g. the depot.
+     * @param nbSites Sites to visit, those from @p nbSites on are skipped.
+     * @return Every site below @p nbSites but @p start, once each.
+     */
+    std::vector<unsigned int> tour(unsigned int start, size_t nbSites) const;
+
+    /**
+     * @brief Varies a travel time by up to 20% either way, so that agents
+     * on the same leg do not move in lockstep.
+     *
+     * @param ms Travel time from the matrix.
+     * @param rng Random stream of the agent.
+     */
+    template <class Rng>
+    static unsigned int jittered(unsigned int ms, Rng& rng)
+    {
+        std::uniform_real_distribution<double> dist(0.8, 1.2);
+        return unsigned(ms * dist(rng));
+    }
+
+private:
+    std::vector<SitePoint> points;
+    std::vector<float> packed; /**< Lower triangle, row by row, diagonal excluded. */
+};
+
+#endif // SITEMAP_H
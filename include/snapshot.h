@@ -0,0 +1,120 @@
+/*
+    * snapshot.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bike.h"
+#include "config.h"
+
+class SimContext;
+
+/**
+ * @brief Saved state of a person.
+ */
+struct RiderState
+{
+    uint32_t id;
+    uint8_t preferredType;
+    uint8_t phase;         /**< A @ref RiderPhase, the one the person was in. */
+    uint16_t site;         /**< Current site. */
+    uint16_t destination;  /**< Destination of the ongoing ride or walk. */
+    uint16_t reserved;
+    uint32_t remainingMs;  /**< Time left in the ongoing ride or walk. */
+    uint64_t rngSeed;
+    uint64_t rngDraws;
+};
+
+/**
+ * @brief Saved state of a van. The cargo is given by the bikes.
+ */
+struct VanState
+{
+    uint32_t id;
+    uint16_t site;
+    uint16_t reserved;
+    uint64_t rngSeed;
+    uint64_t rngDraws;
+};
+
+/**
+ * @brief Where a bike is in a snapshot.
+ */
+enum BikeHolder : uint8_t
+{
+    HeldByStation,
+    HeldByRider,
+    HeldByVan
+};
+
+/**
+ * @brief Saved state of a bike.
+ *
+ * Bikes of a station are listed in the order they are stored, so that the
+ * stations are rebuilt with the same FIFO order per type.
+ */
+struct BikeState
+{
+    uint8_t type;
+    uint8_t holder;   /**< A @ref BikeHolder. */
+    uint16_t reserved;
+    uint32_t index;   /**< Station site, or index of the rider or van. */
+};
+
+/**
+ * @brief Complete state of a simulation, saved to and restored from a file.
+ *
+ * The file is a fixed header followed by the arrays of bikes, riders and
+ * vans, written and read back with a single call each.
+ */
+class Snapshot
+{
+public:
+    /**
+     * @brief Captures the state of a stopped simulation.
+     *
+     * All agent threads must have been joined. Bikes added while running
+     * (depot buttons) are captured too.
+     *
+     * @param context Simulation to capture.
+     */
+    static Snapshot capture(const SimContext& context);
+
+    /**
+     * @brief Rebuilds the simulation from the snapshot.
+     *
+     * Fills the empty stations of @p context and creates the bikes in one
+     * allocation, the people and the vans. Called by SimContext::restore().
+     *
+     * @return false if the bikes do not fit in the stations.
+     */
+    bool restore(SimContext& context) const;
+
+    /**
+     * @brief Writes the snapshot to a file.
+     *
+     * @return false on I/O error.
+     */
+    bool save(const std::string& path) const;
+
+    /**
+     * @brief Reads a snapshot written by save().
+     *
+     * @return false on I/O error, if the snapshot does not match this
+     *         build (number of sites, bike types) or if a site, phase or
+     *         type in it is out of range.
+     */
+    bool load(const std::string& path);
+
+    std::vector<BikeState> bikes;
+    std::vector<RiderState> riders;
+    std::vector<VanState> vans;
+};
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,162 @@
+/*
+    * spinfutex.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef SPINFUTEX_H
+#define SPINFUTEX_H
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @brief Mutex that spins briefly before sleeping on a futex.
+ *
+ * The word is 0 when free, 1 when held and 2 when held with possible
+ * sleepers, so that an uncontended lock() and unlock() are a single atomic
+ * instruction each and unlock() only enters the kernel if somebody sleeps.
+ *
+ * A contended lock() first spins on a read of the word with an exponential
+ * backoff of pause instructions, for a number of rounds that adapts to the
+ * mutex: it moves towards the rounds that led to the lock, and is halved
+ * whenever spinning did not pay. It does not spin at all on a single CPU,
+ * where the holder cannot release the lock meanwhile.
+ */
+class SpinFutexMutex
+{
+public:
+    void lock()
+    {
+        uint32_t expected = 0;
+        if (!word.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            lockContended();
+        }
+    }
+
+    void unlock()
+    {
+        if (word.exchange(0, std::memory_order_release) == 2)
+        {
+            wake();
+        }
+    }
+
+private:
+    friend class FutexConditionVariable;
+
+    void lockContended();
+    void wake();
+
+    std::atomic<uint32_t> word{0};
+    std::atomic<uint32_t> spinBudget{64}; /**< Pause instructions a contended lock() spins for. */
+};
+
+/**
+ * @brief Condition variable on a futex, for @ref SpinFutexMutex.
+ *
+ * A waiter sleeps on a sequence number that every notification bumps, so
+ * that a notification between the release of the mutex and the sleep is
+ * never lost. The notifications must be made with the mutex held, as
+ * BikeStation does; they skip the system call when nobody waits.
+ */
+class FutexConditionVariable
+{
+public:
+    void wait(SpinFutexMutex *mutex);
+    void notifyOne();
+    void notifyAll();
+
+private:
+    std::atomic<uint32_t> sequence{0};
+    std::atomic<uint32_t> waiters{0};
+};
+
+/**
+ * @brief Lets threads sleep until a lock-free condition may have changed.
+ *
+ * A waiter calls prepareWait(), checks its condition again, then either
+ * gives up with cancelWait() or sleeps with wait(). A notifier makes the
+ * condition true first, then calls notify(), which only enters the kernel
+ * if somebody waits. A notification after prepareWait() is never lost:
+ * wait() then returns at once.
+ */
+class FutexEventCount
+{
+public:
+    /**
+     * @brief Registers the calling thread as a waiter.
+     *
+     * @return Key to give to wait().
+     */
+    uint32_t prepareWait()
+    {
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        return sequence.load(std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief Unregisters a waiter that does not sleep after all.
+     */
+    void cancelWait()
+    {
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Sleeps until a notification after prepareWait(), then
+     * unregisters the waiter.
+     *
+     * May also return spuriously.
+     *
+     * @param key Result of prepareWait().
+     * @param deadlineNs Latest time to sleep until (see nowNs()), 0 for none.
+     */
+    void wait(uint32_t key, uint64_t deadlineNs = 0);
+
+    /**
+     * @brief Wakes up to @p count waiters.
+     */
+    void notify(int count)
+    {
+        sequence.fetch_add(1, std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_seq_cst))
+        {
+            wake(count);
+        }
+    }
+
+    /**
+     * @brief Wakes every waiter.
+     */
+    void notifyAll();
+
+private:
+    void wake(int count);
+
+    std::atomic<uint32_t> sequence{0};
+    std::atomic<uint32_t> waiters{0};
+};
+
+/**
+ * @brief Sleeps while a word holds a value, see futex(2).
+ *
+ * @param word Word to watch.
+ * @param expected Value to sleep on; returns at once if the word differs.
+ * @param timeoutNs Longest sleep, 0 for none.
+ */
+void futexWait(std::atomic<uint32_t> *word, uint32_t expected, uint64_t timeoutNs = 0);
+
+/**
+ * @brief Wakes up to @p count threads sleeping on a word.
+ */
+void futexWake(std::atomic<uint32_t> *word, int count);
+
+/**
+ * @brief Spin-futex locks have no profile to label.
+ */
+inline void labelLock(SpinFutexMutex&, unsigned int)
+{
+}
+
+#endif // SPINFUTEX_H
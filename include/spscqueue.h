@@ -0,0 +1,101 @@
+/*
+    * spscqueue.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/**
+ * @brief Bounded queue between exactly one producer thread and one
+ * consumer thread, without any lock.
+ *
+ * A ring of a power-of-two size. The producer only writes the tail and
+ * the consumer only writes the head, each on its own cache line; each
+ * side keeps a private copy of the other side's index and reloads it only
+ * when the ring looks full (or empty), so an uncontended push or pop
+ * touches a single shared line.
+ *
+ * @tparam T Trivially copyable element.
+ */
+template <class T>
+class SpscQueue
+{
+public:
+    /**
+     * @brief Creates an empty queue.
+     *
+     * @param minCapacity Rounded up to a power of two.
+     */
+    explicit SpscQueue(size_t minCapacity)
+    {
+        size_t capacity = 1;
+        while (capacity < minCapacity)
+        {
+            capacity *= 2;
+        }
+        mask = capacity - 1;
+        ring.reset(new T[capacity]);
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /**
+     * @brief Appends an element, from the producer thread only.
+     *
+     * @return false if the queue is full.
+     */
+    bool push(const T& value)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - headCache > mask)
+        {
+            headCache = head.load(std::memory_order_acquire);
+            if (t - headCache > mask)
+            {
+                return false;
+            }
+        }
+        ring[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Removes the oldest element, from the consumer thread only.
+     *
+     * @return false if the queue is empty.
+     */
+    bool pop(T& value)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tailCache)
+        {
+            tailCache = tail.load(std::memory_order_acquire);
+            if (h == tailCache)
+            {
+                return false;
+            }
+        }
+        value = ring[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::unique_ptr<T[]> ring;
+    size_t mask;
+
+    alignas(64) std::atomic<size_t> tail{0}; /**< Written by the producer. */
+    size_t headCache = 0;                    /**< Producer's copy of @ref head. */
+
+    alignas(64) std::atomic<size_t> head{0}; /**< Written by the consumer. */
+    size_t tailCache = 0;                    /**< Consumer's copy of @ref tail. */
+};
+
+#endif // SPSCQUEUE_H
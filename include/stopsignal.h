@@ -0,0 +1,66 @@
+/*
+    * stopsignal.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef STOPSIGNAL_H
+#define STOPSIGNAL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * @brief Stop request shared by every agent of a simulation, which also
+ * cuts their timed delays short.
+ *
+ * Agents sleep through sleepUntil() instead of usleep() or QTest::qSleep(),
+ * so raising the signal wakes all of them at once: a stop takes as long as
+ * the slowest station operation, not as long as the longest trip. Checking
+ * the signal without sleeping is a relaxed atomic load.
+ *
+ * PcoConditionVariable only has waits of whole seconds, hence the standard
+ * condition variable here.
+ */
+class StopSignal
+{
+public:
+    /**
+     * @brief Raises the signal and wakes every sleeper.
+     *
+     * Can be called from any thread, several times.
+     */
+    void raise();
+
+    /**
+     * @brief Whether the signal is raised.
+     */
+    bool raised() const
+    {
+        return isRaised.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Sleeps until a given time unless the signal is raised first.
+     *
+     * @param dueNs Time to wake up at (see nowNs()).
+     * @return false if the signal is raised.
+     */
+    bool sleepUntil(uint64_t dueNs);
+
+    /**
+     * @brief Sleeps for a given duration unless the signal is raised first.
+     *
+     * @param durationNs Time to sleep, in nanoseconds.
+     * @return false if the signal is raised.
+     */
+    bool sleepFor(uint64_t durationNs);
+
+private:
+    std::atomic<bool> isRaised{false};
+    std::mutex mutex;
+    std::condition_variable raisedChanged;
+};
+
+#endif // STOPSIGNAL_H
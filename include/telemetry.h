@@ -0,0 +1,220 @@
+/*
+    * telemetry.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "bike.h"
+#include "config.h"
+
+class SimContext;
+
+/**
+ * @brief First word of a telemetry region, "PCBT".
+ */
+const uint32_t TELEMETRY_MAGIC = 0x54424350;
+
+/**
+ * @brief Version of the layout below, bumped on any change to it.
+ */
+const uint32_t TELEMETRY_VERSION = 1;
+
+/**
+ * @brief Size of a page of the region; each page has its own sequence.
+ */
+const size_t TELEMETRY_PAGE_SIZE = 4096;
+
+/**
+ * @brief Vans described in the region, the others are left out.
+ */
+const size_t TELEMETRY_MAX_VANS = 64;
+
+/**
+ * @brief Period of the publication, in microseconds.
+ */
+const unsigned int TELEMETRY_PERIOD_US = 10000;
+
+/**
+ * @brief Published state of a station or of the depot.
+ */
+struct TelemetryStation
+{
+    uint32_t bikes[Bike::nbBikeTypes]; /**< Bikes of each type. */
+    uint32_t total;                    /**< Sum of @ref bikes. */
+    uint32_t capacity;
+    uint32_t bikeWaiters;              /**< Riders waiting for a bike. */
+    uint32_t dockWaiters;              /**< Riders waiting for a free dock. */
+};
+
+/**
+ * @brief Published state of a van.
+ */
+struct TelemetryVan
+{
+    uint32_t site;   /**< Last site reached, DEPOT_ID for the depot. */
+    uint32_t cargo;
+    uint64_t rounds; /**< Rounds completed by this van. */
+};
+
+/**
+ * @brief Global counters, page 1 of the region.
+ */
+struct TelemetryCounters
+{
+    uint64_t sample;          /**< Publications so far. */
+    uint64_t elapsedNs;       /**< Since the start of the simulation. */
+    uint64_t tripsCompleted;
+    int64_t bikesInTransit;
+    uint64_t vanRounds;       /**< Sum over every van. */
+    uint32_t nbVans;          /**< Entries of @ref vans in use. */
+    uint32_t stalls;          /**< Riders blocked beyond the stall threshold so far. */
+    TelemetryVan vans[TELEMETRY_MAX_VANS];
+};
+
+/**
+ * @brief Stations then depot, page 2 of the region.
+ */
+struct TelemetryStations
+{
+    TelemetryStation stations[NB_SITES_TOTAL];
+};
+
+/**
+ * @brief Page of data protected by a sequence lock.
+ *
+ * One writer, any number of readers in any process, no lock on either
+ * side: the writer makes the sequence odd, copies the data and makes it
+ * even again; a reader copies the data and keeps its copy only if the
+ * sequence was even and unchanged around the copy.
+ */
+template <class T>
+struct alignas(TELEMETRY_PAGE_SIZE) TelemetryPage
+{
+    std::atomic<uint64_t> sequence;
+    T data;
+
+    /**
+     * @brief Replaces the data, from the only writer.
+     */
+    void write(const T& value)
+    {
+        uint64_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(&data, &value, sizeof(T));
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    /**
+     * @brief Copies the data, retrying while the writer is busy.
+     *
+     * @param value Receives a consistent copy.
+     * @param attempts Copies tried before giving up.
+     * @return false if every attempt overlapped a write.
+     */
+    bool read(T& value, int attempts = 100) const
+    {
+        for (int i = 0; i < attempts; ++i)
+        {
+            uint64_t before = sequence.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                continue;
+            }
+            std::memcpy(&value, &data, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/**
+ * @brief Page 0: what a reader checks before trusting the other pages.
+ */
+struct alignas(TELEMETRY_PAGE_SIZE) TelemetryHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t regionSize;    /**< sizeof(TelemetryRegion) of the writer. */
+    uint32_t nbSites;       /**< Entries of TelemetryStations, depot included. */
+    uint32_t nbBikeTypes;
+    uint32_t maxVans;
+    uint64_t pid;           /**< Process of the simulation. */
+    std::atomic<uint32_t> running; /**< Cleared when the simulation has stopped. */
+};
+
+/**
+ * @brief Whole telemetry region, as mapped from /dev/shm.
+ */
+struct TelemetryRegion
+{
+    TelemetryHeader header;
+    TelemetryPage<TelemetryCounters> counters;
+    TelemetryPage<TelemetryStations> stations;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "sequences must be usable across processes");
+static_assert(sizeof(TelemetryStations) + 64 <= TELEMETRY_PAGE_SIZE, "stations must fit in one page");
+
+/**
+ * @brief Path of a region from its name.
+ *
+ * @param name Name under /dev/shm, or a path if it contains a '/'.
+ */
+inline std::string telemetryPath(const std::string& name)
+{
+    return name.find('/') == std::string::npos ? "/dev/shm/" + name : name;
+}
+
+/**
+ * @brief Publishes the state of a running simulation into a memory-mapped
+ * file, for pco_biking_top.
+ *
+ * The region is created and mapped once; publish() then only reads
+ * counters the simulation already keeps lock-free and copies them into
+ * the pages. The simulation itself never waits for a reader, nor makes
+ * any system call for them. The file is left in place after the run,
+ * marked as stopped, and replaced by the next run with the same name.
+ */
+class Telemetry
+{
+public:
+    ~Telemetry();
+
+    /**
+     * @brief Creates or replaces the region.
+     *
+     * @param name Name under /dev/shm, or a path.
+     * @return false, with a message on stderr, if it cannot be mapped.
+     */
+    bool open(const std::string& name);
+
+    /**
+     * @brief Writes the current state of a simulation into the region.
+     *
+     * Called from a single thread, see SimContext::start().
+     */
+    void publish(const SimContext& context);
+
+    /**
+     * @brief Marks the simulation as stopped for the readers.
+     */
+    void markStopped();
+
+private:
+    TelemetryRegion *region = nullptr;
+    uint64_t samples = 0;
+};
+
+#endif // TELEMETRY_H
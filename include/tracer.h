@@ -0,0 +1,124 @@
+/*
+    * tracer.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "simstats.h"
+
+/**
+ * @brief Optional recorder of simulation activity in Chrome trace format.
+ *
+ * Events go to an arena reserved once by enable(), for a budget shared by
+ * all the threads. Each thread takes a chunk of it when it records its
+ * first event and another one whenever its chunk is full, so a thread
+ * costs memory only for the events it records, and an idle rider almost
+ * nothing. Recording is a few stores, plus an atomic increment per chunk;
+ * it never takes a lock nor touches the disk. Once the budget is used up,
+ * further events are counted and dropped. The file is written once by
+ * writeAndDisable(), usually from stopSimulation(), and can be opened in
+ * chrome://tracing or ui.perfetto.dev.
+ */
+class Tracer
+{
+public:
+    /**
+     * @brief Enables recording.
+     *
+     * @param path File written by writeAndDisable().
+     * @param maxEvents Events recorded by all the threads together, 32 bytes
+     *        each; the memory is only touched as events are recorded.
+     */
+    static void enable(const std::string& path, size_t maxEvents = 1 << 21);
+
+    /**
+     * @brief Tells whether events are currently recorded.
+     */
+    static bool enabled()
+    {
+        return isEnabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Names the calling thread in the trace (e.g. "Person 3").
+     *
+     * @param name Thread name.
+     */
+    static void setThreadName(const std::string& name);
+
+    /**
+     * @brief Records a complete span of the calling thread.
+     *
+     * @param name Event name, must be a string literal.
+     * @param startNs Start timestamp (see nowNs()).
+     * @param endNs End timestamp.
+     * @param site Site concerned by the event, -1 if none.
+     * @param value Additional value (bike type, number of bikes...), -1 if none.
+     */
+    static void record(const char *name, uint64_t startNs, uint64_t endNs,
+                       int32_t site = -1, int32_t value = -1);
+
+    /**
+     * @brief Stops recording and writes the trace file.
+     *
+     * Events still being recorded by other threads are either fully
+     * written or ignored. Does nothing if recording was not enabled.
+     */
+    static void writeAndDisable();
+
+private:
+    static std::atomic<bool> isEnabled;
+};
+
+/**
+ * @brief Records the lifetime of a scope as a trace span.
+ *
+ * Costs a single relaxed load when tracing is disabled.
+ */
+class TraceSpan
+{
+public:
+    /**
+     * @param _name Event name, must be a string literal.
+     * @param _site Site concerned by the event, -1 if none.
+     * @param _value Additional value, -1 if none.
+     */
+    TraceSpan(const char *_name, int32_t _site = -1, int32_t _value = -1)
+        : name(_name), site(_site), value(_value),
+          start(Tracer::enabled() ? nowNs() : 0)
+    {
+    }
+
+    ~TraceSpan()
+    {
+        if (start)
+        {
+            Tracer::record(name, start, nowNs(), site, value);
+        }
+    }
+
+    /**
+     * @brief Updates the value reported when the span ends.
+     */
+    void setValue(int32_t _value)
+    {
+        value = _value;
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char *name;
+    int32_t site;
+    int32_t value;
+    uint64_t start;
+};
+
+#endif // TRACER_H
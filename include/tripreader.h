@@ -0,0 +1,111 @@
+/*
+    * tripreader.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef TRIPREADER_H
+#define TRIPREADER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "pcosynchro/pcomutex.h"
+#include "simstats.h"
+
+/**
+ * @brief One recorded trip.
+ */
+struct Trip
+{
+    double timeS = 0;        /**< Departure, in seconds since the beginning of the data. */
+    unsigned int origin = 0;
+    unsigned int destination = 0;
+    size_t bikeType = 0;
+    double durationS = -1;   /**< Ride duration, negative if not recorded. */
+};
+
+/**
+ * @brief Streams recorded trips from a file, in departure order.
+ *
+ * The file is a text file with one trip per line:
+ * @code
+ * time_s,origin,destination,bike_type[,duration_s]
+ * @endcode
+ * Lines that do not parse (header, comments) or that refer to unknown sites
+ * or bike types are skipped. Times must be non-decreasing.
+ *
+ * The file is memory-mapped and parsed on demand; pages already consumed
+ * are dropped, so arbitrarily large files replay in constant memory.
+ * next() can be called by any number of riders.
+ */
+class TripReader
+{
+public:
+    TripReader() = default;
+    ~TripReader();
+
+    /**
+     * @brief Maps the trip file.
+     *
+     * @param path Trip file.
+     * @param _speed Replay speed, in seconds of data per second of simulation.
+     * @return false if the file cannot be opened.
+     */
+    bool open(const std::string& path, double _speed);
+
+    /**
+     * @brief Reads the next trip and starts the replay clock on first call.
+     *
+     * @param trip Receives the trip.
+     * @return false once every trip has been handed out.
+     */
+    bool next(Trip& trip);
+
+    /**
+     * @brief Time at which a trip is due on the replay clock.
+     *
+     * @return Timestamp comparable with nowNs().
+     */
+    uint64_t dueNs(const Trip& trip) const;
+
+    /**
+     * @brief Converts a duration of the data to simulation time.
+     */
+    uint64_t scaledNs(double seconds) const;
+
+    /**
+     * @brief Records how late a trip departed compared to the data.
+     *
+     * The delay covers both the wait for a free rider and the wait for a
+     * bike of the requested type.
+     *
+     * @param lateNs Departure delay, in simulation nanoseconds.
+     */
+    void recordDelay(uint64_t lateNs);
+
+    /**
+     * @brief Prints the number of trips replayed and their delays.
+     *
+     * @param file Output stream.
+     */
+    void printReport(FILE *file) const;
+
+private:
+    bool parseLine(const char *begin, const char *end, Trip& trip) const;
+
+    PcoMutex mutex;
+    int fd = -1;
+    const char *data = nullptr;
+    size_t size = 0;
+    size_t offset = 0;       /**< Start of the next unread line. */
+    size_t released = 0;     /**< Pages before this offset were dropped. */
+    double speed = 1;
+    double firstTimeS = -1;  /**< Time of the first trip, origin of the data. */
+    uint64_t startNs = 0;    /**< Replay clock origin. */
+    uint64_t tripsRead = 0;
+    uint64_t linesSkipped = 0;
+    Histogram delaysUs;      /**< Departure delays, in microseconds of simulation. */
+};
+
+#endif // TRIPREADER_H
@@ -8,19 +8,21 @@
 
 #include <vector>
 #include <array>
+#include <atomic>
 #include "config.h"
 #include "bikestation.h"
+#include "simcontext.h"
+#include "snapshot.h"
 #include "bikinginterface.h"
 #include "pcosynchro/pcothread.h"
 
-#define VAN_DEPOT_WAITIME 1000000 // microseconds to wait at depot
-
 /**
  * @brief Simulates the van that rebalances bikes between sites and the depot.
  *
  * The van regularly:
  *  - loads bikes at the depot,
- *  - drives to each site to remove surplus bikes or drop missing ones,
+ *  - drives to each site, nearest first (see SimContext::vanRoute), to
+ *    remove surplus bikes or drop missing ones,
  *  - returns to the depot with remaining bikes.
  */
 class Van
@@ -31,9 +33,19 @@ public:
      *
      * The van starts at the depot site.
      *
+     * @param _context Simulation the van belongs to.
      * @param _id Identifier of the van (for logging and UI).
      */
-    Van(unsigned int _id);
+    Van(SimContext* _context, unsigned int _id);
+
+    /**
+     * @brief Recreates a van saved in a snapshot.
+     *
+     * @param _context Simulation the van belongs to.
+     * @param _state Saved state.
+     * @param _cargo Bikes the van was carrying.
+     */
+    Van(SimContext* _context, const VanState& _state, const std::vector<Bike*>& _cargo);
 
     /**
      * @brief Main loop of the van.
@@ -47,18 +59,43 @@ public:
     void run();
 
     /**
-     * @brief Sets the user interface used to display van actions.
+     * @brief Number of bikes currently in the van.
+     *
+     * Safe to call from any thread; used by invariant checkers.
+     *
+     * @return Published cargo size.
+     */
+    size_t cargoCount() const;
+
+    /**
+     * @brief Last site reached by the van, @ref DEPOT_ID for the depot.
+     *
+     * Safe to call from any thread, for monitoring.
+     */
+    unsigned int site() const;
+
+    /**
+     * @brief Rounds completed by this van since it was created.
      *
-     * @param _binkingInterface Pointer to the interface implementation.
+     * Safe to call from any thread, for monitoring.
      */
-    static void setInterface(BikingInterface* _binkingInterface);
+    uint64_t roundCount() const;
 
     /**
-     * @brief Sets the array of bike stations used by the van.
+     * @brief Bikes currently in the van.
      *
-     * @param _stations Array of pointers to all stations (sites + depot).
+     * Must only be called once the van thread has stopped.
+     *
+     * @return The cargo.
      */
-    static void setStations(const std::array<BikeStation*, NB_SITES_TOTAL>& _stations);
+    const std::vector<Bike*>& cargoBikes() const;
+
+    /**
+     * @brief Returns the state of the van for a snapshot.
+     *
+     * Must only be called once the van thread has been joined.
+     */
+    VanState state() const;
 
 private:
     /**
@@ -71,6 +108,7 @@ private:
     /**
      * @brief Simulates driving the van from the current site to a destination site.
      *
+     * The drive takes the time of the site map, varied at random.
      * Notifies the user interface and updates @ref currentSite.
      *
      * @param _dest Destination site index.
@@ -80,8 +118,9 @@ private:
     /**
      * @brief Loads bikes from the depot into the van.
      *
-     * Clears the current cargo, drives to the depot if necessary,
-     * and takes a limited number of bikes from the depot station.
+     * Drives to the depot if necessary and takes a limited number of bikes
+     * from the depot station. Bikes that could not be unloaded at the end
+     * of the previous round stay in the cargo.
      */
     void loadAtDepot();
 
@@ -113,6 +152,11 @@ private:
      */
     Bike* takeBikeFromCargo(size_t type);
 
+    /**
+     * @brief Publishes the cargo size after a change of @ref cargo.
+     */
+    void publishCargo();
+
     /**
      * @brief Identifier of the van.
      */
@@ -131,14 +175,29 @@ private:
     std::vector<Bike*> cargo;
 
     /**
-     * @brief User interface shared by all vans (may be null).
+     * @brief Copy of cargo.size(), readable from other threads.
+     */
+    std::atomic<size_t> cargoSize{0};
+
+    /**
+     * @brief Random stream of the van (travel times).
+     */
+    SimRng rng;
+
+    /**
+     * @brief Simulation the van belongs to.
+     */
+    SimContext* context;
+
+    /**
+     * @brief Copy of @ref currentSite, readable from other threads.
      */
-    static BikingInterface* binkingInterface;
+    std::atomic<unsigned int> siteReached;
 
     /**
-     * @brief Shared array of bike stations for all sites and the depot.
+     * @brief Rounds completed, readable from other threads.
      */
-    static std::array<BikeStation*, NB_SITES_TOTAL> stations;
+    std::atomic<uint64_t> rounds{0};
 };
 
 #endif // VAN_H
@@ -0,0 +1,132 @@
+/*
+    * watchdog.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+class SimContext;
+
+/**
+ * @brief What a blocked agent waits for.
+ */
+enum WaitResource : uint8_t
+{
+    WaitNothing = 0,
+    WaitForBike = 1, /**< A bike of a given type, in getBike(). */
+    WaitForDock = 2  /**< A free dock, in putBike(). */
+};
+
+/**
+ * @brief Notices riders blocked in a station for too long and dumps who
+ * waits for what.
+ *
+ * Each rider thread attaches to a slot of the watchdog of its context.
+ * Stations mark the slot of the calling thread around their waits through
+ * @ref BlockedWait, which costs a clock read and two relaxed stores, and
+ * nothing for threads without a slot. A periodic scan reads the slots without taking
+ * any lock: a wait older than the threshold is a stall, counted once per
+ * wait. It is a stuck wait, probably a lost wake-up, if the station could
+ * serve the rider at two scans in a row.
+ *
+ * Every scan finding new stalls writes a wait-for snapshot: the overdue
+ * riders, with the resource, the site and the type they wait for, and the
+ * state of the stations they wait at. The station counters are read
+ * without their lock, so the snapshot may be slightly torn.
+ */
+class StallWatchdog
+{
+public:
+    /**
+     * @brief Allocates the slots, before the agent threads start.
+     *
+     * @param nbAgents Threads that may attach.
+     */
+    void reset(size_t nbAgents);
+
+    /**
+     * @brief Gives the calling thread a slot, if one is left.
+     *
+     * @param riderId Identifier shown in the snapshots.
+     */
+    void attach(unsigned int riderId);
+
+    /**
+     * @brief Looks for new stalls and writes a snapshot if there are some.
+     *
+     * Only called by one thread at a time.
+     *
+     * @param context Simulation the stations belong to.
+     * @param thresholdNs Wait after which a rider is stalled.
+     * @param out Where the snapshot goes.
+     * @return Number of new stalls.
+     */
+    size_t scan(const SimContext& context, uint64_t thresholdNs, FILE *out);
+
+    /**
+     * @brief Waits that exceeded the threshold so far.
+     */
+    uint64_t nbStalls() const
+    {
+        return stalls.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Stalls during which the station could serve the rider.
+     */
+    uint64_t nbStuck() const
+    {
+        return stuck.load(std::memory_order_relaxed);
+    }
+
+private:
+    friend class BlockedWait;
+
+    struct Slot
+    {
+        std::atomic<uint64_t> sinceNs{0}; /**< Start of the ongoing wait, 0 if none. */
+        std::atomic<uint32_t> what{0};    /**< Resource, type and site, see encode(). */
+        unsigned int rider = 0;
+        uint64_t reportedSince = 0;       /**< Wait already counted as a stall, scanner only. */
+        uint64_t servableSince = 0;       /**< Wait seen servable at the last scan, scanner only. */
+        uint64_t stuckSince = 0;          /**< Wait already counted as stuck, scanner only. */
+    };
+
+    static uint32_t encode(WaitResource resource, unsigned int site, size_t type)
+    {
+        return uint32_t(resource) << 24 | uint32_t(type) << 16 | (site & 0xffff);
+    }
+
+    static thread_local Slot *localSlot; /**< Slot of the calling thread, null if none. */
+
+    std::unique_ptr<Slot[]> entries;
+    size_t nbSlots = 0;
+    std::atomic<size_t> attached{0};
+    std::atomic<uint64_t> stalls{0};
+    std::atomic<uint64_t> stuck{0};
+};
+
+/**
+ * @brief Marks the calling thread as blocked on a station for the lifetime
+ * of a scope, see StallWatchdog.
+ */
+class BlockedWait
+{
+public:
+    BlockedWait(WaitResource resource, unsigned int site, size_t type);
+    ~BlockedWait();
+
+    BlockedWait(const BlockedWait&) = delete;
+    BlockedWait& operator=(const BlockedWait&) = delete;
+
+private:
+    StallWatchdog::Slot *slot;
+};
+
+#endif // WATCHDOG_H
@@ -0,0 +1,109 @@
+/*
+    * workload.h
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <string>
+#include <vector>
+
+#include "config.h"
+
+/**
+ * @brief Load applied from a given time until the next phase of a profile.
+ */
+struct WorkloadPhase
+{
+    double startS = 0;           /**< Start, in seconds since the beginning of the period. */
+    double active = 1;           /**< Share of the riders cycling, the others idle. */
+    unsigned int minTravelMs = 500;  /**< Travel range, as randomTravelTimeMs(); see WorkloadProfile::travelScale(). */
+    unsigned int maxTravelMs = 2000;
+    int hotSite = -1;            /**< Site attracting or repelling trips, -1 for none. */
+    double hotShare = 0;         /**< Probability that a trip ends at @ref hotSite. */
+};
+
+/**
+ * @brief Time-varying load of the riders: active riders, destination skew
+ * and travel times, as a repeating sequence of phases.
+ *
+ * A profile is built once, then only read: riders look up the current
+ * phase without any lock. Profiles are either built in (see names()) or
+ * read from a text file with one phase per line:
+ * @code
+ * # morning rush towards site 0, repeated every 120 s
+ * period=120
+ * at=0  active=0.2 travel=1000-3000
+ * at=20 active=1   travel=500-1500 hot=0 share=0.6
+ * @endcode
+ * Omitted keys take the values of @ref WorkloadPhase. Times are in seconds
+ * of the profile; the replay speed compresses them.
+ */
+class WorkloadProfile
+{
+public:
+    /**
+     * @brief Loads a built-in profile or a profile file.
+     *
+     * @param nameOrPath Name of a built-in profile, or path of a file.
+     * @param speed Profile seconds per second of simulation.
+     * @return false if the name is unknown and the file cannot be parsed.
+     */
+    bool load(const std::string& nameOrPath, double speed = 1);
+
+    /**
+     * @brief Names of the built-in profiles.
+     */
+    static std::vector<std::string> names();
+
+    /**
+     * @brief Phase in force at a given time.
+     *
+     * @param elapsedS Seconds since the beginning of the simulation.
+     */
+    const WorkloadPhase& at(double elapsedS) const;
+
+    /**
+     * @brief Chooses the destination of a trip under a phase.
+     *
+     * @param phase Phase in force.
+     * @param from Origin site, never chosen.
+     * @param rng Random stream of the rider.
+     */
+    static unsigned int destination(const WorkloadPhase& phase, unsigned int from, SimRng& rng);
+
+    /**
+     * @brief Factor applied to the travel times of the site map under a phase.
+     *
+     * The middle of the travel range of the phase over the middle of the
+     * default range: 1 for travel=500-2000, 2 for travel=1000-4000.
+     */
+    static double travelScale(const WorkloadPhase& phase);
+
+    /**
+     * @brief Name of the built-in profile or path of the file.
+     */
+    const std::string& name() const
+    {
+        return profileName;
+    }
+
+    /**
+     * @brief Profile seconds per second of simulation, as given to load().
+     */
+    double speed() const
+    {
+        return timeSpeed;
+    }
+
+private:
+    bool parse(const std::string& text);
+
+    std::string profileName;
+    double timeSpeed = 1;
+    double periodS = 0;                 /**< Length of the cycle of phases, in simulation seconds. */
+    std::vector<WorkloadPhase> phases;  /**< Sorted by start, the first one starts at 0. */
+};
+
+#endif // WORKLOAD_H
@@ -14,4 +14,4 @@ echo "The following files are archived in $ARCHIVE :"
 tar -czvf "$ARCHIVE" \
     CMakeLists.txt \
     "$REPORT_FILE" \
-    $(find src include -name "*.cpp" -o -name "*.h")
+    $(find src include tools -name "*.cpp" -o -name "*.h")
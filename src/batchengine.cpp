@@ -0,0 +1,225 @@
+/*
+    * batchengine.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "batchengine.h"
+
+#include <algorithm>
+
+namespace {
+
+// splitmix64 step, branch-free so that the batch loop can be vectorised
+inline uint64_t mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform value in [0, n) from 32 random bits
+inline uint32_t below(uint32_t bits, uint32_t n)
+{
+    return uint32_t((uint64_t(bits) * n) >> 32);
+}
+
+const uint64_t golden = 0x9e3779b97f4a7c15ULL;
+
+}
+
+BatchEngine::BatchEngine(const BatchConfig& _config)
+    : config(_config),
+      siteMap(config.geographic ? diskLayout(config.nbSites, config.seed) : std::vector<SitePoint>()),
+      site(config.nbRiders),
+      phase(config.nbRiders, Walk),
+      type(config.nbRiders),
+      eventMs(config.nbRiders),
+      cycleStartMs(config.nbRiders),
+      rngState(config.nbRiders),
+      drawnSite(config.nbRiders),
+      drawnMs(config.nbRiders),
+      nextWaiter(config.nbRiders, noRider),
+      stock(config.nbSites * Bike::nbBikeTypes),
+      total(config.nbSites),
+      bikeWaiters(config.nbSites * Bike::nbBikeTypes),
+      dockWaiters(config.nbSites),
+      wheel(wheelSize)
+{
+    // Same initial fill as the threaded simulation, without depot
+    size_t perSite = config.slotsPerSite - 2;
+    bikeTotal = std::min(config.nbBikes, config.nbSites * perSite);
+    for (size_t b = 0; b < bikeTotal; ++b)
+    {
+        size_t s = b / perSite;
+        stock[s * Bike::nbBikeTypes + b % Bike::nbBikeTypes]++;
+        total[s]++;
+    }
+
+    // Every rider starts by arriving at a site, spread over the first walk
+    for (uint32_t r = 0; r < config.nbRiders; ++r)
+    {
+        rngState[r] = mix(config.seed ^ (uint64_t(r) * golden));
+        type[r] = rngState[r] % Bike::nbBikeTypes;
+        site[r] = r % config.nbSites;
+        cycleStartMs[r] = noCycle;
+        schedule(r, 1 + r % (wheelSize - 1));
+    }
+}
+
+void BatchEngine::run(uint64_t untilMs)
+{
+    while (now < untilMs)
+    {
+        processSlot();
+        now++;
+    }
+}
+
+size_t BatchEngine::bikesAccountedFor() const
+{
+    size_t count = 0;
+    for (uint32_t bikes : total)
+    {
+        count += bikes;
+    }
+    for (uint8_t p : phase)
+    {
+        count += p == Ride || p == WaitDock;
+    }
+    return count;
+}
+
+void BatchEngine::processSlot()
+{
+    batch.swap(wheel[now % wheelSize]);
+    wheel[now % wheelSize].clear();
+    size_t n = batch.size();
+    if (n == 0)
+    {
+        return;
+    }
+    events += n;
+
+    // Draws the next destination and travel time of the whole batch at once
+    const uint32_t others = uint32_t(config.nbSites - 1);
+    const uint32_t *ids = batch.data();
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint32_t r = ids[i];
+        uint64_t state = rngState[r] + golden;
+        rngState[r] = state;
+        uint64_t z = mix(state);
+        drawnSite[r] = (site[r] + 1 + below(uint32_t(z), others)) % config.nbSites;
+        drawnMs[r] = 500 + below(uint32_t(z >> 32), 1501);
+    }
+    if (config.geographic)
+    {
+        // Same draws, reused: the time from the map varied by up to 20% either way
+        for (size_t i = 0; i < n; ++i)
+        {
+            uint32_t r = ids[i];
+            uint32_t ms = phase[r] == Walk ? siteMap.bikeMs(site[r], drawnSite[r])
+                                           : siteMap.walkMs(site[r], drawnSite[r]);
+            drawnMs[r] = ms * (800 + (drawnMs[r] - 500) * 400 / 1500) / 1000;
+        }
+    }
+
+    // Then the station operations: arrivals queue up, settle() serves them
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint32_t r = ids[i];
+        uint32_t s = site[r];
+        eventMs[r] = now;
+        if (phase[r] == Walk)
+        {
+            // A cycle goes from one arrival to the next
+            if (cycleStartMs[r] != noCycle)
+            {
+                cycleUs.record((now - cycleStartMs[r]) * 1000);
+            }
+            cycleStartMs[r] = now;
+            phase[r] = WaitBike;
+            push(bikeWaiters[s * Bike::nbBikeTypes + type[r]], r);
+        }
+        else
+        {
+            phase[r] = WaitDock;
+            push(dockWaiters[s], r);
+        }
+        settle(s);
+    }
+    batch.clear();
+}
+
+void BatchEngine::settle(uint32_t s)
+{
+    bool progress = true;
+    while (progress)
+    {
+        progress = false;
+        while (total[s] < config.slotsPerSite && dockWaiters[s].head != noRider)
+        {
+            uint32_t r = pop(dockWaiters[s]);
+            stock[s * Bike::nbBikeTypes + type[r]]++;
+            total[s]++;
+            trips++;
+            waitDockUs.record((now - eventMs[r]) * 1000);
+            startWalk(r);
+            progress = true;
+        }
+        for (size_t t = 0; t < Bike::nbBikeTypes; ++t)
+        {
+            Queue& queue = bikeWaiters[s * Bike::nbBikeTypes + t];
+            while (stock[s * Bike::nbBikeTypes + t] > 0 && queue.head != noRider)
+            {
+                uint32_t r = pop(queue);
+                stock[s * Bike::nbBikeTypes + t]--;
+                total[s]--;
+                waitBikeUs.record((now - eventMs[r]) * 1000);
+                startRide(r);
+                progress = true;
+            }
+        }
+    }
+}
+
+void BatchEngine::startRide(uint32_t r)
+{
+    phase[r] = Ride;
+    site[r] = drawnSite[r];
+    schedule(r, drawnMs[r] + 1000);
+}
+
+void BatchEngine::startWalk(uint32_t r)
+{
+    phase[r] = Walk;
+    site[r] = drawnSite[r];
+    schedule(r, drawnMs[r] + 2000);
+}
+
+void BatchEngine::schedule(uint32_t r, uint32_t delayMs)
+{
+    eventMs[r] = now + delayMs;
+    wheel[eventMs[r] % wheelSize].push_back(r);
+}
+
+void BatchEngine::push(Queue& queue, uint32_t r)
+{
+    nextWaiter[r] = noRider;
+    if (queue.tail == noRider)
+        queue.head = r;
+    else
+        nextWaiter[queue.tail] = r;
+    queue.tail = r;
+}
+
+uint32_t BatchEngine::pop(Queue& queue)
+{
+    uint32_t r = queue.head;
+    queue.head = nextWaiter[r];
+    if (queue.head == noRider)
+    {
+        queue.tail = noRider;
+    }
+    return r;
+}
@@ -4,77 +4,161 @@
 */
 
 #include "bikestation.h"
+#include "lockfreestation.h"
+#include "simstats.h"
+#include "tracer.h"
+#include "journal.h"
+#include "siteindex.h"
+#include "watchdog.h"
 #include <pcosynchro/pcologger.h>
 
-BikeStation::BikeStation(int _capacity) : capacity(_capacity)
+template <class Sync>
+BasicBikeStation<Sync>::BasicBikeStation(int _capacity, unsigned int _id) : capacity(_capacity), id(_id)
 {
     PcoLogger::setVerbosity(1);
     shouldEnd = false;
+    emptySince = nowNs();
+    labelLock(mutex, id);
 }
 
-BikeStation::~BikeStation()
+template <class Sync>
+BasicBikeStation<Sync>::~BasicBikeStation()
 {
     ending();
 }
 
-void BikeStation::putBike(Bike *_bike)
+template <class Sync>
+bool BasicBikeStation<Sync>::putBike(Bike *_bike)
+{
+    return putBike(_bike, 0);
+}
+
+template <class Sync>
+bool BasicBikeStation<Sync>::putBike(Bike *_bike, uint64_t _deadlineNs)
 {
     mutex.lock();
-    while (nbBikes() >= nbSlots() && !shouldEnd)
+    bool timedOut = false;
+    if (nbBikes() >= nbSlots() && !shouldEnd)
     {
-        // wait until there's space
-        bikeRemoved[_bike->bikeType].wait(&mutex);
+        TraceSpan span("station wait dock", id, _bike->bikeType);
+        BlockedWait blocked(WaitForDock, id, _bike->bikeType);
+        dockWaiters.fetch_add(1, std::memory_order_relaxed);
+        if (_deadlineNs)
+        {
+            timedWaiters.fetch_add(1, std::memory_order_relaxed);
+        }
+        while (nbBikes() >= nbSlots() && !shouldEnd && !timedOut)
+        {
+            // wait until there's space
+            dockFreed.wait(&mutex);
+            timedOut = _deadlineNs && nowNs() >= _deadlineNs;
+        }
+        if (_deadlineNs)
+        {
+            timedWaiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+        dockWaiters.fetch_sub(1, std::memory_order_relaxed);
     }
 
-    if (shouldEnd)
+    if (shouldEnd || nbBikes() >= nbSlots())
     {
+        Journal::record(JournalPutBike, id, _bike->bikeType, 1, 0, nbBikes());
         mutex.unlock();
-        return;
+        return false;
     }
 
     // can add bike
     bikesByType[_bike->bikeType].push_back(_bike);
+    publishOccupancy();
+    size_t bikesAfter = nbBikes();
 
     bikeAdded[_bike->bikeType].notifyOne();
     mutex.unlock();
+    // Journaled out of the critical section, with the state it left
+    Journal::record(JournalPutBike, id, _bike->bikeType, 1, 1, bikesAfter);
+    return true;
 }
 
-Bike *BikeStation::getBike(size_t _bikeType)
+template <class Sync>
+Bike *BasicBikeStation<Sync>::getBike(size_t _bikeType)
+{
+    return getBike(_bikeType, 0, false);
+}
+
+template <class Sync>
+Bike *BasicBikeStation<Sync>::getBike(size_t _bikeType, uint64_t _deadlineNs, bool _anyType)
 {
     Bike *bike = nullptr;
     mutex.lock();
-    while (bikesByType[_bikeType].empty() && !shouldEnd)
+    bool timedOut = false;
+    if (bikesByType[_bikeType].empty() && !shouldEnd)
     {
-        // wait until there's a bike of the requested type
-        bikeAdded[_bikeType].wait(&mutex);
+        TraceSpan span("station wait bike", id, _bikeType);
+        BlockedWait blocked(WaitForBike, id, _bikeType);
+        bikeWaiters.fetch_add(1, std::memory_order_relaxed);
+        if (_deadlineNs)
+        {
+            timedWaiters.fetch_add(1, std::memory_order_relaxed);
+        }
+        while (bikesByType[_bikeType].empty() && !shouldEnd && !timedOut)
+        {
+            // wait until there's a bike of the requested type
+            bikeAdded[_bikeType].wait(&mutex);
+            timedOut = _deadlineNs && nowNs() >= _deadlineNs;
+        }
+        if (_deadlineNs)
+        {
+            timedWaiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+        bikeWaiters.fetch_sub(1, std::memory_order_relaxed);
     }
 
-    if (shouldEnd)
+    // On timeout, the first non-empty type if another one is accepted
+    size_t type = _bikeType;
+    for (size_t other = 0; _anyType && bikesByType[type].empty() && other < Bike::nbBikeTypes; ++other)
     {
+        type = other;
+    }
+
+    if (shouldEnd || bikesByType[type].empty())
+    {
+        Journal::record(JournalGetBike, id, _bikeType, 1, 0, nbBikes());
         mutex.unlock();
         return nullptr;
     }
 
     // can get bike
-    bike = bikesByType[_bikeType].front();
-    bikesByType[_bikeType].pop_front();
+    bike = bikesByType[type].front();
+    bikesByType[type].pop_front();
+    publishOccupancy();
+    size_t bikesAfter = nbBikes();
 
-    bikeRemoved[_bikeType].notifyOne();
+    dockFreed.notifyOne();
     mutex.unlock();
+    // The type taken, which differs from the one asked after a fallback
+    Journal::record(JournalGetBike, id, type, 1, 1, bikesAfter);
     return bike;
 }
 
-std::vector<Bike *> BikeStation::addBikes(std::vector<Bike *> _bikesToAdd)
+template <class Sync>
+std::vector<Bike *> BasicBikeStation<Sync>::addBikes(std::vector<Bike *> _bikesToAdd)
 {
     std::vector<Bike *> result;
     // TODO refactor with condition variables to wait if no slots are available
     mutex.lock();
+    // Counted here, nbBikes() is only refreshed by publishOccupancy()
+    size_t occupied = 0;
+    for (const auto& bikes : bikesByType)
+    {
+        occupied += bikes.size();
+    }
     for (Bike *bike : _bikesToAdd)
     {
-        if (nbBikes() < nbSlots())
+        if (occupied < nbSlots())
         {
             // can add bike
             bikesByType[bike->bikeType].push_back(bike);
+            occupied++;
             bikeAdded[bike->bikeType].notifyOne();
         }
         else
@@ -83,11 +167,16 @@ std::vector<Bike *> BikeStation::addBikes(std::vector<Bike *> _bikesToAdd)
             result.push_back(bike);
         }
     }
+    publishOccupancy();
+    size_t bikesAfter = nbBikes();
     mutex.unlock();
+    Journal::record(JournalAddBikes, id, 0xff, _bikesToAdd.size(),
+                    _bikesToAdd.size() - result.size(), bikesAfter);
     return result;
 }
 
-std::vector<Bike *> BikeStation::getBikes(size_t _nbBikes)
+template <class Sync>
+std::vector<Bike *> BasicBikeStation<Sync>::getBikes(size_t _nbBikes)
 {
 
     std::vector<Bike *> result;
@@ -101,38 +190,178 @@ std::vector<Bike *> BikeStation::getBikes(size_t _nbBikes)
             Bike *bike = bikesByType[type].front();
             bikesByType[type].pop_front();
             result.push_back(bike);
-            bikeRemoved[type].notifyOne();
+            dockFreed.notifyOne();
         }
         if (result.size() >= _nbBikes)
         {
             break;
         }
     }
+    publishOccupancy();
+    size_t bikesAfter = nbBikes();
     mutex.unlock();
+    Journal::record(JournalGetBikes, id, 0xff, _nbBikes, result.size(), bikesAfter);
     return result;
 }
 
-size_t BikeStation::countBikesOfType(size_t type) const
+template <class Sync>
+size_t BasicBikeStation<Sync>::countBikesOfType(size_t type) const
+{
+    return typeCounts[type].load(std::memory_order_relaxed);
+}
+
+template <class Sync>
+size_t BasicBikeStation<Sync>::nbBikes() const
+{
+    return bikeCount.load(std::memory_order_relaxed);
+}
+
+template <class Sync>
+size_t BasicBikeStation<Sync>::nbSlots() const
+{
+    return capacity;
+}
+
+template <class Sync>
+size_t BasicBikeStation<Sync>::nbWaitingForBike() const
+{
+    return bikeWaiters.load(std::memory_order_relaxed);
+}
+
+template <class Sync>
+size_t BasicBikeStation<Sync>::nbWaitingForDock() const
+{
+    return dockWaiters.load(std::memory_order_relaxed);
+}
+
+template <class Sync>
+unsigned int BasicBikeStation<Sync>::siteId() const
+{
+    return id;
+}
+
+template <class Sync>
+uint64_t BasicBikeStation<Sync>::emptyTimeNs() const
+{
+    uint64_t since = emptySince.load(std::memory_order_relaxed);
+    uint64_t total = emptyNs.load(std::memory_order_relaxed);
+    return since ? total + (nowNs() - since) : total;
+}
+
+template <class Sync>
+uint64_t BasicBikeStation<Sync>::fullTimeNs() const
+{
+    uint64_t since = fullSince.load(std::memory_order_relaxed);
+    uint64_t total = fullNs.load(std::memory_order_relaxed);
+    return since ? total + (nowNs() - since) : total;
+}
+
+template <class Sync>
+void BasicBikeStation<Sync>::freeze()
+{
+    mutex.lock();
+}
+
+template <class Sync>
+void BasicBikeStation<Sync>::thaw()
+{
+    mutex.unlock();
+}
+
+template <class Sync>
+std::vector<Bike *> BasicBikeStation<Sync>::contents() const
 {
-    return bikesByType[type].size();
+    std::vector<Bike *> result;
+    for (const std::deque<Bike *> &bikes : bikesByType)
+    {
+        result.insert(result.end(), bikes.begin(), bikes.end());
+    }
+    return result;
 }
 
-size_t BikeStation::nbBikes()
+template <class Sync>
+void BasicBikeStation<Sync>::publishOccupancy()
 {
     size_t total = 0;
     for (size_t i = 0; i < Bike::nbBikeTypes; i++)
     {
+        typeCounts[i].store(bikesByType[i].size(), std::memory_order_relaxed);
         total += bikesByType[i].size();
     }
-    return total;
+    bikeCount.store(total, std::memory_order_relaxed);
+
+    if (availability)
+    {
+        uint32_t flags = total < capacity ? SiteFreeDock : 0;
+        for (size_t i = 0; i < Bike::nbBikeTypes; i++)
+        {
+            flags |= bikesByType[i].empty() ? 0 : siteTypeFlag(i);
+        }
+        // Only the owning station writes its word, a plain store is enough
+        if (flags != availabilityPublished)
+        {
+            availability->store(flags, std::memory_order_relaxed);
+            availabilityPublished = flags;
+        }
+    }
+
+    // Open or close the empty/full periods on state changes only
+    bool isEmpty = total == 0;
+    bool isFull = total >= capacity;
+    uint64_t emptyStart = emptySince.load(std::memory_order_relaxed);
+    uint64_t fullStart = fullSince.load(std::memory_order_relaxed);
+    if (isEmpty != (emptyStart != 0) || isFull != (fullStart != 0))
+    {
+        uint64_t now = nowNs();
+        if (isEmpty && !emptyStart)
+        {
+            emptySince.store(now, std::memory_order_relaxed);
+        }
+        else if (!isEmpty && emptyStart)
+        {
+            emptyNs.fetch_add(now - emptyStart, std::memory_order_relaxed);
+            emptySince.store(0, std::memory_order_relaxed);
+        }
+        if (isFull && !fullStart)
+        {
+            fullSince.store(now, std::memory_order_relaxed);
+        }
+        else if (!isFull && fullStart)
+        {
+            fullNs.fetch_add(now - fullStart, std::memory_order_relaxed);
+            fullSince.store(0, std::memory_order_relaxed);
+        }
+    }
 }
 
-size_t BikeStation::nbSlots()
+template <class Sync>
+void BasicBikeStation<Sync>::wakeTimedWaiters()
 {
-    return capacity;
+    if (timedWaiters.load(std::memory_order_relaxed) == 0)
+    {
+        return;
+    }
+    mutex.lock();
+    for (size_t i = 0; i < Bike::nbBikeTypes; i++)
+    {
+        bikeAdded[i].notifyAll();
+    }
+    dockFreed.notifyAll();
+    mutex.unlock();
 }
 
-void BikeStation::ending()
+template <class Sync>
+void BasicBikeStation<Sync>::publishAvailability(std::atomic<uint32_t> *_flags)
+{
+    mutex.lock();
+    availability = _flags;
+    availabilityPublished = ~uint32_t(0);
+    publishOccupancy();
+    mutex.unlock();
+}
+
+template <class Sync>
+void BasicBikeStation<Sync>::ending()
 {
     mutex.lock();
     shouldEnd = true;
@@ -141,8 +370,50 @@ void BikeStation::ending()
     for (size_t i = 0; i < Bike::nbBikeTypes; i++)
     {
         bikeAdded[i].notifyAll();
-        bikeRemoved[i].notifyAll();
     }
+    dockFreed.notifyAll();
 
     mutex.unlock();
 }
+
+template class BasicBikeStation<PcoSync>;
+template class BasicBikeStation<SpinFutexSync>;
+
+bool parseStationKind(const std::string& name, StationKind& kind)
+{
+    if (name == "pco")
+        kind = StationPco;
+    else if (name == "spin")
+        kind = StationSpinFutex;
+    else if (name == "lockfree")
+        kind = StationLockFree;
+    else
+        return false;
+    return true;
+}
+
+const char *stationKindName(StationKind kind)
+{
+    switch (kind)
+    {
+    case StationSpinFutex:
+        return "spin";
+    case StationLockFree:
+        return "lockfree";
+    default:
+        return "pco";
+    }
+}
+
+std::unique_ptr<BikeStation> makeBikeStation(StationKind kind, size_t capacity, unsigned int id)
+{
+    switch (kind)
+    {
+    case StationSpinFutex:
+        return std::make_unique<SpinFutexBikeStation>(int(capacity), id);
+    case StationLockFree:
+        return std::make_unique<LockFreeBikeStation>(capacity, id);
+    default:
+        return std::make_unique<PcoBikeStation>(int(capacity), id);
+    }
+}
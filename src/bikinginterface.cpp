@@ -50,7 +50,7 @@ void BikingInterface::travel(unsigned int personId,unsigned int site1, unsigned
                              unsigned int ms)
 {
     emit sig_travel(personId,site1,site2,ms);
-    QTest::qSleep(ms);
+    sleepMs(ms);
 }
 
 void BikingInterface::walk(unsigned int personId,
@@ -59,14 +59,29 @@ void BikingInterface::walk(unsigned int personId,
                            unsigned int ms)
 {
     emit sig_walk(personId, site1, site2, ms);
-    QTest::qSleep(ms);
+    sleepMs(ms);
 }
 
 void BikingInterface::vanTravel(unsigned int site1, unsigned int site2,
                                 unsigned int ms)
 {
     emit sig_vanTravel(site1,site2,ms);
-    QTest::qSleep(ms);
+    sleepMs(ms);
+}
+
+void BikingInterface::setStopSignal(StopSignal *signal)
+{
+    m_stopSignal=signal;
+}
+
+void BikingInterface::sleepMs(unsigned int ms)
+{
+    if (m_stopSignal) {
+        m_stopSignal->sleepFor(uint64_t(ms)*1000000);
+    }
+    else {
+        QTest::qSleep(ms);
+    }
 }
 
 void BikingInterface::consoleAppendText(unsigned int consoleId,QString text) {
@@ -85,7 +100,8 @@ void BikingInterface::setInitPerson(unsigned int site,unsigned int personID) {
     mainWindow->setPerson(site,personID);
 }
 
-void BikingInterface::initialize(unsigned int nbConsoles,unsigned int nbSites)
+void BikingInterface::initialize(unsigned int nbConsoles,unsigned int nbSites,
+                                 const std::vector<SitePoint> &sitePositions)
 {
     if (sm_didInitialize) {
         cout << "Vous devez ne devriez appeler BikingInteface::initialize()"
@@ -95,7 +111,7 @@ void BikingInterface::initialize(unsigned int nbConsoles,unsigned int nbSites)
                              "qu'une seule fois");
         return;
     }
-    mainWindow= new MainWindow(nbConsoles,nbSites,0);
+    mainWindow= new MainWindow(nbConsoles,nbSites,sitePositions,0);
     mainWindow->show();
     sm_didInitialize=true;
 }
@@ -0,0 +1,123 @@
+/*
+    * controlagent.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "controlagent.h"
+#include "bikestation.h"
+#include "bikinginterface.h"
+#include "simcontext.h"
+
+#include <cerrno>
+
+ControlAgent::ControlAgent(SimContext *_context)
+    : context(_context)
+{
+    sem_init(&pending, 0, 0);
+}
+
+ControlAgent::~ControlAgent()
+{
+    sem_destroy(&pending);
+}
+
+void ControlAgent::post(const ControlCommand& command)
+{
+    commands.push(command);
+    sem_post(&pending);
+}
+
+void ControlAgent::wake()
+{
+    sem_post(&pending);
+}
+
+void ControlAgent::run()
+{
+    while (true)
+    {
+        while (sem_wait(&pending) != 0 && errno == EINTR)
+        {
+        }
+
+        long depotDelta = 0;
+        bool stopRequested = false;
+        ControlCommand command;
+        while (commands.pop(command))
+        {
+            switch (command.type)
+            {
+            case ControlAddDepotBikes:
+                depotDelta += long(command.count);
+                break;
+            case ControlRemoveDepotBikes:
+                depotDelta -= long(command.count);
+                break;
+            case ControlStop:
+                stopRequested = true;
+                break;
+            }
+        }
+
+        if (depotDelta != 0 && !context->stopSignal.raised())
+        {
+            changeDepot(depotDelta);
+            // Publishes the state of the depot and of the spare bikes
+            batches.fetch_add(1, std::memory_order_release);
+        }
+        if (stopRequested)
+        {
+            context->stop();
+        }
+        if (context->stopSignal.raised())
+        {
+            return;
+        }
+    }
+}
+
+void ControlAgent::changeDepot(long delta)
+{
+    BikeStation *depot = context->stations[DEPOT_ID];
+    size_t moved = 0;
+    size_t refused = 0;
+    if (delta > 0)
+    {
+        std::vector<Bike*> batch;
+        while (batch.size() < size_t(delta))
+        {
+            if (!spare.empty())
+            {
+                batch.push_back(spare.back());
+                spare.pop_back();
+                continue;
+            }
+            created.emplace_back();
+            created.back().bikeType = nextType;
+            nextType = (nextType + 1) % Bike::nbBikeTypes;
+            batch.push_back(&created.back());
+        }
+        std::vector<Bike*> rejected = depot->addBikes(batch);
+        refused = rejected.size();
+        moved = batch.size() - refused;
+        spare.insert(spare.end(), rejected.begin(), rejected.end());
+        context->bikeCount.fetch_add(moved, std::memory_order_relaxed);
+    }
+    else
+    {
+        std::vector<Bike*> removed = depot->getBikes(size_t(-delta));
+        moved = removed.size();
+        refused = size_t(-delta) - moved;
+        spare.insert(spare.end(), removed.begin(), removed.end());
+        context->bikeCount.fetch_sub(moved, std::memory_order_relaxed);
+    }
+
+    if (context->interface)
+    {
+        context->interface->setBikes(DEPOT_ID, depot->nbBikes());
+        context->interface->consoleAppendText(0, QString("Dépôt: %1 vélos %2, %3 refusés")
+                                                     .arg(moved)
+                                                     .arg(delta > 0 ? "ajoutés" : "retirés")
+                                                     .arg(refused));
+    }
+}
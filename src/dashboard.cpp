@@ -0,0 +1,174 @@
+/*
+    * dashboard.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "dashboard.h"
+#include "bikestation.h"
+#include "simcontext.h"
+
+#include <QPainter>
+#include <QPaintEvent>
+#include <algorithm>
+
+extern SimContext* globalContext;
+
+namespace {
+
+const int ROWHEIGHT = 18;
+const int TEXTWIDTH = 260;
+const int SPARKWIDTH = 240;
+const int MARGIN = 6;
+
+}
+
+void Sparkline::push(double value)
+{
+    values[next] = value;
+    next = (next + 1) % nbSamples;
+    count = std::min(count + 1, nbSamples);
+}
+
+void Sparkline::draw(QPainter& painter, const QRectF& rect) const
+{
+    painter.setPen(QColor(200, 200, 200));
+    painter.drawRect(rect);
+    if (count < 2)
+    {
+        return;
+    }
+
+    size_t first = (next + nbSamples - count) % nbSamples;
+    double maxValue = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        maxValue = std::max(maxValue, values[(first + i) % nbSamples]);
+    }
+    if (maxValue <= 0)
+    {
+        maxValue = 1;
+    }
+
+    std::array<QPointF, nbSamples> points;
+    double step = rect.width() / (nbSamples - 1);
+    double x0 = rect.right() - step * (count - 1);
+    for (size_t i = 0; i < count; ++i)
+    {
+        double v = values[(first + i) % nbSamples] / maxValue;
+        points[i] = QPointF(x0 + step * i, rect.bottom() - v * rect.height());
+    }
+    painter.setPen(QColor(30, 110, 200));
+    painter.drawPolyline(points.data(), static_cast<int>(count));
+}
+
+DashboardWidget::DashboardWidget(QWidget *parent)
+    : QWidget(parent),
+      lastSampleNs(nowNs())
+{
+    setMinimumHeight(ROWHEIGHT * (5 + static_cast<int>(NB_SITES_TOTAL)) + 2 * MARGIN);
+    connect(&timer, &QTimer::timeout, this, &DashboardWidget::sample);
+    timer.start(SAMPLEPERIODMS);
+}
+
+QSize DashboardWidget::sizeHint() const
+{
+    return QSize(TEXTWIDTH + SPARKWIDTH + 3 * MARGIN,
+                 ROWHEIGHT * (5 + static_cast<int>(NB_SITES_TOTAL)) + 2 * MARGIN);
+}
+
+void DashboardWidget::sample()
+{
+    if (!globalContext)
+    {
+        return;
+    }
+    const SimStats& stats = globalContext->stats;
+    uint64_t now = nowNs();
+    double elapsedS = (now - lastSampleNs) / 1e9;
+    lastSampleNs = now;
+
+    uint64_t trips = stats.tripsCompleted.load(std::memory_order_relaxed);
+    tripsPerSecond = elapsedS > 0 ? (trips - lastTrips) / elapsedS : 0;
+    lastTrips = trips;
+
+    bikesInTransit = stats.bikesInTransit.load(std::memory_order_relaxed);
+
+    uint64_t rounds = stats.vanRounds.load(std::memory_order_relaxed);
+    vanLastRoundS = stats.vanLastRoundNs.load(std::memory_order_relaxed) / 1e9;
+    vanMeanRoundS = rounds ? stats.vanTotalRoundNs.load(std::memory_order_relaxed) / 1e9 / rounds : 0;
+
+    // Cargo utilisation over the last sampling window only
+    uint64_t legs = stats.vanLegs.load(std::memory_order_relaxed);
+    uint64_t cargoSum = stats.vanCargoSum.load(std::memory_order_relaxed);
+    if (legs > lastLegs)
+    {
+        cargoUtilisation = double(cargoSum - lastCargoSum) / ((legs - lastLegs) * globalContext->config.vanCapacity);
+    }
+    lastLegs = legs;
+    lastCargoSum = cargoSum;
+
+    HistogramSnapshot waits = stats.waitTimesUs.snapshot();
+    waitP50Us = waits.percentile(50);
+    waitP95Us = waits.percentile(95);
+    waitP99Us = waits.percentile(99);
+    HistogramSnapshot window = waits;
+    window.subtract(lastWaits);
+    lastWaits = waits;
+
+    double runNs = double(now - stats.startNs);
+    for (size_t s = 0; s < NB_SITES_TOTAL; ++s)
+    {
+        const BikeStation *station = globalContext->stations[s];
+        stationBikes[s] = station->nbBikes();
+        emptyRatio[s] = runNs > 0 ? station->emptyTimeNs() / runNs : 0;
+        fullRatio[s] = runNs > 0 ? station->fullTimeNs() / runNs : 0;
+    }
+
+    tripsHistory.push(tripsPerSecond);
+    transitHistory.push(double(bikesInTransit));
+    waitHistory.push(double(window.percentile(95)));
+    cargoHistory.push(cargoUtilisation);
+
+    update();
+}
+
+void DashboardWidget::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    painter.fillRect(rect(), QColor(255, 255, 255));
+
+    int y = MARGIN;
+    auto row = [&](const QString& text, const Sparkline *history) {
+        painter.setPen(QColor(0, 0, 0));
+        painter.drawText(QRectF(MARGIN, y, TEXTWIDTH, ROWHEIGHT),
+                         Qt::AlignLeft | Qt::AlignVCenter, text);
+        if (history)
+        {
+            history->draw(painter, QRectF(TEXTWIDTH + 2 * MARGIN, y + 2,
+                                          SPARKWIDTH, ROWHEIGHT - 4));
+        }
+        y += ROWHEIGHT;
+    };
+
+    row(QString("Trips/s: %1").arg(tripsPerSecond, 0, 'f', 2), &tripsHistory);
+    row(QString("Bikes in transit: %1").arg(bikesInTransit), &transitHistory);
+    row(QString("Wait p50/p95/p99: %1 / %2 / %3 ms")
+            .arg(waitP50Us / 1000).arg(waitP95Us / 1000).arg(waitP99Us / 1000),
+        &waitHistory);
+    row(QString("Van cargo utilisation: %1 %").arg(cargoUtilisation * 100, 0, 'f', 0),
+        &cargoHistory);
+    row(QString("Van round: last %1 s, mean %2 s")
+            .arg(vanLastRoundS, 0, 'f', 1).arg(vanMeanRoundS, 0, 'f', 1),
+        nullptr);
+
+    for (size_t s = 0; s < NB_SITES_TOTAL; ++s)
+    {
+        QString name = s == DEPOT_ID ? QString("Depot") : QString("Site %1").arg(s);
+        row(QString("%1: %2 bikes, empty %3 %, full %4 %")
+                .arg(name)
+                .arg(stationBikes[s])
+                .arg(emptyRatio[s] * 100, 0, 'f', 1)
+                .arg(fullRatio[s] * 100, 0, 'f', 1),
+            nullptr);
+    }
+}
@@ -11,12 +11,7 @@
 #include <QPaintEvent>
 #include <QPainter>
 
-#include <QParallelAnimationGroup>
-#include <QPropertyAnimation>
-#include <QEventLoop>
-#include <QMutex>
-
-
+#include <algorithm>
 #include <cmath>
 
 #define RADIUS 250.0
@@ -32,21 +27,43 @@ BikeItem::BikeItem() = default;
 
 PersonItem::PersonItem() = default;
 
-BikeDisplay::BikeDisplay(unsigned int nbSite,QWidget *parent):
+BikeDisplay::BikeDisplay(unsigned int nbSite,
+                         const std::vector<SitePoint> &sitePositions,
+                         QWidget *parent):
     QGraphicsView(parent)
 {
     m_sitePos=new QPointF[nbSite+1];
-    for(unsigned int i=0;i<nbSite;i++)
-    {
-        m_sitePos[i]=
-                QPointF(SCENEOFFSET+RADIUS+RADIUS*cos(2.0*3.14/((float)nbSite)
-                                                      *((float)i)),
-                        SCENEOFFSET+RADIUS+RADIUS*sin(2.0*3.14/((float)nbSite)
-                                                      *((float)i)));
+    if (sitePositions.size()==nbSite+1) {
+        // Carte des sites centrée et mise à l'échelle du cercle par défaut
+        double minX=sitePositions[0].x,maxX=minX;
+        double minY=sitePositions[0].y,maxY=minY;
+        for(const SitePoint &p : sitePositions) {
+            minX=std::min(minX,p.x);
+            maxX=std::max(maxX,p.x);
+            minY=std::min(minY,p.y);
+            maxY=std::max(maxY,p.y);
+        }
+        double extent=std::max({maxX-minX,maxY-minY,1e-9});
+        for(unsigned int i=0;i<=nbSite;i++)
+        {
+            m_sitePos[i]=
+                    QPointF(SCENEOFFSET+RADIUS+2*RADIUS*(sitePositions[i].x-(minX+maxX)/2)/extent,
+                            SCENEOFFSET+RADIUS+2*RADIUS*(sitePositions[i].y-(minY+maxY)/2)/extent);
+        }
+    }
+    else {
+        for(unsigned int i=0;i<nbSite;i++)
+        {
+            m_sitePos[i]=
+                    QPointF(SCENEOFFSET+RADIUS+RADIUS*cos(2.0*3.14/((float)nbSite)
+                                                          *((float)i)),
+                            SCENEOFFSET+RADIUS+RADIUS*sin(2.0*3.14/((float)nbSite)
+                                                          *((float)i)));
+        }
+        m_sitePos[nbSite]=
+                QPointF(SCENEOFFSET+RADIUS,
+                        SCENEOFFSET+RADIUS);
     }
-    m_sitePos[nbSite]=
-            QPointF(SCENEOFFSET+RADIUS,
-                    SCENEOFFSET+RADIUS);
     m_scene=new QGraphicsScene(this);
     this->setRenderHints(QPainter::Antialiasing |
                          QPainter::SmoothPixmapTransform);
@@ -80,6 +97,106 @@ BikeDisplay::BikeDisplay(unsigned int nbSite,QWidget *parent):
     m_van->setPixmap(vanPixmap);
     m_scene->addItem(m_van);
     m_van->setPos(m_sitePos[nbSite]);
+
+    m_ticker.setInterval(FRAMEPERIODMS);
+    QObject::connect(&m_ticker, SIGNAL(timeout()), this, SLOT(tick()));
+    m_clock.start();
+}
+
+
+void MotionTable::add(QGraphicsItem *item,Kind kind,QPointF start,
+                      QPointF end,qint64 now,float ms)
+{
+    startX.push_back(start.x());
+    startY.push_back(start.y());
+    endX.push_back(end.x());
+    endY.push_back(end.y());
+    t0.push_back(now);
+    duration.push_back(std::max(ms,1.0f));
+    progress.push_back(0.0f);
+    items.push_back(item);
+    kinds.push_back(kind);
+}
+
+void MotionTable::remove(size_t i)
+{
+    // Suppression par échange avec le dernier élément : l'ordre n'importe pas
+    size_t last=items.size()-1;
+    startX[i]=startX[last];     startX.pop_back();
+    startY[i]=startY[last];     startY.pop_back();
+    endX[i]=endX[last];         endX.pop_back();
+    endY[i]=endY[last];         endY.pop_back();
+    t0[i]=t0[last];             t0.pop_back();
+    duration[i]=duration[last]; duration.pop_back();
+    progress[i]=progress[last]; progress.pop_back();
+    items[i]=items[last];       items.pop_back();
+    kinds[i]=kinds[last];       kinds.pop_back();
+}
+
+
+void BikeDisplay::startMotion(QGraphicsItem *item,MotionTable::Kind kind,
+                              QPointF start,QPointF end,unsigned int ms)
+{
+    item->setPos(start);
+    item->show();
+    m_motions.add(item,kind,start,end,m_clock.elapsed(),
+                  (float)ms-10.0f);
+    if (!m_ticker.isActive())
+        m_ticker.start();
+}
+
+void BikeDisplay::finishMotion(QGraphicsItem *item,MotionTable::Kind kind)
+{
+    switch (kind) {
+    case MotionTable::Bike:
+        item->hide();
+        setFreeBike(static_cast<BikeItem*>(item));
+        break;
+    case MotionTable::Person: {
+        QPointF curPos = item->pos()+ QPointF(BIKEWIDTH/2,BIKEWIDTH*1.2);
+        float angle = rand();
+        item->setPos(curPos.x() + 40*cos(angle),curPos.y() + 40*sin(angle));
+        break;
+    }
+    case MotionTable::Van:
+        break;
+    }
+}
+
+void BikeDisplay::tick()
+{
+    const qint64 now=m_clock.elapsed();
+    const size_t n=m_motions.size();
+    const qint64 *t0=m_motions.t0.data();
+    const float *duration=m_motions.duration.data();
+    float *progress=m_motions.progress.data();
+
+    // Boucle sans branche ni appel : vectorisable par le compilateur.
+    // Seul l'écart depuis le départ, petit, passe en float
+    for(size_t i=0;i<n;i++) {
+        float t=(float)(now-t0[i])/duration[i];
+        progress[i]=std::min(std::max(t,0.0f),1.0f);
+    }
+
+    for(size_t i=0;i<n;i++) {
+        float t=progress[i];
+        m_motions.items[i]->setPos(
+                    m_motions.startX[i]+(m_motions.endX[i]-m_motions.startX[i])*t,
+                    m_motions.startY[i]+(m_motions.endY[i]-m_motions.startY[i])*t);
+    }
+
+    // Parcours à rebours pour que la suppression par échange reste valide
+    for(size_t i=n;i-->0;) {
+        if (progress[i]>=1.0f) {
+            QGraphicsItem *item=m_motions.items[i];
+            MotionTable::Kind kind=m_motions.kinds[i];
+            m_motions.remove(i);
+            finishMotion(item,kind);
+        }
+    }
+
+    if (m_motions.size()==0)
+        m_ticker.stop();
 }
 
 
@@ -113,19 +230,9 @@ void BikeDisplay::setFreeBike(BikeItem *bike)
 void BikeDisplay::vanTravel(unsigned int site1,unsigned int site2,
                             unsigned int ms)
 {
-    static QMutex mutex;
-    mutex.lock();
-    m_van->show();
-    auto *animation=new QPropertyAnimation(m_van, "pos");
-    animation->setDuration(ms-10);
-    animation->setStartValue(m_sitePos[site1]-QPointF(VANWIDTH/2,VANWIDTH/2));
-    animation->setEndValue(m_sitePos[site2]-QPointF(VANWIDTH/2,VANWIDTH/2));
-    animation->start();
-
-    QObject::connect(animation, SIGNAL(finished()), this,
-                     SLOT(finishedVanAnimation()));
-
-    mutex.unlock();
+    startMotion(m_van,MotionTable::Van,
+                m_sitePos[site1]-QPointF(VANWIDTH/2,VANWIDTH/2),
+                m_sitePos[site2]-QPointF(VANWIDTH/2,VANWIDTH/2),ms);
 }
 
 void BikeDisplay::walk(unsigned int personId,
@@ -133,36 +240,9 @@ void BikeDisplay::walk(unsigned int personId,
                        unsigned int site2,
                        unsigned int ms)
 {
-    static QMutex mutex;
-    mutex.lock();
-
-    auto *group = new QParallelAnimationGroup(this);
-
-    {
-        PersonItem *person = getPerson(personId);
-        person->show();
-        auto *animation = new QPropertyAnimation(person, "pos");
-        animation->setDuration(ms - 10);
-        animation->setStartValue(m_sitePos[site1] -
-                                 QPointF(BIKEWIDTH/2, BIKEWIDTH*1.2));
-        animation->setEndValue(m_sitePos[site2] -
-                               QPointF(BIKEWIDTH/2, BIKEWIDTH*1.2));
-        group->addAnimation(animation);
-    }
-
-    group->start();
-
-    QObject::connect(group, SIGNAL(finished()), this,
-                     SLOT(finishedAnimation()));
-
-    mutex.unlock();
-}
-
-
-void BikeDisplay::finishedVanAnimation()
-{
-    auto *animation=dynamic_cast<QPropertyAnimation*>(sender());
-    delete animation;
+    startMotion(getPerson(personId),MotionTable::Person,
+                m_sitePos[site1]-QPointF(BIKEWIDTH/2,BIKEWIDTH*1.2),
+                m_sitePos[site2]-QPointF(BIKEWIDTH/2,BIKEWIDTH*1.2),ms);
 }
 
 void BikeDisplay::setBikes(unsigned int site,unsigned int nbBike)
@@ -217,63 +297,10 @@ PersonItem *BikeDisplay::getPerson(unsigned int personId)
 
 void BikeDisplay::travel(unsigned int personId,unsigned int site1, unsigned int site2,unsigned int ms)
 {
-    static QMutex mutex;
-    mutex.lock();
-
-
-    auto *group=new QParallelAnimationGroup(this);
-
-    {
-        BikeItem *bike=getFreeBike();
-        bike->show();
-        auto *animation=new QPropertyAnimation(bike, "pos");
-        animation->setDuration(ms-10);
-        animation->setStartValue(m_sitePos[site1]-
-                                 QPointF(BIKEWIDTH/2,BIKEWIDTH/2));
-        animation->setEndValue(m_sitePos[site2]-
-                               QPointF(BIKEWIDTH/2,BIKEWIDTH/2));
-
-        group->addAnimation(animation);
-    }
-    {
-        PersonItem *person=getPerson(personId);
-        person->show();
-        auto *animation=new QPropertyAnimation(person, "pos");
-        animation->setDuration(ms-10);
-        animation->setStartValue(m_sitePos[site1]-
-                                 QPointF(BIKEWIDTH/2,BIKEWIDTH*1.2));
-        animation->setEndValue(m_sitePos[site2]-
-                               QPointF(BIKEWIDTH/2,BIKEWIDTH*1.2));
-
-        group->addAnimation(animation);
-    }
-
-    group->start();
-
-    QObject::connect(group, SIGNAL(finished()), this,
-                     SLOT(finishedAnimation()));
-
-    mutex.unlock();
-}
-
-void BikeDisplay::finishedAnimation()
-{
-    auto *group=dynamic_cast<QParallelAnimationGroup*>(sender());
-    for(int i=0;i<group->animationCount();i++) {
-        auto *animation=dynamic_cast<QPropertyAnimation*>(group->animationAt(i));
-        auto *bike=dynamic_cast<BikeItem*>(animation->targetObject());
-        if (bike) {
-            bike->hide();
-            setFreeBike(bike);
-        }
-        auto *person=dynamic_cast<PersonItem*>(animation->targetObject());
-        if (person) {
-            QPointF curPos = person->pos()+ QPointF(BIKEWIDTH/2,BIKEWIDTH*1.2);
-            float angle = rand();
-            person->setPos(curPos.x() + 40*cos(angle),curPos.y() + 40*sin(angle));
-        }
-    }
-    delete group;
+    startMotion(getFreeBike(),MotionTable::Bike,
+                m_sitePos[site1]-QPointF(BIKEWIDTH/2,BIKEWIDTH/2),
+                m_sitePos[site2]-QPointF(BIKEWIDTH/2,BIKEWIDTH/2),ms);
+    startMotion(getPerson(personId),MotionTable::Person,
+                m_sitePos[site1]-QPointF(BIKEWIDTH/2,BIKEWIDTH*1.2),
+                m_sitePos[site2]-QPointF(BIKEWIDTH/2,BIKEWIDTH*1.2),ms);
 }
-
-
@@ -0,0 +1,292 @@
+/*
+    * journal.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "journal.h"
+#include "simstats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace {
+
+uint64_t ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return nowNs();
+#endif
+}
+
+/** Records in the first buffer of a thread, 1.5 KiB. */
+const size_t firstBufferRecords = 64;
+
+struct Buffer
+{
+    // Left uninitialised: pages are only touched as records are written
+    explicit Buffer(size_t _capacity) : records(new JournalRecord[_capacity]), capacity(_capacity) {}
+
+    std::unique_ptr<JournalRecord[]> records;
+    size_t capacity;
+    size_t size = 0;
+};
+
+/**
+ * Journal state of one thread. Only the owner thread touches @c buffer
+ * while the journal is enabled.
+ */
+struct ThreadSlot
+{
+    Buffer *buffer = nullptr;
+    uint32_t agent = 0;
+};
+
+struct Registry
+{
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::vector<std::unique_ptr<Buffer>> buffers;
+    std::vector<std::unique_ptr<ThreadSlot>> slots;
+    std::deque<Buffer*> writeQueue;
+    std::vector<Buffer*> freeBuffers;
+    std::thread writer;
+    bool stopping = false;
+    int fd = -1;
+    JournalHeader header{};
+    size_t recordsPerBuffer = 0;
+    std::chrono::microseconds clockPeriod{0};
+    uint64_t writeErrors = 0;
+    /** Ticks copied in the records, refreshed by the writer every clockPeriod. */
+    std::atomic<uint64_t> clock{0};
+};
+
+Registry& registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+thread_local ThreadSlot *localSlot = nullptr;
+
+ThreadSlot *threadSlot()
+{
+    if (!localSlot)
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.slots.push_back(std::make_unique<ThreadSlot>());
+        localSlot = reg.slots.back().get();
+    }
+    return localSlot;
+}
+
+/**
+ * Returns an empty buffer of at least @p capacity records, reusing one
+ * already written if possible. Must be called with the registry mutex held.
+ */
+Buffer *takeFreeBuffer(Registry& reg, size_t capacity)
+{
+    for (size_t i = reg.freeBuffers.size(); i-- > 0;)
+    {
+        Buffer *buffer = reg.freeBuffers[i];
+        if (buffer->capacity >= capacity)
+        {
+            reg.freeBuffers.erase(reg.freeBuffers.begin() + i);
+            return buffer;
+        }
+    }
+    reg.buffers.push_back(std::make_unique<Buffer>(capacity));
+    return reg.buffers.back().get();
+}
+
+bool writeAll(int fd, const void *data, size_t size)
+{
+    const char *bytes = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        ssize_t written = ::write(fd, bytes, size);
+        if (written <= 0)
+        {
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+void writerLoop()
+{
+    Registry& reg = registry();
+    std::unique_lock<std::mutex> lock(reg.mutex);
+    while (true)
+    {
+        // Reading the tick counter costs as much as a whole station operation
+        // in a virtual machine, so the threads share one refreshed here
+        reg.clock.store(ticks(), std::memory_order_relaxed);
+        if (reg.writeQueue.empty())
+        {
+            if (reg.stopping)
+            {
+                return;
+            }
+            reg.queued.wait_for(lock, reg.clockPeriod);
+            continue;
+        }
+        Buffer *buffer = reg.writeQueue.front();
+        reg.writeQueue.pop_front();
+
+        lock.unlock();
+        bool ok = writeAll(reg.fd, buffer->records.get(), buffer->size * sizeof(JournalRecord));
+        buffer->size = 0;
+        lock.lock();
+
+        if (!ok)
+        {
+            reg.writeErrors++;
+        }
+        reg.freeBuffers.push_back(buffer);
+    }
+}
+
+}
+
+std::atomic<bool> Journal::isEnabled{false};
+
+bool Journal::open(const std::string& path, size_t recordsPerBuffer, unsigned int clockPeriodUs)
+{
+    Registry& reg = registry();
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::perror(path.c_str());
+        return false;
+    }
+
+    JournalHeader header{};
+    std::memcpy(header.magic, "PCOJRNL1", sizeof(header.magic));
+    header.recordSize = sizeof(JournalRecord);
+    header.originNs = nowNs();
+    header.originTicks = ticks();
+    reg.clock.store(header.originTicks, std::memory_order_relaxed);
+    if (!writeAll(fd, &header, sizeof(header)))
+    {
+        std::perror(path.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.fd = fd;
+        reg.header = header;
+        reg.recordsPerBuffer = recordsPerBuffer;
+        reg.clockPeriod = std::chrono::microseconds(std::max(clockPeriodUs, 1u));
+        reg.stopping = false;
+        reg.writeErrors = 0;
+    }
+    reg.writer = std::thread(writerLoop);
+    isEnabled = true;
+    return true;
+}
+
+void Journal::setAgent(uint32_t agent)
+{
+    threadSlot()->agent = agent;
+}
+
+void Journal::record(JournalOp op, unsigned int site, size_t bikeType,
+                     size_t requested, size_t result, size_t bikesAfter)
+{
+    if (!enabled())
+    {
+        return;
+    }
+    ThreadSlot *slot = threadSlot();
+    Registry& reg = registry();
+    if (!slot->buffer || slot->buffer->size == slot->buffer->capacity)
+    {
+        // Hands the full buffer to the writer and continues in a fresh one,
+        // twice as large up to recordsPerBuffer: quiet threads keep small ones
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        size_t capacity = std::min(firstBufferRecords, reg.recordsPerBuffer);
+        if (slot->buffer)
+        {
+            capacity = std::min(slot->buffer->capacity * 2, reg.recordsPerBuffer);
+            reg.writeQueue.push_back(slot->buffer);
+            reg.queued.notify_one();
+        }
+        slot->buffer = takeFreeBuffer(reg, capacity);
+    }
+
+    JournalRecord& record = slot->buffer->records[slot->buffer->size++];
+    record.ticks = reg.clock.load(std::memory_order_relaxed);
+    record.agent = slot->agent;
+    record.site = static_cast<uint16_t>(site);
+    record.op = op;
+    record.bikeType = static_cast<uint8_t>(bikeType);
+    record.requested = static_cast<uint16_t>(requested);
+    record.result = static_cast<uint16_t>(result);
+    record.bikesAfter = static_cast<uint32_t>(bikesAfter);
+}
+
+void Journal::close()
+{
+    if (!isEnabled.exchange(false))
+    {
+        return;
+    }
+
+    Registry& reg = registry();
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (const auto& slot : reg.slots)
+        {
+            if (slot->buffer && slot->buffer->size > 0)
+            {
+                reg.writeQueue.push_back(slot->buffer);
+            }
+            else if (slot->buffer)
+            {
+                reg.freeBuffers.push_back(slot->buffer);
+            }
+            slot->buffer = nullptr;
+        }
+        reg.stopping = true;
+    }
+    reg.queued.notify_one();
+    reg.writer.join();
+
+    // Calibration of the ticks, written over the header
+    reg.header.endNs = nowNs();
+    reg.header.endTicks = ticks();
+    if (::pwrite(reg.fd, &reg.header, sizeof(reg.header), 0) != sizeof(reg.header))
+    {
+        reg.writeErrors++;
+    }
+
+    if (reg.writeErrors)
+    {
+        std::fprintf(stderr, "journal: %llu write(s) failed\n",
+                     (unsigned long long)reg.writeErrors);
+    }
+    ::close(reg.fd);
+    reg.fd = -1;
+}
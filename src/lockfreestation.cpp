@@ -0,0 +1,387 @@
+/*
+    * lockfreestation.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "lockfreestation.h"
+#include "journal.h"
+#include "simstats.h"
+#include "siteindex.h"
+#include "tracer.h"
+#include "watchdog.h"
+
+#include <algorithm>
+#include <climits>
+#include <thread>
+
+LockFreeBikeStation::LockFreeBikeStation(size_t _capacity, unsigned int _id)
+    : capacity(_capacity), id(_id), freeDocks(_capacity)
+{
+    // Any type may fill the whole station
+    for (auto& queue : queues)
+    {
+        queue = std::make_unique<MpmcQueue<Bike*>>(capacity);
+    }
+    emptySince = nowNs();
+}
+
+LockFreeBikeStation::~LockFreeBikeStation()
+{
+    ending();
+}
+
+bool LockFreeBikeStation::putBike(Bike *_bike)
+{
+    return putBike(_bike, 0);
+}
+
+bool LockFreeBikeStation::putBike(Bike *_bike, uint64_t _deadlineNs)
+{
+    enter();
+    bool reserved = !shouldEnd.load(std::memory_order_relaxed) && reserveDocks(1);
+    if (!reserved && !shouldEnd.load(std::memory_order_relaxed))
+    {
+        TraceSpan span("station wait dock", id, _bike->bikeType);
+        BlockedWait blocked(WaitForDock, id, _bike->bikeType);
+        dockWaiters.fetch_add(1, std::memory_order_relaxed);
+        bool timedOut = false;
+        while (true)
+        {
+            // Registered before checking again, so a dock freed meanwhile wakes us.
+            // Also tried once past the deadline: the notification that woke us
+            // may be for a dock nobody else has been woken for.
+            uint32_t key = dockFreed.prepareWait();
+            reserved = reserveDocks(1);
+            if (reserved || timedOut || shouldEnd.load(std::memory_order_seq_cst))
+            {
+                dockFreed.cancelWait();
+                break;
+            }
+            leave();
+            dockFreed.wait(key, _deadlineNs);
+            enter();
+            timedOut = _deadlineNs && nowNs() >= _deadlineNs;
+        }
+        dockWaiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    if (reserved)
+    {
+        store(_bike);
+    }
+    size_t bikesAfter = nbBikes();
+    leave();
+    Journal::record(JournalPutBike, id, _bike->bikeType, 1, reserved ? 1 : 0, bikesAfter);
+    return reserved;
+}
+
+Bike *LockFreeBikeStation::getBike(size_t _bikeType)
+{
+    return getBike(_bikeType, 0, false);
+}
+
+Bike *LockFreeBikeStation::getBike(size_t _bikeType, uint64_t _deadlineNs, bool _anyType)
+{
+    enter();
+    Bike *bike = shouldEnd.load(std::memory_order_relaxed) ? nullptr : take(_bikeType);
+    if (!bike && !shouldEnd.load(std::memory_order_relaxed))
+    {
+        TraceSpan span("station wait bike", id, _bikeType);
+        BlockedWait blocked(WaitForBike, id, _bikeType);
+        bikeWaiters.fetch_add(1, std::memory_order_relaxed);
+        bool timedOut = false;
+        while (true)
+        {
+            // Tried once past the deadline too, as in putBike()
+            uint32_t key = bikeAdded[_bikeType].prepareWait();
+            bike = take(_bikeType);
+            if (bike || timedOut || shouldEnd.load(std::memory_order_seq_cst))
+            {
+                bikeAdded[_bikeType].cancelWait();
+                break;
+            }
+            leave();
+            bikeAdded[_bikeType].wait(key, _deadlineNs);
+            enter();
+            timedOut = _deadlineNs && nowNs() >= _deadlineNs;
+        }
+        bikeWaiters.fetch_sub(1, std::memory_order_relaxed);
+
+        // On timeout, the first non-empty type if another one is accepted
+        for (size_t type = 0; !bike && _anyType && !shouldEnd.load(std::memory_order_relaxed) &&
+                              type < Bike::nbBikeTypes; ++type)
+        {
+            bike = take(type);
+        }
+    }
+
+    size_t bikesAfter = nbBikes();
+    leave();
+    // The type taken, which differs from the one asked after a fallback
+    Journal::record(JournalGetBike, id, bike ? bike->bikeType : _bikeType, 1, bike ? 1 : 0, bikesAfter);
+    return bike;
+}
+
+std::vector<Bike *> LockFreeBikeStation::addBikes(std::vector<Bike *> _bikesToAdd)
+{
+    enter();
+    size_t reserved = reserveDocks(_bikesToAdd.size());
+    for (size_t i = 0; i < reserved; ++i)
+    {
+        store(_bikesToAdd[i]);
+    }
+    size_t bikesAfter = nbBikes();
+    leave();
+    Journal::record(JournalAddBikes, id, 0xff, _bikesToAdd.size(), reserved, bikesAfter);
+    return std::vector<Bike *>(_bikesToAdd.begin() + reserved, _bikesToAdd.end());
+}
+
+std::vector<Bike *> LockFreeBikeStation::getBikes(size_t _nbBikes)
+{
+    std::vector<Bike *> result;
+    enter();
+    bool typeRanOut = false;
+    for (size_t type = 0; type < Bike::nbBikeTypes && result.size() < _nbBikes; type++)
+    {
+        Bike *bike;
+        while (result.size() < _nbBikes && queues[type]->pop(bike))
+        {
+            result.push_back(bike);
+            typeRanOut |= typeCounts[type].fetch_sub(1, std::memory_order_relaxed) == 1;
+        }
+    }
+    if (typeRanOut)
+    {
+        publishOccupancy();
+    }
+    if (!result.empty())
+    {
+        releaseDocks(result.size());
+    }
+    size_t bikesAfter = nbBikes();
+    leave();
+    Journal::record(JournalGetBikes, id, 0xff, _nbBikes, result.size(), bikesAfter);
+    return result;
+}
+
+size_t LockFreeBikeStation::reserveDocks(size_t count)
+{
+    size_t free = freeDocks.load(std::memory_order_relaxed);
+    size_t reserved = 0;
+    do
+    {
+        reserved = std::min(free, count);
+        if (!reserved)
+        {
+            return 0;
+        }
+    } while (!freeDocks.compare_exchange_weak(free, free - reserved, std::memory_order_acq_rel,
+                                              std::memory_order_relaxed));
+    if (free == capacity || free == reserved)
+    {
+        publishOccupancy();
+    }
+    return reserved;
+}
+
+void LockFreeBikeStation::releaseDocks(size_t count)
+{
+    size_t free = freeDocks.fetch_add(count, std::memory_order_acq_rel);
+    if (free == 0 || free + count == capacity)
+    {
+        publishOccupancy();
+    }
+    dockFreed.notify(int(count));
+}
+
+void LockFreeBikeStation::store(Bike *bike)
+{
+    size_t type = bike->bikeType;
+    // Counted first, so that the count never falls below the queue size
+    bool typeAppears = typeCounts[type].fetch_add(1, std::memory_order_relaxed) == 0;
+    while (!queues[type]->push(bike))
+    {
+        // The dock is reserved: only a pop still writing its cell is in the way
+        std::this_thread::yield();
+    }
+    if (typeAppears)
+    {
+        publishOccupancy();
+    }
+    bikeAdded[type].notify(1);
+}
+
+Bike *LockFreeBikeStation::take(size_t type)
+{
+    Bike *bike;
+    if (!queues[type]->pop(bike))
+    {
+        return nullptr;
+    }
+    if (typeCounts[type].fetch_sub(1, std::memory_order_relaxed) == 1)
+    {
+        publishOccupancy();
+    }
+    releaseDocks(1);
+    return bike;
+}
+
+void LockFreeBikeStation::publishOccupancy()
+{
+    bookkeeping.lock();
+    // Read under the lock: the last thread to get here sees the last change
+    size_t total = capacity - freeDocks.load(std::memory_order_acquire);
+    if (availability)
+    {
+        uint32_t flags = total < capacity ? SiteFreeDock : 0;
+        for (size_t i = 0; i < Bike::nbBikeTypes; i++)
+        {
+            flags |= typeCounts[i].load(std::memory_order_relaxed) ? siteTypeFlag(i) : 0;
+        }
+        if (flags != availabilityPublished)
+        {
+            availability->store(flags, std::memory_order_relaxed);
+            availabilityPublished = flags;
+        }
+    }
+
+    bool isEmpty = total == 0;
+    bool isFull = total >= capacity;
+    uint64_t emptyStart = emptySince.load(std::memory_order_relaxed);
+    uint64_t fullStart = fullSince.load(std::memory_order_relaxed);
+    if (isEmpty != (emptyStart != 0) || isFull != (fullStart != 0))
+    {
+        uint64_t now = nowNs();
+        if (isEmpty && !emptyStart)
+        {
+            emptySince.store(now, std::memory_order_relaxed);
+        }
+        else if (!isEmpty && emptyStart)
+        {
+            emptyNs.fetch_add(now - emptyStart, std::memory_order_relaxed);
+            emptySince.store(0, std::memory_order_relaxed);
+        }
+        if (isFull && !fullStart)
+        {
+            fullSince.store(now, std::memory_order_relaxed);
+        }
+        else if (!isFull && fullStart)
+        {
+            fullNs.fetch_add(now - fullStart, std::memory_order_relaxed);
+            fullSince.store(0, std::memory_order_relaxed);
+        }
+    }
+    bookkeeping.unlock();
+}
+
+void LockFreeBikeStation::enter()
+{
+    active.fetch_add(1, std::memory_order_seq_cst);
+    while (frozen.load(std::memory_order_seq_cst))
+    {
+        leave();
+        futexWait(&frozen, 1);
+        active.fetch_add(1, std::memory_order_seq_cst);
+    }
+}
+
+void LockFreeBikeStation::leave()
+{
+    if (active.fetch_sub(1, std::memory_order_seq_cst) == 1 && frozen.load(std::memory_order_seq_cst))
+    {
+        futexWake(&active, 1);
+    }
+}
+
+void LockFreeBikeStation::freeze()
+{
+    frozen.store(1, std::memory_order_seq_cst);
+    for (uint32_t ongoing; (ongoing = active.load(std::memory_order_seq_cst)) != 0;)
+    {
+        futexWait(&active, ongoing);
+    }
+}
+
+void LockFreeBikeStation::thaw()
+{
+    frozen.store(0, std::memory_order_seq_cst);
+    futexWake(&frozen, INT_MAX);
+}
+
+std::vector<Bike *> LockFreeBikeStation::contents() const
+{
+    std::vector<Bike *> result;
+    for (const auto& queue : queues)
+    {
+        queue->forEach([&result](Bike *bike) { result.push_back(bike); });
+    }
+    return result;
+}
+
+size_t LockFreeBikeStation::countBikesOfType(size_t type) const
+{
+    return typeCounts[type].load(std::memory_order_relaxed);
+}
+
+size_t LockFreeBikeStation::nbBikes() const
+{
+    return capacity - freeDocks.load(std::memory_order_relaxed);
+}
+
+size_t LockFreeBikeStation::nbSlots() const
+{
+    return capacity;
+}
+
+size_t LockFreeBikeStation::nbWaitingForBike() const
+{
+    return bikeWaiters.load(std::memory_order_relaxed);
+}
+
+size_t LockFreeBikeStation::nbWaitingForDock() const
+{
+    return dockWaiters.load(std::memory_order_relaxed);
+}
+
+unsigned int LockFreeBikeStation::siteId() const
+{
+    return id;
+}
+
+uint64_t LockFreeBikeStation::emptyTimeNs() const
+{
+    uint64_t since = emptySince.load(std::memory_order_relaxed);
+    uint64_t total = emptyNs.load(std::memory_order_relaxed);
+    return since ? total + (nowNs() - since) : total;
+}
+
+uint64_t LockFreeBikeStation::fullTimeNs() const
+{
+    uint64_t since = fullSince.load(std::memory_order_relaxed);
+    uint64_t total = fullNs.load(std::memory_order_relaxed);
+    return since ? total + (nowNs() - since) : total;
+}
+
+void LockFreeBikeStation::wakeTimedWaiters()
+{
+    // Timed waits sleep with a timeout of their own
+}
+
+void LockFreeBikeStation::publishAvailability(std::atomic<uint32_t> *_flags)
+{
+    bookkeeping.lock();
+    availability = _flags;
+    availabilityPublished = ~uint32_t(0);
+    bookkeeping.unlock();
+    publishOccupancy();
+}
+
+void LockFreeBikeStation::ending()
+{
+    shouldEnd.store(true, std::memory_order_seq_cst);
+    for (FutexEventCount& added : bikeAdded)
+    {
+        added.notifyAll();
+    }
+    dockFreed.notifyAll();
+}
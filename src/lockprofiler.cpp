@@ -0,0 +1,135 @@
+/*
+    * lockprofiler.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "lockprofiler.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct Registry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<LockProfile>> profiles;
+};
+
+Registry& registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+}
+
+LockProfile *LockProfiler::createProfile()
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.profiles.push_back(std::make_unique<LockProfile>());
+    return reg.profiles.back().get();
+}
+
+void LockProfiler::printReport(FILE *file)
+{
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    if (reg.profiles.empty())
+    {
+        return;
+    }
+
+    struct Row
+    {
+        const LockProfile *profile;
+        HistogramSnapshot acquire;
+        HistogramSnapshot hold;
+        HistogramSnapshot waiters;
+        HistogramSnapshot wake;
+    };
+    std::vector<Row> rows;
+    for (const auto& profile : reg.profiles)
+    {
+        rows.push_back(Row{profile.get(), profile->acquireNs.snapshot(), profile->holdNs.snapshot(),
+                           profile->waitersAtAcquire.snapshot(), profile->wakeNs.snapshot()});
+    }
+    std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+        return a.acquire.sum + a.wake.sum > b.acquire.sum + b.wake.sum;
+    });
+
+    std::fprintf(file, "\nLock contention, ranked by lost time (acquire + wake latency)\n");
+    std::fprintf(file, "%6s %10s %10s %11s %11s %11s %11s %9s %11s %9s\n",
+                 "site", "lost ms", "acquires", "acq p50 us", "acq p99 us", "hold p50 us", "hold p99 us",
+                 "waiters", "wake p99 us", "futile");
+    for (const Row& row : rows)
+    {
+        double meanWaiters = row.waiters.count ? double(row.waiters.sum) / row.waiters.count : 0.0;
+        std::fprintf(file, "%6d %10.1f %10llu %11.1f %11.1f %11.1f %11.1f %9.2f %11.1f %9llu\n",
+                     row.profile->site, (row.acquire.sum + row.wake.sum) / 1e6,
+                     (unsigned long long)row.acquire.count,
+                     row.acquire.percentile(50) / 1e3, row.acquire.percentile(99) / 1e3,
+                     row.hold.percentile(50) / 1e3, row.hold.percentile(99) / 1e3,
+                     meanWaiters, row.wake.percentile(99) / 1e3,
+                     (unsigned long long)row.profile->futileWakeups.load(std::memory_order_relaxed));
+    }
+}
+
+ProfiledMutex::ProfiledMutex() : stats(LockProfiler::createProfile())
+{
+}
+
+void ProfiledMutex::lock()
+{
+    uint64_t start = nowNs();
+    stats->waitersAtAcquire.record(stats->blockedNow.fetch_add(1, std::memory_order_relaxed));
+    mutex.lock();
+    stats->blockedNow.fetch_sub(1, std::memory_order_relaxed);
+    lockedAt = nowNs();
+    holderWoken = false;
+    stats->acquireNs.record(lockedAt - start);
+}
+
+void ProfiledMutex::unlock()
+{
+    stats->holdNs.record(nowNs() - lockedAt);
+    holderWoken = false;
+    mutex.unlock();
+}
+
+void ProfiledConditionVariable::wait(ProfiledMutex *mutex)
+{
+    LockProfile *stats = mutex->stats;
+    if (mutex->holderWoken)
+    {
+        // Woken up, found nothing to do, and going back to sleep
+        stats->futileWakeups.fetch_add(1, std::memory_order_relaxed);
+    }
+    stats->holdNs.record(nowNs() - mutex->lockedAt);
+
+    condition.wait(&mutex->mutex);
+
+    uint64_t now = nowNs();
+    uint64_t notified = notifiedAt.load(std::memory_order_relaxed);
+    if (notified && notified <= now)
+    {
+        stats->wakeNs.record(now - notified);
+    }
+    mutex->lockedAt = now;
+    mutex->holderWoken = true;
+}
+
+void ProfiledConditionVariable::notifyOne()
+{
+    notifiedAt.store(nowNs(), std::memory_order_relaxed);
+    condition.notifyOne();
+}
+
+void ProfiledConditionVariable::notifyAll()
+{
+    notifiedAt.store(nowNs(), std::memory_order_relaxed);
+    condition.notifyAll();
+}
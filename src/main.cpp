@@ -15,31 +15,136 @@
 
 #include <QApplication>
 #include "bikinginterface.h"
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
-#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <string>
 
 #include "person.h"
-#include "van.h"
 #include "bikestation.h"
 #include "config.h"
+#include "simcontext.h"
+#include "tracer.h"
+#include "journal.h"
+#include "occupancy.h"
+#include "tripreader.h"
+#include "snapshot.h"
+#include "telemetry.h"
+#include "workload.h"
+#include "lockprofiler.h"
 
-#include <pcosynchro/pcothread.h>
+SimContext* globalContext = nullptr;
 
-std::array<BikeStation*, NB_SITES_TOTAL>* globalStations = nullptr;
-std::vector<std::unique_ptr<PcoThread>>* globalThreads = nullptr;
+namespace {
 
-// Should stop all threads and release waiting ones
-void stopSimulation() {
-    if (globalThreads) {
-        for (auto& thread : *globalThreads) {
-            thread->requestStop();
-        }
+/**
+ * Command line options that are not simulation parameters, see SimConfig
+ * for the others.
+ */
+struct Options {
+    std::string tracePath;        // --trace <file.json>
+    std::string journalPath;      // --journal <file>
+    std::string restorePath;      // --restore <file>, state to start from
+    std::string checkpointPath;   // --checkpoint <file>, state saved at the end
+    std::string replayPath;       // --replay <trips.csv>
+    double replaySpeed = 1;       // --replay-speed <x>
+    std::string profile;          // --profile <name|file>
+    double profileSpeed = 1;      // --profile-speed <x>
+    std::string sitesPath;        // --sites <file>
+    std::string telemetryName;    // --telemetry <name>, for pco_biking_top
+    std::string occupancyPath;    // --occupancy <file>, for pco_biking_occupancy
+    unsigned int occupancyMs = 10; // --occupancy-ms <ms>
+};
+
+/**
+ * Reads every option in one pass, in any order.
+ *
+ * @return false on an unknown option, a missing or invalid value.
+ */
+bool parseOptions(int argc, char* argv[], Options& options, SimConfig& config) {
+    if (argc % 2 == 0) {
+        return false;
     }
-    if (globalStations) {
-        for (auto& station : *globalStations) {
-            station->ending();
+    try {
+        for (int i = 1; i + 1 < argc; i += 2) {
+            std::string arg = argv[i];
+            std::string value = argv[i + 1];
+            if (arg == "--trace") {
+                options.tracePath = value;
+            }
+            else if (arg == "--journal") {
+                options.journalPath = value;
+            }
+            else if (arg == "--restore") {
+                options.restorePath = value;
+            }
+            else if (arg == "--checkpoint") {
+                options.checkpointPath = value;
+            }
+            else if (arg == "--replay") {
+                options.replayPath = value;
+            }
+            else if (arg == "--replay-speed") {
+                options.replaySpeed = std::stod(value);
+            }
+            else if (arg == "--profile") {
+                options.profile = value;
+            }
+            else if (arg == "--profile-speed") {
+                options.profileSpeed = std::stod(value);
+            }
+            else if (arg == "--sites") {
+                options.sitesPath = value;
+            }
+            else if (arg == "--telemetry") {
+                options.telemetryName = value;
+            }
+            else if (arg == "--occupancy") {
+                options.occupancyPath = value;
+            }
+            else if (arg == "--occupancy-ms") {
+                options.occupancyMs = std::stoul(value);
+            }
+            else if (arg == "--stall-ms") {
+                config.stallMs = std::stoul(value);
+            }
+            else if (arg == "--max-wait-ms") {
+                config.policy.maxWaitMs = std::stoul(value);
+            }
+            else if (arg == "--station") {
+                if (!parseStationKind(value, config.station)) {
+                    return false;
+                }
+            }
+            else if (arg == "--fallbacks") {
+                if (!parseRiderFallbacks(value, config.policy)) {
+                    return false;
+                }
+            }
+            else {
+                return false;
+            }
         }
     }
+    catch (const std::exception&) {
+        // std::stoul and std::stod on a value that is not a number
+        return false;
+    }
+    return options.replaySpeed > 0 && options.profileSpeed > 0 && options.occupancyMs > 0;
+}
+
+}
+
+// Should stop all threads and release waiting ones, without waiting for
+// any of them: the control agent does the stop
+void stopSimulation() {
+    if (globalContext) {
+        globalContext->control.post(ControlCommand{ControlStop, 0});
+    }
+    // Nothing is written to disk before this point
+    Tracer::writeAndDisable();
 }
 
 
@@ -58,76 +163,130 @@ int main(int argc, char* argv[]) {
     }
 
     QApplication a(argc, argv);
-    std::vector<std::unique_ptr<PcoThread>> threads;
-    std::array<BikeStation*, NB_SITES_TOTAL> bikeStations;
 
-    // Init of GUI
-    BikingInterface::initialize(NBPEOPLE, NBSITES);
-    auto* binkingInterface = new BikingInterface();
-
-    // Create bikes stations with BORNES slots
-    for (size_t s = 0; s < NBSITES; ++s) {
-        bikeStations[s] = new BikeStation(BORNES);
+    Options options;
+    SimConfig config;
+    if (!parseOptions(argc, argv, options, config)) {
+        std::fprintf(stderr, "Usage: %s [--trace file] [--journal file] [--restore snapshot] [--checkpoint snapshot]\n"
+                             "          [--replay trips.csv] [--replay-speed x] [--profile name|file] [--profile-speed x]\n"
+                             "          [--sites file] [--telemetry name] [--stall-ms ms] [--station pco|spin|lockfree]\n"
+                             "          [--max-wait-ms ms] [--fallbacks none|type+walk+dock]\n"
+                             "          [--occupancy file] [--occupancy-ms ms]\n",
+                     argv[0]);
+        return 1;
     }
 
-    // Create depot with NB_BIKES slots
-    bikeStations[DEPOT_ID] = new BikeStation(NB_BIKES);
+    if (!options.tracePath.empty()) {
+        Tracer::enable(options.tracePath);
+    }
+    if (!options.journalPath.empty() && !Journal::open(options.journalPath)) {
+        return 1;
+    }
 
-    // Create all bikes
-    std::vector<Bike*> allBikes;
-    allBikes.reserve(NB_BIKES);
-    for (size_t i = 0; i < NB_BIKES; ++i) {
-        auto* bike = new Bike;
-        bike->bikeType = i % Bike::nbBikeTypes;
-        allBikes.push_back(bike);
+    std::unique_ptr<TripReader> trips;
+    if (!options.replayPath.empty()) {
+        trips = std::make_unique<TripReader>();
+        if (!trips->open(options.replayPath, options.replaySpeed)) {
+            return 1;
+        }
     }
 
-    // Distribute bikes to stations
-    size_t idx = 0;
-    for (size_t s = 0; s < NBSITES; ++s) {
-        std::vector<Bike*> chunk;
-        for (size_t k = 0; k < BORNES - 2; ++k) {
-            chunk.push_back(allBikes[idx++]);
+    std::unique_ptr<WorkloadProfile> workload;
+    if (!options.profile.empty()) {
+        workload = std::make_unique<WorkloadProfile>();
+        if (!workload->load(options.profile, options.profileSpeed)) {
+            return 1;
         }
+    }
 
-        bikeStations[s]->addBikes(chunk);
-        binkingInterface->setInitBikes(s, chunk.size());
+    // Sites on a circle without --sites
+    if (!options.sitesPath.empty() && !loadSiteLayout(options.sitesPath, NBSITES, config.sites)) {
+        return 1;
     }
 
-    // Remaining bikes go to depot
-    std::vector<Bike*> depotBikes;
-    for (; idx < allBikes.size(); ++idx) {
-        depotBikes.push_back(allBikes[idx]);
+    std::unique_ptr<Telemetry> telemetry;
+    if (!options.telemetryName.empty()) {
+        telemetry = std::make_unique<Telemetry>();
+        if (!telemetry->open(options.telemetryName)) {
+            return 1;
+        }
     }
-    bikeStations[DEPOT_ID]->addBikes(depotBikes);
-    binkingInterface->setInitBikes(DEPOT_ID, depotBikes.size());
 
-    // Setting up pointer for interfaces
-    Person::setInterface(binkingInterface);
-    Van::setInterface(binkingInterface);
+    // Init of GUI
+    BikingInterface::initialize(NBPEOPLE, NBSITES, config.sites);
+    auto* binkingInterface = new BikingInterface();
 
-    // Setting up pointer for stations
-    Person::setStations(bikeStations);
-    Van::setStations(bikeStations);
+    Snapshot snapshot;
+    if (!options.restorePath.empty()) {
+        if (!snapshot.load(options.restorePath) || snapshot.riders.size() > NBPEOPLE) {
+            std::fprintf(stderr, "%s: cannot restore this snapshot\n", options.restorePath.c_str());
+            return 1;
+        }
+        // Bikes added from the depot buttons must still fit in the depot
+        config.nbBikes = std::max(config.nbBikes, snapshot.bikes.size());
+    }
 
-    globalStations = &bikeStations;
-    globalThreads = &threads;
+    OccupancyRecorder occupancy;
 
-    // Starting people and van threads
-    for(size_t i = 0; i <= NBPEOPLE; ++i){
-        if(i == 0) {
-            threads.emplace_back(std::make_unique<PcoThread>(&Van::run, new Van(i)));
-            continue;
+    // Stations, bikes and agents all live in the context
+    SimContext context(config);
+    context.interface = binkingInterface;
+    context.trips = trips.get();
+    context.workload = workload.get();
+    context.telemetry = telemetry.get();
+    if (!options.occupancyPath.empty()) {
+        std::vector<uint32_t> capacities;
+        for (const BikeStation* station : context.stations) {
+            capacities.push_back(uint32_t(station->nbSlots()));
         }
+        if (!occupancy.open(options.occupancyPath, capacities, Bike::nbBikeTypes, options.occupancyMs * 1000)) {
+            return 1;
+        }
+        context.occupancy = &occupancy;
+    }
 
-        threads.emplace_back(std::make_unique<PcoThread>(&Person::run, new Person(i)));
-        binkingInterface->setInitPerson(0, i);
+    if (!options.restorePath.empty()) {
+        if (!context.restore(snapshot)) {
+            std::fprintf(stderr, "%s: cannot restore this snapshot\n", options.restorePath.c_str());
+            return 1;
+        }
+    }
+    else {
+        context.populate();
     }
+    for (size_t s = 0; s < NB_SITES_TOTAL; ++s) {
+        binkingInterface->setInitBikes(s, context.stations[s]->nbBikes());
+    }
+    for (const Person* person : context.riders) {
+        RiderState state = person->state();
+        binkingInterface->setInitPerson(state.site, state.id);
+    }
+
+    globalContext = &context;
+
+    // Starting people and van threads
+    context.start();
 
     int ret = a.exec();
 
-    for (auto& thread : threads) {
-        thread->join();
+    context.join();
+    globalContext = nullptr;
+    Tracer::writeAndDisable();
+    Journal::close();
+    occupancy.close();
+
+    if (!options.checkpointPath.empty()) {
+        Snapshot::capture(context).save(options.checkpointPath);
+    }
+
+    std::vector<const RiderStats*> riderStats;
+    for (const Person* person : context.riders) {
+        riderStats.push_back(&person->riderStats());
+    }
+    printRiderReport(stdout, riderStats);
+    LockProfiler::printReport(stdout);
+    if (trips) {
+        trips->printReport(stdout);
     }
 
     return ret;
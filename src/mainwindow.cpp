@@ -13,11 +13,10 @@
 
 #define min(a,b) ((a<b)?(a):(b))
 
-extern std::array<BikeStation*, NB_SITES_TOTAL>* globalStations;
-
 extern void stopSimulation();
 
 MainWindow::MainWindow(unsigned int nbConsoles,unsigned int nbSite,
+                       const std::vector<SitePoint> &sitePositions,
                        QWidget *parent)
     : QMainWindow(parent)
 {
@@ -41,9 +40,14 @@ MainWindow::MainWindow(unsigned int nbConsoles,unsigned int nbSite,
 
     for(unsigned int i=0;i<nbConsoles;i++)
         setConsoleTitle(i,QString("Console number : %1").arg(i));
-    m_display=new BikeDisplay(nbSite,this);
+    m_display=new BikeDisplay(nbSite,sitePositions,this);
     setCentralWidget(m_display);
 
+    m_dashboard=new DashboardWidget(this);
+    m_dashboardDock=new QDockWidget("Dashboard",this);
+    m_dashboardDock->setWidget(m_dashboard);
+    this->addDockWidget(Qt::BottomDockWidgetArea,m_dashboardDock);
+
     QToolBar* toolbar = addToolBar("Controls");
 
     QAction* stopAction = toolbar->addAction("Stop simulation");
@@ -81,36 +85,17 @@ void MainWindow::onStopClicked()
 
 void MainWindow::onDepotPlusClicked()
 {
-    if (!globalStations) return;
-
-    BikeStation* depot = (*globalStations)[DEPOT_ID];
-
-    // Create a new bike and add it to the depot
-    auto* bike = new Bike;
-    static thread_local std::mt19937_64 rng(std::random_device{}());
-    std::uniform_int_distribution<size_t> dist(0, Bike::nbBikeTypes - 1);
-    bike->bikeType = dist(rng);
+    if (!globalContext) return;
 
-    depot->putBike(bike);
-
-    // Update GUI directly
-    m_display->setBikes(DEPOT_ID, depot->nbBikes());
+    // Applied by the control agent, which also updates the display
+    globalContext->control.post(ControlCommand{ControlAddDepotBikes, 1});
 }
 
 void MainWindow::onDepotMinusClicked()
 {
-    if (!globalStations) return;
-
-    BikeStation* depot = (*globalStations)[DEPOT_ID];
-
-    // Try to remove one bike from depot
-    auto bikes = depot->getBikes(1);
-    if (!bikes.empty()) {
-        delete bikes[0]; // bike is no longer in any station, we can delete it
-    }
+    if (!globalContext) return;
 
-    // Update GUI
-    m_display->setBikes(DEPOT_ID, depot->nbBikes());
+    globalContext->control.post(ControlCommand{ControlRemoveDepotBikes, 1});
 }
 
 void MainWindow::walk(unsigned int personId,
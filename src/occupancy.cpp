@@ -0,0 +1,221 @@
+/*
+    * occupancy.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "occupancy.h"
+#include "simstats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+void putVarint(std::vector<uint8_t>& bytes, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        bytes.push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    bytes.push_back(uint8_t(value));
+}
+
+uint64_t zigzag(int64_t value)
+{
+    return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+bool writeAll(int fd, const void *data, size_t size)
+{
+    const char *bytes = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        ssize_t written = ::write(fd, bytes, size);
+        if (written <= 0)
+        {
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+}
+
+OccupancyRecorder::~OccupancyRecorder()
+{
+    close();
+}
+
+bool OccupancyRecorder::open(const std::string& path, const std::vector<uint32_t>& capacities, size_t nbTypes,
+                             unsigned int periodUs, size_t _rowsPerBlock)
+{
+    int file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0)
+    {
+        std::perror(path.c_str());
+        return false;
+    }
+
+    header = OccupancyHeader{};
+    std::memcpy(header.magic, "PCOOCC1", sizeof(header.magic));
+    header.nbSites = uint32_t(capacities.size());
+    header.nbTypes = uint32_t(nbTypes);
+    header.periodUs = std::max(periodUs, 1u);
+    header.rowsPerBlock = uint32_t(std::max<size_t>(_rowsPerBlock, 1));
+    header.originNs = nowNs();
+    // The final header is written at close(), the placeholder only reserves room
+    if (!writeAll(file, &header, sizeof(header)) ||
+        !writeAll(file, capacities.data(), capacities.size() * sizeof(uint32_t)))
+    {
+        std::perror(path.c_str());
+        ::close(file);
+        return false;
+    }
+
+    columns.assign(capacities.size() * nbTypes, Column());
+    rowsPerBlock = header.rowsPerBlock;
+    rows = 0;
+    blockFirstRow = 0;
+    fd = file;
+    stopping = false;
+    writeErrors = 0;
+    writer = std::thread(&OccupancyRecorder::writerLoop, this);
+    return true;
+}
+
+uint64_t OccupancyRecorder::rowsDue(uint64_t now) const
+{
+    if (now < header.originNs)
+    {
+        return 1;
+    }
+    return (now - header.originNs) / (uint64_t(header.periodUs) * 1000) + 1;
+}
+
+void OccupancyRecorder::append(const uint32_t *values, uint64_t count)
+{
+    if (!isOpen())
+    {
+        return;
+    }
+    while (count > 0)
+    {
+        // Rows never straddle two blocks
+        uint64_t taken = std::min<uint64_t>(count, rowsPerBlock - (rows - blockFirstRow));
+        for (size_t c = 0; c < columns.size(); ++c)
+        {
+            Column& column = columns[c];
+            if (column.length && column.value != values[c])
+            {
+                putVarint(column.bytes, zigzag(int64_t(column.value) - int64_t(column.previous)));
+                putVarint(column.bytes, column.length);
+                column.previous = column.value;
+                column.length = 0;
+            }
+            column.value = values[c];
+            column.length += taken;
+        }
+        rows += taken;
+        count -= taken;
+        if (rows - blockFirstRow == rowsPerBlock)
+        {
+            seal();
+        }
+    }
+}
+
+void OccupancyRecorder::seal()
+{
+    if (rows == blockFirstRow)
+    {
+        return;
+    }
+    auto block = std::make_unique<Block>();
+    block->sizes.reserve(columns.size());
+    size_t payload = 0;
+    for (Column& column : columns)
+    {
+        putVarint(column.bytes, zigzag(int64_t(column.value) - int64_t(column.previous)));
+        putVarint(column.bytes, column.length);
+        payload += column.bytes.size();
+    }
+    block->payload.reserve(payload);
+    for (Column& column : columns)
+    {
+        block->sizes.push_back(uint32_t(column.bytes.size()));
+        block->payload.insert(block->payload.end(), column.bytes.begin(), column.bytes.end());
+        // Blocks decode on their own: the next one starts again from 0
+        column.bytes.clear();
+        column.previous = 0;
+        column.length = 0;
+    }
+    block->header.magic = OCCUPANCY_BLOCK_MAGIC;
+    block->header.nbRows = uint32_t(rows - blockFirstRow);
+    block->header.firstRow = blockFirstRow;
+    block->header.payloadBytes = block->sizes.size() * sizeof(uint32_t) + block->payload.size();
+    blockFirstRow = rows;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    writeQueue.push_back(std::move(block));
+    queued.notify_one();
+}
+
+void OccupancyRecorder::writerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        queued.wait(lock, [this]() { return !writeQueue.empty() || stopping; });
+        if (writeQueue.empty())
+        {
+            return;
+        }
+        std::unique_ptr<Block> block = std::move(writeQueue.front());
+        writeQueue.pop_front();
+
+        lock.unlock();
+        bool ok = writeAll(fd, &block->header, sizeof(block->header)) &&
+                  writeAll(fd, block->sizes.data(), block->sizes.size() * sizeof(uint32_t)) &&
+                  writeAll(fd, block->payload.data(), block->payload.size());
+        lock.lock();
+
+        if (!ok)
+        {
+            writeErrors++;
+        }
+    }
+}
+
+void OccupancyRecorder::close()
+{
+    if (!isOpen())
+    {
+        return;
+    }
+    seal();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queued.notify_one();
+    writer.join();
+
+    header.nbRows = rows;
+    if (::pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+    {
+        writeErrors++;
+    }
+    if (writeErrors)
+    {
+        std::fprintf(stderr, "occupancy: %llu write(s) failed\n", (unsigned long long)writeErrors);
+    }
+    ::close(fd);
+    fd = -1;
+}
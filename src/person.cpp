@@ -5,32 +5,47 @@
 
 #include "person.h"
 #include "bike.h"
+#include "simstats.h"
+#include "tracer.h"
+#include "journal.h"
+#include <algorithm>
 #include <random>
+#include <string>
 
-BikingInterface* Person::binkingInterface = nullptr;
-std::array<BikeStation*, NB_SITES_TOTAL> Person::stations{};
 
+namespace {
 
-Person::Person(unsigned int _id) : id(_id), homeSite(0), currentSite(0) {
+size_t randomBikeType() {
     static thread_local std::mt19937_64 rng(std::random_device{}());
     std::uniform_int_distribution<size_t> dist(0, Bike::nbBikeTypes - 1);
-    preferredType = dist(rng);
+    return dist(rng);
+}
+
+}
 
-    if (binkingInterface) {
+Person::Person(SimContext* _context, unsigned int _id)
+    : id(_id), preferredType(randomBikeType()), homeSite(0), currentSite(0),
+      stats(preferredType), context(_context) {
+    if (context->interface) {
         log(QString("Person %1, préfère type %2")
                 .arg(id).arg(preferredType));
     }
 }
 
-void Person::setStations(const std::array<BikeStation*, NB_SITES_TOTAL>& _stations){
-    Person::stations = _stations;
-}
-
-void Person::setInterface(BikingInterface* _binkingInterface) {
-    binkingInterface = _binkingInterface;
+Person::Person(SimContext* _context, const RiderState& _state, Bike* _bike)
+    : id(_state.id), preferredType(_state.preferredType), homeSite(0), currentSite(_state.site),
+      phase(RiderPhase(_state.phase)), destination(_state.destination),
+      resumeMs(_state.remainingMs), rng(_state.rngSeed, _state.rngDraws),
+      holding(_bike), stats(preferredType), context(_context) {
+    if (_bike) {
+        context->stats.bikesInTransit.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (context->interface) {
+        log(QString("Person %1, préfère type %2, reprise au site %3")
+                .arg(id).arg(preferredType).arg(currentSite));
+    }
 }
 
-
 void Person::run() {
     /*
     Boucle infinie
@@ -41,84 +56,346 @@ void Person::run() {
         5. i ←k
     Fin de la boucle
     */
+    Tracer::setThreadName("Person " + std::to_string(id));
+    Journal::setAgent(id);
+    context->watchdog.attach(id);
+    if (!resume()) {
+        stoppedNs = nowNs();
+        return;
+    }
+    if (context->trips) {
+        replay();
+        return;
+    }
+    stats.begin();
     while(!PcoThread::thisThread()->stopRequested()){
+        if (!waitUntilActive()) {
+            break;
+        }
+        unsigned int origin = currentSite;
         unsigned int bikeDestination = chooseOtherSite(currentSite);
-        Bike* bike = takeBikeFromSite(currentSite);
+        phase = WaitBike;
+        uint64_t t0 = nowNs();
+        Bike* bike = takeBikeWithPolicy();
         if (bike == nullptr) {
             break;
         }
+        if (bikeDestination == currentSite) {
+            // Walked to the destination to find a bike
+            bikeDestination = chooseOtherSite(currentSite);
+        }
+        uint64_t t1 = nowNs();
+        stats.record(WaitBike, origin, t1 - t0);
+        phase = Ride;
+        destination = bikeDestination;
         bikeTo(bikeDestination, bike);
-        depositBikeAtSite(bikeDestination, bike);
-        currentSite = bikeDestination;
+        uint64_t t2 = nowNs();
+        stats.record(Ride, origin, t2 - t1);
+        phase = WaitDock;
+        if (!depositBikeWithPolicy(bike)) {
+            break;
+        }
+        uint64_t t3 = nowNs();
+        stats.record(WaitDock, origin, t3 - t2);
         unsigned int walkDestination = chooseOtherSite(currentSite);
+        phase = Walk;
+        destination = walkDestination;
         walkTo(walkDestination);
         currentSite = walkDestination;
+        phase = WaitBike;
+        uint64_t t4 = nowNs();
+        stats.record(Walk, origin, t4 - t3);
+        stats.completeCycle(t4 - t0);
+    }
+    stats.end();
+    stoppedNs = nowNs();
+}
+
+bool Person::resume() {
+    // Finishes the cycle interrupted when the snapshot was taken
+    Bike* bike = holding.load();
+    switch (phase) {
+    case Ride:
+        if (bike) {
+            uint64_t arrivalNs = nowNs() + uint64_t(resumeMs) * 1000000;
+            bikeTo(destination, bike, std::max(resumeMs, 1u));
+            if (!context->interface && !sleepUntil(arrivalNs)) {
+                return false;
+            }
+        }
+        // fall through
+    case WaitDock:
+        if (bike) {
+            phase = WaitDock;
+            if (!depositBikeAtSite(destination, bike)) {
+                return false;
+            }
+            currentSite = destination;
+        }
+        break;
+    case Walk:
+        walkTo(destination, std::max(resumeMs, 1u));
+        break;
+    default:
+        break;
+    }
+    phase = WaitBike;
+    resumeMs = 0;
+    return true;
+}
+
+void Person::replay() {
+    stats.begin();
+    Trip trip;
+    while (!PcoThread::thisThread()->stopRequested() && context->trips->next(trip)) {
+        uint64_t due = context->trips->dueNs(trip);
+
+        // Goes to the origin while waiting for the departure
+        if (currentSite != trip.origin) {
+            uint64_t now = nowNs();
+            unsigned int idleMs = due > now ? (due - now) / 1000000 : 0;
+            if (context->interface) {
+                TraceSpan span("walk", currentSite, trip.origin);
+                context->interface->walk(id, currentSite, trip.origin, std::min(idleMs, walkTravelTime(currentSite, trip.origin)));
+            }
+            currentSite = trip.origin;
+        }
+        if (!sleepUntil(due)) {
+            break;
+        }
+
+        phase = WaitBike;
+        uint64_t t0 = nowNs();
+        Bike* bike = takeBikeFromSite(trip.origin, trip.bikeType);
+        if (bike == nullptr) {
+            break;
+        }
+        uint64_t t1 = nowNs();
+        context->trips->recordDelay(t1 - due);
+        stats.record(WaitBike, trip.origin, t1 - t0);
+
+        unsigned int rideMs = trip.durationS >= 0 ? std::max<uint64_t>(context->trips->scaledNs(trip.durationS) / 1000000, 1)
+                                                  : bikeTravelTime(trip.origin, trip.destination);
+        phase = Ride;
+        destination = trip.destination;
+        phaseEndNs = t1 + uint64_t(rideMs) * 1000000;
+        bikeTo(trip.destination, bike, rideMs);
+        // Headless runs do not animate the ride, the bike must stay out anyway
+        if (!context->interface && !sleepUntil(phaseEndNs)) {
+            break;
+        }
+        uint64_t t2 = nowNs();
+        stats.record(Ride, trip.origin, t2 - t1);
+
+        phase = WaitDock;
+        if (!depositBikeAtSite(trip.destination, bike)) {
+            break;
+        }
+        phase = WaitBike;
+        uint64_t t3 = nowNs();
+        stats.record(WaitDock, trip.origin, t3 - t2);
+        stats.completeCycle(t3 - t0);
     }
+    stats.end();
+    stoppedNs = nowNs();
 }
 
-Bike* Person::takeBikeFromSite(unsigned int _site) {
-    size_t preferredType = this->preferredType;
+bool Person::sleepUntil(uint64_t _dueNs) const {
+    return context->stopSignal.sleepUntil(_dueNs) && !PcoThread::thisThread()->stopRequested();
+}
+
+Bike* Person::takeBikeWithPolicy() {
+    const RiderPolicy& policy = context->config.policy;
+    while (true) {
+        uint64_t deadline = policy.maxWaitMs ? nowNs() + uint64_t(policy.maxWaitMs) * 1000000 : 0;
+        Bike* bike = takeBikeFromSite(currentSite, preferredType, deadline, policy.acceptOtherType);
+        if (bike != nullptr || PcoThread::thisThread()->stopRequested()) {
+            if (bike != nullptr && bike->bikeType != preferredType) {
+                stats.recordFallback(TookOtherType);
+            }
+            return bike;
+        }
+        int site = policy.walkToStock ? context->nearestSiteWithBike(currentSite, preferredType,
+                                                                     policy.acceptOtherType)
+                                      : -1;
+        if (site >= 0) {
+            stats.recordFallback(WalkedForBike);
+            walkTo(site);
+        }
+    }
+}
+
+bool Person::depositBikeWithPolicy(Bike* _bike) {
+    const RiderPolicy& policy = context->config.policy;
+    while (true) {
+        uint64_t deadline = policy.maxWaitMs ? nowNs() + uint64_t(policy.maxWaitMs) * 1000000 : 0;
+        if (depositBikeAtSite(currentSite, _bike, deadline)) {
+            return true;
+        }
+        if (PcoThread::thisThread()->stopRequested()) {
+            return false;
+        }
+        int site = policy.divertToFreeDock ? context->nearestSiteWithFreeDock(currentSite) : -1;
+        if (site >= 0) {
+            stats.recordFallback(DivertedToDock);
+            destination = site;
+            bikeTo(site, _bike);
+        }
+    }
+}
+
+Bike* Person::takeBikeFromSite(unsigned int _site, size_t _type, uint64_t _deadlineNs, bool _anyType) {
+    size_t preferredType = _type;
+    TraceSpan span("take bike", _site, preferredType);
     log(QString("Attend un vélo de type %1 au site %2").arg(preferredType).arg(_site));
-    Bike * bike = stations[_site]->getBike(preferredType);
+    uint64_t waitStart = nowNs();
+    Bike * bike = context->stations[_site]->getBike(preferredType, _deadlineNs, _anyType);
+    context->stats.waitTimesUs.record((nowNs() - waitStart) / 1000);
     if( bike == nullptr ) {
-        log(QString("Simulation arrêtée, personne %1 quitte son attente de vélo au site %2").arg(id).arg(_site));
+        if (_deadlineNs && !PcoThread::thisThread()->stopRequested()) {
+            log(QString("Personne %1 abandonne son attente de vélo au site %2").arg(id).arg(_site));
+        }
+        else {
+            log(QString("Simulation arrêtée, personne %1 quitte son attente de vélo au site %2").arg(id).arg(_site));
+        }
         return nullptr;
     }
+    holding = bike;
+    context->stats.bikesInTransit.fetch_add(1, std::memory_order_relaxed);
     log(QString("A pris un vélo de type %1 au site %2 (%3 vélos restants)")
-        .arg(bike->bikeType).arg(_site).arg(stations[_site]->nbBikes()));
+        .arg(bike->bikeType).arg(_site).arg(context->stations[_site]->nbBikes()));
 
-    if (binkingInterface) {
-        binkingInterface->setBikes(_site, stations[_site]->nbBikes());
+    if (context->interface) {
+        context->interface->setBikes(_site, context->stations[_site]->nbBikes());
     }
 
     return bike;
 }
 
-void Person::depositBikeAtSite(unsigned int _site, Bike* _bike) {
+bool Person::depositBikeAtSite(unsigned int _site, Bike* _bike, uint64_t _deadlineNs) {
+    TraceSpan span("deposit bike", _site, _bike->bikeType);
     log(QString("Dépose un vélo de type %1 au site %2").arg(_bike->bikeType).arg(_site));
-    stations[_site]->putBike(_bike);
+    uint64_t waitStart = nowNs();
+    if (!context->stations[_site]->putBike(_bike, _deadlineNs)) {
+        if (_deadlineNs && !PcoThread::thisThread()->stopRequested()) {
+            context->stats.waitTimesUs.record((nowNs() - waitStart) / 1000);
+            log(QString("Personne %1 abandonne son attente de borne au site %2").arg(id).arg(_site));
+        }
+        else {
+            log(QString("Simulation arrêtée, personne %1 garde son vélo au site %2").arg(id).arg(_site));
+        }
+        return false;
+    }
+    holding = nullptr;
+    SimStats& simStats = context->stats;
+    simStats.waitTimesUs.record((nowNs() - waitStart) / 1000);
+    simStats.bikesInTransit.fetch_sub(1, std::memory_order_relaxed);
+    simStats.tripsCompleted.fetch_add(1, std::memory_order_relaxed);
     log(QString("Vélo déposé au site %1 (%2 vélos maintenant)")
-        .arg(_site).arg(stations[_site]->nbBikes()));
+        .arg(_site).arg(context->stations[_site]->nbBikes()));
 
-    if (binkingInterface) {
-        binkingInterface->setBikes(_site, stations[_site]->nbBikes());
+    if (context->interface) {
+        context->interface->setBikes(_site, context->stations[_site]->nbBikes());
     }
+    return true;
 }
 
-void Person::bikeTo(unsigned int _dest, Bike* _bike) {
-    unsigned int t = bikeTravelTime();
+Bike* Person::heldBike() const {
+    return holding.load();
+}
+
+const RiderStats& Person::riderStats() const {
+    return stats;
+}
+
+RiderState Person::state() const {
+    RiderState state{};
+    state.id = id;
+    state.preferredType = preferredType;
+    state.phase = phase;
+    state.site = currentSite;
+    state.destination = destination;
+    state.remainingMs = phase == Ride && phaseEndNs > stoppedNs ? (phaseEndNs - stoppedNs) / 1000000 : 0;
+    state.rngSeed = rng.seed;
+    state.rngDraws = rng.draws;
+    return state;
+}
+
+void Person::bikeTo(unsigned int _dest, Bike* _bike, unsigned int _ms) {
+    unsigned int t = _ms ? _ms : bikeTravelTime(currentSite, _dest);
+    TraceSpan span("ride", currentSite, _dest);
     log(QString("Va en vélo du site %1 au site %2 (type %3)")
         .arg(currentSite).arg(_dest).arg(_bike->bikeType));
-    if (binkingInterface) {
-        binkingInterface->travel(id, currentSite, _dest, t);
+    if (context->interface) {
+        context->interface->travel(id, currentSite, _dest, t);
+    }
+    else {
+        travelHeadless(t);
     }
     currentSite = _dest;
 }
 
-void Person::walkTo(unsigned int _dest) {
-    unsigned int t = walkTravelTime();
+void Person::walkTo(unsigned int _dest, unsigned int _ms) {
+    unsigned int t = _ms ? _ms : walkTravelTime(currentSite, _dest);
+    TraceSpan span("walk", currentSite, _dest);
     log(QString("Marche du site %1 au site %2").arg(currentSite).arg(_dest));
-    if (binkingInterface) {
-        binkingInterface->walk(id, currentSite, _dest, t);
+    if (context->interface) {
+        context->interface->walk(id, currentSite, _dest, t);
+    }
+    else {
+        travelHeadless(t);
     }
     currentSite = _dest;
 }
 
-unsigned int Person::chooseOtherSite(unsigned int _from) const {
-    return randomSiteExcept(NBSITES, _from);
+void Person::travelHeadless(unsigned int _ms) const {
+    // Replayed trips keep their own timing, see replay()
+    if (context->trips || (!context->workload && context->config.sites.empty())) {
+        return;
+    }
+    double speed = context->workload ? context->workload->speed() : 1;
+    sleepUntil(nowNs() + uint64_t(_ms * 1e6 / speed));
+}
+
+const WorkloadPhase* Person::currentLoad() const {
+    if (!context->workload) {
+        return nullptr;
+    }
+    return &context->workload->at((nowNs() - context->stats.startNs) / 1e9);
+}
+
+bool Person::waitUntilActive() {
+    const WorkloadPhase* load = currentLoad();
+    while (load && id > load->active * context->riders.size() + 0.5) {
+        // Checks the profile again every 100 ms
+        if (!sleepUntil(nowNs() + 100000000)) {
+            return false;
+        }
+        load = currentLoad();
+    }
+    return true;
+}
+
+unsigned int Person::chooseOtherSite(unsigned int _from) {
+    const WorkloadPhase* load = currentLoad();
+    return load ? WorkloadProfile::destination(*load, _from, rng) : randomSiteExcept(NBSITES, _from, rng);
 }
 
-unsigned int Person::bikeTravelTime() const {
-    return randomTravelTimeMs() + 1000;
+unsigned int Person::bikeTravelTime(unsigned int _from, unsigned int _to) {
+    const WorkloadPhase* load = currentLoad();
+    unsigned int ms = SiteMap::jittered(context->siteMap.bikeMs(_from, _to), rng);
+    return (load ? unsigned(ms * WorkloadProfile::travelScale(*load)) : ms) + 1000;
 }
 
-unsigned int Person::walkTravelTime() const {
-    return randomTravelTimeMs() + 2000;
+unsigned int Person::walkTravelTime(unsigned int _from, unsigned int _to) {
+    const WorkloadPhase* load = currentLoad();
+    unsigned int ms = SiteMap::jittered(context->siteMap.walkMs(_from, _to), rng);
+    return (load ? unsigned(ms * WorkloadProfile::travelScale(*load)) : ms) + 2000;
 }
 
 void Person::log(const QString& msg) const {
-    if (binkingInterface) {
-        binkingInterface->consoleAppendText(id, msg);
+    if (context->interface) {
+        context->interface->consoleAppendText(id, msg);
     }
 }
 
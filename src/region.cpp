@@ -0,0 +1,986 @@
+/*
+    * region.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "region.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static_assert(std::is_trivially_copyable<RegionReport>::value, "reports are sent as is");
+static_assert(std::is_trivially_copyable<WireRider>::value, "riders are sent as is");
+
+/**
+ * @brief One end of a connection, with its buffers.
+ *
+ * The socket is non-blocking: send() only appends to the output buffer,
+ * flush() writes what the socket accepts, and next() hands out the
+ * messages completely received.
+ */
+class RegionLink
+{
+public:
+    explicit RegionLink(int _fd) : fd(_fd)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    ~RegionLink()
+    {
+        close(fd);
+    }
+
+    RegionLink(const RegionLink&) = delete;
+    RegionLink& operator=(const RegionLink&) = delete;
+
+    /**
+     * @brief Appends a message to the output buffer.
+     */
+    void send(RegionWireType type, size_t from, const void *body, size_t bytes)
+    {
+        WireHeader header{uint16_t(type), uint16_t(from), uint32_t(bytes)};
+        const char *begin = reinterpret_cast<const char *>(&header);
+        out.insert(out.end(), begin, begin + sizeof(header));
+        begin = static_cast<const char *>(body);
+        out.insert(out.end(), begin, begin + bytes);
+    }
+
+    /**
+     * @brief Writes as much of the output buffer as the socket accepts.
+     *
+     * @return false if the connection is broken.
+     */
+    bool flush()
+    {
+        while (sent < out.size())
+        {
+            ssize_t n = ::send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            }
+            sent += n;
+        }
+        out.clear();
+        sent = 0;
+        return true;
+    }
+
+    bool pending() const
+    {
+        return sent < out.size();
+    }
+
+    /**
+     * @brief Reads what the socket holds into the input buffer.
+     *
+     * @return false at the end of the stream or if the connection is broken.
+     */
+    bool receive()
+    {
+        if (consumed > 0 && consumed * 2 >= in.size())
+        {
+            in.erase(in.begin(), in.begin() + consumed);
+            consumed = 0;
+        }
+        char buffer[65536];
+        for (;;)
+        {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n > 0)
+            {
+                in.insert(in.end(), buffer, buffer + n);
+                continue;
+            }
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+        }
+    }
+
+    /**
+     * @brief Takes the next complete message of the input buffer.
+     *
+     * @param header Receives its header.
+     * @param body Receives its body, valid until the next receive().
+     * @return false if no message is complete.
+     */
+    bool next(WireHeader& header, const char *&body)
+    {
+        if (in.size() - consumed < sizeof(header))
+        {
+            return false;
+        }
+        std::memcpy(&header, in.data() + consumed, sizeof(header));
+        if (in.size() - consumed - sizeof(header) < header.bytes)
+        {
+            return false;
+        }
+        body = in.data() + consumed + sizeof(header);
+        consumed += sizeof(header) + header.bytes;
+        return true;
+    }
+
+    /**
+     * @brief Waits for the next message, for the handshake and the reports.
+     *
+     * @return false on timeout or if the connection is broken.
+     */
+    bool wait(WireHeader& header, std::vector<char>& body, int timeoutMs)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        const char *data;
+        while (!next(header, data))
+        {
+            int left = int(std::chrono::duration_cast<std::chrono::milliseconds>(
+                               deadline - std::chrono::steady_clock::now()).count());
+            pollfd entry{fd, POLLIN, 0};
+            if (closed || left <= 0 || poll(&entry, 1, left) <= 0)
+            {
+                return false;
+            }
+            // What came before the end of the stream is still delivered
+            closed = !receive();
+        }
+        body.assign(data, data + header.bytes);
+        return true;
+    }
+
+    /**
+     * @brief Writes the whole output buffer, waiting for the socket.
+     *
+     * @return false on timeout or if the connection is broken.
+     */
+    bool drain(int timeoutMs)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (flush() && pending())
+        {
+            int left = int(std::chrono::duration_cast<std::chrono::milliseconds>(
+                               deadline - std::chrono::steady_clock::now()).count());
+            pollfd entry{fd, POLLOUT, 0};
+            if (left <= 0 || poll(&entry, 1, left) <= 0)
+            {
+                return false;
+            }
+        }
+        return !pending();
+    }
+
+    const int fd;
+    size_t peer = 0;       /**< Region at the other end, nbRegions for the coordinator. */
+    bool drained = false;  /**< The other end will send no more riders. */
+    bool closed = false;   /**< The other end has closed the connection. */
+
+private:
+    std::vector<char> in;
+    size_t consumed = 0;
+    std::vector<char> out;
+    size_t sent = 0;
+};
+
+namespace {
+
+// Time allowed to the processes to connect, and to report once stopped
+const int connectTimeoutMs = 10000;
+const int reportTimeoutMs = 30000;
+
+// Spread of the first arrivals after the start
+const unsigned int startSpreadMs = 1000;
+
+std::string coordinatorPath(const std::string& dir)
+{
+    return dir + "/coordinator.sock";
+}
+
+std::string regionPath(const std::string& dir, size_t region)
+{
+    return dir + "/region-" + std::to_string(region) + ".sock";
+}
+
+bool makeAddress(const std::string& path, sockaddr_un& address)
+{
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        std::fprintf(stderr, "%s: socket path too long\n", path.c_str());
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+int listenAt(const std::string& path)
+{
+    sockaddr_un address;
+    if (!makeAddress(path, address))
+    {
+        return -1;
+    }
+    unlink(path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(fd, 64) < 0)
+    {
+        std::perror(path.c_str());
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// Retries while the other end is not listening yet
+int connectTo(const std::string& path)
+{
+    sockaddr_un address;
+    if (!makeAddress(path, address))
+    {
+        return -1;
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(connectTimeoutMs);
+    for (;;)
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            std::perror("socket");
+            return -1;
+        }
+        if (::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0)
+        {
+            return fd;
+        }
+        int error = errno;
+        close(fd);
+        if ((error != ENOENT && error != ECONNREFUSED) || std::chrono::steady_clock::now() > deadline)
+        {
+            std::fprintf(stderr, "%s: %s\n", path.c_str(), std::strerror(error));
+            return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+int acceptFrom(int listener, const std::string& path)
+{
+    pollfd entry{listener, POLLIN, 0};
+    int fd = poll(&entry, 1, connectTimeoutMs) > 0 ? accept4(listener, nullptr, nullptr, SOCK_CLOEXEC) : -1;
+    if (fd < 0)
+    {
+        std::fprintf(stderr, "%s: no connection\n", path.c_str());
+    }
+    return fd;
+}
+
+WireHelloBody helloOf(const RegionConfig& config, size_t bikeTotal)
+{
+    WireHelloBody hello{};
+    hello.magic = REGION_WIRE_MAGIC;
+    hello.version = REGION_WIRE_VERSION;
+    hello.nbRegions = uint32_t(config.nbRegions);
+    hello.nbSites = uint32_t(config.nbSites);
+    hello.slotsPerSite = uint32_t(config.slotsPerSite);
+    hello.nbBikes = uint32_t(bikeTotal);
+    hello.nbRiders = uint32_t(config.nbRiders);
+    hello.seed = config.seed;
+    return hello;
+}
+
+// Waits for the hello of the other end and checks it against ours
+bool handshake(RegionLink& link, const WireHelloBody& expected, const std::string& path)
+{
+    WireHeader header;
+    std::vector<char> body;
+    if (!link.wait(header, body, connectTimeoutMs) || header.type != WireHello ||
+        body.size() != sizeof(WireHelloBody) || header.from > expected.nbRegions)
+    {
+        std::fprintf(stderr, "%s: no hello\n", path.c_str());
+        return false;
+    }
+    if (std::memcmp(body.data(), &expected, sizeof(expected)) != 0)
+    {
+        std::fprintf(stderr, "%s: region %u runs another configuration\n", path.c_str(), header.from);
+        return false;
+    }
+    link.peer = header.from;
+    return true;
+}
+
+size_t capBikes(const RegionConfig& config)
+{
+    return std::min(config.nbBikes, config.nbSites * (config.slotsPerSite - 2));
+}
+
+}
+
+void RegionReport::merge(const RegionReport& other)
+{
+    trips += other.trips;
+    events += other.events;
+    handoffsOut += other.handoffsOut;
+    handoffsIn += other.handoffsIn;
+    messagesOut += other.messagesOut;
+    bytesOut += other.bytesOut;
+    vanRounds += other.vanRounds;
+    riders += other.riders;
+    bikes += other.bikes;
+    waitBikeUs.merge(other.waitBikeUs);
+    waitDockUs.merge(other.waitDockUs);
+}
+
+RegionNode::RegionNode(const RegionConfig& _config, size_t _region)
+    : config(_config),
+      region(_region),
+      siteMap(defaultSiteLayout(_config.nbSites)),
+      firstSite(firstSiteOf(_config, _region)),
+      endSite(firstSiteOf(_config, _region + 1)),
+      rng(_config.seed * 0x9e3779b97f4a7c15ULL + _region)
+{
+    // The whole fleet is numbered as by SimContext::populate(), each region
+    // keeps the bikes of its sites; its depot starts empty
+    bikeTotal = capBikes(config);
+    bikes.reset(new Bike[bikeTotal]);
+    for (size_t b = 0; b < bikeTotal; ++b)
+    {
+        bikes[b].bikeType = b % Bike::nbBikeTypes;
+    }
+    size_t perSite = config.slotsPerSite - 2;
+    for (size_t s = firstSite; s < endSite; ++s)
+    {
+        stations.push_back(std::make_unique<PcoBikeStation>(int(config.slotsPerSite), unsigned(s)));
+        std::vector<Bike*> chunk;
+        for (size_t b = s * perSite; b < std::min((s + 1) * perSite, bikeTotal); ++b)
+        {
+            chunk.push_back(&bikes[b]);
+        }
+        stations.back()->addBikes(chunk);
+        vanRoute.push_back(uint32_t(s));
+    }
+    depot = std::make_unique<PcoBikeStation>(int(std::max<size_t>(bikeTotal, 1)), unsigned(config.nbSites));
+    vanSite = uint32_t(config.nbSites);
+
+    bikeWaiters.resize(endSite - firstSite);
+    dockWaiters.resize(endSite - firstSite);
+    for (size_t r = 0; r < config.nbRiders; ++r)
+    {
+        size_t site = r % config.nbSites;
+        if (site >= firstSite && site < endSite)
+        {
+            riders.push_back(Rider{uint32_t(r), uint32_t(site), WireRider::noBike, 0});
+        }
+    }
+    nbInitialRiders = riders.size();
+
+    peers.resize(config.nbRegions);
+    outbound.resize(config.nbRegions);
+    outboundSince.resize(config.nbRegions, 0);
+}
+
+RegionNode::~RegionNode() = default;
+
+bool RegionNode::connect(const std::string& dir)
+{
+    // Listening first: the regions above connect as soon as they are up
+    std::string path = regionPath(dir, region);
+    int listener = listenAt(path);
+    if (listener < 0)
+    {
+        return false;
+    }
+    WireHelloBody hello = helloOf(config, bikeTotal);
+    bool ok = true;
+
+    int fd = connectTo(coordinatorPath(dir));
+    if (fd >= 0)
+    {
+        coordinator = std::make_unique<RegionLink>(fd);
+        coordinator->peer = config.nbRegions;
+        coordinator->send(WireHello, region, &hello, sizeof(hello));
+        ok = coordinator->drain(connectTimeoutMs);
+    }
+    else
+    {
+        ok = false;
+    }
+    for (size_t other = 0; ok && other < region; ++other)
+    {
+        fd = connectTo(regionPath(dir, other));
+        ok = fd >= 0;
+        if (ok)
+        {
+            peers[other] = std::make_unique<RegionLink>(fd);
+            peers[other]->peer = other;
+            peers[other]->send(WireHello, region, &hello, sizeof(hello));
+            ok = peers[other]->drain(connectTimeoutMs);
+        }
+    }
+    for (size_t k = region + 1; ok && k < config.nbRegions; ++k)
+    {
+        fd = acceptFrom(listener, path);
+        ok = fd >= 0;
+        if (ok)
+        {
+            auto link = std::make_unique<RegionLink>(fd);
+            ok = handshake(*link, hello, path) && link->peer > region && link->peer < config.nbRegions &&
+                 !peers[link->peer];
+            if (ok)
+            {
+                size_t other = link->peer;
+                peers[other] = std::move(link);
+                peers[other]->send(WireHello, region, &hello, sizeof(hello));
+                ok = peers[other]->drain(connectTimeoutMs);
+            }
+        }
+    }
+    // The regions below answer the hello they were sent
+    for (size_t other = 0; ok && other < region; ++other)
+    {
+        ok = handshake(*peers[other], hello, regionPath(dir, other)) && peers[other]->peer == other;
+    }
+    close(listener);
+    unlink(path.c_str());
+    return ok;
+}
+
+bool RegionNode::run(const std::string& dir)
+{
+    if (!connect(dir))
+    {
+        return false;
+    }
+    size_t nbPeers = config.nbRegions - 1;
+    while (!stopping || drainedPeers < nbPeers ||
+           std::any_of(peers.begin(), peers.end(), [](const auto& link) { return link && link->pending(); }))
+    {
+        uint64_t now = nowNs();
+        uint64_t wakeNs = now + 100000000;
+        if (started && !stopping)
+        {
+            while (!events.empty() && events.top().dueNs <= now)
+            {
+                Event event = events.top();
+                events.pop();
+                counters.events++;
+                if (event.rider == vanEvent)
+                    vanArrive(now);
+                else
+                    arrive(event.rider, now);
+            }
+            for (size_t to = 0; to < config.nbRegions; ++to)
+            {
+                if (!outbound[to].empty())
+                {
+                    uint64_t flushAt = outboundSince[to] + uint64_t(config.flushUs) * 1000;
+                    if (flushAt <= now)
+                        flush(to, now);
+                    else
+                        wakeNs = std::min(wakeNs, flushAt);
+                }
+            }
+            if (!events.empty())
+            {
+                wakeNs = std::min(wakeNs, events.top().dueNs);
+            }
+        }
+        if (!serveLinks(wakeNs > now ? wakeNs - now : 0))
+        {
+            return false;
+        }
+    }
+
+    RegionReport result;
+    report(result);
+    coordinator->send(WireReport, region, &result, sizeof(result));
+    if (!coordinator->drain(reportTimeoutMs))
+    {
+        std::fprintf(stderr, "region %zu: report not sent\n", region);
+        return false;
+    }
+    return true;
+}
+
+bool RegionNode::serveLinks(uint64_t timeoutNs)
+{
+    std::vector<pollfd> entries;
+    std::vector<RegionLink*> links;
+    for (const auto& link : peers)
+    {
+        if (link && !link->closed)
+            links.push_back(link.get());
+    }
+    links.push_back(coordinator.get());
+    for (RegionLink *link : links)
+    {
+        entries.push_back(pollfd{link->fd, short(POLLIN | (link->pending() ? POLLOUT : 0)), 0});
+    }
+
+    timespec timeout{time_t(timeoutNs / 1000000000), long(timeoutNs % 1000000000)};
+    if (ppoll(entries.data(), entries.size(), &timeout, nullptr) < 0 && errno != EINTR)
+    {
+        std::perror("ppoll");
+        return false;
+    }
+    for (size_t i = 0; i < links.size(); ++i)
+    {
+        RegionLink& link = *links[i];
+        if ((entries[i].revents & POLLOUT) && !link.flush())
+        {
+            std::fprintf(stderr, "region %zu: connection to %zu broken\n", region, link.peer);
+            return false;
+        }
+        if (!(entries[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            continue;
+        }
+        bool open = link.receive();
+        WireHeader header;
+        const char *body;
+        while (link.next(header, body))
+        {
+            if (!receive(link, header, body))
+            {
+                return false;
+            }
+        }
+        // A region closes its connections once everyone is drained
+        if (!open && !(link.drained && stopping))
+        {
+            std::fprintf(stderr, "region %zu: connection to %zu closed\n", region, link.peer);
+            return false;
+        }
+        link.closed = !open;
+    }
+    return true;
+}
+
+bool RegionNode::receive(RegionLink& link, const WireHeader& header, const char *body)
+{
+    uint64_t now = nowNs();
+    switch (header.type)
+    {
+    case WireStart:
+        begin(now);
+        return true;
+    case WireStop:
+        stop(now);
+        return true;
+    case WireRiders:
+        for (size_t offset = 0; offset + sizeof(WireRider) <= header.bytes; offset += sizeof(WireRider))
+        {
+            WireRider wire;
+            std::memcpy(&wire, body + offset, sizeof(wire));
+            adopt(wire, now);
+        }
+        return true;
+    case WireDrained:
+        if (!link.drained)
+        {
+            link.drained = true;
+            drainedPeers++;
+        }
+        return true;
+    default:
+        std::fprintf(stderr, "region %zu: unexpected message %u from %u\n", region, header.type, header.from);
+        return false;
+    }
+}
+
+void RegionNode::begin(uint64_t now)
+{
+    if (started)
+    {
+        return;
+    }
+    started = true;
+    // Riders sent by a region that started first are already scheduled
+    std::uniform_int_distribution<unsigned int> spread(0, startSpreadMs);
+    for (uint32_t r = 0; r < nbInitialRiders; ++r)
+    {
+        events.push(Event{now + uint64_t(spread(rng) * 1e6 / config.timeScale), r});
+    }
+    events.push(Event{now + uint64_t(config.depotWaitUs * 1e3 / config.timeScale), vanEvent});
+}
+
+void RegionNode::stop(uint64_t now)
+{
+    if (stopping)
+    {
+        return;
+    }
+    stopping = true;
+    for (size_t to = 0; to < config.nbRegions; ++to)
+    {
+        if (peers[to])
+        {
+            flush(to, now);
+            peers[to]->send(WireDrained, region, nullptr, 0);
+        }
+    }
+}
+
+void RegionNode::arrive(uint32_t rider, uint64_t now)
+{
+    Rider& r = riders[rider];
+    r.sinceNs = now;
+    size_t local = r.site - firstSite;
+    if (r.bike == WireRider::noBike)
+        bikeWaiters[local][typeOf(rider)].push_back(rider);
+    else
+        dockWaiters[local].push_back(rider);
+    settle(r.site, now);
+}
+
+void RegionNode::settle(uint32_t site, uint64_t now)
+{
+    // Each bike taken frees a dock and each bike docked may serve a rider
+    BikeStation& st = station(site);
+    size_t local = site - firstSite;
+    bool served = true;
+    while (served)
+    {
+        served = false;
+        for (size_t type = 0; type < Bike::nbBikeTypes; ++type)
+        {
+            std::deque<uint32_t>& waiters = bikeWaiters[local][type];
+            while (!waiters.empty() && st.countBikesOfType(type) > 0)
+            {
+                uint32_t rider = waiters.front();
+                waiters.pop_front();
+                takeBike(rider, now);
+                served = true;
+            }
+        }
+        std::deque<uint32_t>& waiters = dockWaiters[local];
+        while (!waiters.empty() && st.nbBikes() < st.nbSlots())
+        {
+            uint32_t rider = waiters.front();
+            waiters.pop_front();
+            dockBike(rider, now);
+            served = true;
+        }
+    }
+}
+
+void RegionNode::takeBike(uint32_t rider, uint64_t now)
+{
+    Rider& r = riders[rider];
+    Bike *bike = station(r.site).getBike(typeOf(rider));
+    r.bike = uint32_t(bike - bikes.get());
+    counters.waitBikeUs.record((now - r.sinceNs) / 1000);
+    unsigned int to = randomSiteExcept(unsigned(config.nbSites), r.site, rng);
+    travel(rider, to, SiteMap::jittered(siteMap.bikeMs(r.site, to), rng), now);
+}
+
+void RegionNode::dockBike(uint32_t rider, uint64_t now)
+{
+    Rider& r = riders[rider];
+    station(r.site).putBike(&bikes[r.bike]);
+    r.bike = WireRider::noBike;
+    counters.trips++;
+    counters.waitDockUs.record((now - r.sinceNs) / 1000);
+    unsigned int to = randomSiteExcept(unsigned(config.nbSites), r.site, rng);
+    travel(rider, to, SiteMap::jittered(siteMap.walkMs(r.site, to), rng), now);
+}
+
+void RegionNode::travel(uint32_t rider, uint32_t site, unsigned int ms, uint64_t now)
+{
+    Rider& r = riders[rider];
+    uint64_t due = now + uint64_t(ms * 1e6 / config.timeScale);
+    size_t owner = ownerOf(config, site);
+    if (owner == region)
+    {
+        r.site = site;
+        events.push(Event{due, rider});
+        return;
+    }
+
+    // Leaves the region at departure, its slot is free again
+    if (outbound[owner].empty())
+    {
+        outboundSince[owner] = now;
+    }
+    outbound[owner].push_back(Departure{WireRider{r.id, site, r.bike, 0}, due});
+    r.id = freeSlot;
+    freeRiders.push_back(rider);
+    counters.handoffsOut++;
+    if (outbound[owner].size() >= config.batchSize)
+    {
+        flush(owner, now);
+    }
+}
+
+void RegionNode::adopt(const WireRider& wire, uint64_t now)
+{
+    uint32_t rider;
+    if (freeRiders.empty())
+    {
+        rider = uint32_t(riders.size());
+        riders.push_back(Rider{});
+    }
+    else
+    {
+        rider = freeRiders.back();
+        freeRiders.pop_back();
+    }
+    riders[rider] = Rider{wire.id, wire.site, wire.bike, 0};
+    counters.handoffsIn++;
+    // Riders arriving after the stop are only held, for the count
+    if (!stopping)
+    {
+        events.push(Event{now + uint64_t(wire.remainingUs) * 1000, rider});
+    }
+}
+
+void RegionNode::flush(size_t to, uint64_t now)
+{
+    std::vector<Departure>& departures = outbound[to];
+    std::vector<WireRider> batch;
+    for (size_t first = 0; first < departures.size(); first += config.batchSize)
+    {
+        size_t end = std::min(departures.size(), first + config.batchSize);
+        batch.clear();
+        for (size_t i = first; i < end; ++i)
+        {
+            WireRider wire = departures[i].rider;
+            wire.remainingUs = uint32_t(departures[i].dueNs > now ? (departures[i].dueNs - now) / 1000 : 0);
+            batch.push_back(wire);
+        }
+        size_t bytes = batch.size() * sizeof(WireRider);
+        peers[to]->send(WireRiders, region, batch.data(), bytes);
+        counters.messagesOut++;
+        counters.bytesOut += sizeof(WireHeader) + bytes;
+    }
+    departures.clear();
+    // Whatever the socket does not take now goes with the next poll
+    peers[to]->flush();
+}
+
+void RegionNode::vanArrive(uint64_t now)
+{
+    // Same round as Van::run(): load at the depot, balance every site, unload
+    size_t nbStops = vanRoute.size();
+    if (vanStop == 0)
+    {
+        size_t space = vanCargo.size() < config.vanCapacity ? config.vanCapacity - vanCargo.size() : 0;
+        std::vector<Bike*> loaded = depot->getBikes(std::min({config.depotLoad, depot->nbBikes(), space}));
+        vanCargo.insert(vanCargo.end(), loaded.begin(), loaded.end());
+    }
+    else if (vanStop <= nbStops)
+    {
+        balanceSite(vanRoute[vanStop - 1]);
+        settle(vanRoute[vanStop - 1], now);
+    }
+    else
+    {
+        vanCargo = depot->addBikes(vanCargo);
+        counters.vanRounds++;
+        vanStop = 0;
+        events.push(Event{now + uint64_t(config.depotWaitUs * 1e3 / config.timeScale), vanEvent});
+        return;
+    }
+
+    vanStop++;
+    uint32_t next = vanStop <= nbStops ? vanRoute[vanStop - 1] : uint32_t(config.nbSites);
+    unsigned int ms = SiteMap::jittered(siteMap.driveMs(vanSite, next), rng);
+    vanSite = next;
+    events.push(Event{now + uint64_t(ms * 1e6 / config.timeScale), vanEvent});
+}
+
+void RegionNode::balanceSite(uint32_t site)
+{
+    // Van::balanceSite(), without waiting: the van is the only other user
+    BikeStation& st = station(site);
+    size_t bikesHere = st.nbBikes();
+    size_t threshold = config.slotsPerSite - 2;
+    if (bikesHere > threshold)
+    {
+        size_t space = vanCargo.size() < config.vanCapacity ? config.vanCapacity - vanCargo.size() : 0;
+        std::vector<Bike*> taken = st.getBikes(std::min(bikesHere - threshold, space));
+        vanCargo.insert(vanCargo.end(), taken.begin(), taken.end());
+    }
+    else if (bikesHere < threshold && !vanCargo.empty())
+    {
+        size_t count = std::min(threshold - bikesHere, vanCargo.size());
+        size_t deposited = 0;
+        // Types missing from the site first
+        for (size_t type = 0; type < Bike::nbBikeTypes && deposited < count; ++type)
+        {
+            auto it = std::find_if(vanCargo.begin(), vanCargo.end(),
+                                   [type](const Bike *bike) { return bike->bikeType == type; });
+            if (st.countBikesOfType(type) == 0 && it != vanCargo.end())
+            {
+                st.putBike(*it);
+                vanCargo.erase(it);
+                deposited++;
+            }
+        }
+        for (; deposited < count; ++deposited)
+        {
+            st.putBike(vanCargo.back());
+            vanCargo.pop_back();
+        }
+    }
+}
+
+void RegionNode::report(RegionReport& result) const
+{
+    result = counters;
+    result.riders = 0;
+    result.bikes = depot->nbBikes() + vanCargo.size();
+    for (const auto& st : stations)
+    {
+        result.bikes += st->nbBikes();
+    }
+    for (const Rider& r : riders)
+    {
+        result.riders += r.id != freeSlot;
+        result.bikes += r.id != freeSlot && r.bike != WireRider::noBike;
+    }
+}
+
+RegionCoordinator::RegionCoordinator(const RegionConfig& _config)
+    : config(_config)
+{
+}
+
+size_t RegionCoordinator::nbBikes() const
+{
+    return capBikes(config);
+}
+
+bool RegionCoordinator::run(unsigned int durationMs, std::string dir)
+{
+    bool ownDir = dir.empty();
+    if (ownDir)
+    {
+        char pattern[] = "/tmp/pco_biking_regions.XXXXXX";
+        if (!mkdtemp(pattern))
+        {
+            std::perror(pattern);
+            return false;
+        }
+        dir = pattern;
+    }
+    else if (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST)
+    {
+        std::perror(dir.c_str());
+        return false;
+    }
+    std::string path = coordinatorPath(dir);
+    int listener = listenAt(path);
+    if (listener < 0)
+    {
+        return false;
+    }
+
+    // Each region builds its own state, after the fork
+    std::vector<pid_t> children;
+    for (size_t k = 0; k < config.nbRegions; ++k)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(listener);
+            bool ok;
+            {
+                RegionNode node(config, k);
+                ok = node.run(dir);
+            }
+            std::fflush(nullptr);
+            _exit(ok ? 0 : 1);
+        }
+        if (pid < 0)
+        {
+            std::perror("fork");
+            break;
+        }
+        children.push_back(pid);
+    }
+
+    WireHelloBody hello = helloOf(config, nbBikes());
+    std::vector<std::unique_ptr<RegionLink>> links(config.nbRegions);
+    bool ok = children.size() == config.nbRegions;
+    for (size_t k = 0; ok && k < config.nbRegions; ++k)
+    {
+        int fd = acceptFrom(listener, path);
+        ok = fd >= 0;
+        if (ok)
+        {
+            auto link = std::make_unique<RegionLink>(fd);
+            ok = handshake(*link, hello, path) && link->peer < config.nbRegions && !links[link->peer];
+            if (ok)
+            {
+                links[link->peer] = std::move(link);
+            }
+        }
+    }
+    close(listener);
+    unlink(path.c_str());
+
+    if (ok)
+    {
+        for (auto& link : links)
+        {
+            link->send(WireStart, config.nbRegions, nullptr, 0);
+            link->flush();
+        }
+        auto begin = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(std::chrono::milliseconds(durationMs));
+        for (auto& link : links)
+        {
+            link->send(WireStop, config.nbRegions, nullptr, 0);
+            ok = link->drain(reportTimeoutMs) && ok;
+        }
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        reports.assign(config.nbRegions, RegionReport());
+        for (size_t k = 0; ok && k < config.nbRegions; ++k)
+        {
+            WireHeader header;
+            std::vector<char> body;
+            ok = links[k]->wait(header, body, reportTimeoutMs) && header.type == WireReport &&
+                 body.size() == sizeof(RegionReport);
+            if (!ok)
+            {
+                std::fprintf(stderr, "region %zu: no report\n", k);
+                break;
+            }
+            std::memcpy(&reports[k], body.data(), sizeof(RegionReport));
+            total.merge(reports[k]);
+        }
+    }
+    links.clear();
+
+    for (pid_t pid : children)
+    {
+        if (!ok)
+        {
+            kill(pid, SIGTERM);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    if (ownDir)
+    {
+        rmdir(dir.c_str());
+    }
+    return ok;
+}
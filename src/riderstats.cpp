@@ -0,0 +1,130 @@
+/*
+    * riderstats.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "riderstats.h"
+#include "bike.h"
+
+#include <string>
+
+const char *const riderPhaseNames[NbRiderPhases] = {"wait bike", "ride", "wait dock", "walk"};
+const char *const riderFallbackNames[NbRiderFallbacks] = {"other type", "walk for bike", "divert to dock"};
+
+namespace {
+
+using PhaseHistograms = std::array<HistogramSnapshot, NbRiderPhases>;
+
+void printHeader(FILE *file, const char *title)
+{
+    std::fprintf(file, "\n%-22s %10s %10s %10s %10s %10s\n",
+                 title, "count", "p50 ms", "p95 ms", "p99 ms", "max ms");
+}
+
+void printRow(FILE *file, const std::string& label, const HistogramSnapshot& h)
+{
+    std::fprintf(file, "%-22s %10llu %10.1f %10.1f %10.1f %10.1f\n",
+                 label.c_str(), (unsigned long long)h.count,
+                 h.percentile(50) / 1000.0, h.percentile(95) / 1000.0,
+                 h.percentile(99) / 1000.0, h.max / 1000.0);
+}
+
+void printGroup(FILE *file, const std::string& prefix, const PhaseHistograms& phases)
+{
+    for (size_t phase = 0; phase < NbRiderPhases; ++phase)
+    {
+        printRow(file, prefix + riderPhaseNames[phase], phases[phase]);
+    }
+}
+
+}
+
+RiderStats::RiderStats(size_t _preferredType) : preferredType(_preferredType)
+{
+}
+
+void RiderStats::begin()
+{
+    startNs = nowNs();
+}
+
+void RiderStats::end()
+{
+    activeNs += nowNs() - startNs;
+}
+
+void RiderStats::record(RiderPhase phase, unsigned int origin, uint64_t durationNs)
+{
+    byOrigin[origin][phase].record(durationNs / 1000);
+}
+
+void RiderStats::completeCycle(uint64_t durationNs)
+{
+    cycleUs.record(durationNs / 1000);
+    cycles++;
+}
+
+void RiderStats::recordFallback(RiderFallback fallback)
+{
+    fallbacks[fallback]++;
+}
+
+void printRiderReport(FILE *file, const std::vector<const RiderStats*>& riders)
+{
+    PhaseHistograms all;
+    std::array<PhaseHistograms, Bike::nbBikeTypes> byType;
+    std::array<PhaseHistograms, NBSITES> byOrigin;
+    HistogramSnapshot cycleTimes;
+    std::array<uint64_t, NbRiderFallbacks> fallbacks{};
+    uint64_t cycles = 0;
+    uint64_t activeNs = 0;
+
+    for (const RiderStats *rider : riders)
+    {
+        for (size_t site = 0; site < NBSITES; ++site)
+        {
+            for (size_t phase = 0; phase < NbRiderPhases; ++phase)
+            {
+                const SparseHistogram& h = rider->byOrigin[site][phase];
+                h.mergeInto(all[phase]);
+                h.mergeInto(byType[rider->preferredType][phase]);
+                h.mergeInto(byOrigin[site][phase]);
+            }
+        }
+        rider->cycleUs.mergeInto(cycleTimes);
+        for (size_t f = 0; f < NbRiderFallbacks; ++f)
+        {
+            fallbacks[f] += rider->fallbacks[f];
+        }
+        cycles += rider->cycles;
+        activeNs += rider->activeNs;
+    }
+
+    double riderHours = activeNs / 3.6e12;
+    std::fprintf(file, "Rider cycles: %zu riders, %llu cycles, %.3f rider-hours, %.1f cycles per rider-hour\n",
+                 riders.size(), (unsigned long long)cycles, riderHours,
+                 riderHours > 0 ? cycles / riderHours : 0.0);
+
+    std::fprintf(file, "Fallbacks:");
+    for (size_t f = 0; f < NbRiderFallbacks; ++f)
+    {
+        std::fprintf(file, " %s %llu%s", riderFallbackNames[f], (unsigned long long)fallbacks[f],
+                     f + 1 < NbRiderFallbacks ? "," : "\n");
+    }
+
+    printHeader(file, "Phase");
+    printGroup(file, "", all);
+    printRow(file, "cycle", cycleTimes);
+
+    printHeader(file, "Preferred type");
+    for (size_t type = 0; type < Bike::nbBikeTypes; ++type)
+    {
+        printGroup(file, "type " + std::to_string(type) + " ", byType[type]);
+    }
+
+    printHeader(file, "Origin site");
+    for (size_t site = 0; site < NBSITES; ++site)
+    {
+        printGroup(file, "site " + std::to_string(site) + " ", byOrigin[site]);
+    }
+}
@@ -0,0 +1,330 @@
+/*
+    * shardengine.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "shardengine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace {
+
+// splitmix64, as in the batch engine
+inline uint64_t mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+inline uint64_t next(uint64_t& state)
+{
+    state += 0x9e3779b97f4a7c15ULL;
+    return mix(state);
+}
+
+// Uniform value in [0, n) from 32 random bits
+inline uint32_t below(uint32_t bits, uint32_t n)
+{
+    return uint32_t((uint64_t(bits) * n) >> 32);
+}
+
+// Riders handled between two looks at the stop flag and the queues
+const size_t batchSize = 64;
+
+// Riders a queue between two threads can hold before they overflow
+const size_t queueCapacity = 4096;
+
+void pinToCpu(size_t k)
+{
+    unsigned int cpus = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(k % cpus, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+}
+
+const char *shardModeName(ShardMode mode)
+{
+    return mode == ShardMode::Owned ? "owned" : "shared";
+}
+
+ShardEngine::ShardEngine(const ShardConfig& _config)
+    : config(_config)
+{
+    bikeTotal = std::min(config.nbBikes, config.nbSites * (config.slotsPerSite - 2));
+    for (size_t k = 0; k < config.threads; ++k)
+    {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    if (config.mode == ShardMode::SharedLocks)
+    {
+        shared.reset(new SharedStation[config.nbSites]);
+        for (size_t s = 0; s < config.nbSites; ++s)
+        {
+            Station& station = shared[s].state;
+            station.total = 0;
+            for (size_t t = 0; t < Bike::nbBikeTypes; ++t)
+            {
+                station.stock[t] = initialStock(s, t);
+                station.total += station.stock[t];
+            }
+        }
+    }
+    else
+    {
+        for (size_t q = 0; q < config.threads * config.threads; ++q)
+        {
+            queues.push_back(std::make_unique<SpscQueue<Rider>>(queueCapacity));
+        }
+    }
+}
+
+ShardEngine::~ShardEngine() = default;
+
+uint32_t ShardEngine::initialStock(size_t site, size_t type) const
+{
+    // Bike b at site b modulo the number of sites, types in turn: unlike the
+    // batch engine, riders have no travel time to smooth out a site-by-site
+    // fill, and would mostly wait at the full and empty halves of the map
+    size_t rounds = bikeTotal / config.nbSites + (site < bikeTotal % config.nbSites);
+    uint32_t count = 0;
+    for (size_t round = 0; round < rounds; ++round)
+    {
+        count += round % Bike::nbBikeTypes == type;
+    }
+    return count;
+}
+
+void ShardEngine::run(unsigned int durationMs)
+{
+    std::vector<std::thread> threads;
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t k = 0; k < config.threads; ++k)
+    {
+        threads.emplace_back([this, k]() {
+            if (config.pin)
+            {
+                pinToCpu(k);
+            }
+            setUp(k);
+            if (config.mode == ShardMode::Owned)
+                runOwned(k);
+            else
+                runShared(k);
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(durationMs));
+    stopping.store(true, std::memory_order_relaxed);
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    // Riders still in flight between threads go to their owner
+    Rider rider;
+    for (size_t from = 0; from < config.threads && !queues.empty(); ++from)
+    {
+        for (size_t to = 0; to < config.threads; ++to)
+        {
+            while (queue(from, to).pop(rider))
+            {
+                workers[to]->riders.push_back(rider);
+            }
+        }
+    }
+
+    for (const auto& worker : workers)
+    {
+        trips += worker->trips;
+        messages += worker->messages;
+        retries += worker->retries;
+    }
+}
+
+void ShardEngine::setUp(size_t k)
+{
+    // Allocated here, after pinning, so that memory is local to the thread
+    Worker& worker = *workers[k];
+    worker.rng = mix(config.seed ^ (k + 1));
+    if (config.mode == ShardMode::Owned)
+    {
+        worker.firstSite = firstSiteOf(k);
+        size_t end = firstSiteOf(k + 1);
+        worker.stations.resize(end - worker.firstSite);
+        for (size_t s = worker.firstSite; s < end; ++s)
+        {
+            Station& station = worker.stations[s - worker.firstSite];
+            station.total = 0;
+            for (size_t t = 0; t < Bike::nbBikeTypes; ++t)
+            {
+                station.stock[t] = initialStock(s, t);
+                station.total += station.stock[t];
+            }
+        }
+        worker.overflow.resize(config.threads);
+    }
+
+    // Riders start on foot at site r modulo the number of sites
+    for (size_t r = 0; r < config.nbRiders; ++r)
+    {
+        uint32_t site = uint32_t(r % config.nbSites);
+        size_t owner = config.mode == ShardMode::Owned ? ownerOf(site) : r % config.threads;
+        if (owner == k)
+        {
+            worker.riders.push_back(Rider{site, uint8_t(mix(config.seed + r) % Bike::nbBikeTypes), 0});
+        }
+    }
+}
+
+bool ShardEngine::serve(Worker& worker, Rider& rider, Station& station)
+{
+    if (!rider.riding)
+    {
+        if (station.stock[rider.type] == 0)
+        {
+            rider.site = destination(worker, rider.site);
+            return false;
+        }
+        station.stock[rider.type]--;
+        station.total--;
+    }
+    else
+    {
+        if (station.total >= config.slotsPerSite)
+        {
+            rider.site = destination(worker, rider.site);
+            return false;
+        }
+        station.stock[rider.type]++;
+        station.total++;
+        worker.trips++;
+    }
+    rider.riding = !rider.riding;
+    rider.site = destination(worker, rider.site);
+    return true;
+}
+
+uint32_t ShardEngine::destination(Worker& worker, uint32_t from)
+{
+    uint64_t bits = next(worker.rng);
+    size_t owner = ownerOf(from);
+    uint32_t first = uint32_t(firstSiteOf(owner));
+    uint32_t size = uint32_t(firstSiteOf(owner + 1)) - first;
+    // Locality is defined by the partitions of the owned mode in both modes,
+    // so that both run the same trips
+    if (size > 1 && below(uint32_t(bits >> 32), 1u << 20) < config.locality * (1u << 20))
+    {
+        return first + (from - first + 1 + below(uint32_t(bits), size - 1)) % size;
+    }
+    uint32_t n = uint32_t(config.nbSites);
+    return (from + 1 + below(uint32_t(bits), n - 1)) % n;
+}
+
+void ShardEngine::runShared(size_t k)
+{
+    Worker& worker = *workers[k];
+    while (!stopping.load(std::memory_order_relaxed) && !worker.riders.empty())
+    {
+        for (size_t i = 0; i < batchSize; ++i)
+        {
+            Rider rider = worker.riders.front();
+            worker.riders.pop_front();
+            SharedStation& station = shared[rider.site];
+            station.mutex.lock();
+            bool served = serve(worker, rider, station.state);
+            station.mutex.unlock();
+            worker.retries += !served;
+            worker.riders.push_back(rider);
+        }
+    }
+}
+
+void ShardEngine::route(Worker& worker, size_t k, const Rider& rider)
+{
+    size_t owner = ownerOf(rider.site);
+    if (owner == k)
+    {
+        worker.riders.push_back(rider);
+        return;
+    }
+    // Keeps the order towards a thread: nothing overtakes the overflow
+    std::vector<Rider>& overflow = worker.overflow[owner];
+    if (overflow.empty() && queue(k, owner).push(rider))
+    {
+        worker.messages++;
+        return;
+    }
+    overflow.push_back(rider);
+}
+
+void ShardEngine::runOwned(size_t k)
+{
+    Worker& worker = *workers[k];
+    while (!stopping.load(std::memory_order_relaxed))
+    {
+        // Riders arriving from the other ranges, then those left over for them
+        Rider rider;
+        for (size_t from = 0; from < config.threads; ++from)
+        {
+            while (from != k && queue(from, k).pop(rider))
+            {
+                worker.riders.push_back(rider);
+            }
+        }
+        for (size_t to = 0; to < config.threads; ++to)
+        {
+            std::vector<Rider>& overflow = worker.overflow[to];
+            size_t sent = 0;
+            while (sent < overflow.size() && queue(k, to).push(overflow[sent]))
+            {
+                sent++;
+            }
+            overflow.erase(overflow.begin(), overflow.begin() + sent);
+            worker.messages += sent;
+        }
+
+        for (size_t i = 0; i < batchSize && !worker.riders.empty(); ++i)
+        {
+            rider = worker.riders.front();
+            worker.riders.pop_front();
+            bool served = serve(worker, rider, worker.stations[rider.site - worker.firstSite]);
+            worker.retries += !served;
+            route(worker, k, rider);
+        }
+    }
+}
+
+size_t ShardEngine::bikesAccountedFor() const
+{
+    size_t count = 0;
+    auto countRiders = [&count](const Rider& rider) { count += rider.riding; };
+    if (shared)
+    {
+        for (size_t s = 0; s < config.nbSites; ++s)
+        {
+            count += shared[s].state.total;
+        }
+    }
+    for (const auto& worker : workers)
+    {
+        for (const Station& station : worker->stations)
+        {
+            count += station.total;
+        }
+        std::for_each(worker->riders.begin(), worker->riders.end(), countRiders);
+        for (const std::vector<Rider>& overflow : worker->overflow)
+        {
+            std::for_each(overflow.begin(), overflow.end(), countRiders);
+        }
+    }
+    return count;
+}
@@ -0,0 +1,257 @@
+/*
+    * simcontext.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "simcontext.h"
+#include "bikestation.h"
+#include "bikinginterface.h"
+#include "occupancy.h"
+#include "person.h"
+#include "snapshot.h"
+#include "telemetry.h"
+#include "van.h"
+
+#include <algorithm>
+#include <sstream>
+
+bool parseRiderFallbacks(const std::string& names, RiderPolicy& policy)
+{
+    policy.acceptOtherType = false;
+    policy.walkToStock = false;
+    policy.divertToFreeDock = false;
+    if (names == "none")
+    {
+        return true;
+    }
+    std::istringstream stream(names);
+    std::string name;
+    while (std::getline(stream, name, '+'))
+    {
+        if (name == "type")
+            policy.acceptOtherType = true;
+        else if (name == "walk")
+            policy.walkToStock = true;
+        else if (name == "dock")
+            policy.divertToFreeDock = true;
+        else
+            return false;
+    }
+    return true;
+}
+
+std::string riderFallbacksName(const RiderPolicy& policy)
+{
+    std::string names;
+    if (policy.acceptOtherType)
+        names += "+type";
+    if (policy.walkToStock)
+        names += "+walk";
+    if (policy.divertToFreeDock)
+        names += "+dock";
+    return names.empty() ? "none" : names.substr(1);
+}
+
+SimContext::SimContext(const SimConfig& _config)
+    : config(_config),
+      siteMap(config.sites.empty() ? defaultSiteLayout(NBSITES) : config.sites),
+      siteIndex(std::vector<SitePoint>(siteMap.positions().begin(), siteMap.positions().begin() + NBSITES),
+                SITE_NEIGHBOURS),
+      vanRoute(siteMap.tour(DEPOT_ID, NBSITES)),
+      control(this)
+{
+    for (size_t s = 0; s < NBSITES; ++s)
+    {
+        stations[s] = makeBikeStation(config.station, config.slotsPerSite, s).release();
+        stations[s]->publishAvailability(&siteIndex.flags(s));
+    }
+    stations[DEPOT_ID] = makeBikeStation(config.station, config.nbBikes, DEPOT_ID).release();
+}
+
+SimContext::~SimContext()
+{
+    if (!threads.empty())
+    {
+        stop();
+        join();
+    }
+    for (Person *rider : riders)
+    {
+        delete rider;
+    }
+    for (Van *van : vans)
+    {
+        delete van;
+    }
+    for (BikeStation *station : stations)
+    {
+        delete station;
+    }
+}
+
+void SimContext::populate()
+{
+    size_t total = config.nbBikes;
+    bikeCount = total;
+    bikes.reset(new Bike[total]);
+    size_t idx = 0;
+    for (size_t s = 0; s < NB_SITES_TOTAL; ++s)
+    {
+        size_t perSite = std::min(config.slotsPerSite - 2, total - idx);
+        size_t count = s == DEPOT_ID ? total - idx : perSite;
+        std::vector<Bike*> chunk;
+        for (size_t k = 0; k < count; ++k, ++idx)
+        {
+            bikes[idx].bikeType = idx % Bike::nbBikeTypes;
+            chunk.push_back(&bikes[idx]);
+        }
+        stations[s]->addBikes(chunk);
+    }
+
+    for (size_t i = 0; i < config.nbVans; ++i)
+    {
+        vans.push_back(new Van(this, i));
+    }
+    for (size_t i = 1; i <= config.nbRiders; ++i)
+    {
+        riders.push_back(new Person(this, i));
+    }
+}
+
+bool SimContext::restore(const Snapshot& snapshot)
+{
+    bikeCount = snapshot.bikes.size();
+    return snapshot.restore(*this);
+}
+
+void SimContext::start()
+{
+    if (interface)
+    {
+        interface->setStopSignal(&stopSignal);
+    }
+    watchdog.reset(riders.size());
+    if (config.policy.maxWaitMs)
+    {
+        threads.emplace_back(std::make_unique<PcoThread>(&SimContext::tick, this));
+    }
+    if (config.stallMs)
+    {
+        threads.emplace_back(std::make_unique<PcoThread>(&SimContext::watchStalls, this));
+    }
+    if (telemetry)
+    {
+        threads.emplace_back(std::make_unique<PcoThread>(&SimContext::publishTelemetry, this));
+    }
+    if (occupancy)
+    {
+        threads.emplace_back(std::make_unique<PcoThread>(&SimContext::recordOccupancy, this));
+    }
+    threads.emplace_back(std::make_unique<PcoThread>(&ControlAgent::run, &control));
+    for (Van *van : vans)
+    {
+        threads.emplace_back(std::make_unique<PcoThread>(&Van::run, van));
+    }
+    for (Person *rider : riders)
+    {
+        threads.emplace_back(std::make_unique<PcoThread>(&Person::run, rider));
+    }
+}
+
+int SimContext::nearestSiteWithBike(unsigned int from, size_t type, bool anyType) const
+{
+    return siteIndex.nearest(from, anyType ? SiteAnyBike : siteTypeFlag(type));
+}
+
+int SimContext::nearestSiteWithFreeDock(unsigned int from) const
+{
+    return siteIndex.nearest(from, SiteFreeDock);
+}
+
+void SimContext::tick()
+{
+    // A quarter of the bound, kept between 1 and 20 ms
+    unsigned int periodUs = std::clamp(config.policy.maxWaitMs * 250u, 1000u, 20000u);
+    while (!PcoThread::thisThread()->stopRequested())
+    {
+        if (!stopSignal.sleepFor(uint64_t(periodUs) * 1000))
+        {
+            break;
+        }
+        for (size_t s = 0; s < NBSITES; ++s)
+        {
+            stations[s]->wakeTimedWaiters();
+        }
+    }
+}
+
+void SimContext::publishTelemetry()
+{
+    while (stopSignal.sleepFor(uint64_t(TELEMETRY_PERIOD_US) * 1000))
+    {
+        telemetry->publish(*this);
+    }
+    // Last state, then the viewers know nothing will change any more
+    telemetry->publish(*this);
+    telemetry->markStopped();
+}
+
+void SimContext::watchStalls()
+{
+    // Four scans per threshold, so a stall is reported at most 25% late
+    uint64_t thresholdNs = uint64_t(config.stallMs) * 1000000;
+    uint64_t periodNs = std::clamp<uint64_t>(thresholdNs / 4, 10000000, 1000000000);
+    while (stopSignal.sleepFor(periodNs))
+    {
+        size_t found = watchdog.scan(*this, thresholdNs, stderr);
+        if (found && interface)
+        {
+            interface->consoleAppendText(0, QString("Blocage: %1 personne(s) attendent depuis plus de %2 ms")
+                                                .arg(found).arg(config.stallMs));
+        }
+    }
+}
+
+void SimContext::recordOccupancy()
+{
+    // Counters are read without the station locks, as for the telemetry
+    std::vector<uint32_t> values(NB_SITES_TOTAL * Bike::nbBikeTypes);
+    uint64_t periodNs = uint64_t(occupancy->periodUs()) * 1000;
+    occupancy->setOrigin(nowNs());
+    do
+    {
+        for (size_t s = 0; s < NB_SITES_TOTAL; ++s)
+        {
+            for (size_t t = 0; t < Bike::nbBikeTypes; ++t)
+            {
+                values[s * Bike::nbBikeTypes + t] = uint32_t(stations[s]->countBikesOfType(t));
+            }
+        }
+        // Late samples repeat the current values, so that row n stays at n periods
+        uint64_t due = occupancy->rowsDue(nowNs());
+        occupancy->append(values.data(), std::max<uint64_t>(due - occupancy->nbRows(), 1));
+    } while (stopSignal.sleepFor(periodNs));
+}
+
+void SimContext::stop()
+{
+    stopSignal.raise();
+    control.wake();
+    for (auto& thread : threads)
+    {
+        thread->requestStop();
+    }
+    for (BikeStation *station : stations)
+    {
+        station->ending();
+    }
+}
+
+void SimContext::join()
+{
+    for (auto& thread : threads)
+    {
+        thread->join();
+    }
+    threads.clear();
+}
@@ -0,0 +1,144 @@
+/*
+    * simstats.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "simstats.h"
+
+#include <algorithm>
+
+size_t HistogramSnapshot::bucketOf(uint64_t value)
+{
+    if (value < 16)
+    {
+        return value;
+    }
+    size_t exponent = 63 - __builtin_clzll(value);
+    size_t sub = (value >> (exponent - 3)) & 7;
+    size_t bucket = 16 + (exponent - 4) * 8 + sub;
+    return bucket < nbBuckets ? bucket : nbBuckets - 1;
+}
+
+uint64_t HistogramSnapshot::bucketUpperBound(size_t bucket)
+{
+    if (bucket < 16)
+    {
+        return bucket;
+    }
+    size_t exponent = (bucket - 16) / 8 + 4;
+    uint64_t sub = (bucket - 16) % 8;
+    uint64_t lower = (8 + sub) << (exponent - 3);
+    return lower + (uint64_t(1) << (exponent - 3)) - 1;
+}
+
+void HistogramSnapshot::merge(const HistogramSnapshot& other)
+{
+    for (size_t i = 0; i < nbBuckets; ++i)
+    {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    if (other.max > max)
+    {
+        max = other.max;
+    }
+}
+
+void HistogramSnapshot::subtract(const HistogramSnapshot& earlier)
+{
+    for (size_t i = 0; i < nbBuckets; ++i)
+    {
+        buckets[i] -= earlier.buckets[i];
+    }
+    count -= earlier.count;
+    sum -= earlier.sum;
+}
+
+uint64_t HistogramSnapshot::percentile(double p) const
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * count);
+    if (rank >= count)
+    {
+        rank = count - 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < nbBuckets; ++i)
+    {
+        seen += buckets[i];
+        if (seen > rank)
+        {
+            uint64_t bound = bucketUpperBound(i);
+            return bound < max ? bound : max;
+        }
+    }
+    return max;
+}
+
+void Histogram::record(uint64_t value)
+{
+    buckets[HistogramSnapshot::bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t previous = max.load(std::memory_order_relaxed);
+    while (value > previous &&
+           !max.compare_exchange_weak(previous, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+HistogramSnapshot Histogram::snapshot() const
+{
+    HistogramSnapshot result;
+    for (size_t i = 0; i < HistogramSnapshot::nbBuckets; ++i)
+    {
+        result.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+        result.count += result.buckets[i];
+    }
+    result.sum = sum.load(std::memory_order_relaxed);
+    result.max = max.load(std::memory_order_relaxed);
+    return result;
+}
+
+void SparseHistogram::record(uint64_t value)
+{
+    uint16_t bucket = static_cast<uint16_t>(HistogramSnapshot::bucketOf(value));
+    auto it = std::lower_bound(entries.begin(), entries.end(), bucket,
+                               [](const std::pair<uint16_t, uint32_t>& entry, uint16_t b) {
+                                   return entry.first < b;
+                               });
+    if (it != entries.end() && it->first == bucket)
+    {
+        it->second++;
+    }
+    else
+    {
+        entries.insert(it, {bucket, 1});
+    }
+    sum += value;
+    max = value > max ? value : max;
+}
+
+void SparseHistogram::mergeInto(HistogramSnapshot& target) const
+{
+    for (const auto& entry : entries)
+    {
+        target.buckets[entry.first] += entry.second;
+        target.count += entry.second;
+    }
+    target.sum += sum;
+    target.max = max > target.max ? max : target.max;
+}
+
+uint64_t SparseHistogram::count() const
+{
+    uint64_t total = 0;
+    for (const auto& entry : entries)
+    {
+        total += entry.second;
+    }
+    return total;
+}
@@ -0,0 +1,50 @@
+/*
+    * siteindex.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "siteindex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+std::vector<SitePoint> circleLayout(size_t nbSites)
+{
+    std::vector<SitePoint> sites(nbSites);
+    for (size_t i = 0; i < nbSites; ++i)
+    {
+        double angle = 2.0 * M_PI * i / nbSites;
+        sites[i] = SitePoint{std::cos(angle), std::sin(angle)};
+    }
+    return sites;
+}
+
+SiteIndex::SiteIndex(const std::vector<SitePoint>& sites, size_t _k)
+    : count(sites.size()),
+      k(std::min(_k, sites.empty() ? 0 : sites.size() - 1)),
+      neighbourIds(count * k),
+      siteFlags(new std::atomic<uint32_t>[count])
+{
+    // Built once, so a full scan per site is enough even for 10k sites
+    std::vector<std::pair<double, uint32_t>> candidates;
+    for (size_t from = 0; from < count; ++from)
+    {
+        siteFlags[from].store(0, std::memory_order_relaxed);
+        candidates.clear();
+        for (size_t to = 0; to < count; ++to)
+        {
+            if (to != from)
+            {
+                double dx = sites[to].x - sites[from].x;
+                double dy = sites[to].y - sites[from].y;
+                candidates.emplace_back(dx * dx + dy * dy, uint32_t(to));
+            }
+        }
+        std::partial_sort(candidates.begin(), candidates.begin() + k, candidates.end());
+        for (size_t i = 0; i < k; ++i)
+        {
+            neighbourIds[from * k + i] = candidates[i].second;
+        }
+    }
+}
@@ -0,0 +1,135 @@
+/*
+    * sitemap.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "sitemap.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+std::vector<SitePoint> defaultSiteLayout(size_t nbSites)
+{
+    std::vector<SitePoint> points = circleLayout(nbSites);
+    points.push_back(SitePoint{0, 0});
+    return points;
+}
+
+std::vector<SitePoint> diskLayout(size_t nbSites, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::vector<SitePoint> points(nbSites);
+    for (SitePoint& point : points)
+    {
+        // Square root of the radius for a uniform density over the disk
+        double radius = std::sqrt(unit(rng));
+        double angle = 2.0 * M_PI * unit(rng);
+        point = SitePoint{radius * std::cos(angle), radius * std::sin(angle)};
+    }
+    return points;
+}
+
+bool loadSiteLayout(const std::string& path, size_t nbSites, std::vector<SitePoint>& points)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::fprintf(stderr, "%s: cannot open the site layout\n", path.c_str());
+        return false;
+    }
+
+    points.clear();
+    SitePoint depot;
+    bool hasDepot = false;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream tokens(line);
+        std::string first;
+        if (!(tokens >> first))
+        {
+            continue;
+        }
+        SitePoint point;
+        bool isDepot = first == "depot";
+        if (isDepot ? !(tokens >> point.x >> point.y) : !(std::istringstream(first) >> point.x && tokens >> point.y))
+        {
+            std::fprintf(stderr, "%s: invalid line \"%s\"\n", path.c_str(), line.c_str());
+            return false;
+        }
+        if (isDepot)
+        {
+            depot = point;
+            hasDepot = true;
+        }
+        else
+        {
+            points.push_back(point);
+        }
+    }
+    if (points.size() != nbSites)
+    {
+        std::fprintf(stderr, "%s: %zu sites, %zu expected\n", path.c_str(), points.size(), nbSites);
+        return false;
+    }
+
+    if (!hasDepot)
+    {
+        for (const SitePoint& point : points)
+        {
+            depot.x += point.x / nbSites;
+            depot.y += point.y / nbSites;
+        }
+    }
+    points.push_back(depot);
+    return true;
+}
+
+SiteMap::SiteMap(const std::vector<SitePoint>& _points)
+    : points(_points),
+      packed(points.size() * (points.size() - 1) / 2)
+{
+    float *cell = packed.data();
+    for (size_t row = 1; row < points.size(); ++row)
+    {
+        for (size_t col = 0; col < row; ++col)
+        {
+            *cell++ = float(std::hypot(points[row].x - points[col].x, points[row].y - points[col].y));
+        }
+    }
+}
+
+std::vector<unsigned int> SiteMap::tour(unsigned int start, size_t nbSites) const
+{
+    std::vector<unsigned int> order;
+    std::vector<bool> visited(nbSites, false);
+    if (start < nbSites)
+    {
+        visited[start] = true;
+    }
+    size_t remaining = nbSites - (start < nbSites ? 1 : 0);
+    unsigned int current = start;
+    while (remaining > 0)
+    {
+        // Ties, within 10 cm, go to the lowest index: the default layout keeps the site order
+        unsigned int next = 0;
+        float best = INFINITY;
+        for (unsigned int s = 0; s < nbSites; ++s)
+        {
+            if (!visited[s] && distance(current, s) < best - 1e-4f)
+            {
+                best = distance(current, s);
+                next = s;
+            }
+        }
+        visited[next] = true;
+        order.push_back(next);
+        current = next;
+        remaining--;
+    }
+    return order;
+}
@@ -0,0 +1,214 @@
+/*
+    * snapshot.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "snapshot.h"
+#include "bikestation.h"
+#include "person.h"
+#include "simcontext.h"
+#include "van.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+struct SnapshotHeader
+{
+    char magic[8];      /**< "PCOSNAP1". */
+    uint32_t nbSites;   /**< NB_SITES_TOTAL. */
+    uint32_t nbTypes;   /**< Bike::nbBikeTypes. */
+    uint32_t nbBikes;
+    uint32_t nbRiders;
+    uint32_t nbVans;
+    uint32_t reserved;
+};
+
+template <class T>
+void append(std::vector<char>& buffer, const std::vector<T>& items)
+{
+    const char *bytes = reinterpret_cast<const char *>(items.data());
+    buffer.insert(buffer.end(), bytes, bytes + items.size() * sizeof(T));
+}
+
+template <class T>
+void extract(const char *&cursor, std::vector<T>& items, size_t count)
+{
+    items.resize(count);
+    std::memcpy(items.data(), cursor, count * sizeof(T));
+    cursor += count * sizeof(T);
+}
+
+}
+
+Snapshot Snapshot::capture(const SimContext& context)
+{
+    Snapshot snapshot;
+
+    // Station bikes first, in storage order, then the ones in transit
+    for (size_t s = 0; s < NB_SITES_TOTAL; ++s)
+    {
+        for (Bike *bike : context.stations[s]->contents())
+        {
+            snapshot.bikes.push_back(BikeState{uint8_t(bike->bikeType), HeldByStation, 0, uint32_t(s)});
+        }
+    }
+    for (size_t r = 0; r < context.riders.size(); ++r)
+    {
+        snapshot.riders.push_back(context.riders[r]->state());
+        if (Bike *bike = context.riders[r]->heldBike())
+        {
+            snapshot.bikes.push_back(BikeState{uint8_t(bike->bikeType), HeldByRider, 0, uint32_t(r)});
+        }
+    }
+    for (size_t v = 0; v < context.vans.size(); ++v)
+    {
+        snapshot.vans.push_back(context.vans[v]->state());
+        for (Bike *bike : context.vans[v]->cargoBikes())
+        {
+            snapshot.bikes.push_back(BikeState{uint8_t(bike->bikeType), HeldByVan, 0, uint32_t(v)});
+        }
+    }
+    return snapshot;
+}
+
+bool Snapshot::restore(SimContext& context) const
+{
+    context.bikes.reset(new Bike[bikes.size()]);
+    std::array<std::vector<Bike*>, NB_SITES_TOTAL> stationBikes;
+    std::vector<Bike*> riderBikes(riders.size(), nullptr);
+    std::vector<std::vector<Bike*>> vanBikes(vans.size());
+
+    for (size_t i = 0; i < bikes.size(); ++i)
+    {
+        const BikeState& state = bikes[i];
+        Bike *bike = &context.bikes[i];
+        bike->bikeType = state.type;
+        if (state.holder == HeldByStation && state.index < NB_SITES_TOTAL)
+            stationBikes[state.index].push_back(bike);
+        else if (state.holder == HeldByRider && state.index < riders.size())
+            riderBikes[state.index] = bike;
+        else if (state.holder == HeldByVan && state.index < vans.size())
+            vanBikes[state.index].push_back(bike);
+        else
+            return false;
+    }
+
+    for (size_t s = 0; s < NB_SITES_TOTAL; ++s)
+    {
+        if (!context.stations[s]->addBikes(stationBikes[s]).empty())
+        {
+            return false;
+        }
+    }
+    for (size_t r = 0; r < riders.size(); ++r)
+    {
+        context.riders.push_back(new Person(&context, riders[r], riderBikes[r]));
+    }
+    for (size_t v = 0; v < vans.size(); ++v)
+    {
+        context.vans.push_back(new Van(&context, vans[v], vanBikes[v]));
+    }
+    return true;
+}
+
+bool Snapshot::save(const std::string& path) const
+{
+    SnapshotHeader header{};
+    std::memcpy(header.magic, "PCOSNAP1", sizeof(header.magic));
+    header.nbSites = NB_SITES_TOTAL;
+    header.nbTypes = Bike::nbBikeTypes;
+    header.nbBikes = bikes.size();
+    header.nbRiders = riders.size();
+    header.nbVans = vans.size();
+
+    std::vector<char> buffer(reinterpret_cast<const char *>(&header),
+                             reinterpret_cast<const char *>(&header) + sizeof(header));
+    append(buffer, bikes);
+    append(buffer, riders);
+    append(buffer, vans);
+
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        std::perror(path.c_str());
+        return false;
+    }
+    bool ok = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok)
+    {
+        std::perror(path.c_str());
+    }
+    return ok;
+}
+
+bool Snapshot::load(const std::string& path)
+{
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        std::perror(path.c_str());
+        return false;
+    }
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    std::vector<char> buffer(size > 0 ? size : 0);
+    bool ok = std::fread(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    std::fclose(file);
+
+    SnapshotHeader header;
+    if (!ok || buffer.size() < sizeof(header))
+    {
+        std::fprintf(stderr, "%s: cannot read snapshot\n", path.c_str());
+        return false;
+    }
+    std::memcpy(&header, buffer.data(), sizeof(header));
+    size_t expected = sizeof(header) + header.nbBikes * sizeof(BikeState) +
+                      header.nbRiders * sizeof(RiderState) + header.nbVans * sizeof(VanState);
+    if (std::memcmp(header.magic, "PCOSNAP1", sizeof(header.magic)) != 0 ||
+        buffer.size() != expected)
+    {
+        std::fprintf(stderr, "%s: not a snapshot or truncated\n", path.c_str());
+        return false;
+    }
+    if (header.nbSites != NB_SITES_TOTAL || header.nbTypes != Bike::nbBikeTypes)
+    {
+        std::fprintf(stderr, "%s: snapshot of a different configuration\n", path.c_str());
+        return false;
+    }
+
+    const char *cursor = buffer.data() + sizeof(header);
+    extract(cursor, bikes, header.nbBikes);
+    extract(cursor, riders, header.nbRiders);
+    extract(cursor, vans, header.nbVans);
+    for (const BikeState& bike : bikes)
+    {
+        if (bike.type >= Bike::nbBikeTypes)
+        {
+            std::fprintf(stderr, "%s: invalid bike type\n", path.c_str());
+            return false;
+        }
+    }
+    // Agents index the stations with these, riders never go to the depot
+    for (const RiderState& rider : riders)
+    {
+        if (rider.site >= NBSITES || rider.destination >= NBSITES ||
+            rider.phase >= NbRiderPhases || rider.preferredType >= Bike::nbBikeTypes)
+        {
+            std::fprintf(stderr, "%s: invalid state of rider %u\n", path.c_str(), rider.id);
+            return false;
+        }
+    }
+    for (const VanState& van : vans)
+    {
+        if (van.site >= NB_SITES_TOTAL)
+        {
+            std::fprintf(stderr, "%s: invalid state of van %u\n", path.c_str(), van.id);
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,139 @@
+/*
+    * spinfutex.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "spinfutex.h"
+#include "simstats.h"
+
+#include <algorithm>
+#include <climits>
+#include <ctime>
+#include <thread>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace {
+
+// Bounds of the spinning of a contended lock, in pause instructions
+const uint32_t maxSpin = 4096;
+const uint32_t maxBackoff = 64;
+
+const bool multiCore = std::thread::hardware_concurrency() > 1;
+
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+}
+
+void futexWait(std::atomic<uint32_t> *word, uint32_t expected, uint64_t timeoutNs)
+{
+    timespec timeout{time_t(timeoutNs / 1000000000), long(timeoutNs % 1000000000)};
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT_PRIVATE, expected,
+            timeoutNs ? &timeout : nullptr, nullptr, 0);
+}
+
+void futexWake(std::atomic<uint32_t> *word, int count)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+void SpinFutexMutex::lockContended()
+{
+    uint32_t budget = spinBudget.load(std::memory_order_relaxed);
+    uint32_t limit = multiCore ? std::min(2 * budget + 16, maxSpin) : 0;
+    uint32_t delay = 1;
+    for (uint32_t spun = 0; spun < limit; spun += delay, delay = std::min(delay * 2, maxBackoff))
+    {
+        for (uint32_t i = 0; i < delay; ++i)
+        {
+            cpuRelax();
+        }
+        uint32_t expected = 0;
+        // Reads first, so that spinners do not steal the line from the holder
+        if (word.load(std::memory_order_relaxed) == 0 &&
+            word.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            spinBudget.store(uint32_t(int32_t(budget) + (int32_t(spun) - int32_t(budget)) / 8),
+                             std::memory_order_relaxed);
+            return;
+        }
+    }
+    if (multiCore)
+    {
+        spinBudget.store(budget / 2, std::memory_order_relaxed);
+    }
+
+    // Marked as contended, so that the unlock wakes the next sleeper
+    while (word.exchange(2, std::memory_order_acquire) != 0)
+    {
+        futexWait(&word, 2);
+    }
+}
+
+void SpinFutexMutex::wake()
+{
+    futexWake(&word, 1);
+}
+
+void FutexConditionVariable::wait(SpinFutexMutex *mutex)
+{
+    uint32_t seq = sequence.load(std::memory_order_relaxed);
+    waiters.fetch_add(1, std::memory_order_relaxed);
+    mutex->unlock();
+    futexWait(&sequence, seq);
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+    mutex->lock();
+}
+
+void FutexConditionVariable::notifyOne()
+{
+    sequence.fetch_add(1, std::memory_order_relaxed);
+    if (waiters.load(std::memory_order_relaxed))
+    {
+        futexWake(&sequence, 1);
+    }
+}
+
+void FutexConditionVariable::notifyAll()
+{
+    sequence.fetch_add(1, std::memory_order_relaxed);
+    if (waiters.load(std::memory_order_relaxed))
+    {
+        futexWake(&sequence, INT_MAX);
+    }
+}
+
+void FutexEventCount::wait(uint32_t key, uint64_t deadlineNs)
+{
+    uint64_t now = deadlineNs ? nowNs() : 0;
+    if (!deadlineNs || now < deadlineNs)
+    {
+        futexWait(&sequence, key, deadlineNs ? deadlineNs - now : 0);
+    }
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void FutexEventCount::notifyAll()
+{
+    sequence.fetch_add(1, std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_seq_cst))
+    {
+        futexWake(&sequence, INT_MAX);
+    }
+}
+
+void FutexEventCount::wake(int count)
+{
+    futexWake(&sequence, count);
+}
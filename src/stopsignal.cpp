@@ -0,0 +1,40 @@
+/*
+    * stopsignal.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "stopsignal.h"
+#include "simstats.h"
+
+#include <chrono>
+
+void StopSignal::raise()
+{
+    {
+        // Under the lock, so that a sleeper cannot miss the notification
+        // between its check and its wait
+        std::lock_guard<std::mutex> lock(mutex);
+        isRaised.store(true, std::memory_order_relaxed);
+    }
+    raisedChanged.notify_all();
+}
+
+bool StopSignal::sleepUntil(uint64_t dueNs)
+{
+    uint64_t now = nowNs();
+    if (now >= dueNs)
+    {
+        return !raised();
+    }
+    // nowNs() reads the steady clock, so the deadline converts directly
+    std::chrono::steady_clock::time_point due(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(dueNs)));
+    std::unique_lock<std::mutex> lock(mutex);
+    raisedChanged.wait_until(lock, due, [this]() { return raised(); });
+    return !raised();
+}
+
+bool StopSignal::sleepFor(uint64_t durationNs)
+{
+    return sleepUntil(nowNs() + durationNs);
+}
@@ -0,0 +1,114 @@
+/*
+    * telemetry.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "telemetry.h"
+#include "bikestation.h"
+#include "simcontext.h"
+#include "van.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+Telemetry::~Telemetry()
+{
+    if (region)
+    {
+        markStopped();
+        munmap(region, sizeof(TelemetryRegion));
+    }
+}
+
+bool Telemetry::open(const std::string& name)
+{
+    std::string path = telemetryPath(name);
+    // A new file each time, so that a reader still mapping the previous
+    // run keeps its own copy instead of seeing this one being laid out
+    unlink(path.c_str());
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(TelemetryRegion)) != 0)
+    {
+        std::fprintf(stderr, "%s: %s\n", path.c_str(), std::strerror(errno));
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return false;
+    }
+    void *memory = mmap(nullptr, sizeof(TelemetryRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        std::fprintf(stderr, "%s: %s\n", path.c_str(), std::strerror(errno));
+        return false;
+    }
+
+    // The file is zero-filled: every sequence starts even, every page empty
+    region = new (memory) TelemetryRegion;
+    TelemetryHeader& header = region->header;
+    header.version = TELEMETRY_VERSION;
+    header.regionSize = sizeof(TelemetryRegion);
+    header.nbSites = NB_SITES_TOTAL;
+    header.nbBikeTypes = Bike::nbBikeTypes;
+    header.maxVans = TELEMETRY_MAX_VANS;
+    header.pid = getpid();
+    header.running.store(1, std::memory_order_relaxed);
+    // Written last: readers ignore the region until the magic is there
+    std::atomic_thread_fence(std::memory_order_release);
+    header.magic = TELEMETRY_MAGIC;
+    return true;
+}
+
+void Telemetry::publish(const SimContext& context)
+{
+    if (!region)
+    {
+        return;
+    }
+
+    TelemetryStations stations{};
+    for (size_t s = 0; s < NB_SITES_TOTAL; ++s)
+    {
+        const BikeStation *station = context.stations[s];
+        TelemetryStation& out = stations.stations[s];
+        for (size_t t = 0; t < Bike::nbBikeTypes; ++t)
+        {
+            out.bikes[t] = station->countBikesOfType(t);
+        }
+        out.total = station->nbBikes();
+        out.capacity = station->nbSlots();
+        out.bikeWaiters = station->nbWaitingForBike();
+        out.dockWaiters = station->nbWaitingForDock();
+    }
+    region->stations.write(stations);
+
+    TelemetryCounters counters{};
+    counters.sample = ++samples;
+    counters.elapsedNs = nowNs() - context.stats.startNs;
+    counters.tripsCompleted = context.stats.tripsCompleted.load(std::memory_order_relaxed);
+    counters.bikesInTransit = context.stats.bikesInTransit.load(std::memory_order_relaxed);
+    counters.vanRounds = context.stats.vanRounds.load(std::memory_order_relaxed);
+    counters.stalls = uint32_t(context.watchdog.nbStalls());
+    counters.nbVans = std::min(context.vans.size(), TELEMETRY_MAX_VANS);
+    for (size_t v = 0; v < counters.nbVans; ++v)
+    {
+        const Van *van = context.vans[v];
+        counters.vans[v] = TelemetryVan{van->site(), uint32_t(van->cargoCount()), van->roundCount()};
+    }
+    region->counters.write(counters);
+}
+
+void Telemetry::markStopped()
+{
+    if (region)
+    {
+        region->header.running.store(0, std::memory_order_release);
+    }
+}
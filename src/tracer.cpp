@@ -0,0 +1,238 @@
+/*
+    * tracer.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "tracer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct TraceEvent
+{
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+    int32_t site;
+    int32_t value;
+};
+
+/**
+ * Events per chunk of the arena, 8 KiB: small enough that thousands of
+ * riders recording a few events each do not use up the budget.
+ */
+const size_t chunkEvents = 256;
+
+/**
+ * State of one thread. Only the owner thread touches @c chunk and @c used.
+ */
+struct ThreadBuffer
+{
+    explicit ThreadBuffer(uint32_t _tid) : tid(_tid) {}
+
+    TraceEvent *chunk = nullptr;  /**< Chunk being filled, null before the first event. */
+    size_t chunkIndex = 0;
+    size_t used = 0;              /**< Events in @c chunk. */
+    uint64_t generation = 0;      /**< enable() the chunk was taken under. */
+    std::atomic<uint64_t> dropped{0};
+    uint32_t tid;
+    std::string name;
+};
+
+/**
+ * Chunks are handed out in order; the writer reads chunk c once its owner
+ * is published, then its first @c chunkSizes[c] events, which are never
+ * modified once published.
+ */
+struct Registry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::string path;
+    uint64_t originNs = 0;
+    std::atomic<uint64_t> generation{0};
+    std::unique_ptr<TraceEvent[]> arena;  /**< Left uninitialised, pages are touched on use. */
+    size_t nbChunks = 0;
+    std::unique_ptr<std::atomic<uint32_t>[]> chunkOwners; /**< Thread id, 0 while unused. */
+    std::unique_ptr<std::atomic<size_t>[]> chunkSizes;
+    std::atomic<size_t> nextChunk{0};
+};
+
+Registry& registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+thread_local ThreadBuffer *localBuffer = nullptr;
+
+ThreadBuffer *threadBuffer()
+{
+    if (!localBuffer)
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.buffers.push_back(std::make_unique<ThreadBuffer>(static_cast<uint32_t>(reg.buffers.size() + 1)));
+        localBuffer = reg.buffers.back().get();
+    }
+    return localBuffer;
+}
+
+/**
+ * Gives the thread a fresh chunk of the arena, false once it is used up.
+ */
+bool takeChunk(Registry& reg, ThreadBuffer *buffer)
+{
+    size_t index = reg.nextChunk.fetch_add(1, std::memory_order_relaxed);
+    if (index >= reg.nbChunks)
+    {
+        buffer->chunk = nullptr;
+        return false;
+    }
+    buffer->chunk = &reg.arena[index * chunkEvents];
+    buffer->chunkIndex = index;
+    buffer->used = 0;
+    reg.chunkOwners[index].store(buffer->tid, std::memory_order_release);
+    return true;
+}
+
+void writeJsonString(FILE *file, const std::string& text)
+{
+    std::fputc('"', file);
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            std::fputc('\\', file);
+        }
+        std::fputc(c, file);
+    }
+    std::fputc('"', file);
+}
+
+}
+
+std::atomic<bool> Tracer::isEnabled{false};
+
+void Tracer::enable(const std::string& path, size_t maxEvents)
+{
+    Registry& reg = registry();
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.path = path;
+        reg.originNs = nowNs();
+        // Chunks of an earlier recording are forgotten by their threads
+        reg.generation++;
+        reg.nbChunks = std::max<size_t>(maxEvents / chunkEvents, 1);
+        reg.arena.reset(new TraceEvent[reg.nbChunks * chunkEvents]);
+        reg.chunkOwners.reset(new std::atomic<uint32_t>[reg.nbChunks]);
+        reg.chunkSizes.reset(new std::atomic<size_t>[reg.nbChunks]);
+        for (size_t c = 0; c < reg.nbChunks; ++c)
+        {
+            reg.chunkOwners[c].store(0, std::memory_order_relaxed);
+            reg.chunkSizes[c].store(0, std::memory_order_relaxed);
+        }
+        reg.nextChunk.store(0, std::memory_order_relaxed);
+    }
+    isEnabled = true;
+}
+
+void Tracer::setThreadName(const std::string& name)
+{
+    if (!enabled())
+    {
+        return;
+    }
+    ThreadBuffer *buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    buffer->name = name;
+}
+
+void Tracer::record(const char *name, uint64_t startNs, uint64_t endNs,
+                    int32_t site, int32_t value)
+{
+    if (!enabled())
+    {
+        return;
+    }
+    Registry& reg = registry();
+    ThreadBuffer *buffer = threadBuffer();
+    uint64_t generation = reg.generation.load(std::memory_order_relaxed);
+    if (buffer->generation != generation)
+    {
+        buffer->generation = generation;
+        takeChunk(reg, buffer);
+    }
+    else if (buffer->chunk && buffer->used == chunkEvents)
+    {
+        takeChunk(reg, buffer);
+    }
+    if (!buffer->chunk)
+    {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer->chunk[buffer->used] = TraceEvent{name, startNs, endNs, site, value};
+    buffer->used++;
+    reg.chunkSizes[buffer->chunkIndex].store(buffer->used, std::memory_order_release);
+}
+
+void Tracer::writeAndDisable()
+{
+    if (!isEnabled.exchange(false))
+    {
+        return;
+    }
+
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    FILE *file = std::fopen(reg.path.c_str(), "w");
+    if (!file)
+    {
+        std::perror(reg.path.c_str());
+        return;
+    }
+
+    uint64_t dropped = 0;
+    bool first = true;
+    std::fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (const auto& buffer : reg.buffers)
+    {
+        if (!buffer->name.empty())
+        {
+            std::fprintf(file, "%s{\"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"name\": \"thread_name\", "
+                               "\"args\": {\"name\": ",
+                         first ? "" : ",\n", buffer->tid);
+            writeJsonString(file, buffer->name);
+            std::fprintf(file, "}}");
+            first = false;
+        }
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+    }
+
+    size_t nbChunks = std::min(reg.nextChunk.load(std::memory_order_relaxed), reg.nbChunks);
+    for (size_t c = 0; c < nbChunks; ++c)
+    {
+        // A chunk taken but not published yet has no event
+        uint32_t tid = reg.chunkOwners[c].load(std::memory_order_acquire);
+        size_t size = tid ? reg.chunkSizes[c].load(std::memory_order_acquire) : 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            const TraceEvent& event = reg.arena[c * chunkEvents + i];
+            double ts = (event.start - reg.originNs) / 1000.0;
+            double dur = (event.end - event.start) / 1000.0;
+            std::fprintf(file, "%s{\"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"name\": \"%s\", "
+                               "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"site\": %d, \"value\": %d}}",
+                         first ? "" : ",\n", tid, event.name, ts, dur, event.site, event.value);
+            first = false;
+        }
+    }
+    std::fprintf(file, "\n], \"otherData\": {\"droppedEvents\": %llu}}\n",
+                 (unsigned long long)dropped);
+    std::fclose(file);
+}
@@ -0,0 +1,207 @@
+/*
+    * tripreader.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "tripreader.h"
+#include "bike.h"
+#include "config.h"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+/**
+ * Consumed pages are dropped by chunks of this size.
+ */
+const size_t releaseChunk = size_t(64) << 20;
+
+bool parseUnsigned(const char *&p, const char *end, unsigned long& value)
+{
+    const char *start = p;
+    value = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+    return p != start;
+}
+
+bool parseDecimal(const char *&p, const char *end, double& value)
+{
+    unsigned long integer = 0;
+    bool hasInteger = parseUnsigned(p, end, integer);
+    value = double(integer);
+    if (p < end && *p == '.')
+    {
+        p++;
+        double scale = 0.1;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            value += (*p - '0') * scale;
+            scale /= 10;
+            p++;
+            hasInteger = true;
+        }
+    }
+    return hasInteger;
+}
+
+bool expectComma(const char *&p, const char *end)
+{
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+    if (p >= end || *p != ',')
+    {
+        return false;
+    }
+    p++;
+    while (p < end && *p == ' ')
+    {
+        p++;
+    }
+    return true;
+}
+
+}
+
+TripReader::~TripReader()
+{
+    if (data)
+    {
+        munmap(const_cast<char *>(data), size);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+bool TripReader::open(const std::string& path, double _speed)
+{
+    fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        std::perror(path.c_str());
+        return false;
+    }
+    size = info.st_size;
+    speed = _speed > 0 ? _speed : 1;
+    if (size == 0)
+    {
+        return true;
+    }
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        std::perror("mmap");
+        size = 0;
+        return false;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    data = static_cast<const char *>(mapping);
+    return true;
+}
+
+bool TripReader::parseLine(const char *begin, const char *end, Trip& trip) const
+{
+    const char *p = begin;
+    unsigned long origin, destination, type;
+    if (!parseDecimal(p, end, trip.timeS) || !expectComma(p, end) ||
+        !parseUnsigned(p, end, origin) || !expectComma(p, end) ||
+        !parseUnsigned(p, end, destination) || !expectComma(p, end) ||
+        !parseUnsigned(p, end, type))
+    {
+        return false;
+    }
+    trip.durationS = -1;
+    if (expectComma(p, end) && !parseDecimal(p, end, trip.durationS))
+    {
+        return false;
+    }
+    if (origin >= NBSITES || destination >= NBSITES || type >= Bike::nbBikeTypes)
+    {
+        return false;
+    }
+    trip.origin = origin;
+    trip.destination = destination;
+    trip.bikeType = type;
+    return true;
+}
+
+bool TripReader::next(Trip& trip)
+{
+    mutex.lock();
+    if (startNs == 0)
+    {
+        startNs = nowNs();
+    }
+    bool found = false;
+    while (!found && offset < size)
+    {
+        const char *line = data + offset;
+        const char *newline = static_cast<const char *>(std::memchr(line, '\n', size - offset));
+        const char *end = newline ? newline : data + size;
+        offset = end - data + (newline ? 1 : 0);
+
+        found = parseLine(line, end, trip);
+        if (!found)
+        {
+            linesSkipped++;
+        }
+    }
+
+    // Gives the consumed pages back, they will not be read again
+    if (offset - released >= releaseChunk)
+    {
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        size_t upTo = offset / pageSize * pageSize;
+        madvise(const_cast<char *>(data) + released, upTo - released, MADV_DONTNEED);
+        released = upTo;
+    }
+
+    if (found)
+    {
+        if (firstTimeS < 0)
+        {
+            firstTimeS = trip.timeS;
+        }
+        tripsRead++;
+    }
+    mutex.unlock();
+    return found;
+}
+
+uint64_t TripReader::dueNs(const Trip& trip) const
+{
+    return startNs + scaledNs(trip.timeS - firstTimeS);
+}
+
+uint64_t TripReader::scaledNs(double seconds) const
+{
+    return seconds > 0 ? uint64_t(seconds / speed * 1e9) : 0;
+}
+
+void TripReader::recordDelay(uint64_t lateNs)
+{
+    delaysUs.record(lateNs / 1000);
+}
+
+void TripReader::printReport(FILE *file) const
+{
+    HistogramSnapshot delays = delaysUs.snapshot();
+    std::fprintf(file, "\nReplay: %llu trips read, %llu lines skipped, speed x%g\n",
+                 (unsigned long long)tripsRead, (unsigned long long)linesSkipped, speed);
+    std::fprintf(file, "Departure delay (data time): p50 %.1f s, p95 %.1f s, p99 %.1f s, max %.1f s\n",
+                 delays.percentile(50) * speed / 1e6, delays.percentile(95) * speed / 1e6,
+                 delays.percentile(99) * speed / 1e6, delays.max * speed / 1e6);
+}
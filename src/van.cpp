@@ -4,48 +4,102 @@
 */
 
 #include "van.h"
+#include "simstats.h"
+#include "tracer.h"
+#include "journal.h"
+#include <algorithm>
+#include <string>
 
-BikingInterface *Van::binkingInterface = nullptr;
-std::array<BikeStation *, NB_SITES_TOTAL> Van::stations{};
-
-Van::Van(unsigned int _id)
+Van::Van(SimContext *_context, unsigned int _id)
     : id(_id),
-      currentSite(DEPOT_ID)
+      currentSite(DEPOT_ID),
+      context(_context),
+      siteReached(DEPOT_ID)
+{
+}
+
+Van::Van(SimContext *_context, const VanState &_state, const std::vector<Bike *> &_cargo)
+    : id(_state.id),
+      currentSite(_state.site),
+      cargo(_cargo),
+      rng(_state.rngSeed, _state.rngDraws),
+      context(_context),
+      siteReached(_state.site)
 {
+    publishCargo();
 }
 
 void Van::run()
 {
+    Tracer::setThreadName("Van " + std::to_string(id));
+    Journal::setAgent(Journal::vanAgent | id);
     while (!PcoThread::thisThread()->stopRequested())
     {
         // wait for some time before starting next round
-        PcoThread::thisThread()->usleep(VAN_DEPOT_WAITIME);
+        if (!context->stopSignal.sleepFor(uint64_t(context->config.depotWaitUs) * 1000))
+        {
+            break;
+        }
+        TraceSpan span("van round");
+        uint64_t roundStart = nowNs();
         loadAtDepot();
-        for (unsigned int s = 0; s < NBSITES; ++s)
+        for (unsigned int s : context->vanRoute)
         {
             driveTo(s);
             balanceSite(s);
         }
         returnToDepot();
+
+        SimStats& stats = context->stats;
+        uint64_t roundNs = nowNs() - roundStart;
+        stats.vanLastRoundNs.store(roundNs, std::memory_order_relaxed);
+        stats.vanTotalRoundNs.fetch_add(roundNs, std::memory_order_relaxed);
+        stats.vanRounds.fetch_add(1, std::memory_order_relaxed);
+        rounds.fetch_add(1, std::memory_order_relaxed);
     }
     log("Van s'arrête proprement");
 }
 
-void Van::setInterface(BikingInterface *_binkingInterface)
+size_t Van::cargoCount() const
 {
-    binkingInterface = _binkingInterface;
+    return cargoSize.load();
 }
 
-void Van::setStations(const std::array<BikeStation *, NB_SITES_TOTAL> &_stations)
+unsigned int Van::site() const
 {
-    stations = _stations;
+    return siteReached.load(std::memory_order_relaxed);
+}
+
+uint64_t Van::roundCount() const
+{
+    return rounds.load(std::memory_order_relaxed);
+}
+
+const std::vector<Bike *> &Van::cargoBikes() const
+{
+    return cargo;
+}
+
+VanState Van::state() const
+{
+    VanState state{};
+    state.id = id;
+    state.site = currentSite;
+    state.rngSeed = rng.seed;
+    state.rngDraws = rng.draws;
+    return state;
+}
+
+void Van::publishCargo()
+{
+    cargoSize.store(cargo.size());
 }
 
 void Van::log(const QString &msg) const
 {
-    if (binkingInterface)
+    if (context->interface)
     {
-        binkingInterface->consoleAppendText(0, msg);
+        context->interface->consoleAppendText(0, msg);
     }
 }
 
@@ -53,48 +107,61 @@ void Van::driveTo(unsigned int _dest)
 {
     if (currentSite == _dest)
         return;
+    TraceSpan span("van leg", currentSite, _dest);
 
     log(QString("Conduit du site %1 au site %2 (cargo: %3 vélos)")
             .arg(currentSite)
             .arg(_dest)
             .arg(cargo.size()));
-    unsigned int travelTime = randomTravelTimeMs();
-    if (binkingInterface)
+    unsigned int travelTime = SiteMap::jittered(context->siteMap.driveMs(currentSite, _dest), rng);
+    SimStats& stats = context->stats;
+    stats.vanLegs.fetch_add(1, std::memory_order_relaxed);
+    stats.vanCargoSum.fetch_add(cargo.size(), std::memory_order_relaxed);
+    if (context->interface)
     {
-        binkingInterface->vanTravel(currentSite, _dest, travelTime);
+        context->interface->vanTravel(currentSite, _dest, travelTime);
     }
 
     currentSite = _dest;
+    siteReached.store(_dest, std::memory_order_relaxed);
 }
 
 void Van::loadAtDepot()
 {
     driveTo(DEPOT_ID);
+    TraceSpan span("van load", DEPOT_ID);
 
-    cargo.clear();
+    // Le cargo n'est pas vidé : il ne contient que les vélos que le dépôt
+    // n'a pas pu reprendre au tour précédent, les jeter les ferait disparaître
     log(QString("Charge des vélos au dépôt"));
     
     // Charger a = min(2, D) vélos où D est le nombre de vélos au dépôt
-    size_t depotBikes = stations[DEPOT_ID]->nbBikes();
-    size_t bikesToLoad = std::min(size_t(2), depotBikes);
-    std::vector<Bike *> loadedBikes = stations[DEPOT_ID]->getBikes(bikesToLoad);
+    size_t capacity = context->config.vanCapacity;
+    size_t depotBikes = context->stations[DEPOT_ID]->nbBikes();
+    size_t cargoSpace = cargo.size() < capacity ? capacity - cargo.size() : 0;
+    size_t bikesToLoad = std::min({context->config.depotLoad, depotBikes, cargoSpace});
+    std::vector<Bike *> loadedBikes = context->stations[DEPOT_ID]->getBikes(bikesToLoad);
     cargo.insert(cargo.end(), loadedBikes.begin(), loadedBikes.end());
+    publishCargo();
+    span.setValue(loadedBikes.size());
     
     log(QString("Chargé %1 vélos (dépôt: %2 vélos restants)")
             .arg(loadedBikes.size())
-            .arg(stations[DEPOT_ID]->nbBikes()));
+            .arg(context->stations[DEPOT_ID]->nbBikes()));
 
-    if (binkingInterface)
+    if (context->interface)
     {
-        binkingInterface->setBikes(DEPOT_ID, stations[DEPOT_ID]->nbBikes());
+        context->interface->setBikes(DEPOT_ID, context->stations[DEPOT_ID]->nbBikes());
     }
 }
 
 void Van::balanceSite(unsigned int _site)
 {
-    size_t Vi = stations[_site]->nbBikes();  // Number of bikes at site i
-    size_t threshold = BORNES - 2;           // B-2 (target threshold)
+    size_t Vi = context->stations[_site]->nbBikes();  // Number of bikes at site i
+    size_t threshold = context->config.slotsPerSite - 2; // B-2 (target threshold)
     size_t a = cargo.size();                 // Number of bikes in the van
+    // Trace value: bikes taken (> 0) or deposited (< 0)
+    TraceSpan span("van balance", _site, 0);
 
     log(QString("Van at site %1: %2 bikes (threshold: %3), cargo: %4")
             .arg(_site)
@@ -106,20 +173,23 @@ void Van::balanceSite(unsigned int _site)
     if (Vi > threshold)
     {
         // c = min(Vi-(B-2), 4-a) bikes to take
-        size_t cargoSpace = VAN_CAPACITY - a;
+        size_t capacity = context->config.vanCapacity;
+        size_t cargoSpace = a < capacity ? capacity - a : 0;
         size_t c = std::min(Vi - threshold, cargoSpace);
         
         if (c > 0)
         {
-            std::vector<Bike *> taken = stations[_site]->getBikes(c);
+            std::vector<Bike *> taken = context->stations[_site]->getBikes(c);
             cargo.insert(cargo.end(), taken.begin(), taken.end());
+            publishCargo();
+            span.setValue(taken.size());
             
             log(QString("Takes %1 bike(s) from site %2 (surplus)")
                     .arg(taken.size())
                     .arg(_site));
 
-            if (binkingInterface)
-                binkingInterface->setBikes(_site, stations[_site]->nbBikes());
+            if (context->interface)
+                context->interface->setBikes(_site, context->stations[_site]->nbBikes());
         }
     }
     // 2b. If Vi < B-2 then deposit bikes
@@ -134,12 +204,18 @@ void Van::balanceSite(unsigned int _site)
         {
             // If site i contains no bikes of type t
             // and the van contains at least one bike of type t
-            if (stations[_site]->countBikesOfType(type) == 0)
+            if (context->stations[_site]->countBikesOfType(type) == 0)
             {
                 Bike *bike = takeBikeFromCargo(type);
                 if (bike)
                 {
-                    stations[_site]->putBike(bike);
+                    if (!context->stations[_site]->putBike(bike))
+                    {
+                        // Simulation ending: the bike stays in the van
+                        cargo.push_back(bike);
+                        return;
+                    }
+                    publishCargo();
                     deposited++;
                     log(QString("Deposits bike type %1 (missing) at site %2")
                             .arg(type)
@@ -152,22 +228,28 @@ void Van::balanceSite(unsigned int _site)
         while (deposited < c && !cargo.empty())
         {
             Bike *bike = cargo.back();
+            if (!context->stations[_site]->putBike(bike))
+            {
+                return;
+            }
             cargo.pop_back();
-            stations[_site]->putBike(bike);
+            publishCargo();
             deposited++;
             log(QString("Deposits bike type %1 at site %2")
                     .arg(bike->bikeType)
                     .arg(_site));
         }
 
-        if (binkingInterface)
-            binkingInterface->setBikes(_site, stations[_site]->nbBikes());
+        span.setValue(-static_cast<int32_t>(deposited));
+        if (context->interface)
+            context->interface->setBikes(_site, context->stations[_site]->nbBikes());
     }
 }
 
 void Van::returnToDepot()
 {
     driveTo(DEPOT_ID);
+    TraceSpan span("van unload", DEPOT_ID);
 
     size_t a = cargo.size();
 
@@ -175,8 +257,10 @@ void Van::returnToDepot()
     if (a > 0)
     {
         log(QString("Retourne au dépôt avec %1 vélos").arg(a));
-        std::vector<Bike *> remainingBikes = stations[DEPOT_ID]->addBikes(cargo);
+        std::vector<Bike *> remainingBikes = context->stations[DEPOT_ID]->addBikes(cargo);
         cargo = remainingBikes;
+        publishCargo();
+        span.setValue(a - remainingBikes.size());
         
         if (remainingBikes.empty())
         {
@@ -194,9 +278,9 @@ void Van::returnToDepot()
         log(QString("Retourne au dépôt (cargo vide, a=0)"));
     }
 
-    if (binkingInterface)
+    if (context->interface)
     {
-        binkingInterface->setBikes(DEPOT_ID, stations[DEPOT_ID]->nbBikes());
+        context->interface->setBikes(DEPOT_ID, context->stations[DEPOT_ID]->nbBikes());
     }
 }
 
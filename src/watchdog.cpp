@@ -0,0 +1,184 @@
+/*
+    * watchdog.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "watchdog.h"
+#include "bikestation.h"
+#include "simcontext.h"
+#include "simstats.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Rows of a snapshot, the others are only counted
+const size_t maxDumpedRiders = 32;
+
+WaitResource resourceOf(uint32_t what)
+{
+    return WaitResource(what >> 24);
+}
+
+size_t typeOf(uint32_t what)
+{
+    return (what >> 16) & 0xff;
+}
+
+unsigned int siteOf(uint32_t what)
+{
+    return what & 0xffff;
+}
+
+/**
+ * @brief Whether the station could serve the wait right now.
+ */
+bool servable(const SimContext& context, uint32_t what)
+{
+    if (siteOf(what) >= NB_SITES_TOTAL)
+    {
+        return false;
+    }
+    const BikeStation *station = context.stations[siteOf(what)];
+    if (resourceOf(what) == WaitForDock)
+    {
+        return station->nbBikes() < station->nbSlots();
+    }
+    return station->countBikesOfType(typeOf(what)) > 0;
+}
+
+}
+
+thread_local StallWatchdog::Slot *StallWatchdog::localSlot = nullptr;
+
+void StallWatchdog::reset(size_t nbAgents)
+{
+    entries.reset(new Slot[nbAgents]);
+    nbSlots = nbAgents;
+    attached.store(0, std::memory_order_relaxed);
+}
+
+void StallWatchdog::attach(unsigned int riderId)
+{
+    size_t index = attached.fetch_add(1, std::memory_order_relaxed);
+    if (index >= nbSlots)
+    {
+        localSlot = nullptr;
+        return;
+    }
+    entries[index].rider = riderId;
+    localSlot = &entries[index];
+}
+
+size_t StallWatchdog::scan(const SimContext& context, uint64_t thresholdNs, FILE *out)
+{
+    struct Overdue
+    {
+        const Slot *slot;
+        uint32_t what;
+        uint64_t waitedNs;
+        bool servable;
+    };
+
+    uint64_t now = nowNs();
+    size_t count = std::min(attached.load(std::memory_order_acquire), nbSlots);
+    std::vector<Overdue> overdue;
+    size_t newStalls = 0;
+    size_t newStuck = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        Slot& slot = entries[i];
+        uint64_t since = slot.sinceNs.load(std::memory_order_acquire);
+        if (!since || now < since + thresholdNs)
+        {
+            continue;
+        }
+        uint32_t what = slot.what.load(std::memory_order_relaxed);
+        bool canServe = servable(context, what);
+        if (slot.reportedSince != since)
+        {
+            slot.reportedSince = since;
+            newStalls++;
+        }
+        // Servable at one scan may just be a wake-up on its way, not at two
+        if (canServe && slot.servableSince == since && slot.stuckSince != since)
+        {
+            slot.stuckSince = since;
+            newStuck++;
+        }
+        slot.servableSince = canServe ? since : 0;
+        overdue.push_back(Overdue{&slot, what, now - since, canServe});
+    }
+    stalls.fetch_add(newStalls, std::memory_order_relaxed);
+    stuck.fetch_add(newStuck, std::memory_order_relaxed);
+    if (!newStalls && !newStuck)
+    {
+        return 0;
+    }
+
+    // Longest waits first
+    std::sort(overdue.begin(), overdue.end(),
+              [](const Overdue& a, const Overdue& b) { return a.waitedNs > b.waitedNs; });
+    std::fprintf(out, "stall: %zu rider(s) blocked for more than %llu ms, %zu new, %zu stuck; "
+                      "%llu stall(s) and %llu stuck so far\n",
+                 overdue.size(), (unsigned long long)(thresholdNs / 1000000), newStalls, newStuck,
+                 (unsigned long long)nbStalls(), (unsigned long long)nbStuck());
+    std::fprintf(out, "  %6s %5s %5s %5s %9s  %s\n", "rider", "waits", "site", "type", "ms", "station");
+    std::vector<unsigned int> sites;
+    for (size_t i = 0; i < overdue.size(); ++i)
+    {
+        const Overdue& o = overdue[i];
+        sites.push_back(siteOf(o.what));
+        if (i < maxDumpedRiders)
+        {
+            std::fprintf(out, "  %6u %5s %5u %5zu %9llu  %s\n", o.slot->rider,
+                         resourceOf(o.what) == WaitForDock ? "dock" : "bike", siteOf(o.what), typeOf(o.what),
+                         (unsigned long long)(o.waitedNs / 1000000), o.servable ? "could serve" : "cannot serve");
+        }
+    }
+    if (overdue.size() > maxDumpedRiders)
+    {
+        std::fprintf(out, "  ... %zu more\n", overdue.size() - maxDumpedRiders);
+    }
+
+    std::sort(sites.begin(), sites.end());
+    sites.erase(std::unique(sites.begin(), sites.end()), sites.end());
+    std::fprintf(out, "  %6s %11s %-16s %9s %9s\n", "site", "bikes/slots", "per type", "wait bike", "wait dock");
+    for (unsigned int site : sites)
+    {
+        if (site >= NB_SITES_TOTAL)
+        {
+            continue;
+        }
+        const BikeStation *station = context.stations[site];
+        std::string perType;
+        for (size_t type = 0; type < Bike::nbBikeTypes; ++type)
+        {
+            perType += (type ? " " : "") + std::to_string(station->countBikesOfType(type));
+        }
+        std::fprintf(out, "  %6u %5zu/%-5zu %-16s %9zu %9zu\n", site, station->nbBikes(), station->nbSlots(),
+                     perType.c_str(), station->nbWaitingForBike(), station->nbWaitingForDock());
+    }
+    std::fflush(out);
+    return newStalls;
+}
+
+BlockedWait::BlockedWait(WaitResource resource, unsigned int site, size_t type)
+    : slot(StallWatchdog::localSlot)
+{
+    if (slot)
+    {
+        slot->what.store(StallWatchdog::encode(resource, site, type), std::memory_order_relaxed);
+        slot->sinceNs.store(nowNs(), std::memory_order_release);
+    }
+}
+
+BlockedWait::~BlockedWait()
+{
+    if (slot)
+    {
+        slot->sinceNs.store(0, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,194 @@
+/*
+    * workload.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+#include "workload.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+namespace {
+
+// Built-in profiles, in the file format, times in profile seconds
+const std::pair<const char *, const char *> builtins[] = {
+    {"uniform",
+     "period=60\n"
+     "at=0 active=1 travel=500-2000\n"},
+    {"night",
+     "period=60\n"
+     "at=0 active=0.1 travel=1000-3000\n"},
+    {"rush",
+     "period=120\n"
+     "at=0   active=0.3 travel=800-2500\n"
+     "at=20  active=1   travel=500-1500 hot=0 share=0.6\n"   // morning, towards site 0
+     "at=50  active=0.5 travel=500-2000\n"
+     "at=80  active=1   travel=500-1500 hot=0 share=0\n"     // evening, away from site 0
+     "at=110 active=0.3 travel=800-2500\n"},
+    {"event",
+     "period=60\n"
+     "at=0  active=0.6 travel=500-2000\n"
+     "at=20 active=1   travel=500-2000 hot=3 share=0.8\n"    // everybody goes to site 3
+     "at=35 active=0.6 travel=500-2000\n"},
+    {"day",
+     "period=240\n"
+     "at=0   active=0.1 travel=1000-3000\n"
+     "at=40  active=1   travel=500-1500 hot=0 share=0.6\n"
+     "at=80  active=0.5 travel=500-2000\n"
+     "at=140 active=1   travel=500-1500 hot=0 share=0\n"
+     "at=180 active=0.4 travel=500-2000\n"
+     "at=210 active=0.1 travel=1000-3000\n"},
+};
+
+}
+
+std::vector<std::string> WorkloadProfile::names()
+{
+    std::vector<std::string> result;
+    for (const auto& builtin : builtins)
+    {
+        result.push_back(builtin.first);
+    }
+    return result;
+}
+
+bool WorkloadProfile::load(const std::string& nameOrPath, double speed)
+{
+    profileName = nameOrPath;
+    std::string text;
+    for (const auto& builtin : builtins)
+    {
+        if (nameOrPath == builtin.first)
+        {
+            text = builtin.second;
+        }
+    }
+    if (text.empty())
+    {
+        std::ifstream file(nameOrPath);
+        if (!file)
+        {
+            std::fprintf(stderr, "%s: unknown workload profile\n", nameOrPath.c_str());
+            return false;
+        }
+        std::ostringstream content;
+        content << file.rdbuf();
+        text = content.str();
+    }
+    if (!parse(text) || speed <= 0)
+    {
+        std::fprintf(stderr, "%s: invalid workload profile\n", nameOrPath.c_str());
+        return false;
+    }
+
+    timeSpeed = speed;
+    periodS /= speed;
+    for (WorkloadPhase& phase : phases)
+    {
+        phase.startS /= speed;
+    }
+    return true;
+}
+
+bool WorkloadProfile::parse(const std::string& text)
+{
+    phases.clear();
+    periodS = 0;
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream tokens(line);
+        std::string token;
+        WorkloadPhase phase;
+        bool isPhase = false;
+        while (tokens >> token)
+        {
+            size_t eq = token.find('=');
+            if (eq == std::string::npos)
+            {
+                return false;
+            }
+            std::string key = token.substr(0, eq);
+            std::string value = token.substr(eq + 1);
+            try
+            {
+                if (key == "period")
+                    periodS = std::stod(value);
+                else if (key == "at")
+                    phase.startS = std::stod(value), isPhase = true;
+                else if (key == "active")
+                    phase.active = std::stod(value);
+                else if (key == "hot")
+                    phase.hotSite = std::stoi(value);
+                else if (key == "share")
+                    phase.hotShare = std::stod(value);
+                else if (key == "travel")
+                {
+                    size_t dash = value.find('-');
+                    phase.minTravelMs = std::stoul(value.substr(0, dash));
+                    phase.maxTravelMs = dash == std::string::npos ? phase.minTravelMs
+                                                                  : std::stoul(value.substr(dash + 1));
+                }
+                else
+                    return false;
+            }
+            catch (const std::exception&)
+            {
+                return false;
+            }
+        }
+        if (!isPhase)
+        {
+            continue;
+        }
+        if (phase.active < 0 || phase.active > 1 || phase.hotShare < 0 || phase.hotShare > 1 ||
+            phase.hotSite >= int(NBSITES) || phase.minTravelMs > phase.maxTravelMs)
+        {
+            return false;
+        }
+        phases.push_back(phase);
+    }
+
+    std::sort(phases.begin(), phases.end(),
+              [](const WorkloadPhase& a, const WorkloadPhase& b) { return a.startS < b.startS; });
+    return !phases.empty() && phases.front().startS == 0 && periodS >= 0 &&
+           (periodS == 0 || phases.back().startS < periodS);
+}
+
+const WorkloadPhase& WorkloadProfile::at(double elapsedS) const
+{
+    double t = periodS > 0 ? std::fmod(elapsedS, periodS) : elapsedS;
+    auto next = std::upper_bound(phases.begin(), phases.end(), t,
+                                 [](double time, const WorkloadPhase& phase) { return time < phase.startS; });
+    return *(next - 1);
+}
+
+unsigned int WorkloadProfile::destination(const WorkloadPhase& phase, unsigned int from, SimRng& rng)
+{
+    unsigned int hot = unsigned(phase.hotSite);
+    if (phase.hotSite < 0 || hot == from)
+    {
+        return randomSiteExcept(NBSITES, from, rng);
+    }
+    if (std::uniform_real_distribution<double>(0, 1)(rng) < phase.hotShare || NBSITES <= 2)
+    {
+        return hot;
+    }
+    unsigned int site;
+    do {
+        site = randomSiteExcept(NBSITES, from, rng);
+    } while (site == hot);
+    return site;
+}
+
+double WorkloadProfile::travelScale(const WorkloadPhase& phase)
+{
+    const WorkloadPhase standard;
+    return double(phase.minTravelMs + phase.maxTravelMs) / (standard.minTravelMs + standard.maxTravelMs);
+}
@@ -0,0 +1,76 @@
+/*
+    * bikestation_test.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+// Checks of the batch operations of every kind of station, without Qt.
+//
+// Overfills a station with addBikes() and checks that it keeps exactly its
+// capacity and hands back the rest, then frees a few docks and does it
+// again. Prints one line per failed check and exits non-zero if any.
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "bike.h"
+#include "bikestation.h"
+
+namespace {
+
+int failures = 0;
+
+void expect(bool condition, StationKind kind, const char *what, size_t got, size_t wanted)
+{
+    if (!condition)
+    {
+        std::printf("%s: %s is %zu, expected %zu\n", stationKindName(kind), what, got, wanted);
+        failures++;
+    }
+}
+
+void checkOverfill(StationKind kind)
+{
+    const size_t capacity = 4;
+    std::vector<Bike> bikes(10);
+    std::vector<Bike*> batch;
+    for (size_t i = 0; i < bikes.size(); ++i)
+    {
+        bikes[i].bikeType = i % Bike::nbBikeTypes;
+        batch.push_back(&bikes[i]);
+    }
+
+    std::unique_ptr<BikeStation> station = makeBikeStation(kind, capacity, 0);
+    std::vector<Bike*> rejected = station->addBikes(batch);
+    expect(rejected.size() == bikes.size() - capacity, kind, "rejected on an empty station",
+           rejected.size(), bikes.size() - capacity);
+    expect(station->nbBikes() == capacity, kind, "occupancy after overfill", station->nbBikes(), capacity);
+
+    // A full station takes nothing more
+    std::vector<Bike*> again = station->addBikes(rejected);
+    expect(again.size() == rejected.size(), kind, "rejected on a full station", again.size(), rejected.size());
+
+    // Two free docks take two bikes out of the batch
+    std::vector<Bike*> taken = station->getBikes(2);
+    expect(taken.size() == 2, kind, "bikes taken", taken.size(), 2);
+    std::vector<Bike*> refill = station->addBikes(again);
+    size_t wanted = again.size() > 2 ? again.size() - 2 : 0;
+    expect(refill.size() == wanted, kind, "rejected with two free docks", refill.size(), wanted);
+    expect(station->nbBikes() == capacity, kind, "occupancy after refill", station->nbBikes(), capacity);
+    station->ending();
+}
+
+}
+
+int main()
+{
+    for (StationKind kind : {StationPco, StationSpinFutex, StationLockFree})
+    {
+        checkOverfill(kind);
+    }
+    if (failures == 0)
+    {
+        std::printf("all station checks passed\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
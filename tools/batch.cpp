@@ -0,0 +1,104 @@
+/*
+    * batch.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+// Runs the struct-of-arrays rider engine in simulated time and reports how
+// much faster than real time it went.
+//
+// Example:
+//   pco_biking_batch --riders 1000000 --sites 10000 --slots 20 --bikes 150000
+//                    --sim-seconds 600
+//   pco_biking_batch --riders 100000 --sites 2000 --geographic 1
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "batchengine.h"
+
+namespace {
+
+struct Options
+{
+    BatchConfig config;
+    double simSeconds = 60;
+};
+
+bool parseOptions(int argc, char *argv[], Options& options)
+{
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if (arg == "--sim-seconds")
+        {
+            options.simSeconds = std::stod(argv[i + 1]);
+            continue;
+        }
+        unsigned long long value = std::stoull(argv[i + 1]);
+        if (arg == "--riders")
+            options.config.nbRiders = value;
+        else if (arg == "--sites")
+            options.config.nbSites = value;
+        else if (arg == "--slots")
+            options.config.slotsPerSite = value;
+        else if (arg == "--bikes")
+            options.config.nbBikes = value;
+        else if (arg == "--seed")
+            options.config.seed = value;
+        else if (arg == "--geographic")
+            options.config.geographic = value != 0;
+        else
+            return false;
+    }
+    return argc % 2 == 1 && options.config.nbSites >= 2 && options.config.slotsPerSite >= 4;
+}
+
+void printRow(const char *label, const HistogramSnapshot& h)
+{
+    std::printf("%-10s %12llu %10.1f %10.1f %10.1f %10.1f\n", label, (unsigned long long)h.count,
+                h.percentile(50) / 1000.0, h.percentile(95) / 1000.0, h.percentile(99) / 1000.0,
+                h.max / 1000.0);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        std::fprintf(stderr, "Usage: %s [--riders N] [--sites N] [--slots N] [--bikes N] [--seed N]\n"
+                             "          [--sim-seconds s] [--geographic 0|1]\n",
+                     argv[0]);
+        return 2;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    BatchEngine engine(options.config);
+    auto built = std::chrono::steady_clock::now();
+    engine.run(uint64_t(options.simSeconds * 1000));
+    auto end = std::chrono::steady_clock::now();
+
+    double setupS = std::chrono::duration<double>(built - begin).count();
+    double wallS = std::chrono::duration<double>(end - built).count();
+    const BatchConfig& c = engine.config;
+    std::printf("riders=%zu sites=%zu geographic=%d slots=%zu bikes=%zu sim_s=%.1f wall_s=%.3f setup_s=%.3f "
+                "speedup=%.1f events=%llu events_per_s=%.0f trips=%llu\n",
+                c.nbRiders, c.nbSites, int(c.geographic), c.slotsPerSite, engine.nbBikes(), options.simSeconds, wallS, setupS,
+                wallS > 0 ? options.simSeconds / wallS : 0.0, (unsigned long long)engine.events,
+                wallS > 0 ? engine.events / wallS : 0.0, (unsigned long long)engine.trips);
+
+    std::printf("\n%-10s %12s %10s %10s %10s %10s\n", "Simulated", "count", "p50 ms", "p95 ms", "p99 ms", "max ms");
+    printRow("wait bike", engine.waitBikeUs);
+    printRow("wait dock", engine.waitDockUs);
+    printRow("cycle", engine.cycleUs);
+
+    size_t counted = engine.bikesAccountedFor();
+    if (counted != engine.nbBikes())
+    {
+        std::fprintf(stderr, "%zu bikes accounted for (expected %zu)\n", counted, engine.nbBikes());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,367 @@
+/*
+    * bikestation_bench.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+// Microbenchmark of BikeStation operations.
+//
+// Every worker alternates between taking bikes from the station and giving
+// them back, either one at a time (getBike/putBike) or in batches
+// (getBikes/addBikes), according to the operation mix. The bike pool is
+// sized so that the station is half full (balanced), almost always full
+// (full) or almost always empty with workers waiting for bikes (empty).
+// In the empty scenario workers only ask for the types of the pool, in
+// proportion of their number of bikes. Results are printed as JSON on
+// stdout, one entry per synchronisation and thread count, with the CPU
+// time the workers used (user + system) next to the throughput.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <pcosynchro/pcothread.h>
+
+#include "bike.h"
+#include "bikestation.h"
+#include "journal.h"
+#include "lockfreestation.h"
+#include "lockprofiler.h"
+#include "simstats.h"
+
+namespace {
+
+enum Op { PutBike, GetBike, AddBikes, GetBikes, NbOps };
+const char *opNames[NbOps] = {"putBike", "getBike", "addBikes", "getBikes"};
+
+struct Options
+{
+    size_t maxThreads = 8;
+    size_t capacity = 16;
+    std::string scenario = "balanced";
+    std::vector<double> typeMix = {1, 1, 1};
+    double batchRatio = 0.0; /**< Share of rounds using getBikes/addBikes. */
+    size_t batchSize = 4;
+    unsigned int durationMs = 1000;
+    std::string journalPath;
+    std::vector<std::string> syncs = {"pco"}; /**< Station kinds, see parseStationKind(). */
+};
+
+struct WorkerResult
+{
+    std::array<HistogramSnapshot, NbOps> latencyNs;
+    uint64_t contextSwitches = 0;
+    uint64_t cpuNs = 0;
+};
+
+void usage(const char *name)
+{
+    std::fprintf(stderr,
+                 "Usage: %s [--threads N] [--capacity C] [--scenario balanced|full|empty]\n"
+                 "          [--types w0,w1,w2] [--batch-ratio r] [--batch-size k]\n"
+                 "          [--duration-ms ms] [--journal file] [--sync pco|spin|lockfree|both|all]\n"
+                 "Runs 1, 2, 4, ... up to N threads and prints one JSON document.\n"
+                 "--sync picks the station: PcoMutex (pco), spin then futex (spin), lock-free\n"
+                 "queues (lockfree); both is pco and spin.\n",
+                 name);
+}
+
+std::vector<double> parseList(const std::string& text)
+{
+    std::vector<double> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        values.push_back(std::stod(item));
+    }
+    return values;
+}
+
+bool parseOptions(int argc, char *argv[], Options& options)
+{
+    try
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+            std::string value = argv[++i];
+            if (arg == "--threads")
+                options.maxThreads = std::stoul(value);
+            else if (arg == "--capacity")
+                options.capacity = std::stoul(value);
+            else if (arg == "--scenario")
+                options.scenario = value;
+            else if (arg == "--types")
+                options.typeMix = parseList(value);
+            else if (arg == "--batch-ratio")
+                options.batchRatio = std::stod(value);
+            else if (arg == "--batch-size")
+                options.batchSize = std::stoul(value);
+            else if (arg == "--duration-ms")
+                options.durationMs = std::stoul(value);
+            else if (arg == "--journal")
+                options.journalPath = value;
+            else if (arg == "--sync" && value == "both")
+                options.syncs = {"pco", "spin"};
+            else if (arg == "--sync" && value == "all")
+                options.syncs = {"pco", "spin", "lockfree"};
+            else if (arg == "--sync" && (value == "pco" || value == "spin" || value == "lockfree"))
+                options.syncs = {value};
+            else
+                return false;
+        }
+    }
+    catch (const std::exception&)
+    {
+        // std::stoul and std::stod on a value that is not a number
+        return false;
+    }
+    options.typeMix.resize(Bike::nbBikeTypes, 0.0);
+    return options.maxThreads > 0 && options.capacity > 0 &&
+           options.batchRatio >= 0 && options.batchRatio <= 1 &&
+           (options.scenario == "balanced" || options.scenario == "full" ||
+            options.scenario == "empty");
+}
+
+uint64_t threadContextSwitches()
+{
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+uint64_t threadCpuNs()
+{
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return (uint64_t(usage.ru_utime.tv_sec) + usage.ru_stime.tv_sec) * 1000000000ULL +
+           (uint64_t(usage.ru_utime.tv_usec) + usage.ru_stime.tv_usec) * 1000;
+}
+
+/**
+ * Number of bikes in circulation for a scenario. Each worker holds at most
+ * one bike (or one batch) at a time, so "full" keeps nbThreads - 1 bikes
+ * more than the capacity and "empty" keeps half as many bikes as workers,
+ * so that the others wait in getBike.
+ */
+size_t poolSize(const Options& options, size_t nbThreads)
+{
+    if (options.scenario == "full")
+        return options.capacity + nbThreads - 1;
+    if (options.scenario == "empty")
+        return (nbThreads + 1) / 2;
+    return std::max<size_t>(options.capacity / 2, 1);
+}
+
+template <class Station>
+void worker(Station *station, const Options& options, const std::vector<double>& requestMix,
+            size_t seed, const std::atomic<bool> *stop, WorkerResult *result)
+{
+    std::mt19937_64 rng(seed);
+    std::discrete_distribution<size_t> typeDist(requestMix.begin(), requestMix.end());
+    std::bernoulli_distribution batchDist(options.batchRatio);
+    uint64_t switchesAtStart = threadContextSwitches();
+    uint64_t cpuAtStart = threadCpuNs();
+
+    while (!stop->load(std::memory_order_relaxed))
+    {
+        if (batchDist(rng))
+        {
+            uint64_t t0 = nowNs();
+            std::vector<Bike*> bikes = station->getBikes(options.batchSize);
+            uint64_t t1 = nowNs();
+            std::vector<Bike*> rejected = station->addBikes(bikes);
+            uint64_t t2 = nowNs();
+            result->latencyNs[GetBikes].record(t1 - t0);
+            result->latencyNs[AddBikes].record(t2 - t1);
+            // Rejected bikes only happen if the station filled up meanwhile
+            for (Bike *bike : rejected)
+            {
+                station->putBike(bike);
+            }
+        }
+        else
+        {
+            uint64_t t0 = nowNs();
+            Bike *bike = station->getBike(typeDist(rng));
+            uint64_t t1 = nowNs();
+            if (bike == nullptr)
+            {
+                break;
+            }
+            station->putBike(bike);
+            uint64_t t2 = nowNs();
+            result->latencyNs[GetBike].record(t1 - t0);
+            result->latencyNs[PutBike].record(t2 - t1);
+        }
+    }
+
+    result->contextSwitches = threadContextSwitches() - switchesAtStart;
+    result->cpuNs = threadCpuNs() - cpuAtStart;
+}
+
+template <class Station>
+void runOnce(const Options& options, const char *sync, size_t nbThreads, bool first)
+{
+    Station station(options.capacity);
+
+    // All bikes of the run in one allocation, types spread by the mix
+    size_t nbBikes = poolSize(options, nbThreads);
+    std::unique_ptr<Bike[]> bikes(new Bike[nbBikes]);
+    std::mt19937_64 rng(nbThreads);
+    std::discrete_distribution<size_t> typeDist(options.typeMix.begin(), options.typeMix.end());
+    std::vector<Bike*> initial;
+    std::vector<double> poolMix(Bike::nbBikeTypes, 0.0);
+    for (size_t i = 0; i < nbBikes; ++i)
+    {
+        // Make sure every requested type exists so that getBike can progress
+        bikes[i].bikeType = i < Bike::nbBikeTypes && options.typeMix[i] > 0 ? i : typeDist(rng);
+        poolMix[bikes[i].bikeType] += 1;
+        initial.push_back(&bikes[i]);
+    }
+    std::vector<Bike*> overflow = station.addBikes(initial);
+
+    // A pool smaller than the number of types lacks some of them, nobody
+    // could ever give back a bike of those
+    const std::vector<double>& requestMix = options.scenario == "empty" ? poolMix : options.typeMix;
+
+    std::atomic<bool> stop{false};
+    std::vector<WorkerResult> results(nbThreads);
+    std::vector<std::unique_ptr<PcoThread>> threads;
+
+    // Bikes that do not fit in the station start in the hands of workers
+    uint64_t start = nowNs();
+    for (size_t t = 0; t < nbThreads; ++t)
+    {
+        threads.emplace_back(std::make_unique<PcoThread>(
+            [&station, &options, &requestMix, &stop, &results, &overflow, t, nbThreads]() {
+                // Workers are the agents of the journal, numbered from 0
+                Journal::setAgent(uint32_t(t));
+                for (size_t i = t; i < overflow.size(); i += nbThreads)
+                {
+                    station.putBike(overflow[i]);
+                }
+                worker(&station, options, requestMix, t + 1, &stop, &results[t]);
+            }));
+    }
+
+    PcoThread::usleep(uint64_t(options.durationMs) * 1000);
+    stop = true;
+    // Releases the workers still blocked in putBike/getBike
+    station.ending();
+    for (auto& thread : threads)
+    {
+        thread->join();
+    }
+    double elapsedS = (nowNs() - start) / 1e9;
+
+    std::array<HistogramSnapshot, NbOps> latency;
+    uint64_t switches = 0;
+    uint64_t cpuNs = 0;
+    for (const WorkerResult& result : results)
+    {
+        for (size_t op = 0; op < NbOps; ++op)
+        {
+            latency[op].merge(result.latencyNs[op]);
+        }
+        switches += result.contextSwitches;
+        cpuNs += result.cpuNs;
+    }
+    uint64_t totalOps = 0;
+    for (const HistogramSnapshot& h : latency)
+    {
+        totalOps += h.count;
+    }
+
+    std::printf("%s    {\"sync\": \"%s\", \"threads\": %zu, \"bikes\": %zu, \"duration_s\": %.3f, "
+                "\"ops\": %llu, \"ops_per_s\": %.0f, \"context_switches_per_op\": %.4f,\n"
+                "     \"cpu_s\": %.3f, \"cpu_ns_per_op\": %.0f,\n"
+                "     \"latency_ns\": {",
+                first ? "" : ",\n", sync, nbThreads, nbBikes, elapsedS,
+                (unsigned long long)totalOps, totalOps / elapsedS,
+                totalOps ? double(switches) / totalOps : 0.0,
+                cpuNs / 1e9, totalOps ? double(cpuNs) / totalOps : 0.0);
+    bool firstOp = true;
+    for (size_t op = 0; op < NbOps; ++op)
+    {
+        if (latency[op].count == 0)
+        {
+            continue;
+        }
+        std::printf("%s\n        \"%s\": {\"count\": %llu, \"p50\": %llu, \"p90\": %llu, "
+                    "\"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+                    firstOp ? "" : ",", opNames[op],
+                    (unsigned long long)latency[op].count,
+                    (unsigned long long)latency[op].percentile(50),
+                    (unsigned long long)latency[op].percentile(90),
+                    (unsigned long long)latency[op].percentile(99),
+                    (unsigned long long)latency[op].percentile(99.9),
+                    (unsigned long long)latency[op].max);
+        firstOp = false;
+    }
+    std::printf("}}");
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!options.journalPath.empty() && !Journal::open(options.journalPath))
+    {
+        return 1;
+    }
+
+    std::printf("{\n  \"benchmark\": \"bikestation\",\n  \"scenario\": \"%s\",\n"
+                "  \"capacity\": %zu,\n  \"type_mix\": [",
+                options.scenario.c_str(), options.capacity);
+    for (size_t type = 0; type < Bike::nbBikeTypes; ++type)
+    {
+        std::printf("%s%g", type ? ", " : "", options.typeMix[type]);
+    }
+    std::printf("],\n  \"batch_ratio\": %g,\n  \"batch_size\": %zu,\n  \"runs\": [\n",
+                options.batchRatio, options.batchSize);
+
+    bool first = true;
+    for (const std::string& sync : options.syncs)
+    {
+        for (size_t n = 1; ; n = std::min(n * 2, options.maxThreads))
+        {
+            if (sync == "spin")
+                runOnce<SpinFutexBikeStation>(options, "spin", n, first);
+            else if (sync == "lockfree")
+                runOnce<LockFreeBikeStation>(options, "lockfree", n, first);
+            else
+                runOnce<PcoBikeStation>(options, "pco", n, first);
+            first = false;
+            if (n == options.maxThreads)
+            {
+                break;
+            }
+        }
+    }
+    std::printf("\n  ]\n}\n");
+    Journal::close();
+
+    // Kept off stdout so that the JSON stays parseable
+    LockProfiler::printReport(stderr);
+    return 0;
+}
@@ -0,0 +1,220 @@
+/*
+    * journal_reader.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+// Reader of the station journals written with --journal.
+//
+// The file is memory-mapped and scanned sequentially, so even large
+// journals are read at disk speed without being loaded in memory. Prints a
+// summary per station and operation, and optionally the records of one
+// site or one agent. Records are grouped by writer thread in the file; use
+// the timestamps to order them, keeping in mind that they are only accurate
+// to the journal clock period (1 ms by default).
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+namespace {
+
+const char *opNames[NbJournalOps] = {"putBike", "getBike", "addBikes", "getBikes"};
+
+struct Options
+{
+    std::string path;
+    long site = -1;
+    long long agent = -1;
+    size_t dump = 0;
+};
+
+struct OpSummary
+{
+    uint64_t calls = 0;
+    uint64_t failed = 0;    /**< Calls that moved fewer bikes than requested. */
+    uint64_t requested = 0;
+    uint64_t moved = 0;
+};
+
+struct SiteSummary
+{
+    std::array<OpSummary, NbJournalOps> ops;
+    uint32_t minBikes = UINT32_MAX;
+    uint32_t maxBikes = 0;
+};
+
+void usage(const char *name)
+{
+    std::fprintf(stderr,
+                 "Usage: %s journal [--site s] [--agent a] [--dump n]\n"
+                 "Summarises a station journal, --dump prints the first n matching records.\n"
+                 "Vans are reported as agents v<id>, or 2147483648+id with --agent.\n",
+                 name);
+}
+
+bool parseOptions(int argc, char *argv[], Options& options)
+{
+    if (argc < 2)
+    {
+        return false;
+    }
+    options.path = argv[1];
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        if (arg == "--site")
+            options.site = std::stol(argv[i + 1]);
+        else if (arg == "--agent")
+            options.agent = std::stoll(argv[i + 1]);
+        else if (arg == "--dump")
+            options.dump = std::stoul(argv[i + 1]);
+        else
+            return false;
+    }
+    return argc % 2 == 0;
+}
+
+std::string agentName(uint32_t agent)
+{
+    if (agent & Journal::vanAgent)
+    {
+        return "v" + std::to_string(agent & ~Journal::vanAgent);
+    }
+    return std::to_string(agent);
+}
+
+bool matches(const Options& options, const JournalRecord& record)
+{
+    return (options.site < 0 || record.site == options.site) &&
+           (options.agent < 0 || record.agent == options.agent);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    int fd = open(options.path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        std::perror(options.path.c_str());
+        return 1;
+    }
+    size_t fileSize = info.st_size;
+    if (fileSize < sizeof(JournalHeader))
+    {
+        std::fprintf(stderr, "%s: too short to be a journal\n", options.path.c_str());
+        return 1;
+    }
+    void *mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        std::perror("mmap");
+        return 1;
+    }
+    madvise(mapping, fileSize, MADV_SEQUENTIAL);
+
+    const char *bytes = static_cast<const char *>(mapping);
+    JournalHeader header;
+    std::memcpy(&header, bytes, sizeof(header));
+    if (std::memcmp(header.magic, "PCOJRNL1", sizeof(header.magic)) != 0 ||
+        header.recordSize != sizeof(JournalRecord))
+    {
+        std::fprintf(stderr, "%s: not a journal or incompatible version\n", options.path.c_str());
+        return 1;
+    }
+    if (header.endNs == 0)
+    {
+        std::fprintf(stderr, "%s: journal not closed, times are approximate\n", options.path.c_str());
+    }
+
+    const JournalRecord *records = reinterpret_cast<const JournalRecord *>(bytes + sizeof(header));
+    size_t nbRecords = (fileSize - sizeof(header)) / sizeof(JournalRecord);
+
+    auto start = std::chrono::steady_clock::now();
+    std::map<uint16_t, SiteSummary> sites;
+    std::map<uint32_t, uint64_t> agents;
+    uint64_t firstTicks = UINT64_MAX;
+    uint64_t lastTicks = 0;
+    size_t matched = 0;
+    size_t dumped = 0;
+    for (size_t i = 0; i < nbRecords; ++i)
+    {
+        const JournalRecord& record = records[i];
+        if (!matches(options, record) || record.op >= NbJournalOps)
+        {
+            continue;
+        }
+
+        matched++;
+        SiteSummary& site = sites[record.site];
+        OpSummary& op = site.ops[record.op];
+        op.calls++;
+        op.requested += record.requested;
+        op.moved += record.result;
+        if (record.result < record.requested)
+        {
+            op.failed++;
+        }
+        site.minBikes = std::min(site.minBikes, record.bikesAfter);
+        site.maxBikes = std::max(site.maxBikes, record.bikesAfter);
+        agents[record.agent]++;
+        firstTicks = std::min(firstTicks, record.ticks);
+        lastTicks = std::max(lastTicks, record.ticks);
+
+        if (dumped < options.dump)
+        {
+            std::printf("%14.6f ms  agent %-6s site %2u  %-8s type %3u  %u/%u  after %u\n",
+                        header.toNs(record.ticks) / 1e6, agentName(record.agent).c_str(),
+                        record.site, opNames[record.op], record.bikeType,
+                        record.result, record.requested, record.bikesAfter);
+            dumped++;
+        }
+    }
+    double scanS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::printf("%zu records, %zu matching, %zu agents, %.3f s of activity, scanned at %.0f MB/s\n",
+                nbRecords, matched, agents.size(),
+                lastTicks > firstTicks ? (header.toNs(lastTicks) - header.toNs(firstTicks)) / 1e9 : 0.0,
+                scanS > 0 ? fileSize / scanS / 1e6 : 0.0);
+    std::printf("\n%4s %-9s %10s %10s %10s %10s %6s %6s\n",
+                "site", "op", "calls", "failed", "requested", "moved", "min", "max");
+    for (const auto& entry : sites)
+    {
+        for (size_t op = 0; op < NbJournalOps; ++op)
+        {
+            const OpSummary& summary = entry.second.ops[op];
+            if (summary.calls == 0)
+            {
+                continue;
+            }
+            std::printf("%4u %-9s %10llu %10llu %10llu %10llu %6u %6u\n",
+                        entry.first, opNames[op],
+                        (unsigned long long)summary.calls, (unsigned long long)summary.failed,
+                        (unsigned long long)summary.requested, (unsigned long long)summary.moved,
+                        entry.second.minBikes, entry.second.maxBikes);
+        }
+    }
+
+    munmap(mapping, fileSize);
+    close(fd);
+    return 0;
+}
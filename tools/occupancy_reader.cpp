@@ -0,0 +1,500 @@
+/*
+    * occupancy_reader.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+// Queries on the occupancy time series written with --occupancy.
+//
+// The file is memory-mapped and decoded one block at a time, run by run,
+// without expanding the rows: the cost depends on the number of changes,
+// not on the length of the recording. Prints a summary per site (mean,
+// extremes, time empty and full), and optionally the rolling mean of each
+// site or the empty and full intervals. The depot is the last site.
+//
+// Example:
+//   pco_biking_occupancy week.occ
+//   pco_biking_occupancy week.occ --rolling 3600 --step 600 --type 1
+//   pco_biking_occupancy week.occ --intervals --site 3 --min-s 60
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "occupancy.h"
+
+namespace {
+
+struct Options
+{
+    std::string path;
+    long site = -1;          /**< Only this site, all if negative. */
+    long type = -1;          /**< Bikes of this type instead of all the bikes. */
+    double rollingS = 0;     /**< Window of the rolling mean, 0 for none. */
+    double stepS = 0;        /**< Between two rolling means, the window by default. */
+    bool intervals = false;
+    double minS = 0;         /**< Shortest interval listed. */
+};
+
+struct Run
+{
+    uint64_t length;
+    uint32_t value;
+};
+
+struct Interval
+{
+    uint64_t begin;
+    uint64_t end;
+};
+
+const uint64_t none = UINT64_MAX;
+
+/**
+ * Statistics of one series, fed with its runs in order.
+ */
+struct SeriesStats
+{
+    uint32_t capacity = 0;
+    bool canBeFull = true;    /**< False for a single type, which has no capacity of its own. */
+    uint64_t stepRows = 0;    /**< Between two checkpoints, 0 for none. */
+    uint64_t minRows = 0;     /**< Shortest interval kept. */
+    bool keepIntervals = false;
+
+    uint64_t rows = 0;
+    uint64_t sum = 0;
+    uint32_t min = UINT32_MAX;
+    uint32_t max = 0;
+    uint64_t emptyRows = 0;
+    uint64_t fullRows = 0;
+    uint64_t emptyCount = 0;
+    uint64_t fullCount = 0;
+    uint64_t longestEmpty = 0;
+    uint64_t longestFull = 0;
+    uint64_t emptySince = none;
+    uint64_t fullSince = none;
+    std::vector<Interval> empties;
+    std::vector<Interval> fulls;
+    std::vector<uint64_t> checkpoints; /**< Sum of the values before row k * stepRows. */
+
+    void feed(const Run& run)
+    {
+        uint64_t end = rows + run.length;
+        while (stepRows && checkpoints.size() * stepRows <= end)
+        {
+            checkpoints.push_back(sum + uint64_t(run.value) * (checkpoints.size() * stepRows - rows));
+        }
+        sum += uint64_t(run.value) * run.length;
+        min = std::min(min, run.value);
+        max = std::max(max, run.value);
+
+        bool isEmpty = run.value == 0;
+        bool isFull = canBeFull && run.value >= capacity;
+        track(isEmpty, emptySince, emptyRows, emptyCount, longestEmpty, empties, run.length);
+        track(isFull, fullSince, fullRows, fullCount, longestFull, fulls, run.length);
+        rows = end;
+    }
+
+    void finish()
+    {
+        track(false, emptySince, emptyRows, emptyCount, longestEmpty, empties, 0);
+        track(false, fullSince, fullRows, fullCount, longestFull, fulls, 0);
+    }
+
+private:
+    void track(bool state, uint64_t& since, uint64_t& total, uint64_t& count, uint64_t& longest,
+               std::vector<Interval>& kept, uint64_t length)
+    {
+        if (state)
+        {
+            total += length;
+            if (since == none)
+            {
+                since = rows;
+            }
+            return;
+        }
+        if (since == none)
+        {
+            return;
+        }
+        count++;
+        longest = std::max(longest, rows - since);
+        if (keepIntervals && rows - since >= minRows)
+        {
+            kept.push_back(Interval{since, rows});
+        }
+        since = none;
+    }
+};
+
+void usage(const char *name)
+{
+    std::fprintf(stderr,
+                 "Usage: %s file [--site s] [--type t] [--rolling seconds] [--step seconds]\n"
+                 "          [--intervals] [--min-s seconds]\n"
+                 "Summarises an occupancy file. --rolling prints the mean over the last window\n"
+                 "every step as CSV, at the start the mean since row 0; --intervals lists the periods when a\n"
+                 "site was empty or full. With --type, only the bikes of that type are counted.\n",
+                 name);
+}
+
+bool parseOptions(int argc, char *argv[], Options& options)
+{
+    if (argc < 2)
+    {
+        return false;
+    }
+    options.path = argv[1];
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--intervals")
+        {
+            options.intervals = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--site")
+            options.site = std::stol(value);
+        else if (arg == "--type")
+            options.type = std::stol(value);
+        else if (arg == "--rolling")
+            options.rollingS = std::stod(value);
+        else if (arg == "--step")
+            options.stepS = std::stod(value);
+        else if (arg == "--min-s")
+            options.minS = std::stod(value);
+        else
+            return false;
+    }
+    if (options.stepS <= 0)
+    {
+        options.stepS = options.rollingS;
+    }
+    return options.rollingS >= 0;
+}
+
+bool readVarint(const uint8_t *& bytes, const uint8_t *end, uint64_t& value)
+{
+    value = 0;
+    for (unsigned int shift = 0; bytes < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *bytes++;
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Decodes one column of a block, see OccupancyBlockHeader.
+ */
+bool decodeColumn(const uint8_t *bytes, size_t size, uint64_t nbRows, std::vector<Run>& runs)
+{
+    runs.clear();
+    const uint8_t *end = bytes + size;
+    int64_t value = 0;
+    uint64_t covered = 0;
+    while (bytes < end)
+    {
+        uint64_t delta;
+        uint64_t length;
+        if (!readVarint(bytes, end, delta) || !readVarint(bytes, end, length) || !length)
+        {
+            return false;
+        }
+        value += int64_t(delta >> 1) ^ -int64_t(delta & 1);
+        covered += length;
+        runs.push_back(Run{length, uint32_t(value)});
+    }
+    return covered == nbRows;
+}
+
+/**
+ * Adds columns of the same rows into one series of runs.
+ */
+void sumColumns(const std::vector<const std::vector<Run>*>& columns, std::vector<Run>& total)
+{
+    total.clear();
+    std::vector<size_t> next(columns.size(), 0);
+    std::vector<uint64_t> left(columns.size(), 0);
+    uint32_t value = 0;
+    for (size_t c = 0; c < columns.size(); ++c)
+    {
+        left[c] = (*columns[c])[0].length;
+        value += (*columns[c])[0].value;
+    }
+    while (true)
+    {
+        uint64_t length = *std::min_element(left.begin(), left.end());
+        if (!total.empty() && total.back().value == value)
+        {
+            total.back().length += length;
+        }
+        else
+        {
+            total.push_back(Run{length, value});
+        }
+        for (size_t c = 0; c < columns.size(); ++c)
+        {
+            left[c] -= length;
+            if (left[c] == 0)
+            {
+                const std::vector<Run>& runs = *columns[c];
+                value -= runs[next[c]].value;
+                if (++next[c] == runs.size())
+                {
+                    // Columns of a block cover the same rows, they all end here
+                    return;
+                }
+                left[c] = runs[next[c]].length;
+                value += runs[next[c]].value;
+            }
+        }
+    }
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    int fd = open(options.path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        std::perror(options.path.c_str());
+        return 1;
+    }
+    size_t fileSize = info.st_size;
+    if (fileSize < sizeof(OccupancyHeader))
+    {
+        std::fprintf(stderr, "%s: too short to be an occupancy file\n", options.path.c_str());
+        return 1;
+    }
+    void *mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        std::perror("mmap");
+        return 1;
+    }
+    madvise(mapping, fileSize, MADV_SEQUENTIAL);
+
+    const uint8_t *bytes = static_cast<const uint8_t *>(mapping);
+    OccupancyHeader header;
+    std::memcpy(&header, bytes, sizeof(header));
+    size_t capacitiesSize = size_t(header.nbSites) * sizeof(uint32_t);
+    if (std::memcmp(header.magic, "PCOOCC1", sizeof(header.magic)) != 0 || !header.nbSites ||
+        !header.nbTypes || !header.periodUs || fileSize < sizeof(header) + capacitiesSize)
+    {
+        std::fprintf(stderr, "%s: not an occupancy file or incompatible version\n", options.path.c_str());
+        return 1;
+    }
+    if (options.site >= long(header.nbSites) || options.type >= long(header.nbTypes))
+    {
+        std::fprintf(stderr, "%s: %u sites and %u types only\n", options.path.c_str(), header.nbSites,
+                     header.nbTypes);
+        return 2;
+    }
+    if (header.nbRows == 0)
+    {
+        std::fprintf(stderr, "%s: not closed, reading the complete blocks only\n", options.path.c_str());
+    }
+    std::vector<uint32_t> capacities(header.nbSites);
+    std::memcpy(capacities.data(), bytes + sizeof(header), capacitiesSize);
+
+    // Sums are kept every gcd of the window and the step, both in whole rows
+    double periodS = header.periodUs / 1e6;
+    uint64_t windowRows = std::max<uint64_t>(1, uint64_t(options.rollingS / periodS + 0.5));
+    uint64_t outputRows = std::max<uint64_t>(1, uint64_t(options.stepS / periodS + 0.5));
+    uint64_t checkpointRows = options.rollingS > 0 ? std::gcd(windowRows, outputRows) : 0;
+
+    size_t nbColumns = size_t(header.nbSites) * header.nbTypes;
+    std::vector<unsigned int> sites;
+    for (unsigned int s = 0; s < header.nbSites; ++s)
+    {
+        if (options.site < 0 || long(s) == options.site)
+        {
+            sites.push_back(s);
+        }
+    }
+    std::vector<SeriesStats> series(header.nbSites);
+    for (unsigned int s : sites)
+    {
+        series[s].capacity = capacities[s];
+        series[s].canBeFull = options.type < 0;
+        series[s].stepRows = checkpointRows;
+        series[s].keepIntervals = options.intervals;
+        series[s].minRows = uint64_t(options.minS / periodS);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::vector<Run>> columns(nbColumns);
+    std::vector<Run> total;
+    std::vector<uint32_t> sizes(nbColumns);
+    uint64_t rows = 0;
+    uint64_t runs = 0;
+    size_t blocks = 0;
+    size_t offset = sizeof(header) + capacitiesSize;
+    while (offset + sizeof(OccupancyBlockHeader) <= fileSize)
+    {
+        OccupancyBlockHeader block;
+        std::memcpy(&block, bytes + offset, sizeof(block));
+        offset += sizeof(block);
+        size_t sizesBytes = nbColumns * sizeof(uint32_t);
+        if (block.magic != OCCUPANCY_BLOCK_MAGIC || block.firstRow != rows || !block.nbRows ||
+            block.payloadBytes < sizesBytes ||
+            block.payloadBytes > fileSize - offset)
+        {
+            std::fprintf(stderr, "%s: damaged block at byte %zu, stopping there\n", options.path.c_str(),
+                         offset - sizeof(block));
+            break;
+        }
+        std::memcpy(sizes.data(), bytes + offset, sizesBytes);
+        const uint8_t *payloadEnd = bytes + offset + block.payloadBytes;
+        std::vector<const uint8_t *> starts{bytes + offset + sizesBytes};
+        for (size_t c = 0; c < nbColumns; ++c)
+        {
+            starts.push_back(starts.back() + sizes[c]);
+        }
+        offset += block.payloadBytes;
+
+        // Only the columns of the sites asked for are decoded
+        bool ok = starts.back() <= payloadEnd;
+        for (unsigned int s : sites)
+        {
+            for (size_t t = 0; ok && t < header.nbTypes; ++t)
+            {
+                size_t c = s * header.nbTypes + t;
+                ok = decodeColumn(starts[c], sizes[c], block.nbRows, columns[c]);
+            }
+        }
+        if (!ok)
+        {
+            std::fprintf(stderr, "%s: damaged column in block %zu, stopping there\n", options.path.c_str(), blocks);
+            break;
+        }
+
+        for (unsigned int s : sites)
+        {
+            std::vector<Run> *selected = &columns[s * header.nbTypes + std::max(options.type, 0L)];
+            if (options.type < 0)
+            {
+                std::vector<const std::vector<Run>*> types;
+                for (size_t t = 0; t < header.nbTypes; ++t)
+                {
+                    types.push_back(&columns[s * header.nbTypes + t]);
+                }
+                sumColumns(types, total);
+                selected = &total;
+            }
+            for (const Run& run : *selected)
+            {
+                series[s].feed(run);
+            }
+            runs += selected->size();
+        }
+        rows += block.nbRows;
+        blocks++;
+    }
+    for (unsigned int s : sites)
+    {
+        series[s].finish();
+    }
+    double scanS = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::printf("%llu rows every %u us (%.1f h), %u sites x %u types, %zu blocks, %llu runs read, "
+                "%.1f bytes per column and hour, read in %.3f s\n",
+                (unsigned long long)rows, header.periodUs, rows * periodS / 3600, header.nbSites,
+                header.nbTypes, blocks, (unsigned long long)runs,
+                rows ? fileSize / double(nbColumns) / (rows * periodS / 3600) : 0.0, scanS);
+    if (!rows)
+    {
+        return 0;
+    }
+
+    if (checkpointRows)
+    {
+        std::printf("\ntime_s");
+        for (unsigned int s : sites)
+        {
+            std::printf(",site%u", s);
+        }
+        std::printf("\n");
+        size_t nbCheckpoints = series[sites[0]].checkpoints.size();
+        size_t window = windowRows / checkpointRows;
+        for (size_t k = outputRows / checkpointRows; k < nbCheckpoints; k += outputRows / checkpointRows)
+        {
+            size_t from = k > window ? k - window : 0;
+            std::printf("%.3f", k * checkpointRows * periodS);
+            for (unsigned int s : sites)
+            {
+                const std::vector<uint64_t>& sums = series[s].checkpoints;
+                std::printf(",%.3f", double(sums[k] - sums[from]) / ((k - from) * checkpointRows));
+            }
+            std::printf("\n");
+        }
+    }
+
+    if (options.intervals)
+    {
+        std::printf("\nsite,state,begin_s,end_s,duration_s\n");
+        for (unsigned int s : sites)
+        {
+            std::vector<std::pair<Interval, const char *>> listed;
+            for (const Interval& interval : series[s].empties)
+            {
+                listed.emplace_back(interval, "empty");
+            }
+            for (const Interval& interval : series[s].fulls)
+            {
+                listed.emplace_back(interval, "full");
+            }
+            std::sort(listed.begin(), listed.end(),
+                      [](const auto& a, const auto& b) { return a.first.begin < b.first.begin; });
+            for (const auto& entry : listed)
+            {
+                std::printf("%u,%s,%.3f,%.3f,%.3f\n", s, entry.second, entry.first.begin * periodS,
+                            entry.first.end * periodS, (entry.first.end - entry.first.begin) * periodS);
+            }
+        }
+    }
+
+    std::printf("\n%4s %5s %8s %5s %5s %8s %7s %10s %8s %7s %10s\n", "site", "slots", "mean", "min", "max",
+                "empty %", "empties", "longest s", "full %", "fulls", "longest s");
+    for (unsigned int s : sites)
+    {
+        const SeriesStats& stats = series[s];
+        std::printf("%4u %5u %8.3f %5u %5u %8.2f %7llu %10.1f %8.2f %7llu %10.1f\n", s, stats.capacity,
+                    double(stats.sum) / stats.rows, stats.min, stats.max, 100.0 * stats.emptyRows / stats.rows,
+                    (unsigned long long)stats.emptyCount, stats.longestEmpty * periodS,
+                    100.0 * stats.fullRows / stats.rows, (unsigned long long)stats.fullCount,
+                    stats.longestFull * periodS);
+    }
+
+    munmap(mapping, fileSize);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+    * regions.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+// Runs a simulation split over several processes, one per region of
+// sites, and prints the merged statistics (see RegionCoordinator).
+//
+// The exit code is non-zero if a region failed or if bikes were lost or
+// created on the way between regions.
+//
+// Example:
+//   pco_biking_regions --regions 4 --sites 2000 --slots 20 --bikes 30000
+//                      --riders 50000 --time-scale 10 --duration-ms 5000
+
+#include <cstdio>
+#include <string>
+
+#include "region.h"
+
+namespace {
+
+struct Options
+{
+    RegionConfig config;
+    unsigned int durationMs = 5000;
+    std::string dir;
+};
+
+bool parseOptions(int argc, char *argv[], Options& options)
+{
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        std::string value = argv[i + 1];
+        if (arg == "--dir")
+        {
+            options.dir = value;
+            continue;
+        }
+        if (arg == "--time-scale")
+        {
+            options.config.timeScale = std::stod(value);
+            continue;
+        }
+        unsigned long long number = std::stoull(value);
+        if (arg == "--regions")
+            options.config.nbRegions = number;
+        else if (arg == "--sites")
+            options.config.nbSites = number;
+        else if (arg == "--slots")
+            options.config.slotsPerSite = number;
+        else if (arg == "--bikes")
+            options.config.nbBikes = number;
+        else if (arg == "--riders")
+            options.config.nbRiders = number;
+        else if (arg == "--van-capacity")
+            options.config.vanCapacity = number;
+        else if (arg == "--depot-wait-ms")
+            options.config.depotWaitUs = unsigned(number * 1000);
+        else if (arg == "--batch")
+            options.config.batchSize = number;
+        else if (arg == "--flush-us")
+            options.config.flushUs = unsigned(number);
+        else if (arg == "--seed")
+            options.config.seed = number;
+        else if (arg == "--duration-ms")
+            options.durationMs = unsigned(number);
+        else
+            return false;
+    }
+    const RegionConfig& c = options.config;
+    return argc % 2 == 1 && c.nbRegions >= 1 && c.nbRegions < 1000 && c.nbSites >= 2 * c.nbRegions &&
+           c.slotsPerSite >= 4 && c.batchSize >= 1 && c.timeScale > 0;
+}
+
+void printRow(const char *label, const HistogramSnapshot& h)
+{
+    std::printf("%-10s %12llu %10.1f %10.1f %10.1f %10.1f\n", label, (unsigned long long)h.count,
+                h.percentile(50) / 1000.0, h.percentile(95) / 1000.0, h.percentile(99) / 1000.0,
+                h.max / 1000.0);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        std::fprintf(stderr, "Usage: %s [--regions N] [--sites N] [--slots N] [--bikes N] [--riders N]\n"
+                             "          [--van-capacity N] [--depot-wait-ms ms] [--time-scale x]\n"
+                             "          [--batch N] [--flush-us us] [--seed N] [--duration-ms ms] [--dir path]\n"
+                             "Each region needs at least two sites. Travel times are divided by the time scale.\n",
+                     argv[0]);
+        return 2;
+    }
+
+    RegionCoordinator coordinator(options.config);
+    if (!coordinator.run(options.durationMs, options.dir))
+    {
+        std::fprintf(stderr, "simulation failed\n");
+        return 1;
+    }
+
+    const RegionConfig& c = coordinator.config;
+    std::printf("regions=%zu sites=%zu slots=%zu bikes=%zu riders=%zu time_scale=%.1f batch=%zu flush_us=%u "
+                "wall_s=%.3f\n",
+                c.nbRegions, c.nbSites, c.slotsPerSite, coordinator.nbBikes(), c.nbRiders, c.timeScale,
+                c.batchSize, c.flushUs, coordinator.seconds);
+
+    std::printf("\n%-8s %10s %10s %10s %10s %10s %10s %8s %8s %8s\n", "region", "trips", "events", "sent",
+                "received", "messages", "kB sent", "rounds", "riders", "bikes");
+    for (size_t k = 0; k <= coordinator.reports.size(); ++k)
+    {
+        bool all = k == coordinator.reports.size();
+        const RegionReport& r = all ? coordinator.total : coordinator.reports[k];
+        std::printf("%-8s %10llu %10llu %10llu %10llu %10llu %10.1f %8llu %8llu %8llu\n",
+                    all ? "total" : std::to_string(k).c_str(), (unsigned long long)r.trips,
+                    (unsigned long long)r.events, (unsigned long long)r.handoffsOut,
+                    (unsigned long long)r.handoffsIn, (unsigned long long)r.messagesOut, r.bytesOut / 1024.0,
+                    (unsigned long long)r.vanRounds, (unsigned long long)r.riders, (unsigned long long)r.bikes);
+    }
+    const RegionReport& total = coordinator.total;
+    std::printf("\ntrips_per_s=%.0f riders_per_message=%.1f\n", total.trips / coordinator.seconds,
+                total.messagesOut ? double(total.handoffsOut) / total.messagesOut : 0.0);
+
+    std::printf("\n%-10s %12s %10s %10s %10s %10s\n", "Wall", "count", "p50 ms", "p95 ms", "p99 ms", "max ms");
+    printRow("wait bike", total.waitBikeUs);
+    printRow("wait dock", total.waitDockUs);
+
+    int status = 0;
+    if (total.bikes != coordinator.nbBikes())
+    {
+        std::fprintf(stderr, "%llu bikes accounted for (expected %zu)\n", (unsigned long long)total.bikes,
+                     coordinator.nbBikes());
+        status = 1;
+    }
+    if (total.riders != c.nbRiders)
+    {
+        std::fprintf(stderr, "%llu riders accounted for (expected %zu)\n", (unsigned long long)total.riders,
+                     c.nbRiders);
+        status = 1;
+    }
+    return status;
+}
@@ -0,0 +1,161 @@
+/*
+    * shards.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+// Scaling curve of the rider cycle with shared stations against stations
+// owned by one thread each (see ShardEngine).
+//
+// Both modes run for every thread count of the list and the throughput is
+// printed as CSV, one row per run. The exit code is non-zero if a run
+// loses or creates bikes.
+//
+// Example:
+//   pco_biking_shards --threads 1,2,4,8,16 --sites 4096 --riders 200000
+//                     --locality 0.8 --duration-ms 2000
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shardengine.h"
+
+namespace {
+
+struct Options
+{
+    ShardConfig config;
+    std::vector<size_t> threads;
+    std::vector<ShardMode> modes{ShardMode::SharedLocks, ShardMode::Owned};
+    unsigned int durationMs = 1000;
+};
+
+bool parseList(const std::string& text, std::vector<size_t>& values)
+{
+    values.clear();
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        values.push_back(std::stoul(item));
+        if (values.back() == 0)
+        {
+            return false;
+        }
+    }
+    return !values.empty();
+}
+
+bool parseOptions(int argc, char *argv[], Options& options)
+{
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        std::string value = argv[i + 1];
+        if (arg == "--threads")
+        {
+            if (!parseList(value, options.threads))
+                return false;
+        }
+        else if (arg == "--mode" && (value == "shared" || value == "owned" || value == "both"))
+        {
+            options.modes.clear();
+            if (value != "owned")
+                options.modes.push_back(ShardMode::SharedLocks);
+            if (value != "shared")
+                options.modes.push_back(ShardMode::Owned);
+        }
+        else if (arg == "--locality")
+            options.config.locality = std::stod(value);
+        else if (arg == "--sites")
+            options.config.nbSites = std::stoul(value);
+        else if (arg == "--slots")
+            options.config.slotsPerSite = std::stoul(value);
+        else if (arg == "--bikes")
+            options.config.nbBikes = std::stoul(value);
+        else if (arg == "--riders")
+            options.config.nbRiders = std::stoul(value);
+        else if (arg == "--pin")
+            options.config.pin = std::stoul(value) != 0;
+        else if (arg == "--seed")
+            options.config.seed = std::stoull(value);
+        else if (arg == "--duration-ms")
+            options.durationMs = std::stoul(value);
+        else
+            return false;
+    }
+    return argc % 2 == 1 && options.config.nbSites >= 2 && options.config.slotsPerSite >= 4 &&
+           options.config.locality >= 0 && options.config.locality <= 1;
+}
+
+// 1, 2, 4, ... then every CPU
+std::vector<size_t> defaultThreads()
+{
+    size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> counts;
+    for (size_t n = 1; n < cpus; n *= 2)
+    {
+        counts.push_back(n);
+    }
+    counts.push_back(cpus);
+    return counts;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        std::fprintf(stderr, "Usage: %s [--threads list] [--mode shared|owned|both] [--locality p]\n"
+                             "          [--sites N] [--slots N] [--bikes N] [--riders N] [--pin 0|1]\n"
+                             "          [--seed N] [--duration-ms ms]\n"
+                             "Threads default to 1, 2, 4, ... up to the number of CPUs.\n",
+                     argv[0]);
+        return 2;
+    }
+    if (options.threads.empty())
+    {
+        options.threads = defaultThreads();
+    }
+
+    int status = 0;
+    std::printf("mode,threads,cpus,sites,riders,locality,trips,trips_per_s,speedup,messages,retry_ratio\n");
+    for (ShardMode mode : options.modes)
+    {
+        double single = 0;
+        for (size_t threads : options.threads)
+        {
+            ShardConfig config = options.config;
+            config.mode = mode;
+            config.threads = threads;
+            ShardEngine engine(config);
+            engine.run(options.durationMs);
+
+            double tripsPerS = engine.trips / engine.seconds;
+            if (single == 0)
+            {
+                single = tripsPerS / threads;
+            }
+            uint64_t visits = engine.retries + 2 * engine.trips;
+            std::printf("%s,%zu,%u,%zu,%zu,%.2f,%llu,%.0f,%.2f,%llu,%.3f\n", shardModeName(mode), threads,
+                        std::thread::hardware_concurrency(), config.nbSites, config.nbRiders, config.locality,
+                        (unsigned long long)engine.trips, tripsPerS, single > 0 ? tripsPerS / single : 0.0,
+                        (unsigned long long)engine.messages, visits ? double(engine.retries) / visits : 0.0);
+            std::fflush(stdout);
+
+            size_t counted = engine.bikesAccountedFor();
+            if (counted != engine.nbBikes())
+            {
+                std::fprintf(stderr, "%s, %zu threads: %zu bikes accounted for (expected %zu)\n",
+                             shardModeName(mode), threads, counted, engine.nbBikes());
+                status = 1;
+            }
+        }
+    }
+    return status;
+}
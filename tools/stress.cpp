@@ -0,0 +1,522 @@
+/*
+    * stress.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+// Headless stress test of the whole simulation.
+//
+// Thousands of riders and several vans run without GUI, hence without any
+// travel delay unless a workload profile or a site map is given, for a
+// fixed duration. A checker periodically freezes all
+// stations and verifies that no station is over capacity, that no bike is
+// in two places at once and that the fleet size is conserved. A final exact
+// check runs once every thread has been joined. Before the run, the batch
+// operations of every station kind are checked directly against capacity.
+// The exit code is non-zero if any invariant was violated.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "bike.h"
+#include "bikestation.h"
+#include "config.h"
+#include "journal.h"
+#include "lockprofiler.h"
+#include "occupancy.h"
+#include "person.h"
+#include "simcontext.h"
+#include "snapshot.h"
+#include "telemetry.h"
+#include "tracer.h"
+#include "tripreader.h"
+#include "van.h"
+#include "workload.h"
+
+SimContext* globalContext = nullptr;
+
+// Required by MainWindow, never called since there is no GUI here
+void stopSimulation() {}
+
+namespace {
+
+struct Options
+{
+    size_t nbRiders = 2000;
+    size_t nbVans = 4;
+    unsigned int durationMs = 5000;
+    unsigned int sampleMs = 50;
+    unsigned int stallMs = 2000;
+    StationKind station = StationPco;
+    std::string tracePath;
+    std::string journalPath;
+    std::string replayPath;
+    double replaySpeed = 1;
+    std::string restorePath;
+    std::string checkpointPath;
+    RiderPolicy policy;
+    std::string profile;
+    double profileSpeed = 1;
+    std::string sitesPath;
+    std::string telemetryName;
+    std::string occupancyPath;
+    unsigned int occupancyMs = 10;
+};
+
+/**
+ * Outcome of one check. Conservation and duplicates can be transiently
+ * wrong while an agent is between a station call and the update of its
+ * published holding, so they are only reported when two consecutive
+ * samples agree. Capacity is read under the station locks and is exact.
+ */
+struct CheckResult
+{
+    size_t counted = 0;
+    size_t duplicates = 0;
+    size_t overCapacity = 0;
+};
+
+bool parseOptions(int argc, char *argv[], Options& options)
+{
+    try
+    {
+        for (int i = 1; i + 1 < argc; i += 2)
+        {
+            std::string arg = argv[i];
+            if (arg == "--trace")
+            {
+                options.tracePath = argv[i + 1];
+                continue;
+            }
+            if (arg == "--journal")
+            {
+                options.journalPath = argv[i + 1];
+                continue;
+            }
+            if (arg == "--replay")
+            {
+                options.replayPath = argv[i + 1];
+                continue;
+            }
+            if (arg == "--replay-speed")
+            {
+                options.replaySpeed = std::stod(argv[i + 1]);
+                continue;
+            }
+            if (arg == "--restore")
+            {
+                options.restorePath = argv[i + 1];
+                continue;
+            }
+            if (arg == "--checkpoint")
+            {
+                options.checkpointPath = argv[i + 1];
+                continue;
+            }
+            if (arg == "--profile")
+            {
+                options.profile = argv[i + 1];
+                continue;
+            }
+            if (arg == "--profile-speed")
+            {
+                options.profileSpeed = std::stod(argv[i + 1]);
+                continue;
+            }
+            if (arg == "--telemetry")
+            {
+                options.telemetryName = argv[i + 1];
+                continue;
+            }
+            if (arg == "--occupancy")
+            {
+                options.occupancyPath = argv[i + 1];
+                continue;
+            }
+            if (arg == "--sites")
+            {
+                options.sitesPath = argv[i + 1];
+                continue;
+            }
+            if (arg == "--fallbacks")
+            {
+                if (!parseRiderFallbacks(argv[i + 1], options.policy))
+                    return false;
+                continue;
+            }
+            if (arg == "--station")
+            {
+                if (!parseStationKind(argv[i + 1], options.station))
+                    return false;
+                continue;
+            }
+            unsigned long value = std::stoul(argv[i + 1]);
+            if (arg == "--riders")
+                options.nbRiders = value;
+            else if (arg == "--vans")
+                options.nbVans = value;
+            else if (arg == "--duration-ms")
+                options.durationMs = value;
+            else if (arg == "--sample-ms")
+                options.sampleMs = value;
+            else if (arg == "--max-wait-ms")
+                options.policy.maxWaitMs = value;
+            else if (arg == "--stall-ms")
+                options.stallMs = value;
+            else if (arg == "--occupancy-ms")
+                options.occupancyMs = value;
+            else
+                return false;
+        }
+    }
+    catch (const std::exception&)
+    {
+        // std::stoul and std::stod on a value that is not a number
+        return false;
+    }
+    return argc % 2 == 1;
+}
+
+void countBike(Bike *bike, std::unordered_set<Bike*>& seen, CheckResult& result)
+{
+    // Keyed by address: the depot commands add bikes outside context.bikes
+    if (!seen.insert(bike).second)
+    {
+        result.duplicates++;
+        return;
+    }
+    result.counted++;
+}
+
+CheckResult check(const SimContext& context, bool frozen)
+{
+    CheckResult result;
+    std::unordered_set<Bike*> seen;
+    seen.reserve(context.nbBikes());
+
+    if (frozen)
+    {
+        for (BikeStation *station : context.stations)
+        {
+            station->freeze();
+        }
+        // Lets agents that just left a station publish what they hold
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    for (BikeStation *station : context.stations)
+    {
+        if (station->nbBikes() > station->nbSlots())
+        {
+            result.overCapacity++;
+        }
+        for (Bike *bike : station->contents())
+        {
+            countBike(bike, seen, result);
+        }
+    }
+    for (Person *rider : context.riders)
+    {
+        if (Bike *bike = rider->heldBike())
+        {
+            countBike(bike, seen, result);
+        }
+    }
+    for (Van *van : context.vans)
+    {
+        if (frozen)
+        {
+            result.counted += van->cargoCount();
+            continue;
+        }
+        for (Bike *bike : van->cargoBikes())
+        {
+            countBike(bike, seen, result);
+        }
+    }
+
+    if (frozen)
+    {
+        for (BikeStation *station : context.stations)
+        {
+            station->thaw();
+        }
+    }
+    return result;
+}
+
+bool isConsistent(const SimContext& context, const CheckResult& result)
+{
+    return result.counted == context.nbBikes() && result.duplicates == 0;
+}
+
+/**
+ * Overfills a small station of each kind with addBikes() and checks that it
+ * keeps exactly its capacity and hands back the rest. The samples of the
+ * run only see the stations the agents fill one bike at a time.
+ */
+bool checkAddBikesCapacity()
+{
+    const size_t capacity = 4;
+    std::vector<Bike> bikes(10);
+    std::vector<Bike*> batch;
+    for (Bike& bike : bikes)
+    {
+        batch.push_back(&bike);
+    }
+
+    bool ok = true;
+    for (StationKind kind : {StationPco, StationSpinFutex, StationLockFree})
+    {
+        std::unique_ptr<BikeStation> station = makeBikeStation(kind, capacity, 0);
+        size_t rejected = station->addBikes(batch).size();
+        if (rejected != bikes.size() - capacity || station->nbBikes() != capacity)
+        {
+            std::fprintf(stderr, "%s addBikes: %zu/%zu bikes, %zu rejected (expected %zu)\n",
+                         stationKindName(kind), station->nbBikes(), capacity, rejected, bikes.size() - capacity);
+            ok = false;
+        }
+        station->ending();
+    }
+    return ok;
+}
+
+/**
+ * Posts more depot bikes than the depot has free docks to a simulation
+ * without agents, and checks that the control agent fills the depot and
+ * keeps the rest aside.
+ */
+bool checkDepotOverflow(StationKind kind)
+{
+    SimConfig config;
+    config.nbRiders = 0;
+    config.nbVans = 0;
+    config.station = kind;
+    SimContext context(config);
+    context.populate();
+    context.start();
+
+    const size_t extra = 3;
+    BikeStation *depot = context.stations[DEPOT_ID];
+    size_t freeDocks = depot->nbSlots() - depot->nbBikes();
+    size_t fleet = context.nbBikes();
+    context.control.post(ControlCommand{ControlAddDepotBikes, unsigned(freeDocks + extra)});
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (context.control.nbBatches() == 0 && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    bool ok = context.control.nbBatches() == 1 && depot->nbBikes() == depot->nbSlots() &&
+              context.nbBikes() == fleet + freeDocks && context.control.nbSpareBikes() == extra;
+    if (!ok)
+    {
+        std::fprintf(stderr, "%s depot: %zu/%zu bikes, fleet %zu (expected %zu), %zu spare (expected %zu)\n",
+                     stationKindName(kind), depot->nbBikes(), depot->nbSlots(), context.nbBikes(),
+                     fleet + freeDocks, context.control.nbSpareBikes(), extra);
+    }
+    context.stop();
+    context.join();
+    return ok;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        std::fprintf(stderr, "Usage: %s [--riders N] [--vans K] [--duration-ms ms] [--sample-ms ms] [--trace file]\n"
+                             "          [--journal file] [--replay trips.csv] [--replay-speed x]\n"
+                             "          [--restore snapshot] [--checkpoint snapshot]\n"
+                             "          [--max-wait-ms ms] [--fallbacks none|type+walk+dock]\n"
+                             "          [--profile name|file] [--profile-speed x] [--sites file]\n"
+                             "          [--telemetry name] [--stall-ms ms] [--station pco|spin|lockfree]\n"
+                             "          [--occupancy file] [--occupancy-ms ms]\n",
+                     argv[0]);
+        return 2;
+    }
+
+    // Before any trace or journal, which would record them
+    bool capacityOk = checkAddBikesCapacity();
+    bool depotOk = checkDepotOverflow(options.station);
+
+    if (!options.tracePath.empty())
+    {
+        Tracer::enable(options.tracePath);
+    }
+    if (!options.journalPath.empty() && !Journal::open(options.journalPath))
+    {
+        return 2;
+    }
+
+    TripReader trips;
+    if (!options.replayPath.empty() && !trips.open(options.replayPath, options.replaySpeed))
+    {
+        return 2;
+    }
+
+    WorkloadProfile workload;
+    if (!options.profile.empty() && !workload.load(options.profile, options.profileSpeed))
+    {
+        return 2;
+    }
+
+    Snapshot snapshot;
+    if (!options.restorePath.empty() && !snapshot.load(options.restorePath))
+    {
+        std::fprintf(stderr, "%s: cannot restore this snapshot\n", options.restorePath.c_str());
+        return 2;
+    }
+
+    SimConfig config;
+    config.nbRiders = options.nbRiders;
+    config.nbVans = options.nbVans;
+    config.depotWaitUs = 1000;
+    config.policy = options.policy;
+    config.stallMs = options.stallMs;
+    config.station = options.station;
+    if (!options.sitesPath.empty() && !loadSiteLayout(options.sitesPath, NBSITES, config.sites))
+    {
+        return 2;
+    }
+    if (!options.restorePath.empty())
+    {
+        config.nbBikes = std::max(config.nbBikes, snapshot.bikes.size());
+    }
+
+    Telemetry telemetry;
+    if (!options.telemetryName.empty() && !telemetry.open(options.telemetryName))
+    {
+        return 2;
+    }
+
+    OccupancyRecorder occupancy;
+    SimContext context(config);
+    if (!options.telemetryName.empty())
+    {
+        context.telemetry = &telemetry;
+    }
+    if (!options.occupancyPath.empty())
+    {
+        std::vector<uint32_t> capacities;
+        for (const BikeStation *station : context.stations)
+        {
+            capacities.push_back(uint32_t(station->nbSlots()));
+        }
+        if (!occupancy.open(options.occupancyPath, capacities, Bike::nbBikeTypes, options.occupancyMs * 1000))
+        {
+            return 2;
+        }
+        context.occupancy = &occupancy;
+    }
+    if (!options.replayPath.empty())
+    {
+        context.trips = &trips;
+    }
+    if (!options.profile.empty())
+    {
+        context.workload = &workload;
+    }
+    globalContext = &context;
+
+    if (!options.restorePath.empty())
+    {
+        if (!context.restore(snapshot))
+        {
+            std::fprintf(stderr, "%s: cannot restore this snapshot\n", options.restorePath.c_str());
+            return 2;
+        }
+        options.nbRiders = context.riders.size();
+        options.nbVans = context.vans.size();
+    }
+    else
+    {
+        // Same initial distribution as the GUI
+        context.populate();
+    }
+
+    context.start();
+
+    size_t samples = 0;
+    size_t violations = (capacityOk ? 0 : 1) + (depotOk ? 0 : 1);
+    bool suspect = false;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.durationMs);
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(options.sampleMs));
+        CheckResult result = check(context, true);
+        samples++;
+        if (result.overCapacity)
+        {
+            std::fprintf(stderr, "sample %zu: %zu station(s) over capacity\n", samples, result.overCapacity);
+            violations++;
+        }
+        if (!isConsistent(context, result))
+        {
+            if (suspect)
+            {
+                std::fprintf(stderr, "sample %zu: %zu bikes accounted for (expected %zu), %zu duplicate(s)\n",
+                             samples, result.counted, context.nbBikes(), result.duplicates);
+                violations++;
+            }
+            suspect = true;
+        }
+        else
+        {
+            suspect = false;
+        }
+    }
+
+    context.stop();
+    context.join();
+
+    Tracer::writeAndDisable();
+    Journal::close();
+    occupancy.close();
+
+    CheckResult final = check(context, false);
+    if (!isConsistent(context, final) || final.overCapacity)
+    {
+        std::fprintf(stderr, "final: %zu bikes accounted for (expected %zu), %zu duplicate(s), "
+                             "%zu station(s) over capacity\n",
+                     final.counted, context.nbBikes(), final.duplicates, final.overCapacity);
+        violations++;
+    }
+
+    if (!options.checkpointPath.empty() &&
+        !Snapshot::capture(context).save(options.checkpointPath))
+    {
+        return 2;
+    }
+
+    const SimStats& stats = context.stats;
+    std::printf("riders=%zu vans=%zu duration_ms=%u samples=%zu trips=%llu van_rounds=%llu stalls=%llu "
+                "stuck=%llu violations=%zu\n",
+                options.nbRiders, options.nbVans, options.durationMs, samples,
+                (unsigned long long)stats.tripsCompleted.load(), (unsigned long long)stats.vanRounds.load(),
+                (unsigned long long)context.watchdog.nbStalls(), (unsigned long long)context.watchdog.nbStuck(),
+                violations);
+
+    std::vector<const RiderStats*> riderStats;
+    for (const Person *rider : context.riders)
+    {
+        riderStats.push_back(&rider->riderStats());
+    }
+    printRiderReport(stdout, riderStats);
+    LockProfiler::printReport(stdout);
+    if (!options.replayPath.empty())
+    {
+        trips.printReport(stdout);
+    }
+
+    return violations ? 1 : 0;
+}
@@ -0,0 +1,423 @@
+/*
+    * sweep.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+// Headless parameter sweep.
+//
+// Every combination of the listed parameters is run as an independent
+// simulation, in its own SimContext, for a fixed duration. Several
+// simulations run at the same time in this process, one per job. The
+// results are printed as a single table, one row per run, in CSV or JSON.
+//
+// Example:
+//   pco_biking_sweep --slots 4,6,8 --van-capacity 2,4,8 --riders 500
+//                    --duration-ms 2000 --repeat 3 --format csv
+//   pco_biking_sweep --max-wait-ms 0,200 --fallbacks none,type+walk+dock
+//   pco_biking_sweep --profile uniform,rush,event --profile-speed 10
+//   pco_biking_sweep --station pco,spin,lockfree --riders 100,1000
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bikestation.h"
+#include "config.h"
+#include "person.h"
+#include "workload.h"
+#include "simcontext.h"
+
+// Required by MainWindow, never used since there is no GUI here
+SimContext* globalContext = nullptr;
+void stopSimulation() {}
+
+namespace {
+
+struct Options
+{
+    std::vector<size_t> slotsPerSite{BORNES};
+    std::vector<size_t> bikes{NB_BIKES};
+    std::vector<size_t> vanCapacity{VAN_CAPACITY};
+    std::vector<size_t> depotLoad{2};
+    std::vector<size_t> riders{500};
+    std::vector<size_t> vans{1};
+    std::vector<size_t> maxWaitMs{0};
+    std::vector<RiderPolicy> fallbacks{RiderPolicy()};
+    std::vector<StationKind> stations{StationPco};
+    std::vector<std::string> profiles{""};
+    double profileSpeed = 1;
+    std::vector<SitePoint> sites;
+    unsigned int durationMs = 2000;
+    unsigned int depotWaitUs = 1000;
+    size_t jobs = 0;
+    size_t repeat = 1;
+    bool json = false;
+};
+
+struct Run
+{
+    SimConfig config;
+    const WorkloadProfile *workload = nullptr;
+    size_t repetition = 0;
+};
+
+struct Result
+{
+    double elapsedS = 0;
+    uint64_t trips = 0;
+    uint64_t waitP50Us = 0;
+    uint64_t waitP95Us = 0;
+    uint64_t waitP99Us = 0;
+    uint64_t vanRounds = 0;
+    double cargoUse = 0;
+    double emptyRatio = 0;
+    double fullRatio = 0;
+    uint64_t cycleP50Us = 0;
+    uint64_t cycleP95Us = 0;
+    uint64_t cycleP99Us = 0;
+    uint64_t fallbacks = 0;
+};
+
+bool parseList(const std::string& text, std::vector<size_t>& values)
+{
+    values.clear();
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        try
+        {
+            values.push_back(std::stoul(item));
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+    }
+    return !values.empty();
+}
+
+bool parseFallbackList(const std::string& text, std::vector<RiderPolicy>& policies)
+{
+    policies.clear();
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        RiderPolicy policy;
+        if (!parseRiderFallbacks(item, policy))
+        {
+            return false;
+        }
+        policies.push_back(policy);
+    }
+    return !policies.empty();
+}
+
+bool parseStationList(const std::string& text, std::vector<StationKind>& kinds)
+{
+    kinds.clear();
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        StationKind kind;
+        if (!parseStationKind(item, kind))
+        {
+            return false;
+        }
+        kinds.push_back(kind);
+    }
+    return !kinds.empty();
+}
+
+bool parseNameList(const std::string& text, std::vector<std::string>& names)
+{
+    names.clear();
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        names.push_back(item);
+    }
+    return !names.empty();
+}
+
+bool parseOptions(int argc, char *argv[], Options& options)
+{
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        std::string value = argv[i + 1];
+        bool ok = true;
+        if (arg == "--slots")
+            ok = parseList(value, options.slotsPerSite);
+        else if (arg == "--bikes")
+            ok = parseList(value, options.bikes);
+        else if (arg == "--van-capacity")
+            ok = parseList(value, options.vanCapacity);
+        else if (arg == "--depot-load")
+            ok = parseList(value, options.depotLoad);
+        else if (arg == "--riders")
+            ok = parseList(value, options.riders);
+        else if (arg == "--vans")
+            ok = parseList(value, options.vans);
+        else if (arg == "--max-wait-ms")
+            ok = parseList(value, options.maxWaitMs);
+        else if (arg == "--fallbacks")
+            ok = parseFallbackList(value, options.fallbacks);
+        else if (arg == "--station")
+            ok = parseStationList(value, options.stations);
+        else if (arg == "--profile")
+            ok = parseNameList(value, options.profiles);
+        else if (arg == "--profile-speed")
+            options.profileSpeed = std::stod(value);
+        else if (arg == "--sites")
+            ok = loadSiteLayout(value, NBSITES, options.sites);
+        else if (arg == "--duration-ms")
+            options.durationMs = std::stoul(value);
+        else if (arg == "--depot-wait-us")
+            options.depotWaitUs = std::stoul(value);
+        else if (arg == "--jobs")
+            options.jobs = std::stoul(value);
+        else if (arg == "--repeat")
+            options.repeat = std::stoul(value);
+        else if (arg == "--format" && (value == "csv" || value == "json"))
+            options.json = value == "json";
+        else
+            return false;
+        if (!ok)
+            return false;
+    }
+    for (size_t count : options.slotsPerSite)
+    {
+        if (count < 4)
+        {
+            std::fprintf(stderr, "Each station should have at least 4 slots\n");
+            return false;
+        }
+    }
+    return argc % 2 == 1 && options.repeat > 0;
+}
+
+// Replaces every configuration by one copy per value of the list
+template <class T, class Setter>
+void multiply(std::vector<SimConfig>& configs, const std::vector<T>& values, Setter set)
+{
+    std::vector<SimConfig> product;
+    for (const SimConfig& config : configs)
+    {
+        for (const T& value : values)
+        {
+            product.push_back(config);
+            set(product.back(), value);
+        }
+    }
+    configs.swap(product);
+}
+
+// Cartesian product of the parameter lists, then profiles, then repetitions
+std::vector<Run> expand(const Options& options, const std::vector<WorkloadProfile>& workloads)
+{
+    SimConfig base;
+    base.depotWaitUs = options.depotWaitUs;
+    base.sites = options.sites;
+    std::vector<SimConfig> configs{base};
+    multiply(configs, options.slotsPerSite, [](SimConfig& c, size_t v) { c.slotsPerSite = v; });
+    multiply(configs, options.bikes, [](SimConfig& c, size_t v) { c.nbBikes = v; });
+    multiply(configs, options.vanCapacity, [](SimConfig& c, size_t v) { c.vanCapacity = v; });
+    multiply(configs, options.depotLoad, [](SimConfig& c, size_t v) { c.depotLoad = v; });
+    multiply(configs, options.riders, [](SimConfig& c, size_t v) { c.nbRiders = v; });
+    multiply(configs, options.vans, [](SimConfig& c, size_t v) { c.nbVans = v; });
+    multiply(configs, options.maxWaitMs, [](SimConfig& c, size_t v) { c.policy.maxWaitMs = v; });
+    multiply(configs, options.fallbacks, [](SimConfig& c, const RiderPolicy& v) {
+        c.policy.acceptOtherType = v.acceptOtherType;
+        c.policy.walkToStock = v.walkToStock;
+        c.policy.divertToFreeDock = v.divertToFreeDock;
+    });
+    multiply(configs, options.stations, [](SimConfig& c, StationKind v) { c.station = v; });
+
+    std::vector<Run> runs;
+    for (const SimConfig& config : configs)
+    {
+        for (size_t p = 0; p < options.profiles.size(); ++p)
+        {
+            const WorkloadProfile *workload = options.profiles[p].empty() ? nullptr : &workloads[p];
+            for (size_t r = 0; r < options.repeat; ++r)
+            {
+                runs.push_back(Run{config, workload, r});
+            }
+        }
+    }
+    return runs;
+}
+
+Result simulate(const SimConfig& config, const WorkloadProfile *workload, unsigned int durationMs)
+{
+    SimContext context(config);
+    context.workload = workload;
+    context.populate();
+    auto begin = std::chrono::steady_clock::now();
+    context.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(durationMs));
+    context.stop();
+    context.join();
+
+    Result result;
+    const SimStats& stats = context.stats;
+    result.elapsedS = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    result.trips = stats.tripsCompleted.load();
+    HistogramSnapshot waits = stats.waitTimesUs.snapshot();
+    result.waitP50Us = waits.percentile(50);
+    result.waitP95Us = waits.percentile(95);
+    result.waitP99Us = waits.percentile(99);
+    result.vanRounds = stats.vanRounds.load();
+    uint64_t legs = stats.vanLegs.load();
+    if (legs && config.vanCapacity)
+    {
+        result.cargoUse = double(stats.vanCargoSum.load()) / (legs * config.vanCapacity);
+    }
+
+    // Occupancy of the sites only, the depot is not visited by riders
+    double runNs = double(nowNs() - stats.startNs);
+    for (size_t s = 0; s < NBSITES; ++s)
+    {
+        result.emptyRatio += context.stations[s]->emptyTimeNs() / runNs / NBSITES;
+        result.fullRatio += context.stations[s]->fullTimeNs() / runNs / NBSITES;
+    }
+
+    HistogramSnapshot cycles;
+    for (const Person *rider : context.riders)
+    {
+        const RiderStats& riderStats = rider->riderStats();
+        riderStats.cycleUs.mergeInto(cycles);
+        for (uint64_t count : riderStats.fallbacks)
+        {
+            result.fallbacks += count;
+        }
+    }
+    result.cycleP50Us = cycles.percentile(50);
+    result.cycleP95Us = cycles.percentile(95);
+    result.cycleP99Us = cycles.percentile(99);
+    return result;
+}
+
+const char *profileName(const Run& run)
+{
+    return run.workload ? run.workload->name().c_str() : "none";
+}
+
+void printCsv(const std::vector<Run>& runs, const std::vector<Result>& results)
+{
+    std::printf("slots,bikes,van_capacity,depot_load,riders,vans,max_wait_ms,fallbacks,station,profile,repeat,"
+                "trips_per_s,wait_p50_us,wait_p95_us,wait_p99_us,van_rounds,"
+                "cargo_use,empty_ratio,full_ratio,cycle_p50_us,cycle_p95_us,cycle_p99_us,"
+                "fallbacks_taken\n");
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        const SimConfig& c = runs[i].config;
+        const Result& r = results[i];
+        std::printf("%zu,%zu,%zu,%zu,%zu,%zu,%u,%s,%s,%s,%zu,%.1f,%llu,%llu,%llu,%llu,%.3f,%.3f,%.3f,"
+                    "%llu,%llu,%llu,%llu\n",
+                    c.slotsPerSite, c.nbBikes, c.vanCapacity, c.depotLoad, c.nbRiders, c.nbVans,
+                    c.policy.maxWaitMs, riderFallbacksName(c.policy).c_str(), stationKindName(c.station),
+                    profileName(runs[i]),
+                    runs[i].repetition, r.trips / r.elapsedS,
+                    (unsigned long long)r.waitP50Us, (unsigned long long)r.waitP95Us,
+                    (unsigned long long)r.waitP99Us, (unsigned long long)r.vanRounds,
+                    r.cargoUse, r.emptyRatio, r.fullRatio,
+                    (unsigned long long)r.cycleP50Us, (unsigned long long)r.cycleP95Us,
+                    (unsigned long long)r.cycleP99Us, (unsigned long long)r.fallbacks);
+    }
+}
+
+void printJson(const std::vector<Run>& runs, const std::vector<Result>& results)
+{
+    std::printf("[\n");
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        const SimConfig& c = runs[i].config;
+        const Result& r = results[i];
+        std::printf("  {\"slots\": %zu, \"bikes\": %zu, \"van_capacity\": %zu, \"depot_load\": %zu, "
+                    "\"riders\": %zu, \"vans\": %zu, \"max_wait_ms\": %u, \"fallbacks\": \"%s\", "
+                    "\"station\": \"%s\", \"profile\": \"%s\", "
+                    "\"repeat\": %zu, \"trips_per_s\": %.1f, "
+                    "\"wait_p50_us\": %llu, \"wait_p95_us\": %llu, \"wait_p99_us\": %llu, "
+                    "\"van_rounds\": %llu, \"cargo_use\": %.3f, \"empty_ratio\": %.3f, "
+                    "\"full_ratio\": %.3f, \"cycle_p50_us\": %llu, \"cycle_p95_us\": %llu, "
+                    "\"cycle_p99_us\": %llu, \"fallbacks_taken\": %llu}%s\n",
+                    c.slotsPerSite, c.nbBikes, c.vanCapacity, c.depotLoad, c.nbRiders, c.nbVans,
+                    c.policy.maxWaitMs, riderFallbacksName(c.policy).c_str(), stationKindName(c.station),
+                    profileName(runs[i]),
+                    runs[i].repetition, r.trips / r.elapsedS,
+                    (unsigned long long)r.waitP50Us, (unsigned long long)r.waitP95Us,
+                    (unsigned long long)r.waitP99Us, (unsigned long long)r.vanRounds,
+                    r.cargoUse, r.emptyRatio, r.fullRatio,
+                    (unsigned long long)r.cycleP50Us, (unsigned long long)r.cycleP95Us,
+                    (unsigned long long)r.cycleP99Us, (unsigned long long)r.fallbacks,
+                    i + 1 < runs.size() ? "," : "");
+    }
+    std::printf("]\n");
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        std::fprintf(stderr, "Usage: %s [--slots list] [--bikes list] [--van-capacity list] [--depot-load list]\n"
+                             "          [--riders list] [--vans list] [--max-wait-ms list] [--fallbacks list] [--station list]\n"
+                             "          [--profile list] [--profile-speed x] [--duration-ms ms] [--depot-wait-us us]\n"
+                             "          [--sites file] [--jobs N] [--repeat N] [--format csv|json]\n"
+                             "Lists are comma-separated, every combination is run. Fallbacks are\n"
+                             "none or type, walk and dock joined with '+'. Stations are pco, spin or lockfree.\n",
+                     argv[0]);
+        return 2;
+    }
+
+    // Profiles are loaded once and shared, read-only, by the runs using them
+    std::vector<WorkloadProfile> workloads(options.profiles.size());
+    for (size_t p = 0; p < options.profiles.size(); ++p)
+    {
+        if (!options.profiles[p].empty() && !workloads[p].load(options.profiles[p], options.profileSpeed))
+        {
+            return 2;
+        }
+    }
+
+    std::vector<Run> runs = expand(options, workloads);
+    std::vector<Result> results(runs.size());
+    size_t jobs = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    jobs = std::min(jobs, runs.size());
+
+    // Each job takes the next run until there are none left
+    std::atomic<size_t> nextRun{0};
+    std::vector<std::thread> workers;
+    for (size_t j = 0; j < jobs; ++j)
+    {
+        workers.emplace_back([&]() {
+            for (size_t i = nextRun++; i < runs.size(); i = nextRun++)
+            {
+                results[i] = simulate(runs[i].config, runs[i].workload, options.durationMs);
+                std::fprintf(stderr, "run %zu/%zu done\n", i + 1, runs.size());
+            }
+        });
+    }
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    if (options.json)
+        printJson(runs, results);
+    else
+        printCsv(runs, results);
+    return 0;
+}
@@ -0,0 +1,183 @@
+/*
+    * top.cpp
+    * Author: Jonatan Perret and Adrien Marcuard
+*/
+
+// Live view of a running simulation, refreshed at 10 Hz.
+//
+// Maps the telemetry region of a simulation started with --telemetry
+// read-only and prints its pages; the simulation does not know it is being
+// watched. Stops when the simulation does.
+//
+// Example:
+//   pco_biking_stress --riders 5000 --duration-ms 60000 --telemetry pco_biking
+//   pco_biking_top pco_biking
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+
+namespace {
+
+const char *typeNames[Bike::nbBikeTypes] = {"VTT", "Road", "Gravel"};
+
+const TelemetryRegion *attach(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::fprintf(stderr, "%s: %s\n", path.c_str(), std::strerror(errno));
+        return nullptr;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(TelemetryHeader))
+    {
+        std::fprintf(stderr, "%s: not a telemetry region\n", path.c_str());
+        close(fd);
+        return nullptr;
+    }
+    void *memory = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        std::fprintf(stderr, "%s: %s\n", path.c_str(), std::strerror(errno));
+        return nullptr;
+    }
+
+    const TelemetryRegion *region = static_cast<const TelemetryRegion *>(memory);
+    const TelemetryHeader& header = region->header;
+    if (header.magic != TELEMETRY_MAGIC)
+    {
+        std::fprintf(stderr, "%s: not a telemetry region\n", path.c_str());
+        return nullptr;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header.version != TELEMETRY_VERSION || header.regionSize != sizeof(TelemetryRegion) ||
+        size_t(info.st_size) < sizeof(TelemetryRegion) || header.nbSites != NB_SITES_TOTAL ||
+        header.nbBikeTypes != Bike::nbBikeTypes || header.maxVans != TELEMETRY_MAX_VANS)
+    {
+        std::fprintf(stderr, "%s: layout version %u, this viewer reads version %u with %zu sites\n",
+                     path.c_str(), header.version, TELEMETRY_VERSION, NB_SITES_TOTAL);
+        return nullptr;
+    }
+    return region;
+}
+
+void printFrame(const std::string& path, const TelemetryRegion& region, const TelemetryCounters& counters,
+                const TelemetryStations& stations, double tripsPerS, bool running)
+{
+    std::printf("%s  pid %llu  %s  t=%.1f s  sample %llu\n", path.c_str(),
+                (unsigned long long)region.header.pid, running ? "running" : "stopped",
+                counters.elapsedNs / 1e9, (unsigned long long)counters.sample);
+    std::printf("trips %llu (%.1f/s)  in transit %lld  van rounds %llu  stalls %u\n\n",
+                (unsigned long long)counters.tripsCompleted, tripsPerS, (long long)counters.bikesInTransit,
+                (unsigned long long)counters.vanRounds, counters.stalls);
+
+    std::printf("%-6s", "site");
+    for (const char *name : typeNames)
+    {
+        std::printf(" %6s", name);
+    }
+    std::printf(" %11s  %-20s %9s %9s\n", "bikes/slots", "occupancy", "wait bike", "wait dock");
+    for (size_t s = 0; s < NB_SITES_TOTAL; ++s)
+    {
+        const TelemetryStation& station = stations.stations[s];
+        if (s == DEPOT_ID)
+            std::printf("%-6s", "depot");
+        else
+            std::printf("%-6zu", s);
+        for (size_t t = 0; t < Bike::nbBikeTypes; ++t)
+        {
+            std::printf(" %6u", station.bikes[t]);
+        }
+        char bar[21];
+        size_t filled = station.capacity ? size_t(station.total) * 20 / station.capacity : 0;
+        for (size_t i = 0; i < 20; ++i)
+        {
+            bar[i] = i < filled ? '#' : '.';
+        }
+        bar[20] = '\0';
+        std::printf(" %5u/%-5u  %s %9u %9u\n", station.total, station.capacity, bar, station.bikeWaiters,
+                    station.dockWaiters);
+    }
+
+    std::printf("\n%-6s %6s %6s %8s\n", "van", "site", "cargo", "rounds");
+    for (size_t v = 0; v < counters.nbVans && v < TELEMETRY_MAX_VANS; ++v)
+    {
+        const TelemetryVan& van = counters.vans[v];
+        if (van.site == DEPOT_ID)
+            std::printf("%-6zu %6s %6u %8llu\n", v, "depot", van.cargo, (unsigned long long)van.rounds);
+        else
+            std::printf("%-6zu %6u %6u %8llu\n", v, van.site, van.cargo, (unsigned long long)van.rounds);
+    }
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    std::string name = "pco_biking";
+    bool once = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--once")
+            once = true;
+        else if (arg[0] != '-')
+            name = arg;
+        else
+        {
+            std::fprintf(stderr, "Usage: %s [name|path] [--once]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::string path = telemetryPath(name);
+    const TelemetryRegion *region = attach(path);
+    if (!region)
+    {
+        return 1;
+    }
+
+    uint64_t lastTrips = 0;
+    uint64_t lastNs = 0;
+    for (;;)
+    {
+        bool running = region->header.running.load(std::memory_order_acquire);
+        TelemetryCounters counters;
+        TelemetryStations stations;
+        if (!region->counters.read(counters) || !region->stations.read(stations))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        double tripsPerS = counters.elapsedNs > lastNs
+                               ? (counters.tripsCompleted - lastTrips) * 1e9 / (counters.elapsedNs - lastNs)
+                               : 0.0;
+        lastTrips = counters.tripsCompleted;
+        lastNs = counters.elapsedNs;
+
+        if (!once)
+        {
+            // Home and clear, as top does
+            std::printf("\033[H\033[2J");
+        }
+        printFrame(path, *region, counters, stations, tripsPerS, running);
+        std::fflush(stdout);
+        if (once || !running)
+        {
+            return 0;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}